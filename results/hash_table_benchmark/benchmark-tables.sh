@@ -58,4 +58,12 @@ do
   fi
 done
 
+for T in 0 1 4
+do
+  # Each hash function on a fresh table, throughput relative to the first
+  echo "McCortex hash functions with $T threads 80M entries"
+  ../../bin/mccortex31 hashtest --hash all -t $T -k 31 -m 2G -n 100M 80000000
+  ../../bin/mccortex31 hashtest --hash all -t $T -k 31 -m 2G -n 100M --func-only 80000000
+done
+
 # grep '(^real|\[cmd\])'
@@ -33,7 +33,7 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
   size_t contig_start, contig_end = 0, search_start = 0;
   const size_t kmer_size = db_graph->kmer_size;
 
-  BinaryKmer bkmer, tmp_key;
+  BinaryKmer fw, rv, tmp_key;
   Nucleotide nuc;
   hkey_t node;
   size_t i, offset, nxtbse;
@@ -56,21 +56,21 @@ static size_t db_alignment_from_read(dBAlignment *aln, const read_t *r,
     const char *contig = r->seq.b + contig_start;
     size_t contig_len = contig_end - contig_start;
 
-    bkmer = binary_kmer_from_str(contig, kmer_size);
-    bkmer = binary_kmer_right_shift_one_base(bkmer);
+    fw = rv = zero_bkmer;
+    binary_kmer_roll_str(contig, kmer_size-1, kmer_size, &fw, &rv, NULL, NULL);
 
     for(offset=contig_start, nxtbse=kmer_size-1; nxtbse < contig_len; nxtbse++,offset++)
     {
       nuc = dna_char_to_nuc(contig[nxtbse]);
-      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      tmp_key = binary_kmer_get_key(bkmer, kmer_size);
+      binary_kmer_roll(&fw, &rv, kmer_size, nuc);
+      tmp_key = binary_kmer_roll_key(fw, rv);
       node = hash_table_find(&db_graph->ht, tmp_key);
 
       if(node != HASH_NOT_FOUND &&
          (colour == -1 || db_node_has_col(db_graph, node, colour)))
       {
         nodes->b[n].key = node;
-        nodes->b[n].orient = bkmer_get_orientation(bkmer, tmp_key);
+        nodes->b[n].orient = bkmer_get_orientation(fw, tmp_key);
         rpos->b[n] = offset;
         n++;
       }
@@ -103,7 +103,7 @@ void db_alignment_from_reads(dBAlignment *alignment,
                              uint8_t hp_cutoff,
                              const dBGraph *db_graph, int colour)
 {
-  ctx_assert(colour == -1 || db_graph->node_in_cols != NULL);
+  ctx_assert(colour == -1 || db_graph_has_node_in_cols(db_graph));
 
   db_node_buf_reset(&alignment->nodes);
   int32_buf_reset(&alignment->rpos);
@@ -1,17 +1,21 @@
 #include "global.h"
 #include "async_read_io.h"
 #include "seq_reader.h"
+#include "seq_inflate.h"
 #include "file_util.h"
 #include "util.h" // util_run_threads()
 
 #include <pthread.h>
+#include <sys/stat.h>
 
 struct AsyncIOWorker
 {
   pthread_t thread;
   MsgPool *const pool;
   AsyncIOInput task;
+  AsyncIOChunk chunk; // chunk being filled
   size_t *const num_running;
+  const size_t nthreads; // threads to decompress each input file
 };
 
 
@@ -86,6 +90,22 @@ void asyncio_task_close(AsyncIOInput *task)
   task->file1 = task->file2 = NULL;
 }
 
+// Reopen input files so they can be read again from the start
+void asyncio_task_reopen(AsyncIOInput *task)
+{
+  seq_file_t **sfs[2] = {&task->file1, &task->file2}, *sf;
+  size_t i;
+
+  for(i = 0; i < 2; i++) {
+    if(*sfs[i] == NULL) continue;
+    if(strcmp((*sfs[i])->path, "-") == 0) die("Cannot read STDIN twice");
+    if((sf = seq_open((*sfs[i])->path)) == NULL)
+      die("Cannot reopen file: %s", (*sfs[i])->path);
+    seq_close(*sfs[i]);
+    *sfs[i] = sf;
+  }
+}
+
 void asynciodata_alloc(AsyncIOData *iod)
 {
   if(seq_read_alloc(&iod->r1) == NULL ||
@@ -98,36 +118,89 @@ void asynciodata_dealloc(AsyncIOData *iod)
   seq_read_dealloc(&iod->r2);
 }
 
-void asynciodata_pool_init(void *el, size_t idx, void *args)
+void asynciochunk_alloc(AsyncIOChunk *chunk)
+{
+  memset(chunk, 0, sizeof(AsyncIOChunk));
+}
+
+void asynciochunk_dealloc(AsyncIOChunk *chunk)
 {
-  // status("alloc: %zu %p", idx, el);
-  AsyncIOData *store = (AsyncIOData*)args, *data = store + idx;
-  memcpy(el, &data, sizeof(AsyncIOData*));
+  size_t i;
+  for(i = 0; i < chunk->capacity; i++) asynciodata_dealloc(&chunk->data[i]);
+  ctx_free(chunk->data);
+  ctx_free(chunk->views); // views don't own memory
+  strbuf_dealloc(&chunk->blocks[0]);
+  strbuf_dealloc(&chunk->blocks[1]);
+  memset(chunk, 0, sizeof(AsyncIOChunk));
+}
+
+void asynciochunk_pool_init(void *el, size_t idx, void *args)
+{
+  AsyncIOChunk *store = (AsyncIOChunk*)args, *chunk = store + idx;
+  memcpy(el, &chunk, sizeof(AsyncIOChunk*));
 }
 
 // No memory allocated for io worker
 static void async_io_worker_init(AsyncIOWorker *wrkr,
                                  const AsyncIOInput *task,
-                                 MsgPool *pool, size_t *num_running)
+                                 MsgPool *pool, size_t *num_running,
+                                 size_t nthreads)
 {
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
-  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running};
+  ctx_assert(pool->elsize == sizeof(AsyncIOChunk*));
+  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running,
+                       .nthreads = nthreads};
   memcpy(wrkr, &tmp, sizeof(AsyncIOWorker));
 }
 
-static void add_to_pool(read_t *r1, read_t *r2,
-                        uint8_t fq_offset1, uint8_t fq_offset2,
-                        void *arg)
+// Swap our full chunk with an empty one from the pool
+// If `carry` is not NULL, input blocks from carry[i] onwards are copied into
+// the new chunk's blocks, before the full chunk can be reused
+static void push_chunk(AsyncIOWorker *wrkr, const size_t *carry, size_t nblocks)
 {
-  AsyncIOWorker *wrkr = (AsyncIOWorker*)arg;
   MsgPool *pool = wrkr->pool;
+  AsyncIOChunk *chunk;
+  StrBuf *blk;
+  size_t i, len;
   int pos;
-  AsyncIOData *data;
 
-  // Swap reads and parameters into the data obj
   pos = msgpool_claim_write(pool);
-  memcpy(&data, msgpool_get_ptr(pool, pos), sizeof(AsyncIOData*));
+  memcpy(&chunk, msgpool_get_ptr(pool, pos), sizeof(AsyncIOChunk*));
+  SWAP(*chunk, wrkr->chunk);
+
+  for(i = 0; carry && i < nblocks; i++) {
+    blk = &wrkr->chunk.blocks[i];
+    len = chunk->blocks[i].end - carry[i];
+    // Free blocks that grew to hold a long read
+    if(blk->size > 4*ASYNCIO_BLOCK_BYTES && len < ASYNCIO_BLOCK_BYTES)
+      strbuf_dealloc(blk);
+    strbuf_ensure_capacity(blk, MAX2(len, ASYNCIO_BLOCK_BYTES));
+    memcpy(blk->b, chunk->blocks[i].b + carry[i], len);
+    blk->end = len;
+  }
+
+  msgpool_release(pool, pos, MPOOL_FULL);
+
+  wrkr->chunk.len = wrkr->chunk.nviews = wrkr->chunk.nbases = 0;
+}
+
+static void add_to_chunk(read_t *r1, read_t *r2,
+                         uint8_t fq_offset1, uint8_t fq_offset2,
+                         void *arg)
+{
+  AsyncIOWorker *wrkr = (AsyncIOWorker*)arg;
+  AsyncIOChunk *chunk = &wrkr->chunk;
+  AsyncIOData *data;
 
+  // Reads are only allocated the first time a chunk grows this long
+  if(chunk->len == chunk->capacity) {
+    size_t i, newcap = MIN2(MAX2(chunk->capacity*2, 16), ASYNCIO_CHUNK_READS);
+    chunk->data = ctx_realloc(chunk->data, newcap * sizeof(AsyncIOData));
+    for(i = chunk->capacity; i < newcap; i++) asynciodata_alloc(&chunk->data[i]);
+    chunk->capacity = newcap;
+  }
+
+  // Swap reads and parameters into the data obj
+  data = &chunk->data[chunk->len++];
   data->fq_offset1 = fq_offset1;
   data->fq_offset2 = fq_offset2;
   data->ptr = wrkr->task.ptr;
@@ -137,7 +210,157 @@ static void add_to_pool(read_t *r1, read_t *r2,
   if(r2) SWAP(data->r2, *r2);
   else seq_read_reset(&data->r2);
 
-  msgpool_release(pool, pos, MPOOL_FULL);
+  chunk->nbases += data->r1.seq.end + data->r2.seq.end;
+
+  if(chunk->len == ASYNCIO_CHUNK_READS || chunk->nbases >= ASYNCIO_CHUNK_BASES)
+    push_chunk(wrkr, NULL, 0);
+}
+
+//
+// Parsing FASTQ/FASTA in place
+//
+
+// Input is opened again by path, so it must be a regular file: seq_file has
+// already read from STDIN, pipes and /dev/fd/N whilst guessing the format
+static bool asyncio_file_inplace(const seq_file_t *sf)
+{
+  struct stat st;
+  return strcmp(sf->path, "-") != 0 &&
+         (seq_is_fastq(sf) || sf->format == SEQ_FMT_FASTA) &&
+         stat(sf->path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+// Read into the block until it is full or we reach the end of the file
+// Leaves one byte spare so the last line can be NUL terminated
+static void block_fill(StrBuf *blk, gzFile gz, bool *eof, const char *path)
+{
+  int n;
+  while(!*eof && blk->end+1 < blk->size) {
+    n = gzread(gz, blk->b + blk->end, MIN2(blk->size - blk->end - 1, (size_t)INT_MAX));
+    if(n < 0) die("Cannot read file: %s", path);
+    if(n == 0) *eof = true;
+    blk->end += n;
+  }
+}
+
+static AsyncIOData* chunk_next_view(AsyncIOChunk *chunk)
+{
+  if(chunk->nviews == chunk->viewcap) {
+    size_t newcap = MAX2(chunk->viewcap*2, 64);
+    chunk->views = ctx_recallocarray(chunk->views, chunk->viewcap, newcap,
+                                     sizeof(AsyncIOData));
+    chunk->viewcap = newcap;
+  }
+  return &chunk->views[chunk->nviews++];
+}
+
+// Read single or paired FASTQ/FASTA files a block at a time, parsing reads in
+// place so that reads are not copied
+static void async_io_read_inplace(AsyncIOWorker *wrkr, gzFile *gz,
+                                  seq_file_t **sfs, size_t nfiles)
+{
+  AsyncIOInput *task = &wrkr->task;
+  AsyncIOChunk *chunk = &wrkr->chunk;
+  AsyncIOData *view;
+  StrBuf *blk;
+  uint8_t qoffset[2] = {0}, qmin[2] = {0}, qmax[2] = {0}, warn_flags = 0;
+  size_t i, pos[2] = {0}, end[2] = {0}, nreads = 0;
+  bool eof[2] = {false, false}, input_err = false, more_input = false;
+  int s[2] = {0};
+  read_t *r;
+
+  if(nfiles == 1)
+    status("[seq] Parsing sequence file %s", futil_inpath_str(sfs[0]->path));
+  else
+    status("[seq] Parsing sequence files %s %s\n",
+           futil_inpath_str(sfs[0]->path), futil_inpath_str(sfs[1]->path));
+
+  for(i = 0; i < nfiles; i++) {
+    seq_get_qual_range(sfs[i], task->fq_offset, &qoffset[i], &qmin[i], &qmax[i]);
+    strbuf_ensure_capacity(&chunk->blocks[i], ASYNCIO_BLOCK_BYTES);
+    chunk->blocks[i].end = 0;
+  }
+
+  while(1)
+  {
+    for(i = 0; i < nfiles; i++)
+      block_fill(&chunk->blocks[i], gz[i], &eof[i], sfs[i]->path);
+
+    // Take reads (or pairs) whilst we have complete records in every file
+    while(1)
+    {
+      for(i = 0; i < nfiles; i++) {
+        blk = &chunk->blocks[i];
+        s[i] = seq_buf_next(blk->b, blk->end, pos[i], eof[i], &end[i]);
+        input_err |= (s[i] < 0);
+      }
+      if(input_err || s[0] != 1 || (nfiles > 1 && s[1] != 1)) break;
+
+      view = chunk_next_view(chunk);
+      view->fq_offset1 = qoffset[0];
+      view->fq_offset2 = nfiles > 1 ? qoffset[1] : 0;
+      view->ptr = task->ptr;
+
+      for(i = 0; i < nfiles; i++) {
+        r = i ? &view->r2 : &view->r1;
+        seq_buf_read(chunk->blocks[i].b, pos[i], end[i], r);
+        warn_flags = seq_check_read(r, qmin[i], qmax[i], sfs[i]->path, warn_flags);
+        chunk->nbases += r->seq.end;
+        pos[i] = end[i];
+      }
+
+      // No second read: empty strings
+      if(nfiles == 1) {
+        view->r2.name = view->r2.seq = view->r2.qual
+          = (StrBuf){.b = view->r1.seq.b + view->r1.seq.end, .end = 0, .size = 1};
+        view->r2.from_sam = false;
+      }
+
+      nreads++;
+    }
+
+    // No more complete records: end of input or we need to read more
+    if(input_err || (s[0] == 0 && eof[0]) ||
+       (nfiles > 1 && s[1] == 0 && eof[1])) break;
+
+    if(chunk->nviews > 0) {
+      push_chunk(wrkr, pos, nfiles);
+      pos[0] = pos[1] = 0;
+    }
+    else {
+      // Blocks are full without a complete record, so must hold a long read
+      for(i = 0; i < nfiles; i++) {
+        blk = &chunk->blocks[i];
+        if(s[i] == 0) strbuf_ensure_capacity(blk, blk->size*2);
+      }
+    }
+  }
+
+  if(input_err) {
+    for(i = 0; i < nfiles; i++)
+      if(s[i] < 0) warn("Input error: %s\n", sfs[i]->path);
+  }
+  else {
+    // One file ended, check the other did too
+    for(i = 0; i < nfiles; i++) more_input |= (s[i] != 0 || !eof[i]);
+  }
+
+  if(more_input) {
+    warn("Different number of reads in pe files [%s; %s]\n",
+         sfs[0]->path, sfs[1]->path);
+  }
+
+  if(chunk->nviews > 0) push_chunk(wrkr, NULL, 0);
+
+  char nreads_str[100];
+  ulong_to_str(nreads, nreads_str);
+  if(nfiles == 1) {
+    status("[seq] Loaded %s reads and 0 reads pairs (file: %s)",
+           nreads_str, futil_inpath_str(sfs[0]->path));
+  } else {
+    status("[seq] Loaded %s read pairs (files: %s, %s)", nreads_str,
+           futil_inpath_str(sfs[0]->path), futil_inpath_str(sfs[1]->path));
+  }
 }
 
 static void* async_io_reader(void *ptr) __attribute__((noreturn));
@@ -150,18 +373,54 @@ static void* async_io_reader(void *ptr)
   read_t r1, r2;
   seq_read_alloc(&r1);
   seq_read_alloc(&r2);
+  asynciochunk_alloc(&wrkr->chunk);
+
+  // Decompress gzipped input in other threads. Task files are left open so
+  // that the task can be reopened.
+  seq_file_t *sfs[2] = {task->file1, task->file2};
+  SeqInflate *infs[2] = {NULL, NULL};
+  size_t i, nfiles = task->file2 ? 2 : 1;
 
-  if(task->interleaved)
+  bool inplace = !task->interleaved;
+  for(i = 0; i < nfiles; i++) inplace &= asyncio_file_inplace(sfs[i]);
+
+  for(i = 0; i < nfiles && wrkr->nthreads > 1; i++)
+    infs[i] = seq_inflate_open(sfs[i], wrkr->nthreads);
+
+  if(inplace)
   {
-    seq_parse_interleaved_sf(task->file1, task->fq_offset,
-                             &r1, &r2, add_to_pool, wrkr);
-  } else {
-    seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
-                    &r1, &r2, add_to_pool, wrkr);
+    gzFile gz[2] = {NULL, NULL};
+    for(i = 0; i < nfiles; i++) {
+      gz[i] = infs[i] ? gzdopen(seq_inflate_fd(infs[i]), "r")
+                      : gzopen(sfs[i]->path, "r");
+      if(gz[i] == NULL) die("Cannot open file: %s", sfs[i]->path);
+    }
+    async_io_read_inplace(wrkr, gz, sfs, nfiles);
+    for(i = 0; i < nfiles; i++) gzclose(gz[i]);
+  }
+  else
+  {
+    for(i = 0; i < nfiles; i++)
+      if(infs[i]) sfs[i] = seq_inflate_file(infs[i]);
+
+    if(task->interleaved) {
+      seq_parse_interleaved_sf(sfs[0], task->fq_offset,
+                               &r1, &r2, add_to_chunk, wrkr);
+    } else {
+      seq_parse_pe_sf(sfs[0], sfs[1], task->fq_offset,
+                      &r1, &r2, add_to_chunk, wrkr);
+    }
+
+    // Pass on remaining reads
+    if(wrkr->chunk.len > 0) push_chunk(wrkr, NULL, 0);
   }
 
+  for(i = 0; i < nfiles; i++)
+    if(infs[i]) seq_inflate_close(infs[i]);
+
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
+  asynciochunk_dealloc(&wrkr->chunk);
 
   // Check if we are the last thread to finish, if so close the pool
   size_t n = __sync_sub_and_fetch((volatile size_t*)wrkr->num_running, 1);
@@ -177,9 +436,10 @@ static void* async_io_reader(void *ptr)
 // Start loading into a pool
 // returns an array of AsyncIOWorker of length len_files, each is a running
 // thread putting reading into the pool passed.
+// `num_readers` threads are shared between inputs to decompress them
 static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
                                          const AsyncIOInput *inputs,
-                                         size_t num_inputs)
+                                         size_t num_inputs, size_t num_readers)
 {
   if(num_inputs == 0) return NULL;
 
@@ -187,7 +447,7 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   int rc;
 
   // Initiate all reads in the pool
-  ctx_assert(pool->elsize == sizeof(AsyncIOData*));
+  ctx_assert(pool->elsize == sizeof(AsyncIOChunk*));
 
   // Create workers
   AsyncIOWorker *workers = ctx_malloc(num_inputs * sizeof(AsyncIOWorker));
@@ -197,8 +457,10 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
   size_t *num_running = ctx_malloc(sizeof(size_t));
   *num_running = num_inputs;
 
+  size_t nthreads = MAX2(num_readers / num_inputs, 1);
+
   for(i = 0; i < num_inputs; i++)
-    async_io_worker_init(&workers[i], &inputs[i], pool, num_running);
+    async_io_worker_init(&workers[i], &inputs[i], pool, num_running, nthreads);
 
   // Start threads
   pthread_attr_t thread_attr;
@@ -249,7 +511,8 @@ void asyncio_run_threads(MsgPool *pool,
 
   // Start async io reading
   AsyncIOWorker *asyncio_workers;
-  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs);
+  asyncio_workers = asyncio_read_start(pool, asyncio_inputs, num_inputs,
+                                       num_readers);
 
   util_run_threads(args, num_readers, elsize, num_readers, job);
 
@@ -263,17 +526,21 @@ typedef struct {
   void *arg;
 } PoolFuncPair;
 
-// pthread method, loop: reads from pool, call function
+// pthread method, loop: take a chunk of reads from pool, call function on each
 static void grab_reads_from_pool(void *arg, size_t threadid)
 {
   PoolFuncPair wrkr = *(PoolFuncPair*)arg;
   int pos;
-  AsyncIOData *data = NULL;
+  size_t i;
+  AsyncIOChunk *chunk = NULL;
 
   while((pos = msgpool_claim_read(wrkr.pool)) != -1)
   {
-    memcpy(&data, msgpool_get_ptr(wrkr.pool, pos), sizeof(AsyncIOData*));
-    wrkr.func(data, threadid, wrkr.arg);
+    memcpy(&chunk, msgpool_get_ptr(wrkr.pool, pos), sizeof(AsyncIOChunk*));
+    for(i = 0; i < chunk->len; i++)
+      wrkr.func(&chunk->data[i], threadid, wrkr.arg);
+    for(i = 0; i < chunk->nviews; i++)
+      wrkr.func(&chunk->views[i], threadid, wrkr.arg);
     msgpool_release(wrkr.pool, pos, MPOOL_EMPTY);
   }
 }
@@ -284,13 +551,14 @@ void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
                       void *args, size_t num_readers, size_t elsize)
 {
-  size_t i;
-  AsyncIOData *data = ctx_malloc(MSGPOOLSIZE * sizeof(AsyncIOData));
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_alloc(&data[i]);
+  // Two chunks per worker: one being processed, one waiting
+  size_t i, nchunks = 2*num_readers;
+  AsyncIOChunk *chunks = ctx_malloc(nchunks * sizeof(AsyncIOChunk));
+  for(i = 0; i < nchunks; i++) asynciochunk_alloc(&chunks[i]);
 
   MsgPool pool;
-  msgpool_alloc(&pool, MSGPOOLSIZE, sizeof(AsyncIOData*), USE_MSG_POOL);
-  msgpool_iterate(&pool, asynciodata_pool_init, data);
+  msgpool_alloc(&pool, nchunks, sizeof(AsyncIOChunk*), USE_MSG_POOL);
+  msgpool_iterate(&pool, asynciochunk_pool_init, chunks);
 
   PoolFuncPair *poolfunc = ctx_calloc(num_readers, sizeof(PoolFuncPair));
 
@@ -304,8 +572,8 @@ void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
 
   ctx_free(poolfunc);
 
-  for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_dealloc(&data[i]);
-  ctx_free(data);
+  for(i = 0; i < nchunks; i++) asynciochunk_dealloc(&chunks[i]);
+  ctx_free(chunks);
   msgpool_dealloc(&pool);
 }
 
@@ -332,3 +600,14 @@ size_t asyncio_input_nkmers(const AsyncIOInput *io)
   // Heuristic: multiply by 5 to correct for compression
   return est_num_bases * 5;
 }
+
+// Memory used to decompress input whilst reading `num_inputs` inputs at a time
+// with `num_readers` threads. Assumes every input is a pair of files.
+size_t asyncio_read_mem(size_t num_inputs, size_t num_readers)
+{
+  size_t nthreads;
+  if(num_inputs == 0) return 0;
+  nthreads = num_readers / num_inputs;
+  // Inputs are only decompressed in other threads if they have more than one
+  return nthreads > 1 ? 2 * num_inputs * seq_inflate_mem(nthreads) : 0;
+}
@@ -26,6 +26,29 @@ typedef struct
 
 #define asyncio_task_is_pe(a) ((a)->file2 != NULL || (a)->interleaved)
 
+// Reads are passed from input threads to worker threads in chunks, so that
+// short reads don't cost one message pool operation each. A chunk is full once
+// it holds ASYNCIO_CHUNK_BASES bases. ASYNCIO_CHUNK_READS reads (or pairs) is
+// only a backstop for very short reads (64bp reads fill a chunk by bases).
+// Chunks are recycled: reads are swapped in and out, keeping their memory.
+#define ASYNCIO_CHUNK_READS (1UL<<16)
+#define ASYNCIO_CHUNK_BASES (4*ONE_MEGABYTE)
+
+// FASTQ/FASTA files are read in blocks which are parsed in place: reads point
+// into the block, which is passed on with the chunk and reused once the chunk
+// has been processed. SAM/BAM, interleaved input and input that is not a
+// regular file (STDIN, pipes) are copied as above.
+#define ASYNCIO_BLOCK_BYTES ONE_MEGABYTE
+
+typedef struct
+{
+  AsyncIOData *data; // [capacity], reads allocated up to `capacity`
+  size_t len, capacity, nbases;
+  AsyncIOData *views; // [viewcap], reads that point into `blocks`
+  size_t nviews, viewcap;
+  StrBuf blocks[2]; // input blocks, one per file
+} AsyncIOChunk;
+
 // if out_base != NULL, we expect an output string as well:
 //   -1, --seq <in>:<out>
 //   -2, --seq2 <in1>:<in2>:<out>
@@ -40,21 +63,32 @@ void asyncio_task_parse(AsyncIOInput *task, char shortopt, char *path_arg,
 
 void asyncio_task_close(AsyncIOInput *task);
 
+// Reopen input files so they can be read again from the start
+// Exits with an error if reading from STDIN
+void asyncio_task_reopen(AsyncIOInput *task);
+
 void asynciodata_alloc(AsyncIOData *iod);
 void asynciodata_dealloc(AsyncIOData *iod);
 
 typedef struct AsyncIOWorker AsyncIOWorker;
 
-void asynciodata_pool_init(void *el, size_t idx, void *args);
-void asynciodata_pool_destroy(void *el, size_t idx, void *args);
+void asynciochunk_alloc(AsyncIOChunk *chunk);
+void asynciochunk_dealloc(AsyncIOChunk *chunk);
 
+// Message pool elements are AsyncIOChunk pointers, `args` is an array of
+// AsyncIOChunk, one per pool element
+void asynciochunk_pool_init(void *el, size_t idx, void *args);
+
+// Input threads push chunks of reads into `pool` whilst `num_readers` threads
+// run `job`
 void asyncio_run_threads(MsgPool *pool,
                          AsyncIOInput *asyncio_tasks, size_t num_inputs,
                          void (*job)(void *_arg, size_t _tid),
                          void *args, size_t num_readers, size_t elsize);
 
 // `num_inputs` number of threads pushing reads into the pool
-// `num_readers` number of threads pulling reads from the pool
+// `num_readers` number of threads pulling chunks of reads from the pool,
+//   calling `job` on each read (or pair) in turn
 void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
                       void (*job)(AsyncIOData *_data, size_t _tid, void *_arg),
                       void *args, size_t num_readers, size_t elsize);
@@ -62,4 +96,8 @@ void asyncio_run_pool(AsyncIOInput *asyncio_inputs, size_t num_inputs,
 // Guess numer of kmers
 size_t asyncio_input_nkmers(const AsyncIOInput *io);
 
+// Memory used to decompress input whilst reading `num_inputs` inputs at a time
+// with `num_readers` threads
+size_t asyncio_read_mem(size_t num_inputs, size_t num_readers);
+
 #endif /* ASYNC_READ_IO_H_ */
@@ -21,6 +21,11 @@ extern const char dna_char_to_vcf_char[256]; // all non-ACGT chars are 'N'
 #define dna_nuc_to_char(n) ({ ctx_assert(((n)&3)==(n)); dna_nuc_to_char_arr[n]; })
 #define dna_nuc_complement(n) ({ ctx_assert(((n)&3)==(n)); (Nucleotide)(~(n) & 0x3); })
 #define dna_char_to_nuc(c)  ({ ctx_assert2(char_is_acgt(c),"%c",c); dna_char_to_nuc_arr[(uint8_t)(c)]; })
+// Branch free, without a lookup table, so that loops over a string are
+// vectorised. Only valid for ACGT (either case).
+#define dna_char_to_nuc_fast(c) \
+        ({ ctx_assert2(char_is_acgt(c),"%c",c); \
+           (Nucleotide)((((uint8_t)(c) >> 1) ^ ((uint8_t)(c) >> 2)) & 3); })
 #define dna_char_complement(c) ({ ctx_assert2(char_is_acgt(c),"%i",c); (char)dna_complement_char_arr[(uint8_t)(c)]; })
 
 #define dna_reverse_complement_str(str,len) dna_revcomp_str(str,str,len)
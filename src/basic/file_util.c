@@ -301,24 +301,25 @@ bool futil_path_has_extension(const char *path, const char *ext)
 }
 
 // Usage:
-//     FILE **tmp_files = futil_create_tmp_files(num_tmp);
+//     FILE **tmp_files = futil_create_tmp_files(dir, num_tmp);
 // to clear up:
 //     for(i = 0; i < num_tmp; i++) fclose(tmp_files[i]);
 //     ctx_free(tmp_files);
-FILE** futil_create_tmp_files(size_t num_tmp_files)
+FILE** futil_create_tmp_files(const char *dir, size_t num_tmp_files)
 {
   size_t i;
   StrBuf tmppath;
   strbuf_alloc(&tmppath, 1024);
   FILE **tmp_files = ctx_malloc(num_tmp_files * sizeof(FILE*));
 
+  if(dir == NULL) dir = "/tmp";
   int r = rand() & ((1<<20)-1);
 
   for(i = 0; i < num_tmp_files; i++)
   {
     strbuf_reset(&tmppath);
-    strbuf_sprintf(&tmppath, "/tmp/cortex.tmp.%i.%zu", r, i);
-    if((tmp_files[i] = fopen(tmppath.b, "r+")) == NULL) {
+    strbuf_sprintf(&tmppath, "%s/cortex.tmp.%i.%i.%zu", dir, (int)getpid(), r, i);
+    if((tmp_files[i] = fopen(tmppath.b, "w+")) == NULL) {
       die("Cannot write temporary file: %s [%s]", tmppath.b, strerror(errno));
     }
     unlink(tmppath.b); // Immediately unlink to hide temp file
@@ -113,12 +113,14 @@ char* futil_get_current_dir(char abspath[PATH_MAX+1]);
 // Case insensitive comparision of path with given extension
 bool futil_path_has_extension(const char *path, const char *ext);
 
+// Temporary files are created in `dir` (/tmp if NULL) and unlinked straight
+// away, so they are removed when closed or on exit.
 // Usage:
-//   FILE **tmp_files = futil_create_tmp_files(num_tmp);
+//   FILE **tmp_files = futil_create_tmp_files(dir, num_tmp);
 // To clear up:
 //   for(i = 0; i < num_tmp; i++) fclose(tmp_files[i]);
 //   ctx_free(tmp_files);
-FILE** futil_create_tmp_files(size_t num_tmp_files);
+FILE** futil_create_tmp_files(const char *dir, size_t num_tmp_files);
 
 // Merge temporary files, closes tmp files
 void futil_merge_tmp_files(FILE **tmp_files, size_t num_files, FILE *fout);
@@ -0,0 +1,89 @@
+#include "global.h"
+#include "gz_blocks.h"
+
+#include <zlib.h>
+
+// ID1 ID2 CM FLG=FEXTRA MTIME(4) XFL OS XLEN=8 'C' 'X' SLEN=4 <uint32_t:size>
+static const uint8_t gz_block_hdr[GZ_BLOCK_HDR_LEN - 4]
+  = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 8, 0, 'C', 'X', 4, 0};
+
+static inline void put_le32(uint8_t *p, uint32_t x) {
+  p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static inline uint32_t le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void gz_block_deflate(const void *data, size_t len, int level, ByteBuffer *out)
+{
+  ctx_assert(len < UINT32_MAX);
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  // Raw deflate, we write the gzip header and trailer
+  if(deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    die("Cannot initialise zlib compression");
+
+  size_t start = out->len, bound = deflateBound(&strm, len);
+  byte_buf_capacity(out, start + GZ_BLOCK_HDR_LEN + bound + GZ_BLOCK_TRAILER_LEN);
+  uint8_t *blk = out->b + start;
+
+  strm.next_in = (Bytef*)data;
+  strm.avail_in = len;
+  strm.next_out = blk + GZ_BLOCK_HDR_LEN;
+  strm.avail_out = bound;
+
+  if(deflate(&strm, Z_FINISH) != Z_STREAM_END) die("zlib compression failed");
+
+  size_t blklen = GZ_BLOCK_HDR_LEN + strm.total_out + GZ_BLOCK_TRAILER_LEN;
+  deflateEnd(&strm);
+
+  memcpy(blk, gz_block_hdr, sizeof(gz_block_hdr));
+  put_le32(blk + sizeof(gz_block_hdr), blklen);
+  put_le32(blk + blklen - 8, crc32(0, (const Bytef*)data, len));
+  put_le32(blk + blklen - 4, len);
+
+  out->len = start + blklen;
+}
+
+size_t gz_block_size(const uint8_t *data, size_t len)
+{
+  if(len < GZ_BLOCK_HDR_LEN + GZ_BLOCK_TRAILER_LEN ||
+     memcmp(data, gz_block_hdr, 4) != 0 ||
+     memcmp(data+10, gz_block_hdr+10, sizeof(gz_block_hdr)-10) != 0) {
+    return 0;
+  }
+
+  size_t blklen = le32(data + sizeof(gz_block_hdr));
+  if(blklen < GZ_BLOCK_HDR_LEN + GZ_BLOCK_TRAILER_LEN || blklen > len) return 0;
+  return blklen;
+}
+
+void gz_block_inflate(const uint8_t *block, size_t len, ByteBuffer *out,
+                      const char *path)
+{
+  uint32_t crc = le32(block + len - 8), isize = le32(block + len - 4);
+  byte_buf_capacity(out, (size_t)isize + 1);
+
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  if(inflateInit2(&strm, -15) != Z_OK)
+    die("Cannot initialise zlib decompression");
+
+  strm.next_in = (Bytef*)block + GZ_BLOCK_HDR_LEN;
+  strm.avail_in = len - GZ_BLOCK_HDR_LEN - GZ_BLOCK_TRAILER_LEN;
+  strm.next_out = out->b;
+  strm.avail_out = (size_t)isize + 1;
+
+  if(inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.total_out != isize ||
+     crc32(0, out->b, isize) != crc) {
+    die("Corrupt gzip block: %s", path);
+  }
+
+  inflateEnd(&strm);
+  out->b[isize] = '\0';
+  out->len = isize;
+}
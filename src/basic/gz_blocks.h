@@ -0,0 +1,33 @@
+#ifndef GZ_BLOCKS_H_
+#define GZ_BLOCKS_H_
+
+#include "common_buffers.h"
+
+//
+// Gzip files made of independently compressed blocks
+//
+// Each block is a complete gzip member, and gzip readers see the concatenated
+// members as a single stream. Blocks can be compressed by many threads at once
+// and written in any order. The header of each block has an extra field 'CX'
+// giving the block's size in bytes, so readers can find blocks without
+// inflating the file and inflate them with many threads. This is like BGZF, but
+// blocks are not limited to 64KB so they can end on record boundaries.
+//
+
+#define GZ_BLOCK_HDR_LEN 20 // gzip header with 'CX' extra field
+#define GZ_BLOCK_TRAILER_LEN 8 // crc32, input size
+
+// Compress `len` bytes of `data` into a block appended to `out`
+// `len` must be less than 4GB
+void gz_block_deflate(const void *data, size_t len, int level, ByteBuffer *out);
+
+// Size in bytes of the block at the start of `data`. Returns 0 if `data` does
+// not start with a block header or the block is longer than `len`.
+size_t gz_block_size(const uint8_t *data, size_t len);
+
+// Inflate a block of `len` bytes into `out`, replacing its contents
+// Output is NUL terminated. Calls die() if the block is corrupt.
+void gz_block_inflate(const uint8_t *block, size_t len, ByteBuffer *out,
+                      const char *path);
+
+#endif /* GZ_BLOCKS_H_ */
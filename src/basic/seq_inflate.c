@@ -0,0 +1,424 @@
+#include "global.h"
+#include "seq_inflate.h"
+#include "util.h" // util_run_threads()
+
+#include <pthread.h>
+#include <signal.h> // pthread_sigmask
+#include <unistd.h> // pipe, read, write, close
+#include <sys/stat.h> // stat
+#include <zlib.h>
+
+// BGZF blocks are at most 64KB compressed and uncompressed
+#define BGZF_MAX_BLOCK (1<<16)
+#define BGZF_HDR_LEN 12 // header before the extra field
+// Inflate 16 blocks (up to 1MB) per thread at a time, at most 256 blocks
+#define BGZF_THREAD_BLOCKS 16
+#define BGZF_BATCH_BLOCKS 256
+#define bgzf_batch_blocks(nthreads) MIN2((nthreads)*BGZF_THREAD_BLOCKS, BGZF_BATCH_BLOCKS)
+
+#define PLAIN_GZ_BUF ONE_MEGABYTE
+
+typedef struct
+{
+  SeqInflate *inf;
+  const uint8_t *in; // raw deflate data
+  size_t inlen;
+  uint8_t *out; // [BGZF_MAX_BLOCK]
+  uint32_t crc, isize; // from block trailer
+} BgzfBlock;
+
+typedef struct
+{
+  uint8_t *in, *out; // [batch_blocks * BGZF_MAX_BLOCK]
+  BgzfBlock blocks[BGZF_BATCH_BLOCKS];
+  size_t nblocks;
+  bool full; // inflated, waiting to be written
+} BgzfBatch;
+
+struct SeqInflate
+{
+  char *path;
+  bool bgzf;
+  size_t nthreads, batch_blocks;
+  FILE *in; // compressed input (BGZF)
+  gzFile gz; // compressed input (plain gzip)
+  int outfd, infd; // write and read ends of pipe
+  seq_file_t *sf; // opened on infd
+  pthread_t inflater, writer;
+  bool cancel; // reader closed the pipe before the end of the input
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // BGZF only
+  z_stream *strms; // one per thread
+  BgzfBatch batches[2]; // one being inflated, one being written
+  bool done;
+};
+
+static inline uint32_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+static inline uint32_t le32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+         ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Find the 'BC' subfield in a gzip extra field
+// Returns false if not found, otherwise sets bsize (total block size - 1)
+static bool bgzf_extra_bsize(const uint8_t *extra, size_t xlen, uint32_t *bsize)
+{
+  size_t i, slen;
+  for(i = 0; i + 4 <= xlen; i += 4 + slen) {
+    slen = le16(extra+i+2);
+    if(extra[i] == 'B' && extra[i+1] == 'C' && slen == 2 && i+6 <= xlen) {
+      *bsize = le16(extra+i+4);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Threads writing to the pipe get EPIPE instead of SIGPIPE if the reader
+// closes it early
+static void block_sigpipe()
+{
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  int rc = pthread_sigmask(SIG_BLOCK, &set, NULL);
+  if(rc != 0) die("Cannot block SIGPIPE: %s", strerror(rc));
+}
+
+static bool inflate_cancelled(SeqInflate *inf)
+{
+  pthread_mutex_lock(&inf->lock);
+  bool cancel = inf->cancel;
+  pthread_mutex_unlock(&inf->lock);
+  return cancel;
+}
+
+// Returns false if the reader has closed the pipe
+static bool write_all(int fd, const void *ptr, size_t len, const char *path)
+{
+  const char *buf = (const char*)ptr;
+  ssize_t n;
+  while(len > 0) {
+    if((n = write(fd, buf, len)) < 0) {
+      if(errno == EINTR) continue;
+      if(errno == EPIPE) return false;
+      die("Cannot pass on decompressed data [%s]: %s", strerror(errno), path);
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+//
+// BGZF
+//
+
+// Read up to inf->batch_blocks compressed blocks
+// Returns number of blocks read, 0 at the end of the file
+static size_t bgzf_read_batch(SeqInflate *inf, BgzfBatch *batch)
+{
+  uint8_t hdr[BGZF_HDR_LEN], *in = batch->in;
+  uint32_t xlen, bsize, len;
+  size_t n;
+
+  for(batch->nblocks = 0; batch->nblocks < inf->batch_blocks; batch->nblocks++)
+  {
+    if((n = fread(hdr, 1, BGZF_HDR_LEN, inf->in)) == 0) break;
+
+    if(n != BGZF_HDR_LEN || hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != 8 ||
+       !(hdr[3] & 4) || (xlen = le16(hdr+10)) > BGZF_MAX_BLOCK ||
+       fread(in, 1, xlen, inf->in) != xlen ||
+       !bgzf_extra_bsize(in, xlen, &bsize) ||
+       bsize+1 < BGZF_HDR_LEN + xlen + 8) {
+      die("Corrupt BGZF block header: %s", inf->path);
+    }
+
+    // Overwrite extra field with deflate data and trailer
+    len = bsize+1 - BGZF_HDR_LEN - xlen;
+    if(fread(in, 1, len, inf->in) != len)
+      die("Truncated BGZF file: %s", inf->path);
+
+    BgzfBlock *blk = &batch->blocks[batch->nblocks];
+    blk->inf = inf;
+    blk->in = in;
+    blk->inlen = len - 8;
+    blk->out = batch->out + batch->nblocks * BGZF_MAX_BLOCK;
+    blk->crc = le32(in+len-8);
+    blk->isize = le32(in+len-4);
+    in += len;
+
+    if(blk->isize > BGZF_MAX_BLOCK)
+      die("Corrupt BGZF block size: %s", inf->path);
+  }
+
+  if(ferror(inf->in)) die("Cannot read file [%s]: %s", strerror(errno), inf->path);
+
+  return batch->nblocks;
+}
+
+static void bgzf_inflate_block(void *arg, size_t threadid)
+{
+  BgzfBlock *blk = (BgzfBlock*)arg;
+  z_stream *strm = &blk->inf->strms[threadid];
+
+  inflateReset(strm);
+  strm->next_in = (Bytef*)blk->in;
+  strm->avail_in = blk->inlen;
+  strm->next_out = blk->out;
+  strm->avail_out = BGZF_MAX_BLOCK;
+
+  if(inflate(strm, Z_FINISH) != Z_STREAM_END || strm->total_out != blk->isize ||
+     crc32(0, blk->out, blk->isize) != blk->crc) {
+    die("Corrupt BGZF block: %s", blk->inf->path);
+  }
+}
+
+static void* bgzf_inflater(void *arg)
+{
+  SeqInflate *inf = (SeqInflate*)arg;
+  BgzfBatch *batch;
+  size_t b;
+  bool cancel;
+
+  for(b = 0; ; b ^= 1)
+  {
+    batch = &inf->batches[b];
+
+    // Wait for the writer to finish with this batch
+    pthread_mutex_lock(&inf->lock);
+    while(batch->full && !inf->cancel) pthread_cond_wait(&inf->cond, &inf->lock);
+    cancel = inf->cancel;
+    pthread_mutex_unlock(&inf->lock);
+
+    if(cancel || bgzf_read_batch(inf, batch) == 0) break;
+
+    util_run_threads(batch->blocks, batch->nblocks, sizeof(BgzfBlock),
+                     inf->nthreads, bgzf_inflate_block);
+
+    pthread_mutex_lock(&inf->lock);
+    batch->full = true;
+    pthread_cond_broadcast(&inf->cond);
+    pthread_mutex_unlock(&inf->lock);
+  }
+
+  pthread_mutex_lock(&inf->lock);
+  inf->done = true;
+  pthread_cond_broadcast(&inf->cond);
+  pthread_mutex_unlock(&inf->lock);
+
+  return NULL;
+}
+
+// Write inflated batches in order
+static void* bgzf_writer(void *arg)
+{
+  SeqInflate *inf = (SeqInflate*)arg;
+  BgzfBatch *batch;
+  size_t b, i;
+  bool ok = true;
+
+  block_sigpipe();
+
+  for(b = 0; ok; b ^= 1)
+  {
+    batch = &inf->batches[b];
+
+    pthread_mutex_lock(&inf->lock);
+    while(!batch->full && !inf->done && !inf->cancel)
+      pthread_cond_wait(&inf->cond, &inf->lock);
+    ok = batch->full && !inf->cancel;
+    pthread_mutex_unlock(&inf->lock);
+
+    if(!ok) break;
+
+    for(i = 0; i < batch->nblocks && ok; i++) {
+      ok = write_all(inf->outfd, batch->blocks[i].out, batch->blocks[i].isize,
+                     inf->path);
+    }
+
+    // If the reader has stopped, the inflater stops too
+    pthread_mutex_lock(&inf->lock);
+    batch->full = false;
+    if(!ok) inf->cancel = true;
+    pthread_cond_broadcast(&inf->cond);
+    pthread_mutex_unlock(&inf->lock);
+  }
+
+  close(inf->outfd);
+  return NULL;
+}
+
+//
+// Plain gzip
+//
+
+static void* gzip_inflater(void *arg)
+{
+  SeqInflate *inf = (SeqInflate*)arg;
+  char *buf = ctx_malloc(PLAIN_GZ_BUF);
+  int n = 0;
+
+  block_sigpipe();
+
+  while(!inflate_cancelled(inf) &&
+        (n = gzread(inf->gz, buf, PLAIN_GZ_BUF)) > 0 &&
+        write_all(inf->outfd, buf, n, inf->path)) {}
+
+  if(n < 0) die("Cannot decompress file: %s", inf->path);
+
+  close(inf->outfd);
+  ctx_free(buf);
+  return NULL;
+}
+
+//
+// Open/close
+//
+
+size_t seq_inflate_mem(size_t nthreads)
+{
+  // Two batches, each with input and output buffers
+  size_t bgzf_mem = 4 * bgzf_batch_blocks(MAX2(nthreads, 1)) * BGZF_MAX_BLOCK;
+  // Our buffer and zlib's
+  size_t gz_mem = 2 * PLAIN_GZ_BUF;
+  return MAX2(bgzf_mem, gz_mem);
+}
+
+// Returns 0 if not gzip, 1 if gzip, 2 if BGZF
+// Only regular files are checked: reading a pipe would lose data that
+// seq_file has already read or still needs
+static int seq_inflate_gz_type(const char *path)
+{
+  uint8_t hdr[BGZF_HDR_LEN+6];
+  uint32_t bsize;
+  struct stat st;
+  FILE *fh;
+  size_t n;
+
+  if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return 0;
+  if((fh = fopen(path, "r")) == NULL) return 0;
+  n = fread(hdr, 1, sizeof(hdr), fh);
+  fclose(fh);
+
+  if(n < 2 || hdr[0] != 0x1f || hdr[1] != 0x8b) return 0;
+  if(n == sizeof(hdr) && (hdr[3] & 4) && le16(hdr+10) >= 6 &&
+     bgzf_extra_bsize(hdr+BGZF_HDR_LEN, 6, &bsize)) return 2;
+  return 1;
+}
+
+SeqInflate* seq_inflate_open(const seq_file_t *sf, size_t nthreads)
+{
+  const char *path = sf->path;
+  int gztype, fds[2], rc;
+  size_t i;
+
+  if(strcmp(path, "-") == 0 || seq_is_sam(sf) || seq_is_bam(sf)) return NULL;
+  if((gztype = seq_inflate_gz_type(path)) == 0) return NULL;
+
+  SeqInflate *inf = ctx_calloc(1, sizeof(SeqInflate));
+  inf->path = strdup(path);
+  inf->bgzf = (gztype == 2);
+  inf->nthreads = inf->bgzf ? MAX2(nthreads, 1) : 1;
+  inf->batch_blocks = bgzf_batch_blocks(inf->nthreads);
+
+  if(pipe(fds) != 0) die("Cannot create pipe: %s", strerror(errno));
+  inf->infd = fds[0];
+  inf->outfd = fds[1];
+
+  pthread_mutex_init(&inf->lock, NULL);
+  pthread_cond_init(&inf->cond, NULL);
+
+  if(inf->bgzf)
+  {
+    if((inf->in = fopen(path, "r")) == NULL)
+      die("Cannot open file: %s", path);
+
+    inf->strms = ctx_calloc(inf->nthreads, sizeof(z_stream));
+    for(i = 0; i < inf->nthreads; i++)
+      if(inflateInit2(&inf->strms[i], -15) != Z_OK) die("zlib init failed");
+
+    for(i = 0; i < 2; i++) {
+      inf->batches[i].in = ctx_malloc(inf->batch_blocks * BGZF_MAX_BLOCK);
+      inf->batches[i].out = ctx_malloc(inf->batch_blocks * BGZF_MAX_BLOCK);
+    }
+
+    if((rc = pthread_create(&inf->inflater, NULL, bgzf_inflater, inf)) != 0 ||
+       (rc = pthread_create(&inf->writer, NULL, bgzf_writer, inf)) != 0)
+      die("Creating thread failed: %s", strerror(rc));
+  }
+  else
+  {
+    if((inf->gz = gzopen(path, "r")) == NULL)
+      die("Cannot open file: %s", path);
+    gzbuffer(inf->gz, PLAIN_GZ_BUF);
+
+    if((rc = pthread_create(&inf->inflater, NULL, gzip_inflater, inf)) != 0)
+      die("Creating thread failed: %s", strerror(rc));
+  }
+
+  status("[seq] Decompressing %s with %zu thread%s", path,
+         inf->nthreads, util_plural_str(inf->nthreads));
+
+  return inf;
+}
+
+seq_file_t* seq_inflate_file(SeqInflate *inf)
+{
+  if(inf->sf == NULL) {
+    ctx_assert(inf->infd >= 0);
+    char fdpath[50];
+    sprintf(fdpath, "/dev/fd/%i", inf->infd);
+    if((inf->sf = seq_open(fdpath)) == NULL)
+      die("Cannot read decompressed file: %s", inf->path);
+    close(inf->infd);
+    inf->infd = -1;
+  }
+  return inf->sf;
+}
+
+int seq_inflate_fd(SeqInflate *inf)
+{
+  ctx_assert(inf->sf == NULL && inf->infd >= 0);
+  int fd = inf->infd;
+  inf->infd = -1;
+  return fd;
+}
+
+// Input may not have been read to the end: threads still writing stop when
+// the read end of the pipe is closed
+void seq_inflate_close(SeqInflate *inf)
+{
+  size_t i;
+
+  pthread_mutex_lock(&inf->lock);
+  inf->cancel = true;
+  pthread_cond_broadcast(&inf->cond);
+  pthread_mutex_unlock(&inf->lock);
+
+  if(inf->sf) seq_close(inf->sf);
+  if(inf->infd >= 0) close(inf->infd);
+  pthread_join(inf->inflater, NULL);
+
+  if(inf->bgzf) {
+    pthread_join(inf->writer, NULL);
+    fclose(inf->in);
+    for(i = 0; i < inf->nthreads; i++) inflateEnd(&inf->strms[i]);
+    for(i = 0; i < 2; i++) {
+      ctx_free(inf->batches[i].in);
+      ctx_free(inf->batches[i].out);
+    }
+    ctx_free(inf->strms);
+  }
+  else {
+    gzclose(inf->gz);
+  }
+
+  pthread_mutex_destroy(&inf->lock);
+  pthread_cond_destroy(&inf->cond);
+
+  free(inf->path);
+  ctx_free(inf);
+}
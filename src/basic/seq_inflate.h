@@ -0,0 +1,42 @@
+#ifndef SEQ_INFLATE_H_
+#define SEQ_INFLATE_H_
+
+#include "seq_file/seq_file.h"
+
+//
+// Decompress gzipped sequence files in background threads, so that a single
+// large input doesn't limit loading to the speed of one core.
+//
+// BGZF files (as written by bgzip) are made of independent blocks of at most
+// 64KB, which are inflated in batches of 16 blocks per thread by `nthreads`
+// threads, so memory used grows with the number of threads. Plain gzip cannot
+// be split without first reading the whole file, so is inflated by a single
+// thread, which still takes decompression off the thread parsing reads.
+//
+// Decompressed data is written to a pipe which is read as a seq_file_t, or as a
+// file descriptor.
+//
+
+typedef struct SeqInflate SeqInflate;
+
+// Returns NULL if `sf` is not gzip compressed, is SAM/BAM (which htslib reads
+// itself) or is not a regular file (e.g. STDIN, a pipe or process
+// substitution), since `sf` has already read from those. `sf` is only used for
+// its path and format, it is not read from or closed.
+SeqInflate* seq_inflate_open(const seq_file_t *sf, size_t nthreads);
+
+// Upper bound on memory used by a SeqInflate with `nthreads` threads
+size_t seq_inflate_mem(size_t nthreads);
+
+// Decompressed input
+seq_file_t* seq_inflate_file(SeqInflate *inf);
+
+// Decompressed input as a file descriptor, for reading raw bytes. Caller takes
+// ownership and must close it. Cannot be used with seq_inflate_file().
+int seq_inflate_fd(SeqInflate *inf);
+
+// Close decompressed input and wait for decompression threads to finish.
+// Input does not have to have been read to the end: decompression stops early.
+void seq_inflate_close(SeqInflate *inf);
+
+#endif /* SEQ_INFLATE_H_ */
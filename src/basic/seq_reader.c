@@ -190,8 +190,8 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
 
 // Takes, updates and returns warnings that were printed
 // Warnings are only printed once per file
-static uint8_t check_new_read(const read_t *r, uint8_t qmin, uint8_t qmax,
-                              const char *path, uint8_t warn_flags)
+uint8_t seq_check_read(const read_t *r, uint8_t qmin, uint8_t qmax,
+                       const char *path, uint8_t warn_flags)
 {
   // Test if we've already warned about issue (e.g. bad base) before checking
   if(!(warn_flags & WFLAG_INVALID_BASE))
@@ -286,6 +286,23 @@ static inline int guess_fastq_format(seq_file_t *sf)
   return fmt;
 }
 
+// Get quality score offset and range for a file, guessing them if `fq_offset`
+// is zero
+void seq_get_qual_range(seq_file_t *sf, uint8_t fq_offset,
+                        uint8_t *qoffset, uint8_t *qmin, uint8_t *qmax)
+{
+  int format;
+  *qoffset = *qmin = fq_offset;
+  *qmax = 126;
+
+  if(fq_offset == 0 && (format = guess_fastq_format(sf)) != -1)
+  {
+    *qmin = (uint8_t)FASTQ_MIN[format];
+    *qmax = (uint8_t)FASTQ_MAX[format];
+    *qoffset = (uint8_t)FASTQ_OFFSET[format];
+  }
+}
+
 void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
                               read_t *r1, read_t *r2,
                               void (*read_func)(read_t *_r1, read_t *_r2,
@@ -315,7 +332,7 @@ void seq_parse_interleaved_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read_primary(sf, r[ridx])) > 0)
   {
-    warn_flags = check_new_read(r[ridx], qmin, qmax, sf->path, warn_flags);
+    warn_flags = seq_check_read(r[ridx], qmin, qmax, sf->path, warn_flags);
 
     if(ridx)
     {
@@ -406,8 +423,8 @@ void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
 
     // PE
     // We don't care about read orientation at this point
-    warn_flags = check_new_read(r1, qmin1, qmax1, sf1->path, warn_flags);
-    warn_flags = check_new_read(r2, qmin2, qmax2, sf2->path, warn_flags);
+    warn_flags = seq_check_read(r1, qmin1, qmax1, sf1->path, warn_flags);
+    warn_flags = seq_check_read(r2, qmin2, qmax2, sf2->path, warn_flags);
     read_func(r1, r2, qoffset1, qoffset2, reader_ptr);
     num_pe_pairs++;
   }
@@ -447,7 +464,7 @@ void seq_parse_se_sf(seq_file_t *sf, uint8_t ascii_fq_offset,
 
   while((s = seq_read_primary(sf, r1)) > 0)
   {
-    warn_flags = check_new_read(r1, qmin, qmax, sf->path, warn_flags);
+    warn_flags = seq_check_read(r1, qmin, qmax, sf->path, warn_flags);
     read_func(r1, NULL, qoffset, 0, reader_ptr);
     num_se_reads++;
   }
@@ -549,3 +566,132 @@ void chrom_hash_load(char const*const* paths, size_t num_files,
 
   ctx_free(ref_files);
 }
+
+//
+// Parse FASTQ/FASTA records in place in a buffer
+//
+
+static inline size_t buf_skip_blank_lines(const char *buf, size_t len,
+                                          size_t pos)
+{
+  while(pos < len && (buf[pos] == '\n' || buf[pos] == '\r')) pos++;
+  return pos;
+}
+
+// Find the end of the line starting at `pos`, which is the index of the '\n'
+// or `len` if there is no newline and we are at the end of the input
+// Returns false if we need more input
+static inline bool buf_line_end(const char *buf, size_t len, size_t pos,
+                                bool eof, size_t *eol)
+{
+  // memchr is vectorised by libc
+  const char *nl = pos < len ? memchr(buf+pos, '\n', len-pos) : NULL;
+  if(nl != NULL) { *eol = nl - buf; return true; }
+  *eol = len;
+  return eof;
+}
+
+// Length of line buf[pos..eol-1] excluding '\r'
+static inline size_t buf_line_len(const char *buf, size_t pos, size_t eol)
+{
+  return eol - pos - (eol > pos && buf[eol-1] == '\r');
+}
+
+// Find the end of the next record in buf[pos..len-1], without modifying buf
+// Returns 1 and sets *end if record is complete, 0 if we need more input or
+// there are no more records, -1 if the input is not FASTQ/FASTA
+int seq_buf_next(const char *buf, size_t len, size_t pos, bool eof,
+                 size_t *end)
+{
+  size_t eol, seqlen = 0, qlen = 0;
+  char c;
+
+  if((pos = buf_skip_blank_lines(buf, len, pos)) == len) return 0;
+  if((c = buf[pos]) != '@' && c != '>') return -1;
+
+  // Name line
+  if(!buf_line_end(buf, len, pos, eof, &eol)) return 0;
+  pos = eol+1;
+
+  if(c == '>') {
+    // FASTA record ends at the next '>' line
+    for(; pos < len && buf[pos] != '>'; pos = eol+1)
+      if(!buf_line_end(buf, len, pos, eof, &eol)) return 0;
+    if(pos >= len && !eof) return 0;
+    *end = MIN2(pos, len);
+    return 1;
+  }
+
+  // FASTQ sequence lines up to the '+' line
+  for(; pos < len && buf[pos] != '+'; pos = eol+1) {
+    if(!buf_line_end(buf, len, pos, eof, &eol)) return 0;
+    seqlen += buf_line_len(buf, pos, eol);
+  }
+  if(pos >= len) return eof ? -1 : 0;
+  if(!buf_line_end(buf, len, pos, eof, &eol)) return 0;
+  pos = eol+1;
+
+  // At least one quality line, until we have as many scores as bases
+  do {
+    if(pos >= len) {
+      if(!eof) return 0;
+      break;
+    }
+    if(!buf_line_end(buf, len, pos, eof, &eol)) return 0;
+    qlen += buf_line_len(buf, pos, eol);
+    pos = eol+1;
+  } while(qlen < seqlen);
+
+  *end = MIN2(pos, len);
+  return 1;
+}
+
+// Join lines buf[*pos..] into a string starting at buf[*pos], stopping at
+// `end`, at a line starting with `stop` or once we have at least one line and
+// `minlen` chars. Returns number of lines joined.
+static size_t buf_join_lines(char *buf, size_t end, size_t *pos, char stop,
+                             size_t minlen, StrBuf *sbuf)
+{
+  size_t eol, n, w = *pos, nlines = 0;
+  char *nl;
+
+  sbuf->b = buf + *pos;
+  sbuf->end = 0;
+
+  while(*pos < end && buf[*pos] != stop && (!nlines || sbuf->end < minlen)) {
+    nl = memchr(buf + *pos, '\n', end - *pos);
+    eol = nl ? (size_t)(nl - buf) : end;
+    n = buf_line_len(buf, *pos, eol);
+    if(w != *pos) memmove(buf + w, buf + *pos, n);
+    w += n;
+    sbuf->end += n;
+    *pos = eol+1;
+    nlines++;
+  }
+
+  sbuf->size = sbuf->end+1;
+  if(nlines) buf[w] = '\0';
+  return nlines;
+}
+
+// Parse a record found with seq_buf_next(), in place. Read strings point into
+// `buf` and are NUL terminated. `buf` must have a byte spare after `end`.
+void seq_buf_read(char *buf, size_t pos, size_t end, read_t *r)
+{
+  pos = buf_skip_blank_lines(buf, end, pos);
+  bool fastq = (buf[pos++] == '@');
+  r->from_sam = false;
+
+  buf_join_lines(buf, end, &pos, 0, 0, &r->name);
+
+  // Empty sequence or quality strings point to the end of the name
+  if(!buf_join_lines(buf, end, &pos, fastq ? '+' : 0, SIZE_MAX, &r->seq))
+    r->seq = (StrBuf){.b = r->name.b + r->name.end, .end = 0, .size = 1};
+
+  if(fastq && pos < end) {
+    buf_join_lines(buf, end, &pos, 0, 0, &r->qual); // '+' line
+    if(buf_join_lines(buf, end, &pos, 0, r->seq.end, &r->qual)) return;
+  }
+
+  r->qual = (StrBuf){.b = r->name.b + r->name.end, .end = 0, .size = 1};
+}
@@ -44,6 +44,17 @@ size_t seq_contig_end(const read_t *r, size_t contig_start, size_t kmer_size,
                       uint8_t qual_cutoff, uint8_t hp_cutoff,
                       size_t *search_start);
 
+// Get quality score offset and range for a file, guessing them if `fq_offset`
+// is zero
+void seq_get_qual_range(seq_file_t *sf, uint8_t fq_offset,
+                        uint8_t *qoffset, uint8_t *qmin, uint8_t *qmax);
+
+// Warn about bad bases and quality scores
+// Takes, updates and returns warnings that were printed
+// Warnings are only printed once per file
+uint8_t seq_check_read(const read_t *r, uint8_t qmin, uint8_t qmax,
+                       const char *path, uint8_t warn_flags);
+
 void seq_parse_pe_sf(seq_file_t *sf1, seq_file_t *sf2, uint8_t ascii_fq_offset,
                      read_t *r1, read_t *r2,
                      void (*read_func)(read_t *_r1, read_t *_r2,
@@ -80,6 +91,22 @@ void seq_parse_se(const char *path, uint8_t ascii_fq_offset,
                                     void *_ptr),
                   void *reader_ptr);
 
+//
+// Parse FASTQ/FASTA records in place in a buffer, without copying
+//
+
+// Find the end of the next record in buf[pos..len-1], without modifying buf
+// `eof` is true if there is no more input after buf[len-1]
+// Returns 1 and sets *end if record is complete, 0 if we need more input or
+// there are no more records, -1 if the input is not FASTQ/FASTA
+int seq_buf_next(const char *buf, size_t len, size_t pos, bool eof,
+                 size_t *end);
+
+// Parse a record found with seq_buf_next(), in place. Read strings point into
+// `buf` and are NUL terminated. `buf` must have a byte spare after `end`.
+// `r` must not own any memory.
+void seq_buf_read(char *buf, size_t pos, size_t end, read_t *r);
+
 void seq_reader_orient_mp_FF_or_RR(read_t *r1, read_t *r2, ReadMateDir matedir);
 void seq_reader_orient_mp_FF(read_t *r1, read_t *r2, ReadMateDir matedir);
 
@@ -204,6 +204,7 @@ int ctx_breakpoints(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
@@ -220,7 +221,7 @@ int ctx_breakpoints(int argc, char **argv)
 
   // Load path files
   for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], true, &db_graph);
+    gpath_reader_load(&gpfiles.b[i], true, nthreads, &db_graph);
 
   // Get array of sequence file paths
   size_t num_seq_paths = sfilebuf.len;
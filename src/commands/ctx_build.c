@@ -7,6 +7,7 @@
 #include "graphs_load.h"
 #include "graph_writer.h"
 #include "build_graph.h"
+#include "build_partitions.h"
 
 #include "seq_file/seq_file.h"
 
@@ -21,6 +22,13 @@ const char build_usage[] =
 "  -m, --memory <mem>       Memory to use\n"
 "  -n, --nkmers <kmers>     Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"  -G, --grow               Grow the hash table when it fills up, starting\n"
+"                           from -n <kmers>. -m <mem> limits how far it grows\n"
+"  -S, --solid <mem>        Read sequence twice: count kmers with a <mem> Bloom\n"
+"                           filter first, then only load kmers seen twice\n"
+"  -N, --partitions <N>     Build the graph in <N> parts on disk to save memory.\n"
+"                           -m <mem> is then the memory for one partition\n"
+"  -T, --tmp <dir>          Directory for --partitions files [default: /tmp]\n"
 //
 "  -k, --kmer <kmer>        Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
 "  -s, --sample <name>      Sample name (required before any seq args)\n"
@@ -57,6 +65,10 @@ static struct option longopts[] =
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
   {"force",        no_argument,       NULL, 'f'},
+  {"grow",         no_argument,       NULL, 'G'},
+  {"solid",        required_argument, NULL, 'S'},
+  {"partitions",   required_argument, NULL, 'N'},
+  {"tmp",          required_argument, NULL, 'T'},
 // command specific
   {"kmer",         required_argument, NULL, 'k'},
   {"sample",       required_argument, NULL, 's'},
@@ -88,6 +100,10 @@ static SampleNameBuffer snamebuf;
 
 static size_t nthreads = 0;
 static struct MemArgs memargs = MEM_ARGS_INIT;
+static bool grow_graph = false;
+static size_t solid_mem = 0; // memory for counting Bloom filter, 0 if off
+static size_t num_partitions = 0; // 0 if building in memory
+static const char *tmp_dir = NULL;
 
 static char *out_path = NULL;
 static size_t output_colours = 0, kmer_size = 0;
@@ -151,6 +167,10 @@ static void parse_args(int argc, char **argv)
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 'G': cmd_check(!grow_graph, cmd); grow_graph = true; break;
+      case 'S': cmd_check(!solid_mem, cmd); solid_mem = cmd_size_nonzero(cmd, optarg); break;
+      case 'N': cmd_check(!num_partitions, cmd); num_partitions = cmd_uint32_nonzero(cmd, optarg); break;
+      case 'T': cmd_check(!tmp_dir, cmd); tmp_dir = optarg; break;
       case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_kmer_size(cmd, optarg); break;
       case 's':
         intocolour++;
@@ -223,6 +243,11 @@ static void parse_args(int argc, char **argv)
 
   if(!kmer_size) die("kmer size not set with -k <K>");
 
+  if(num_partitions > BUILD_PARTITIONS_MAX)
+    cmd_print_usage("--partitions <N> cannot be more than %i", BUILD_PARTITIONS_MAX);
+  if(tmp_dir && !num_partitions)
+    cmd_print_usage("--tmp <dir> is only used with --partitions <N>");
+
   // Check kmer size in graphs to load
   size_t i;
   for(i = 0; i < gfilebuf.len; i++) {
@@ -288,6 +313,12 @@ int ctx_build(int argc, char **argv)
   {
     if(remove_pcr_used)
       cmd_print_usage("Cannot use --remove-pcr and --intersect");
+    if(grow_graph)
+      cmd_print_usage("Cannot use --grow and --intersect");
+    if(solid_mem)
+      cmd_print_usage("Cannot use --solid and --intersect");
+    if(num_partitions)
+      cmd_print_usage("Cannot use --partitions and --intersect");
 
     for(t = 0; t < ntasks; t++)
       tasks[t].prefs.must_exist_in_graph = true;
@@ -297,6 +328,65 @@ int ctx_build(int argc, char **argv)
       max_kmers += gisecbuf.b[i].num_of_kmers;
   }
 
+  //
+  // Split reads into partitions on disk (out-of-core build)
+  //
+  BuildPartitions partitions;
+  size_t start, end;
+
+  if(num_partitions)
+  {
+    if(remove_pcr_used)
+      cmd_print_usage("Cannot use --remove-pcr and --partitions");
+    if(grow_graph)
+      cmd_print_usage("Cannot use --grow and --partitions");
+    if(solid_mem)
+      cmd_print_usage("Cannot use --solid and --partitions");
+    if(gfilebuf.len > 0)
+      cmd_print_usage("Cannot use --graph and --partitions");
+
+    build_partitions_alloc(&partitions, num_partitions, kmer_size, tmp_dir);
+
+    for(start = 0; start < ntasks; start = end) {
+      end = MIN2(start+MAX_IO_THREADS, ntasks);
+      build_partitions_split(&partitions, tasks+start, end-start, nthreads);
+    }
+
+    // Only one partition is held in memory at a time
+    max_kmers = build_partitions_max_kmers(&partitions);
+  }
+
+  //
+  // Count kmers to find those seen at least twice (two pass build)
+  //
+  KmerBloom solid_kmers;
+  size_t bloom_mem = 0;
+
+  if(solid_mem)
+  {
+    bloom_mem = kmer_bloom_mem(solid_mem);
+    if(bloom_mem >= memargs.mem_to_use)
+      cmd_print_usage("--solid <mem> must be less than -m <mem>");
+
+    kmer_bloom_alloc(&solid_kmers, solid_mem);
+
+    for(start = 0; start < ntasks; start = end) {
+      end = MIN2(start+MAX_IO_THREADS, ntasks);
+      build_graph_count_kmers(&solid_kmers, kmer_size, tasks+start, end-start,
+                              nthreads);
+    }
+
+    for(t = 0; t < ntasks; t++) {
+      asyncio_task_reopen(&tasks[t].files);
+      tasks[t].prefs.solid_kmers = &solid_kmers;
+    }
+
+    // Size the graph from the filter's estimate
+    max_kmers = solid_kmers.num_solid;
+    for(i = 0; i < gfilebuf.len; i++)
+      max_kmers += gfilebuf.b[i].num_of_kmers;
+  }
+
   //
   // Decide on memory
   //
@@ -304,18 +394,37 @@ int ctx_build(int argc, char **argv)
 
   // remove_pcr_dups requires a fw and rv bit per kmer
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * output_colours +
+                  (db_graph_covg_size() + sizeof(Edges)) * 8 * output_colours +
                   (gisecbuf.len > 0 ? sizeof(Edges)*8 : 0) +
-                  remove_pcr_used*2;
+                  remove_pcr_used*2 +
+                  (num_partitions ? sizeof(hkey_t)*8 : 0); // for sorting
+
+  // Buffers for decompressing input in other threads
+  size_t io_mem = asyncio_read_mem(MIN2(ntasks, MAX_IO_THREADS), nthreads);
+  if(bloom_mem + io_mem >= memargs.mem_to_use) {
+    char memstr[50];
+    bytes_to_str(bloom_mem + io_mem, 1, memstr);
+    die("Need to set higher memory limit [ input buffers%s use %s ]",
+        solid_mem ? " and --solid filter" : "", memstr);
+  }
 
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+  // A growable graph starts small unless -n is given
+  // The Bloom filter is kept whilst building
+  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use - bloom_mem - io_mem,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
                                         memargs.num_kmers_set,
-                                        bits_per_kmer, 0, max_kmers,
-                                        true, &graph_mem);
+                                        bits_per_kmer,
+                                        solid_mem ? (int64_t)max_kmers : 0,
+                                        max_kmers, !grow_graph, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + bloom_mem + io_mem);
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  // Largest hash table that fits in -m
+  uint64_t max_capacity = 0;
+  if(grow_graph && memargs.mem_to_use_set)
+    hash_table_mem_limit(memargs.mem_to_use - bloom_mem - io_mem, bits_per_kmer,
+                         &max_capacity);
 
   //
   // Check output path
@@ -332,6 +441,8 @@ int ctx_build(int argc, char **argv)
   db_graph_alloc(&db_graph, kmer_size, output_colours, output_colours,
                  kmers_in_hash, alloc_flags);
 
+  if(grow_graph) db_graph_set_growable(&db_graph, nthreads, max_capacity);
+
   Edges *isec_edges = NULL;
   if(gisecbuf.len > 0)
     isec_edges = ctx_calloc(db_graph.ht.capacity, sizeof(Edges));
@@ -342,8 +453,11 @@ int ctx_build(int argc, char **argv)
   if(gisecbuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     Covg *tmp_covgs = NULL;
+    uint8_t *tmp_covgs8 = NULL;
     SWAP(db_graph.col_covgs, tmp_covgs);
+    SWAP(db_graph.col_covgs8, tmp_covgs8);
     SWAP(db_graph.col_edges, isec_edges); db_graph.num_edge_cols = 1;
     for(i = 0; i < gisecbuf.len; i++) {
       graph_load(&gisecbuf.b[i], gprefs, NULL);
@@ -351,6 +465,7 @@ int ctx_build(int argc, char **argv)
       graph_file_close(&gisecbuf.b[i]);
     }
     SWAP(db_graph.col_covgs, tmp_covgs);
+    SWAP(db_graph.col_covgs8, tmp_covgs8);
     SWAP(db_graph.col_edges, isec_edges); db_graph.num_edge_cols = output_colours;
     // reset ginfo
     graph_info_init(&db_graph.ginfo[0]);
@@ -360,6 +475,7 @@ int ctx_build(int argc, char **argv)
   if(gfilebuf.len > 0)
   {
     GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
     gprefs.must_exist_in_graph = (gisecbuf.len > 0);
     gprefs.must_exist_in_edges = isec_edges;
 
@@ -375,29 +491,43 @@ int ctx_build(int argc, char **argv)
     strbuf_set(&db_graph.ginfo[samples[i].colour].sample_name, samples[i].name);
   }
 
-  size_t start, end, num_load, colour, prev_colour = 0;
+  size_t num_load, colour, prev_colour = 0;
 
-  // If we are using PCR duplicate removal,
-  // it's best to load one colour at a time
-  for(start = 0; start < ntasks; start = end, prev_colour = colour)
+  if(num_partitions)
   {
-    // Wipe read start bitfield
-    colour = tasks[start].prefs.colour;
-    if(remove_pcr_used)
-    {
-      if(colour != prev_colour)
-        memset(db_graph.readstrt, 0, roundup_bits2bytes(db_graph.ht.capacity)*2);
-
-      end = start+1;
-      while(end < ntasks && end-start < MAX_IO_THREADS &&
-            tasks[end].prefs.colour == colour) end++;
-    }
-    else {
-      end = MIN2(start+MAX_IO_THREADS, ntasks);
+    // Reads were parsed whilst partitioning
+    for(t = 0; t < ntasks; t++) {
+      graph_info_update_stats(&db_graph.ginfo[tasks[t].prefs.colour],
+                              &tasks[t].stats);
     }
+    db_graph.num_of_cols_used = output_colours;
 
-    num_load = end-start;
-    build_graph(&db_graph, tasks+start, num_load, nthreads);
+    build_partitions_load(&partitions, &db_graph, nthreads);
+  }
+  else
+  {
+    // If we are using PCR duplicate removal,
+    // it's best to load one colour at a time
+    for(start = 0; start < ntasks; start = end, prev_colour = colour)
+    {
+      // Wipe read start bitfield
+      colour = tasks[start].prefs.colour;
+      if(remove_pcr_used)
+      {
+        if(colour != prev_colour)
+          memset(db_graph.readstrt, 0, roundup_bits2bytes(db_graph.ht.capacity)*2);
+
+        end = start+1;
+        while(end < ntasks && end-start < MAX_IO_THREADS &&
+              tasks[end].prefs.colour == colour) end++;
+      }
+      else {
+        end = MIN2(start+MAX_IO_THREADS, ntasks);
+      }
+
+      num_load = end-start;
+      build_graph(&db_graph, tasks+start, num_load, nthreads);
+    }
   }
 
   // Remove kmers with no coverage
@@ -406,7 +536,13 @@ int ctx_build(int argc, char **argv)
     db_graph_intersect_edges(&db_graph, nthreads, isec_edges);
   }
 
-  // Print stats for hash table
+  if(solid_mem) {
+    // PCR duplicate removal adds the first kmer of reads even if not solid
+    if(remove_pcr_used) db_graph_remove_no_covg_kmers(&db_graph, nthreads);
+    kmer_bloom_dealloc(&solid_kmers);
+  }
+
+  // Print stats for hash table (last partition only if partitioned)
   hash_table_print_stats(&db_graph.ht);
 
   // Print stats per input file
@@ -416,8 +552,14 @@ int ctx_build(int argc, char **argv)
   }
 
   status("Dumping graph...\n");
-  graph_writer_save_mkhdr(out_path, &db_graph, CTX_GRAPH_FILEFORMAT, NULL,
-                          0, output_colours);
+  if(num_partitions) {
+    build_partitions_save(&partitions, out_path, &db_graph, output_colours);
+    build_partitions_dealloc(&partitions);
+  }
+  else {
+    graph_writer_save_mkhdr(out_path, &db_graph, CTX_GRAPH_FILEFORMAT, NULL,
+                            0, output_colours);
+  }
 
   build_graph_task_buf_dealloc(&gtaskbuf);
   gfile_buf_dealloc(&gfilebuf);
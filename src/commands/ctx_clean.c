@@ -230,7 +230,7 @@ int ctx_clean(int argc, char **argv)
   bool use_mem_limit = (memargs.mem_to_use_set && num_gfiles > 1) || !ctx_max_kmers;
 
   size_t kmers_in_hash, bits_per_kmer, graph_mem;
-  size_t per_col_bits = (sizeof(Covg)+sizeof(Edges)) * 8;
+  size_t per_col_bits = (db_graph_covg_size()+sizeof(Edges)) * 8;
   size_t extra_edge_bits = (all_colours_loaded ? 0 : sizeof(Edges) * 8);
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
@@ -279,6 +279,7 @@ int ctx_clean(int argc, char **argv)
 
   // Load graph into a single colour
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   // Construct cleaned graph header
   GraphFileHeader outhdr;
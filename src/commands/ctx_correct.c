@@ -140,8 +140,12 @@ int ctx_correct(int argc, char **argv)
                                         ctx_num_kmers, ctx_num_kmers,
                                         false, &graph_mem);
 
+  // Buffers for decompressing input in other threads
+  size_t io_mem = asyncio_read_mem(MIN2(inputs->len, MAX_IO_THREADS), args.nthreads);
+
   // Paths memory
-  size_t rem_mem = args.memargs.mem_to_use - MIN2(args.memargs.mem_to_use, graph_mem);
+  size_t rem_mem = args.memargs.mem_to_use -
+                   MIN2(args.memargs.mem_to_use, graph_mem + io_mem);
   path_mem = gpath_reader_mem_req(gpfiles->b, gpfiles->len, ncols, rem_mem, false);
 
   cmd_print_mem(path_mem, "paths");
@@ -151,7 +155,7 @@ int ctx_correct(int argc, char **argv)
   path_mem  += sizeof(GPath*)*kmers_in_hash;
 
   // Total memory
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + io_mem;
   cmd_check_mem_limit(args.memargs.mem_to_use, total_mem);
 
   //
@@ -193,6 +197,7 @@ int ctx_correct(int argc, char **argv)
   // Load Graph and Path files
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
   gprefs.empty_colours = true;
 
   // Load graph, print stats, close file
@@ -202,7 +207,8 @@ int ctx_correct(int argc, char **argv)
 
   // Load path files
   for(i = 0; i < gpfiles->len; i++) {
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS,
+                      args.nthreads, &db_graph);
     gpath_reader_close(&gpfiles->b[i]);
   }
 
@@ -50,8 +50,8 @@ static inline void fetch_node_edges(const dBGraph *db_graph, dBNode node,
                                     Edges *dst)
 {
   size_t i, ncols = db_graph->num_edge_cols;
-  const Edges *edges = &db_node_edges(db_graph, node.key, 0);
-  memcpy(dst, edges, ncols * sizeof(Edges));
+  for(i = 0; i < ncols; i++)
+    dst[i] = db_node_get_edges(db_graph, node.key, i);
   if(node.orient == REVERSE) {
     for(i = 0; i < ncols; i++) {
       // dst[i] = rev_nibble_lookup(dst[i]>>4) | (rev_nibble_lookup(dst[i]&0xf)<<4);
@@ -109,7 +109,7 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
   covg_buf_capacity(covgbuf, ncols * klen);
   memset(covgbuf->b, 0, ncols * klen * sizeof(Covg));
 
-  if(db_graph->col_edges) {
+  if(db_graph_has_edges(db_graph)) {
     edges_buf_capacity(edgebuf, ncols * klen);
     memset(edgebuf->b, 0, ncols * klen * sizeof(Edges));
   }
@@ -119,7 +119,6 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
   BinaryKmer bkmer;
   Nucleotide nuc;
   dBNode node;
-  Covg *covgs;
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size, 0, 0)) < r->seq.end)
   {
@@ -134,9 +133,9 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
       bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
       node = db_graph_find(db_graph, bkmer);
       if(node.key != HASH_NOT_FOUND) {
-        covgs = &db_node_covg(db_graph, node.key, 0);
-        memcpy(covgbuf->b+i*ncols, covgs, ncols * sizeof(Covg));
-        if(db_graph->col_edges) {
+        for(col = 0; col < ncols; col++)
+          covgbuf->b[i*ncols+col] = db_node_get_covg(db_graph, node.key, col);
+        if(db_graph_has_edges(db_graph)) {
           fetch_node_edges(db_graph, node, edgebuf->b+i*ncols);
         }
       }
@@ -227,54 +226,63 @@ int ctx_coverage(int argc, char **argv)
   ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
                            &ctx_max_kmers, &ctx_sum_kmers);
 
-  //
-  // Decide on memory
-  //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
-
-  // kmer memory = kmer + (coverage + edges) per colour
-  bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + (print_edges ? sizeof(Edges) : 0)) * 8 * ncols;
-
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        memargs.mem_to_use_set, &graph_mem);
-
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
-
   //
   // Open output file
   //
   FILE *fout = futil_fopen_create(output_file ? output_file : "-", "w");
 
-  //
-  // Set up memory
-  //
-  size_t kmer_size = gfiles[0].hdr.kmer_size;
-
+  // A single sorted, indexed graph is searched in place rather than loaded
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, kmer_size, ncols, print_edges ? ncols : 0, kmers_in_hash,
-                 DBG_ALLOC_COVGS | (print_edges ? DBG_ALLOC_EDGES : 0));
+  bool graph_mmapped = (num_gfiles == 1 && db_graph_mmap(&db_graph, &gfiles[0]));
 
-  //
-  // Load graphs
-  //
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.empty_colours = true;
+  if(graph_mmapped) {
+    graph_file_close(&gfiles[0]);
+  }
+  else
+  {
+    //
+    // Decide on memory
+    //
+    size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+    // kmer memory = kmer + (coverage + edges) per colour
+    bits_per_kmer = sizeof(BinaryKmer)*8 +
+                    (sizeof(Covg) + (print_edges ? sizeof(Edges) : 0)) * 8 * ncols;
+
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_max_kmers, ctx_sum_kmers,
+                                          memargs.mem_to_use_set, &graph_mem);
+
+    cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+    //
+    // Set up memory
+    //
+    size_t kmer_size = gfiles[0].hdr.kmer_size;
+
+    db_graph_alloc(&db_graph, kmer_size, ncols, print_edges ? ncols : 0, kmers_in_hash,
+                   DBG_ALLOC_COVGS | (print_edges ? DBG_ALLOC_EDGES : 0));
+
+    //
+    // Load graphs
+    //
+    GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.empty_colours = true;
+
+    for(i = 0; i < num_gfiles; i++) {
+      graph_load(&gfiles[i], gprefs, NULL);
+      graph_file_close(&gfiles[i]);
+      gprefs.empty_colours = false;
+    }
 
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, NULL);
-    graph_file_close(&gfiles[i]);
-    gprefs.empty_colours = false;
+    hash_table_print_stats(&db_graph.ht);
   }
   ctx_free(gfiles);
 
-  hash_table_print_stats(&db_graph.ht);
-
   //
   // Load sequence
   //
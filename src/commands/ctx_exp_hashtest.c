@@ -4,6 +4,8 @@
 #include "db_graph.h"
 #include "binary_kmer.h"
 
+#include <sys/time.h> // gettimeofday()
+
 const char exp_hashtest_usage[] =
 "usage: "CMD" hashtest [options] <num_ops>\n"
 "\n"
@@ -15,6 +17,10 @@ const char exp_hashtest_usage[] =
 "  -t, --threads <T> Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -k, --kmer <K>    Kmer size must be odd ("QUOTE_VALUE(MAX_KMER_SIZE)" >= k >= "QUOTE_VALUE(MIN_KMER_SIZE)")\n"
 "  -F, --func-only   Only use the hash function, do not store kmers\n"
+"  -L, --lookup      Time lookups with each bucket scan method (scalar/SIMD)\n"
+"  -X, --lockfree    Insert with compare-and-swap instead of bucket locks\n"
+"  -H, --hash <H>    Hash used to pick buckets: rehash, wyhash or all [default: wyhash]\n"
+"                    `all` times each in turn and reports relative throughput\n"
 "\n";
 
 static struct option longopts[] =
@@ -27,12 +33,16 @@ static struct option longopts[] =
 // command specific
   {"kmer",         required_argument, NULL, 'k'},
   {"func-only",    no_argument,       NULL, 'F'},
+  {"lookup",       no_argument,       NULL, 'L'},
+  {"lockfree",     no_argument,       NULL, 'X'},
+  {"hash",         required_argument, NULL, 'H'},
   {NULL, 0, NULL, 0}
 };
 
 struct HashLoopJob {
   dBGraph *db_graph;
-  bool single_threaded;
+  HashTableHash hashfunc; // only used if db_graph is NULL
+  bool single_threaded, lookup;
   size_t start, end;
   size_t hash; // return value
 };
@@ -47,7 +57,12 @@ static inline void hash_loop(void *arg, size_t threadid)
   bool found;
   uint32_t hash = 0;
 
-  if(j.db_graph && j.single_threaded) {
+  if(j.db_graph && j.lookup) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      hash ^= hash_table_find(&j.db_graph->ht, bkmer);
+    }
+  } else if(j.db_graph && j.single_threaded) {
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
       hash_table_find_or_insert(&j.db_graph->ht, bkmer, &found);
@@ -58,6 +73,11 @@ static inline void hash_loop(void *arg, size_t threadid)
       hash_table_find_or_insert_mt(&j.db_graph->ht, bkmer, &found,
                                    j.db_graph->bktlocks);
     }
+  } else if(j.hashfunc == HT_HASH_WYHASH) {
+    for(i = j.start; i < j.end; i++) {
+      bkmer.b[0] = i;
+      hash ^= (uint32_t)binary_kmer_hash64(bkmer, 0);
+    }
   } else {
     for(i = j.start; i < j.end; i++) {
       bkmer.b[0] = i;
@@ -68,11 +88,69 @@ static inline void hash_loop(void *arg, size_t threadid)
   jptr->hash = hash;
 }
 
+static double wall_seconds()
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec / 1e6;
+}
+
+// Run `num_ops` hash operations split across threads, return hash of results
+static size_t run_hash_jobs(dBGraph *db_graph, size_t num_ops,
+                            size_t nthreads, bool single_threaded, bool lookup)
+{
+  HashTableHash hashfunc = hash_table_get_hash();
+  struct HashLoopJob jobs[nthreads];
+  size_t i, hash = 0;
+
+  for(i = 0; i < nthreads; i++) {
+    size_t start = i * (num_ops / nthreads);
+    size_t end = (i+1 == nthreads ? num_ops : start + (num_ops / nthreads));
+    jobs[i] = (struct HashLoopJob){.db_graph = db_graph,
+                                   .hashfunc = hashfunc,
+                                   .single_threaded = single_threaded,
+                                   .lookup = lookup,
+                                   .start = start, .end = end, .hash = 0};
+  }
+
+  util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+
+  for(i = 0; i < nthreads; i++) hash += jobs[i].hash;
+  return hash;
+}
+
+// Look up every kmer with each bucket scan method the CPU supports,
+// report lookups per second relative to the scalar scan
+static void time_lookups(dBGraph *db_graph, size_t num_ops, size_t nthreads)
+{
+  HashTableScan scan, best = hash_table_set_scan(HT_SCAN_AUTO);
+  double start, secs, rate, scalar_rate = 0;
+  char rate_str[50];
+  size_t hash;
+
+  for(scan = HT_SCAN_SCALAR; scan <= best; scan++) {
+    hash_table_set_scan(scan);
+    start = wall_seconds();
+    hash = run_hash_jobs(db_graph, num_ops, nthreads, false, true);
+    secs = wall_seconds() - start;
+    rate = secs > 0 ? num_ops / secs : 0;
+    if(scan == HT_SCAN_SCALAR) scalar_rate = rate;
+    num_to_str(rate, 2, rate_str);
+    status("[lookup] %-6s %s lookups/sec (%.2fx scalar) [%.2f secs; hash: %zu]",
+           hash_table_scan_str(scan), rate_str, safe_frac(rate, scalar_rate),
+           secs, hash);
+  }
+
+  hash_table_set_scan(best);
+}
+
 int ctx_exp_hashtest(int argc, char **argv)
 {
   size_t nthreads = 0, kmer_size = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool store_kmers = true;
+  bool store_kmers = true, time_lookup = false, lockfree = false;
+  bool all_hashes = false;
+  HashTableHash hashfunc = hash_table_get_hash();
 
   // Arg parsing
   char cmd[100], shortopts[100];
@@ -89,6 +167,13 @@ int ctx_exp_hashtest(int argc, char **argv)
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'k': cmd_check(!kmer_size,cmd); kmer_size = cmd_uint32_nonzero(cmd, optarg); break;
       case 'F': cmd_check(store_kmers,cmd); store_kmers = false; break;
+      case 'L': cmd_check(!time_lookup,cmd); time_lookup = true; break;
+      case 'X': cmd_check(!lockfree,cmd); lockfree = true; break;
+      case 'H':
+        if(strcasecmp(optarg,"all") == 0) all_hashes = true;
+        else if(!hash_table_hash_parse(optarg, &hashfunc))
+          cmd_print_usage("Unknown hash: %s", optarg);
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -110,7 +195,10 @@ int ctx_exp_hashtest(int argc, char **argv)
 
   if(optind+1 != argc) cmd_print_usage(NULL);
 
-  size_t i, num_ops;
+  if(time_lookup && !store_kmers)
+    cmd_print_usage("Cannot use --lookup with --func-only");
+
+  size_t num_ops;
   if(!parse_entire_size(argv[optind], &num_ops))
     cmd_print_usage("Invalid <num_ops>");
 
@@ -131,36 +219,50 @@ int ctx_exp_hashtest(int argc, char **argv)
                                           true, &graph_mem);
 
     cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
-
-    db_graph_alloc(&db_graph, kmer_size, 1, 0, kmers_in_hash, DBG_ALLOC_BKTLOCKS);
-    hash_table_print_stats(&db_graph.ht);
   }
 
-  status("[threads] using %zu thread%s (%s-threaded code)",
+  if(lockfree) hash_table_set_lockfree(true);
+
+  status("[threads] using %zu thread%s (%s-threaded code%s)",
          nthreads, util_plural_str(nthreads),
-         single_threaded ? "single" : "multi");
+         single_threaded ? "single" : "multi",
+         !single_threaded && hash_table_get_lockfree() ? ", lock-free" : "");
 
-  struct HashLoopJob jobs[nthreads];
-  size_t hash = 0;
+  // With --hash all, time each hash on a new table and compare with the first
+  size_t h, hstart = all_hashes ? 0 : hashfunc;
+  size_t hend = all_hashes ? HT_NUM_HASHES : hashfunc+1;
+  double start, secs, rate, first_rate = 0;
+  char rate_str[50];
 
-  for(i = 0; i < nthreads; i++) {
-    size_t start = i * (num_ops / nthreads);
-    size_t end = (i+1 == nthreads ? num_ops : start + (num_ops / nthreads));
-    jobs[i] = (struct HashLoopJob){.db_graph = store_kmers ? &db_graph : NULL,
-                                   .single_threaded = single_threaded,
-                                   .start = start, .end = end, .hash = 0};
-  }
+  for(h = hstart; h < hend; h++)
+  {
+    hash_table_set_hash((HashTableHash)h);
 
-  util_run_threads(jobs, nthreads, sizeof(jobs[0]), nthreads, hash_loop);
+    if(store_kmers) {
+      db_graph_alloc(&db_graph, kmer_size, 1, 0, kmers_in_hash, DBG_ALLOC_BKTLOCKS);
+      hash_table_print_stats(&db_graph.ht);
+    }
 
-  for(i = 0; i < nthreads; i++) hash += jobs[i].hash;
+    start = wall_seconds();
+    size_t hash = run_hash_jobs(store_kmers ? &db_graph : NULL, num_ops,
+                                nthreads, single_threaded, false);
+    secs = wall_seconds() - start;
+    rate = secs > 0 ? num_ops / secs : 0;
+    if(h == hstart) first_rate = rate;
 
-  if(store_kmers) {
-    hash_table_print_stats(&db_graph.ht);
-    db_graph_dealloc(&db_graph);
-  }
+    if(store_kmers) {
+      hash_table_print_stats(&db_graph.ht);
+      if(time_lookup) time_lookups(&db_graph, num_ops, nthreads);
+      db_graph_dealloc(&db_graph);
+    }
 
-  status("Output hash: %zu", hash);
+    num_to_str(rate, 2, rate_str);
+    status("[hash] %-6s %s %s/sec (%.2fx %s) [%.2f secs]",
+           hash_table_hash_str((HashTableHash)h), rate_str,
+           store_kmers ? "inserts" : "hashes", safe_frac(rate, first_rate),
+           hash_table_hash_str((HashTableHash)hstart), secs);
+    status("Output hash: %zu", hash);
+  }
 
   return EXIT_SUCCESS;
 }
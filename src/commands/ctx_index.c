@@ -5,6 +5,7 @@
 #include "file_util.h"
 #include "graphs_load.h"
 #include "binary_kmer.h"
+#include "graph_mmap.h"
 
 // TODO: add .ctp.gz indexing
 
@@ -12,6 +13,11 @@ const char index_usage[] =
 "usage: "CMD" index [options] <in.ctx>\n"
 "\n"
 "  Index a sorted cortex graph file (sort with `"CMD" sort` first).\n"
+"  `"CMD" server`, `"CMD" coverage` and `"CMD" reads` memory map a single graph\n"
+"  file instead of loading it, if it has an index saved as <in.ctx>.idx\n"
+"  With --mphf, also save a minimal perfect hash of the kmers. Kmers in a memory\n"
+"  mapped graph are then found in one or two lookups, if it is saved as\n"
+"  <in.ctx>.mphf\n"
 "\n"
 "  -h, --help               This help message\n"
 "  -q, --quiet              Silence status output normally printed to STDERR\n"
@@ -19,6 +25,8 @@ const char index_usage[] =
 "  -o, --out <out.ctx.idx>  Output file [default: STDOUT]\n"
 "  -s, --block-size <S>     Block of <S> bytes [default: 4MB]\n"
 "  -b, --block-kmers <B>    Block of <B> kmers\n"
+"  -M, --mphf <out.mphf>    Save minimal perfect hash of kmers\n"
+"  -t, --threads <T>        Threads to build --mphf with [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n";
 
 static struct option longopts[] =
@@ -28,13 +36,15 @@ static struct option longopts[] =
   {"out",          required_argument, NULL, 'o'},
   {"block-size",   required_argument, NULL, 's'},
   {"block-kmers",  required_argument, NULL, 'b'},
+  {"mphf",         required_argument, NULL, 'M'},
+  {"threads",      required_argument, NULL, 't'},
   {NULL, 0, NULL, 0}
 };
 
 int ctx_index(int argc, char **argv)
 {
-  const char *out_path = NULL;
-  size_t block_size = 0, block_kmers = 0;
+  const char *out_path = NULL, *mphf_path = NULL;
+  size_t block_size = 0, block_kmers = 0, nthreads = 0;
 
   // Arg parsing
   char cmd[100];
@@ -51,6 +61,8 @@ int ctx_index(int argc, char **argv)
       case 0: /* flag set */ break;
       case 'h': cmd_print_usage(NULL); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 'M': cmd_check(!mphf_path, cmd); mphf_path = optarg; break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'b':
         cmd_check(!block_kmers, cmd);
         block_kmers = cmd_size_nonzero(cmd, optarg);
@@ -73,6 +85,8 @@ int ctx_index(int argc, char **argv)
   if(block_size && block_kmers)
     cmd_print_usage("Cannot use --block-kmers and --block-size together");
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
   const char *ctx_path = argv[optind];
 
   //
@@ -85,8 +99,15 @@ int ctx_index(int argc, char **argv)
   if(!file_filter_is_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
-  // Open output file
+  if(graph_file_is_compressed(&gfile)) {
+    die("Cannot index a compressed graph, convert with `"CMD" view --format %i "
+        "--out <out.ctx> <in.ctx>` [path: %s]", CTX_GRAPH_FILEFORMAT,
+        file_filter_path(&gfile.fltr));
+  }
+
+  // Open output files
   FILE *fout = out_path ? futil_fopen_create(out_path, "w") : stdout;
+  if(mphf_path) futil_create_output(mphf_path);
 
   // Start
   size_t filencols = gfile.hdr.num_of_cols;
@@ -137,7 +158,7 @@ int ctx_index(int argc, char **argv)
       die("File is not sorted: %s [%s]", bkmerstr, path);
     // We've already read one kmer entry, read rest of block
     bl_bytes = kmer_mem + gfr_fread_bytes(&gfile, tmp_mem, rem_block);
-    bl_kmers = 1 + bl_bytes / kmer_mem;
+    bl_kmers = bl_bytes / kmer_mem;
     fprintf(fout, "%zu\t%zu\t%s\t%zu\t%zu\n",
             bl_byte_offset, bl_byte_offset+bl_bytes, bkmerstr,
             bl_kmer_offset, bl_kmer_offset+bl_kmers);
@@ -170,6 +191,8 @@ int ctx_index(int argc, char **argv)
 
   if(fout != stdout) status("Saved to %s", out_path);
 
+  if(mphf_path) graph_mmap_save_mphf(&gfile, mphf_path, nthreads);
+
   graph_file_close(&gfile);
   fclose(fout);
 
@@ -122,8 +122,10 @@ static size_t inferedges_on_file(const dBGraph *db_graph, bool add_all_edges,
 
   status("[inferedges] Processing file: %s", file_filter_path(&file->fltr));
 
-  // Print header
-  graph_write_header(fout, &file->hdr);
+  // Print header, kmers are written as fixed width records
+  GraphFileHeader outhdr = file->hdr;
+  if(graph_file_is_compressed(file)) outhdr.version = CTX_GRAPH_FILEFORMAT;
+  graph_write_header(fout, &outhdr);
 
   // Read the input file again
   if(graph_file_fseek(file, file->hdr_size, SEEK_SET) != 0)
@@ -224,6 +226,9 @@ int ctx_infer_edges(int argc, char **argv)
   if(!file_filter_is_direct(&file.fltr))
     cmd_print_usage("Inferedges with filter not implemented - sorry");
 
+  if(editing_file && graph_file_is_compressed(&file))
+    cmd_print_usage("Cannot edit a compressed graph in place, please use --out");
+
   FILE *fout = NULL;
 
   // Editing input file or writing a new file
@@ -290,7 +295,9 @@ int ctx_infer_edges(int argc, char **argv)
     // Reading STDIN, writing STDOUT/file
     ctx_assert(fout != NULL);
     num_kmers_edited = infer_edges(num_of_threads, add_all_edges, &db_graph);
-    graph_write_header(fout, &file.hdr);
+    GraphFileHeader outhdr = file.hdr;
+    if(graph_file_is_compressed(&file)) outhdr.version = CTX_GRAPH_FILEFORMAT;
+    graph_write_header(fout, &outhdr);
     graph_write_all_kmers(fout, &db_graph);
   }
   else if(fout == NULL) {
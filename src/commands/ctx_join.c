@@ -33,6 +33,10 @@ const char join_usage[] =
 "  -i, --intersect <a.ctx> Only load the kmers that are in graph A.ctx. Can be\n"
 "                          specified multiple times. <a.ctx> is NOT merged into\n"
 "                          the output file.\n"
+"  -s, --sparse            Load all colours at once, storing the colours and\n"
+"                          edges of each kmer as a shared list. Uses much less\n"
+"                          memory with many samples. Edges are kept but\n"
+"                          coverages are NOT: they are saved as 0 or 1.\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctx:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctx\n"
@@ -49,14 +53,15 @@ static struct option longopts[] =
 // command specific
   {"ncols",        required_argument, NULL, 'N'},
   {"intersect",    required_argument, NULL, 'i'},
+  {"sparse",       no_argument,       NULL, 's'},
   {NULL, 0, NULL, 0}
 };
 
-static inline void remove_non_intersect_nodes(hkey_t node, Covg *covgs,
-                                              Covg num, HashTable *ht)
+static inline void remove_non_intersect_nodes(hkey_t node, dBGraph *db_graph,
+                                              Covg num)
 {
-  if(covgs[node] != num)
-    hash_table_delete(ht, node);
+  if(db_node_get_covg(db_graph, node, 0) != num)
+    hash_table_delete(&db_graph->ht, node);
 }
 
 int ctx_join(int argc, char **argv)
@@ -64,6 +69,7 @@ int ctx_join(int argc, char **argv)
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_path = NULL;
   size_t use_ncols = 0;
+  bool sparse_cols = false;
 
   GraphFileReader tmp_gfile;
   GraphFileBuffer isec_gfiles_buf;
@@ -84,6 +90,7 @@ int ctx_join(int argc, char **argv)
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'N': cmd_check(!use_ncols, cmd); use_ncols = cmd_uint32_nonzero(cmd, optarg); break;
+      case 's': cmd_check(!sparse_cols, cmd); sparse_cols = true; break;
       case 'i':
         graph_file_reset(&tmp_gfile);
         graph_file_open(&tmp_gfile, optarg);
@@ -108,6 +115,11 @@ int ctx_join(int argc, char **argv)
   if(optind >= argc)
     cmd_print_usage("Please specify at least one input graph file");
 
+  if(sparse_cols && num_igfiles > 0)
+    cmd_print_usage("Cannot use --sparse with --intersect");
+  if(sparse_cols && use_ncols > 0)
+    cmd_print_usage("--sparse loads all colours at once, cannot use --ncols");
+
   // optind .. argend-1 are graphs to load
   size_t num_gfiles = (size_t)(argc - optind);
   char **gfile_paths = argv + optind;
@@ -165,7 +177,10 @@ int ctx_join(int argc, char **argv)
   bool output_to_stdout = (strcmp(out_path,"-") == 0);
 
   // if(use_ncols == 0) use_ncols = 1;
-  if(use_ncols_set) {
+  if(sparse_cols) {
+    use_ncols = ctx_max_cols;
+  }
+  else if(use_ncols_set) {
     if(use_ncols < ctx_max_cols && output_to_stdout)
       die("I need %zu colours if outputting to STDOUT (--ncols)", ctx_max_cols);
     if(use_ncols > ctx_max_cols) {
@@ -209,8 +224,13 @@ int ctx_join(int argc, char **argv)
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
-  bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols;
+  // Sparse: one edge colour and a colour set id per kmer. Colour lists are
+  // shared between kmers, we set aside a word per kmer for them.
+  if(sparse_cols)
+    bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Edges)*8 + sizeof(uint32_t)*8*2;
+  else
+    bits_per_kmer = sizeof(BinaryKmer)*8 +
+                    (db_graph_covg_size() + sizeof(Edges)) * 8 * use_ncols;
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -220,14 +240,14 @@ int ctx_join(int argc, char **argv)
                                         ctx_max_kmers, ctx_sum_kmers,
                                         true, &graph_mem);
 
-  if(!use_ncols_set)
+  if(!use_ncols_set && !sparse_cols)
   {
     // Maximise use_ncols
     size_t max_usencols = (memargs.mem_to_use*8) / bits_per_kmer;
 
     use_ncols = MIN2(max_usencols, ctx_max_cols);
     bits_per_kmer = sizeof(BinaryKmer)*8 +
-                    (sizeof(Covg) + sizeof(Edges)) * 8 * use_ncols;
+                    (db_graph_covg_size() + sizeof(Edges)) * 8 * use_ncols;
 
     // Re-check memory used
     kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
@@ -241,18 +261,38 @@ int ctx_join(int argc, char **argv)
 
   status("Using %zu colour%s in memory", use_ncols, util_plural_str(use_ncols));
 
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  // Colour lists can use the word per kmer and any memory left over
+  size_t colset_mem = 0;
+  if(sparse_cols) {
+    colset_mem = kmers_in_hash * sizeof(uint32_t);
+    graph_mem -= colset_mem;
+    if(memargs.mem_to_use > graph_mem + colset_mem)
+      colset_mem = memargs.mem_to_use - graph_mem;
+    colset_mem = MAX2(colset_mem, colour_sets_min_mem());
+    cmd_print_mem(colset_mem, "colour sets");
+  }
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + colset_mem);
 
   // Create db_graph
   dBGraph db_graph;
   Edges *intersect_edges = NULL;
   size_t edge_cols = (use_ncols + take_intersect);
 
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, use_ncols, use_ncols,
-                 kmers_in_hash, DBG_ALLOC_COVGS);
+  if(sparse_cols) {
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, use_ncols, 1,
+                   kmers_in_hash, DBG_ALLOC_EDGES | DBG_ALLOC_COL_SETS);
+    colour_sets_limit_mem(db_graph.col_sets, colset_mem);
+    status("--sparse: coverages are saved as 0 or 1");
+  }
+  else {
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, use_ncols, use_ncols,
+                   kmers_in_hash, DBG_ALLOC_COVGS);
 
-  // We allocate edges ourself since it's a special case
-  db_graph.col_edges = ctx_calloc(db_graph.ht.capacity*edge_cols, sizeof(Edges));
+    // We allocate edges ourself since it's a special case
+    db_graph.col_edges = ctx_large_alloc(db_graph.ht.capacity*edge_cols,
+                                         sizeof(Edges), NULL);
+  }
 
   // Load intersection binaries
   char *intsct_gname_ptr = NULL;
@@ -280,7 +320,7 @@ int ctx_join(int argc, char **argv)
     {
       // Remove nodes where covg != num_igfiles
       HASH_ITERATE_SAFE(&db_graph.ht, remove_non_intersect_nodes,
-                        db_graph.col_covgs, (Covg)num_igfiles, &db_graph.ht);
+                        &db_graph, (Covg)num_igfiles);
     }
 
     status("Loaded intersection set\n");
@@ -293,7 +333,7 @@ int ctx_join(int argc, char **argv)
       graph_info_init(&db_graph.ginfo[i]);
 
     // Zero covgs
-    memset(db_graph.col_covgs, 0, db_graph.ht.capacity * sizeof(Covg));
+    db_graph_zero_covgs(&db_graph);
 
     // Use union edges we loaded to intersect new edges
     intersect_edges = db_graph.col_edges;
@@ -309,6 +349,13 @@ int ctx_join(int argc, char **argv)
   if(take_intersect)
     db_graph.col_edges -= db_graph.ht.capacity;
 
+  if(sparse_cols) {
+    char nsets_str[50], mem_str[50];
+    ulong_to_str(colour_sets_num(db_graph.col_sets), nsets_str);
+    bytes_to_str(colour_sets_dict_mem(db_graph.col_sets), 1, mem_str);
+    status("Stored %s distinct colour sets [%s]", nsets_str, mem_str);
+  }
+
   for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
 
   strbuf_dealloc(&intersect_gname);
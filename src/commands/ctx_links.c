@@ -10,9 +10,17 @@
 
 #include "carrays/carrays.h" // gca_median_size()
 
+#include <pthread.h>
+
 #define DEFAULT_MAX_DIST 6
 #define DEFAULT_MAX_COVG 100
 
+// Read kmers in blocks of up to LINKS_BLOCK_KMERS kmers or LINKS_BLOCK_BYTES
+// bytes of links. LINKS_BLOCKS_PER_THREAD blocks per thread are in use at once.
+#define LINKS_BLOCK_KMERS 1024
+#define LINKS_BLOCK_BYTES ONE_MEGABYTE
+#define LINKS_BLOCKS_PER_THREAD 4
+
 const char links_usage[] =
 "usage: "CMD" links [options] <in.ctp.gz>\n"
 "\n"
@@ -23,6 +31,7 @@ const char links_usage[] =
 "  -q,--quiet              Silence status output normally printed to STDERR\n"
 "  -f,--force              Overwrite output files\n"
 "  -o,--out <out.ctp.gz>   Save output link file [default: STDOUT]\n"
+"  -t,--threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n"
 "  -L,--limit <N>          Only use links from first N kmers\n"
 "\n"
@@ -42,6 +51,7 @@ static struct option longopts[] =
   {"help",         no_argument,       NULL, 'h'},
   {"out",          required_argument, NULL, 'o'},
   {"force",        no_argument,       NULL, 'f'},
+  {"threads",      required_argument, NULL, 't'},
 // command specific
   {"list",         required_argument, NULL, 'l'},
   {"clean",        required_argument, NULL, 'c'},
@@ -114,9 +124,362 @@ static void print_suggest_cutoff(size_t hist_distsize, size_t hist_covgsize,
     warn("Threshold failed in %zu cases [default to 0]", nthresh_failed);
 }
 
+//
+// Pipeline: a reader thread splits the input into blocks of kmers with their
+// links, worker threads each build a LinkTree for every kmer in a block, and a
+// writer thread writes the output of blocks in the order they were read.
+// A fixed number of blocks are in use, so memory stays low.
+//
+
+enum LinksBlockState { LINKS_BLOCK_EMPTY, LINKS_BLOCK_FULL, LINKS_BLOCK_DONE };
+
+typedef struct
+{
+  size_t first_knum, nkmers;
+  StrBuf txt; // kmers, junctions and sequences, each NUL terminated
+  // per kmer: <kmer,nlinks,nlinks_exp> per link: <fw,covg,juncs,seq,juncpos>
+  // kmer, juncs and seq are offsets into txt, juncpos an offset into jpos
+  SizeBuffer vals, jpos;
+  StrBuf ctp, list, dot; // output
+  enum LinksBlockState state;
+} LinksBlock;
+
+typedef struct
+{
+  LinkTree ltree;
+  LinkTreeStats stats;
+  uint64_t *hists; // [hist_distsize][hist_covgsize]
+} LinksWorker;
+
+typedef struct
+{
+  GPathReader *ctpin;
+  size_t kmer_size, limit, plot_kmer_idx, cutoff;
+  size_t hist_distsize, hist_covgsize;
+  bool clean, hist_covg;
+  FILE *list_fh, *plot_fh, *link_tmp_fh;
+  const char *csv_out_path, *plot_out_path, *link_tmp_path;
+  LinksBlock *blocks;
+  size_t nblocks;
+  LinksWorker *workers; // one per thread
+  // Blocks read and blocks taken by workers, guarded by lock
+  size_t num_read, num_taken;
+  bool done_reading;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} LinksPipeline;
+
+#define links_block_get(pl,id) (&(pl)->blocks[(id) % (pl)->nblocks])
+
+// Wait for block to reach state `state`
+static void links_block_wait(LinksPipeline *pl, LinksBlock *blk,
+                             enum LinksBlockState state)
+{
+  pthread_mutex_lock(&pl->lock);
+  while(blk->state != state) pthread_cond_wait(&pl->cond, &pl->lock);
+  pthread_mutex_unlock(&pl->lock);
+}
+
+static void links_block_set(LinksPipeline *pl, LinksBlock *blk,
+                            enum LinksBlockState state)
+{
+  pthread_mutex_lock(&pl->lock);
+  blk->state = state;
+  if(state == LINKS_BLOCK_FULL) pl->num_read++;
+  pthread_cond_broadcast(&pl->cond);
+  pthread_mutex_unlock(&pl->lock);
+}
+
+// Read up to LINKS_BLOCK_KMERS kmers into a block
+// Returns false if we hit the end of the file or limit
+static bool links_read_block(LinksPipeline *pl, LinksBlock *blk, size_t *knum,
+                             StrBuf *kmerbuf, SizeBuffer *countbuf,
+                             StrBuf *juncsbuf, StrBuf *seqbuf,
+                             SizeBuffer *jposbuf)
+{
+  size_t nlinks, num_links_exp, njuncs, kidx;
+  bool link_fw;
+
+  blk->first_knum = *knum;
+  blk->nkmers = 0;
+  strbuf_reset(&blk->txt);
+  size_buf_reset(&blk->vals);
+  size_buf_reset(&blk->jpos);
+
+  while(blk->nkmers < LINKS_BLOCK_KMERS && blk->txt.end < LINKS_BLOCK_BYTES)
+  {
+    if(pl->limit && *knum >= pl->limit) return false;
+    if(!gpath_reader_read_kmer(pl->ctpin, kmerbuf, &num_links_exp)) return false;
+    ctx_assert2(kmerbuf->end == pl->kmer_size, "Kmer incorrect length %zu != %zu",
+                kmerbuf->end, pl->kmer_size);
+
+    kidx = blk->vals.len;
+    size_buf_add(&blk->vals, blk->txt.end);
+    size_buf_add(&blk->vals, 0);
+    size_buf_add(&blk->vals, num_links_exp);
+    strbuf_append_strn(&blk->txt, kmerbuf->b, kmerbuf->end+1);
+
+    for(nlinks = 0;
+        gpath_reader_read_link(pl->ctpin, &link_fw, &njuncs,
+                               countbuf, juncsbuf,
+                               seqbuf, jposbuf);
+        nlinks++)
+    {
+      size_buf_add(&blk->vals, link_fw);
+      size_buf_add(&blk->vals, countbuf->b[0]);
+      size_buf_add(&blk->vals, blk->txt.end);
+      strbuf_append_strn(&blk->txt, juncsbuf->b, juncsbuf->end+1);
+      size_buf_add(&blk->vals, blk->txt.end);
+      strbuf_append_strn(&blk->txt, seqbuf->b, seqbuf->end+1);
+      size_buf_add(&blk->vals, blk->jpos.len);
+      size_buf_push(&blk->jpos, jposbuf->b, jposbuf->len);
+    }
+
+    blk->vals.b[kidx+1] = nlinks;
+    blk->nkmers++;
+    (*knum)++;
+  }
+
+  return true;
+}
+
+static void* links_reader(void *arg)
+{
+  LinksPipeline *pl = (LinksPipeline*)arg;
+  LinksBlock *blk;
+  size_t id, knum = 0;
+  bool more = true;
+
+  SizeBuffer countbuf, jposbuf;
+  size_buf_alloc(&countbuf, 16);
+  size_buf_alloc(&jposbuf, 1024);
+
+  StrBuf kmerbuf, juncsbuf, seqbuf;
+  strbuf_alloc(&kmerbuf, 1024);
+  strbuf_alloc(&juncsbuf, 1024);
+  strbuf_alloc(&seqbuf, 1024);
+
+  for(id = 0; more; id++)
+  {
+    blk = links_block_get(pl, id);
+    links_block_wait(pl, blk, LINKS_BLOCK_EMPTY);
+    more = links_read_block(pl, blk, &knum, &kmerbuf, &countbuf,
+                            &juncsbuf, &seqbuf, &jposbuf);
+    if(blk->nkmers == 0) break;
+    links_block_set(pl, blk, LINKS_BLOCK_FULL);
+  }
+
+  pthread_mutex_lock(&pl->lock);
+  pl->done_reading = true;
+  pthread_cond_broadcast(&pl->cond);
+  pthread_mutex_unlock(&pl->lock);
+
+  size_buf_dealloc(&countbuf);
+  size_buf_dealloc(&jposbuf);
+  strbuf_dealloc(&kmerbuf);
+  strbuf_dealloc(&juncsbuf);
+  strbuf_dealloc(&seqbuf);
+
+  return NULL;
+}
+
+// Build, clean and write the LinkTree of each kmer in a block
+static void links_process_block(LinksPipeline *pl, LinksBlock *blk,
+                                LinksWorker *wrkr)
+{
+  LinkTree *ltree = &wrkr->ltree;
+  const size_t *vals = blk->vals.b;
+  size_t k, l, nlinks, num_links_exp, num_links, init_num_links;
+  const char *kmer;
+  bool link_fw;
+  size_t covg, *jpos;
+  const char *juncs, *seq;
+
+  strbuf_reset(&blk->ctp);
+  strbuf_reset(&blk->list);
+  strbuf_reset(&blk->dot);
+
+  for(k = 0; k < blk->nkmers; k++)
+  {
+    ltree_reset(ltree);
+    kmer = blk->txt.b + *(vals++);
+    nlinks = *(vals++);
+    num_links_exp = *(vals++);
+
+    for(l = 0; l < nlinks; l++, vals += 5)
+    {
+      link_fw = vals[0];
+      covg = vals[1];
+      juncs = blk->txt.b + vals[2];
+      seq = blk->txt.b + vals[3];
+      jpos = blk->jpos.b + vals[4];
+      ltree_add(ltree, link_fw, covg, jpos, juncs, seq);
+    }
+
+    if(nlinks != num_links_exp)
+      warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
+
+    if(pl->hist_covg)
+    {
+      ltree_update_covg_hists(ltree, wrkr->hists,
+                              pl->hist_distsize, pl->hist_covgsize);
+    }
+    if(pl->clean)
+    {
+      ltree_clean(ltree, pl->cutoff);
+    }
+
+    // Accumulate statistics
+    init_num_links = wrkr->stats.num_links;
+    ltree_get_stats(ltree, &wrkr->stats);
+    num_links = wrkr->stats.num_links - init_num_links;
+
+    if(pl->list_fh)
+    {
+      ltree_write_list(ltree, &blk->list);
+    }
+    if(pl->link_tmp_fh && num_links)
+    {
+      ltree_write_ctp(ltree, kmer, num_links, &blk->ctp);
+    }
+    if(pl->plot_fh && blk->first_knum + k == pl->plot_kmer_idx)
+    {
+      status("Plotting tree...");
+      ltree_write_dot(ltree, &blk->dot);
+    }
+  }
+}
+
+static void links_worker(void *arg, size_t threadid)
+{
+  LinksPipeline *pl = (LinksPipeline*)arg;
+  LinksBlock *blk;
+
+  pthread_mutex_lock(&pl->lock);
+  while(1)
+  {
+    while(pl->num_taken == pl->num_read && !pl->done_reading)
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    if(pl->num_taken == pl->num_read) break;
+
+    blk = links_block_get(pl, pl->num_taken++);
+    pthread_mutex_unlock(&pl->lock);
+
+    links_process_block(pl, blk, &pl->workers[threadid]);
+
+    pthread_mutex_lock(&pl->lock);
+    blk->state = LINKS_BLOCK_DONE;
+    pthread_cond_broadcast(&pl->cond);
+  }
+  pthread_mutex_unlock(&pl->lock);
+}
+
+static void links_write_buf(const StrBuf *sbuf, FILE *fh, const char *path)
+{
+  if(sbuf->end && fwrite(sbuf->b, 1, sbuf->end, fh) != sbuf->end)
+    die("Cannot write to file: %s", path);
+}
+
+// Write output of blocks in the order they were read
+static void* links_writer(void *arg)
+{
+  LinksPipeline *pl = (LinksPipeline*)arg;
+  LinksBlock *blk;
+  size_t id;
+  bool done;
+
+  for(id = 0; ; id++)
+  {
+    blk = links_block_get(pl, id);
+
+    pthread_mutex_lock(&pl->lock);
+    while(blk->state != LINKS_BLOCK_DONE && !(pl->done_reading && id == pl->num_read))
+      pthread_cond_wait(&pl->cond, &pl->lock);
+    done = (blk->state != LINKS_BLOCK_DONE);
+    pthread_mutex_unlock(&pl->lock);
+
+    if(done) break;
+
+    if(pl->list_fh) links_write_buf(&blk->list, pl->list_fh, pl->csv_out_path);
+    if(pl->link_tmp_fh) links_write_buf(&blk->ctp, pl->link_tmp_fh, pl->link_tmp_path);
+    if(pl->plot_fh) links_write_buf(&blk->dot, pl->plot_fh, pl->plot_out_path);
+
+    links_block_set(pl, blk, LINKS_BLOCK_EMPTY);
+  }
+
+  return NULL;
+}
+
+// Process all links with `nthreads` worker threads
+// Sums stats and histograms over all threads
+static void links_run_pipeline(LinksPipeline *pl, size_t nthreads,
+                               LinkTreeStats *stats, uint64_t *hists)
+{
+  size_t i, j, histsize = pl->hist_distsize * pl->hist_covgsize;
+  pthread_t reader, writer;
+  int rc;
+
+  pl->nblocks = nthreads * LINKS_BLOCKS_PER_THREAD;
+  pl->blocks = ctx_calloc(pl->nblocks, sizeof(LinksBlock));
+  for(i = 0; i < pl->nblocks; i++) {
+    strbuf_alloc(&pl->blocks[i].txt, 1024);
+    size_buf_alloc(&pl->blocks[i].vals, 1024);
+    size_buf_alloc(&pl->blocks[i].jpos, 1024);
+    strbuf_alloc(&pl->blocks[i].ctp, 1024);
+    strbuf_alloc(&pl->blocks[i].list, 1024);
+    strbuf_alloc(&pl->blocks[i].dot, 1024);
+    pl->blocks[i].state = LINKS_BLOCK_EMPTY;
+  }
+
+  pl->workers = ctx_calloc(nthreads, sizeof(LinksWorker));
+  for(i = 0; i < nthreads; i++) {
+    ltree_alloc(&pl->workers[i].ltree, pl->kmer_size);
+    if(pl->hist_covg) pl->workers[i].hists = ctx_calloc(histsize, sizeof(uint64_t));
+  }
+
+  pl->num_read = pl->num_taken = 0;
+  pl->done_reading = false;
+  pthread_mutex_init(&pl->lock, NULL);
+  pthread_cond_init(&pl->cond, NULL);
+
+  if((rc = pthread_create(&reader, NULL, links_reader, pl)) != 0 ||
+     (rc = pthread_create(&writer, NULL, links_writer, pl)) != 0)
+    die("Creating thread failed: %s", strerror(rc));
+
+  util_multi_thread(pl, nthreads, links_worker);
+
+  if((rc = pthread_join(reader, NULL)) != 0 ||
+     (rc = pthread_join(writer, NULL)) != 0)
+    die("Joining thread failed: %s", strerror(rc));
+
+  pthread_mutex_destroy(&pl->lock);
+  pthread_cond_destroy(&pl->cond);
+
+  for(i = 0; i < nthreads; i++) {
+    LinksWorker *wrkr = &pl->workers[i];
+    stats->num_trees_with_links += wrkr->stats.num_trees_with_links;
+    stats->num_links += wrkr->stats.num_links;
+    stats->num_link_bytes += wrkr->stats.num_link_bytes;
+    for(j = 0; wrkr->hists && j < histsize; j++) hists[j] += wrkr->hists[j];
+    ltree_dealloc(&wrkr->ltree);
+    ctx_free(wrkr->hists);
+  }
+  ctx_free(pl->workers);
+
+  for(i = 0; i < pl->nblocks; i++) {
+    strbuf_dealloc(&pl->blocks[i].txt);
+    size_buf_dealloc(&pl->blocks[i].vals);
+    size_buf_dealloc(&pl->blocks[i].jpos);
+    strbuf_dealloc(&pl->blocks[i].ctp);
+    strbuf_dealloc(&pl->blocks[i].list);
+    strbuf_dealloc(&pl->blocks[i].dot);
+  }
+  ctx_free(pl->blocks);
+}
+
 int ctx_links(int argc, char **argv)
 {
-  size_t limit = 0;
+  size_t limit = 0, nthreads = 0;
   const char *link_out_path = NULL, *csv_out_path = NULL, *plot_out_path = NULL;
   const char *thresh_path = NULL, *hist_path = NULL;
 
@@ -137,6 +500,7 @@ int ctx_links(int argc, char **argv)
       case 'h': cmd_print_usage(NULL); break;
       case 'o': cmd_check(!link_out_path, cmd); link_out_path = optarg; break;
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'l': cmd_check(!csv_out_path, cmd); csv_out_path = optarg; break;
       case 'c': cmd_check(!cutoff, cmd); cutoff = cmd_size(cmd, optarg); clean = true; break;
       case 'L': cmd_check(!limit, cmd); limit = cmd_size(cmd, optarg); break;
@@ -157,6 +521,7 @@ int ctx_links(int argc, char **argv)
   if(hist_covgsize && !hist_path) cmd_print_usage("--max-covg without --covg-hist");
 
   // Defaults
+  if(!nthreads) nthreads = DEFAULT_NTHREADS;
   if(!hist_distsize) hist_distsize = DEFAULT_MAX_DIST;
   if(!hist_covgsize) hist_covgsize = DEFAULT_MAX_COVG;
 
@@ -271,86 +636,24 @@ int ctx_links(int argc, char **argv)
       die("Cannot open output .dot file %s", plot_out_path);
   }
 
-  SizeBuffer countbuf, jposbuf;
-  size_buf_alloc(&countbuf, 16);
-  size_buf_alloc(&jposbuf, 1024);
-
-  StrBuf kmerbuf, juncsbuf, seqbuf, outbuf;
-  strbuf_alloc(&kmerbuf, 1024);
-  strbuf_alloc(&juncsbuf, 1024);
-  strbuf_alloc(&seqbuf, 1024);
-  strbuf_alloc(&outbuf, 1024);
-
-  bool link_fw;
-  size_t njuncs;
-  size_t knum, nlinks, num_links_exp = 0;
-
-  LinkTree ltree;
-  ltree_alloc(&ltree, kmer_size);
-
   LinkTreeStats tree_stats;
   memset(&tree_stats, 0, sizeof(tree_stats));
-  size_t init_num_links = 0, num_links = 0;
-
-  for(knum = 0; !limit || knum < limit; knum++)
-  {
-    ltree_reset(&ltree);
-    if(!gpath_reader_read_kmer(&ctpin, &kmerbuf, &num_links_exp)) break;
-    ctx_assert2(kmerbuf.end == kmer_size, "Kmer incorrect length %zu != %zu",
-                kmerbuf.end, kmer_size);
-    // status("kmer: %s", kmerbuf.b);
-
-    for(nlinks = 0;
-        gpath_reader_read_link(&ctpin, &link_fw, &njuncs,
-                               &countbuf, &juncsbuf,
-                               &seqbuf, &jposbuf);
-        nlinks++)
-    {
-      ltree_add(&ltree, link_fw, countbuf.b[0], jposbuf.b,
-                juncsbuf.b, seqbuf.b);
-    }
-
-    if(nlinks != num_links_exp)
-      warn("Links count mismatch %zu != %zu", nlinks, num_links_exp);
 
-    if(hist_covg)
-    {
-      ltree_update_covg_hists(&ltree, (uint64_t*)hists,
-                              hist_distsize, hist_covgsize);
-    }
-    if(clean)
-    {
-      ltree_clean(&ltree, cutoff);
-    }
+  status("Processing links with %zu thread%s", nthreads, util_plural_str(nthreads));
 
-    // Accumulate statistics
-    ltree_get_stats(&ltree, &tree_stats);
-    num_links = tree_stats.num_links - init_num_links;
-    init_num_links = tree_stats.num_links;
+  LinksPipeline pipeline = {.ctpin = &ctpin, .kmer_size = kmer_size,
+                            .limit = limit, .plot_kmer_idx = plot_kmer_idx,
+                            .cutoff = cutoff, .clean = clean,
+                            .hist_covg = hist_covg,
+                            .hist_distsize = hist_distsize,
+                            .hist_covgsize = hist_covgsize,
+                            .list_fh = list_fh, .plot_fh = plot_fh,
+                            .link_tmp_fh = link_tmp_fh,
+                            .csv_out_path = csv_out_path,
+                            .plot_out_path = plot_out_path,
+                            .link_tmp_path = link_tmp_path.b};
 
-    if(list)
-    {
-      ltree_write_list(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, list_fh) != outbuf.end)
-        die("Cannot write CSV file to: %s", csv_out_path);
-      strbuf_reset(&outbuf);
-    }
-    if(save && num_links)
-    {
-      ltree_write_ctp(&ltree, kmerbuf.b, num_links, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, link_tmp_fh) != outbuf.end)
-        die("Cannot write ctp file to: %s", link_tmp_path.b);
-      strbuf_reset(&outbuf);
-    }
-    if(plot && knum == plot_kmer_idx)
-    {
-      status("Plotting tree...");
-      ltree_write_dot(&ltree, &outbuf);
-      if(fwrite(outbuf.b, 1, outbuf.end, plot_fh) != outbuf.end)
-        die("Cannot write plot DOT file to: %s", plot_out_path);
-      strbuf_reset(&outbuf);
-    }
-  }
+  links_run_pipeline(&pipeline, nthreads, &tree_stats, (uint64_t*)hists);
 
   gpath_reader_close(&ctpin);
 
@@ -429,13 +732,6 @@ int ctx_links(int argc, char **argv)
   ctx_free(hists);
   cJSON_Delete(newhdr);
   strbuf_dealloc(&link_tmp_path);
-  ltree_dealloc(&ltree);
-  size_buf_dealloc(&countbuf);
-  size_buf_dealloc(&jposbuf);
-  strbuf_dealloc(&kmerbuf);
-  strbuf_dealloc(&juncsbuf);
-  strbuf_dealloc(&seqbuf);
-  strbuf_dealloc(&outbuf);
 
   return EXIT_SUCCESS;
 }
@@ -24,9 +24,11 @@ const char pjoin_usage[] =
 "  -g, --graph <in.ctx>   Get number of hash table entries from graph file\n"
 "  -c, --outcols <C>      How many 'colours' should the output file have\n"
 "  -r, --noredundant      Remove redundant paths\n"
+"  -b, --binary           Write binary link file (indexed, loads without parsing)\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctp:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctp\n"
+"  Input files may be text or binary link files.\n"
 "\n";
 
 static struct option longopts[] =
@@ -42,6 +44,7 @@ static struct option longopts[] =
   {"graph",        required_argument, NULL, 'g'},
   {"outcols",      required_argument, NULL, 'c'},
   {"noredundant",  required_argument, NULL, 'r'},
+  {"binary",       no_argument,       NULL, 'b'},
   {NULL, 0, NULL, 0}
 };
 
@@ -49,7 +52,7 @@ int ctx_pjoin(int argc, char **argv)
 {
   size_t nthreads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool noredundant = false;
+  bool noredundant = false, binary_out = false;
   size_t output_ncols = 0;
   char *graph_file = NULL;
   const char *out_ctp_path = NULL;
@@ -76,6 +79,7 @@ int ctx_pjoin(int argc, char **argv)
       case 'g': cmd_check(!graph_file,cmd); graph_file = optarg; break;
       case 'c': cmd_check(!output_ncols, cmd); output_ncols = cmd_uint32_nonzero(cmd, optarg); break;
       case 'r': cmd_check(!noredundant,cmd); noredundant = true; break;
+      case 'b': cmd_check(!binary_out,cmd); binary_out = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -89,6 +93,8 @@ int ctx_pjoin(int argc, char **argv)
 
   if(out_ctp_path == NULL) cmd_print_usage("--out <out.ctp> required");
   if(optind >= argc) cmd_print_usage("Please specify at least one input file");
+  if(binary_out && strcmp(out_ctp_path,"-") == 0)
+    cmd_print_usage("Cannot write binary (--binary) output to STDOUT");
 
   // argi .. argend-1 are graphs to load
   size_t num_pfiles = (size_t)(argc - optind);
@@ -184,12 +190,13 @@ int ctx_pjoin(int argc, char **argv)
   cmd_check_mem_limit(memargs.mem_to_use, total_mem);
 
   // Open output file
-  gzFile gzout = futil_gzopen_create(out_ctp_path, "w");
+  FILE *fout = futil_fopen_create(out_ctp_path, "w");
 
   // Set up graph and PathStore
   size_t kmer_size = gpath_reader_get_kmer_size(&pfiles[0]);
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, kmers_in_hash, 0);
+  db_graph_alloc(&db_graph, kmer_size, output_ncols, 0, kmers_in_hash,
+                 DBG_ALLOC_BKTLOCKS);
 
   // Create a path store that tracks path counts
   gpath_reader_alloc_gpstore(pfiles, num_pfiles,
@@ -216,27 +223,30 @@ int ctx_pjoin(int argc, char **argv)
 
   // Load path files
   for(i = 0; i < num_pfiles; i++)
-    gpath_reader_load(&pfiles[i], GPATH_ADD_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&pfiles[i], GPATH_ADD_MISSING_KMERS, nthreads, &db_graph);
 
   status("Got %zu path bytes", (size_t)db_graph.gpstore.path_bytes);
 
-  size_t output_threads = MIN2(nthreads, MAX_IO_THREADS);
-
   cJSON **hdrs = ctx_calloc(num_pfiles, sizeof(cJSON*));
   for(i = 0; i < num_pfiles; i++) hdrs[i] = pfiles[i].json;
 
   // Write output file
-  gpath_save(gzout, out_ctp_path, output_threads, false,
-             NULL, NULL, hdrs, num_pfiles,
-             contig_histgrms, output_ncols,
-             &db_graph);
+  if(binary_out) {
+    gpath_save_bin(fout, out_ctp_path, NULL, NULL, hdrs, num_pfiles,
+                   contig_histgrms, output_ncols, &db_graph);
+  } else {
+    gpath_save(fout, out_ctp_path, nthreads, false,
+               NULL, NULL, hdrs, num_pfiles,
+               contig_histgrms, output_ncols,
+               &db_graph);
+  }
+
+  futil_fclose(fout);
 
   for(i = 0; i < output_ncols; i++)
     zsize_buf_dealloc(&contig_histgrms[i]);
 
   ctx_free(contig_histgrms);
-
-  gzclose(gzout);
   ctx_free(hdrs);
 
   // Close ctp files
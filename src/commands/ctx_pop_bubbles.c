@@ -117,7 +117,7 @@ int ctx_pop_bubbles(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  sizeof(Covg)*8*ncols +
+                  db_graph_covg_size()*8*ncols +
                   sizeof(Edges)*8*ncols +
                   2; // 1 bit for visited, 1 for removed
 
@@ -147,6 +147,7 @@ int ctx_pop_bubbles(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
   gprefs.empty_colours = true;
 
   for(i = 0; i < num_gfiles; i++) {
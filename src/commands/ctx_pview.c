@@ -20,7 +20,7 @@ const char pview_usage[] =
 // "  -o, --out <out.txt>    Output file [required]\n"
 "  -m, --memory <mem>     Memory to use\n"
 "  -n, --nkmers <kmers>   Number of hash table entries (e.g. 1G ~ 1 billion)\n"
-"  -p, --paths <in.ctp>   Load path file (can specify multiple times)\n"
+"  -p, --paths <in.ctp>   Load path file, text or binary (can specify multiple times)\n"
 // "  -H, --header-only      Only print the header (no paths)\n"
 // "  -P, --paths-only       Only print the paths (no header)\n"
 "\n";
@@ -211,7 +211,8 @@ int ctx_pview(int argc, char **argv)
 
   // Load path files
   for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS,
+                      DEFAULT_NTHREADS, &db_graph);
 
   // Generate merged header
   if(!paths_only) {
@@ -258,36 +258,54 @@ int ctx_reads(int argc, char **argv)
   // Will exit and remove output files on error
   inputs_attempt_open();
 
-  //
-  // Calculate memory use
-  //
-  size_t kmers_in_hash, graph_mem, bits_per_kmer = sizeof(BinaryKmer)*8;
-
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        true, &graph_mem);
-
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
-
-  //
-  // Set up graph
-  //
+  // A single sorted, indexed graph is searched in place rather than loaded
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
+  bool graph_mmapped = (num_gfiles == 1 && db_graph_mmap(&db_graph, &gfiles[0]));
 
-  // Load graphs
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.empty_colours = true;
+  if(graph_mmapped) {
+    graph_file_close(&gfiles[0]);
+  }
+  else
+  {
+    //
+    // Calculate memory use
+    //
+    size_t kmers_in_hash, graph_mem, bits_per_kmer = sizeof(BinaryKmer)*8;
+
+    // Buffers for decompressing input in other threads
+    size_t io_mem = asyncio_read_mem(MIN2(inputs.len, MAX_IO_THREADS), nthreads);
+    if(io_mem >= memargs.mem_to_use) {
+      char memstr[50];
+      die("Need to set higher memory limit [ input buffers use %s ]",
+          bytes_to_str(io_mem, 1, memstr));
+    }
 
-  for(i = 0; i < num_gfiles; i++) {
-    file_filter_flatten(&gfiles[i].fltr, 0);
-    graph_load(&gfiles[i], gprefs, NULL);
-    graph_file_close(&gfiles[i]);
-    gprefs.empty_colours = false;
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use - io_mem,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_max_kmers, ctx_sum_kmers,
+                                          true, &graph_mem);
+
+    cmd_check_mem_limit(memargs.mem_to_use, graph_mem + io_mem);
+
+    //
+    // Set up graph
+    //
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash, 0);
+
+    // Load graphs
+    GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.nthreads = nthreads;
+    gprefs.empty_colours = true;
+
+    for(i = 0; i < num_gfiles; i++) {
+      file_filter_flatten(&gfiles[i].fltr, 0);
+      graph_load(&gfiles[i], gprefs, NULL);
+      graph_file_close(&gfiles[i]);
+      gprefs.empty_colours = false;
+    }
   }
   ctx_free(gfiles);
 
@@ -42,8 +42,10 @@ static struct option longopts[] =
 
 #define MAX_RANDOM_TRIES 100
 
+// @param covgs  report coverage rather than presence in each colour
 static inline void kmer_response(StrBuf *resp, dBNode node, const char *keystr,
-                                 bool pretty, const dBGraph *db_graph)
+                                 bool pretty, bool covgs,
+                                 const dBGraph *db_graph)
 {
   size_t i, col;
 
@@ -54,8 +56,8 @@ static inline void kmer_response(StrBuf *resp, dBNode node, const char *keystr,
   strbuf_append_str(resp, "\", \"colours\": [");
   for(col = 0; col < db_graph->num_of_cols; col++) {
     if(col) strbuf_append_char(resp, ',');
-    Covg covg = db_graph->col_covgs ? db_node_get_covg(db_graph, node.key, col)
-                                    : db_node_has_col(db_graph, node.key, col);
+    Covg covg = covgs ? db_node_get_covg(db_graph, node.key, col)
+                      : db_node_has_col(db_graph, node.key, col);
     strbuf_append_ulong(resp, covg);
   }
   strbuf_append_str(resp, "],");
@@ -94,7 +96,7 @@ static inline void kmer_response(StrBuf *resp, dBNode node, const char *keystr,
   size_t nlinks;
   const GPath *gpath = gpath_store_safe_fetch(&db_graph->gpstore, node.key);
   const GPathSet *gpset = &db_graph->gpstore.gpset;
-  for(nlinks = 0; gpath != NULL; gpath = gpath->next, nlinks++)
+  for(nlinks = 0; gpath != NULL; gpath = gpath_get_next(gpath), nlinks++)
   {
     if(nlinks) strbuf_append_str(resp, pretty ? ",\n            " : ", ");
     strbuf_append_str(resp, "{\"forward\": ");
@@ -103,7 +105,7 @@ static inline void kmer_response(StrBuf *resp, dBNode node, const char *keystr,
 
     // Print link sequence
     for(i = 0; i < gpath->num_juncs; i++)
-      strbuf_append_char(resp, dna_nuc_to_char(binary_seq_get(gpath->seq, i)));
+      strbuf_append_char(resp, dna_nuc_to_char(binary_seq_get(gpath_get_seq(gpath), i)));
 
     // Print link colours
     // counts may be null if user did not specify -C,--coverages
@@ -139,10 +141,11 @@ static inline void kmer_response(StrBuf *resp, dBNode node, const char *keystr,
  * @param qstr    query string - must be "random" or kmer
  * @param resp    string buffer reset, then used to store response
  * @param pretty  pretty print JSON or one line JSON
+ * @param covgs   report coverage rather than presence in each colour
  * @returns       true iff query was valid kmer
  */
 static inline bool query_response(const char *qstr, StrBuf *resp, bool pretty,
-                                  const dBGraph *db_graph)
+                                  bool covgs, const dBGraph *db_graph)
 {
   size_t qlen;
   dBNode node;
@@ -177,12 +180,12 @@ static inline bool query_response(const char *qstr, StrBuf *resp, bool pretty,
   memcpy(keystr, qstr, qlen+1);
   for(ptr = keystr; *ptr; ptr++) *ptr = toupper(*ptr);
   if(node.orient == REVERSE) dna_reverse_complement_str(keystr, qlen);
-  kmer_response(resp, node, keystr, pretty, db_graph);
+  kmer_response(resp, node, keystr, pretty, covgs, db_graph);
   return true;
 }
 
 // Reply with a random kmer
-static inline void request_random(StrBuf *resp, bool pretty,
+static inline void request_random(StrBuf *resp, bool pretty, bool covgs,
                                   const dBGraph *db_graph)
 {
   dBNode node;
@@ -195,7 +198,7 @@ static inline void request_random(StrBuf *resp, bool pretty,
   node.orient = FORWARD;
   BinaryKmer bkmer = db_node_get_bkmer(db_graph, node.key);
   binary_kmer_to_str(bkmer, db_graph->kmer_size, keystr);
-  kmer_response(resp, node, keystr, pretty, db_graph);
+  kmer_response(resp, node, keystr, pretty, covgs, db_graph);
 }
 
 static char* make_info_json_str(cJSON **hdrs, size_t nhdrs,
@@ -281,74 +284,86 @@ int ctx_server(int argc, char **argv)
   // Check graph + paths are compatible
   graphs_gpaths_compatible(gfiles, num_gfiles, gpfiles.b, gpfiles.len, -1);
 
-  //
-  // Decide on memory
-  //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem = 0;
-
-  // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
-
-  bits_per_kmer = sizeof(BinaryKmer)*8 + // kmer
-                  sizeof(Edges)*8 * (load_edges ? ncols : 1) + // edges
-                  sizeof(Covg)*8 * (load_covgs ? ncols : 0) + // covgs
-                  (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) + // links
-                  ncols; // in colour
-
-  kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
-                                        memargs.mem_to_use_set,
-                                        memargs.num_kmers,
-                                        memargs.num_kmers_set,
-                                        bits_per_kmer,
-                                        ctx_max_kmers, ctx_sum_kmers,
-                                        false, &graph_mem);
-
-  if(gpfiles.len)
-  {
-    // Paths memory
-    size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem);
-    path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len,
-                                    ncols, rem_mem,
-                                    load_covgs); // load path counts
-
-    // Shift path store memory from graphs->paths
-    graph_mem -= sizeof(GPath*)*kmers_in_hash;
-    path_mem  += sizeof(GPath*)*kmers_in_hash;
-    cmd_print_mem(path_mem, "paths");
-  }
-
-  size_t total_mem = graph_mem + path_mem;
-  cmd_check_mem_limit(memargs.mem_to_use, total_mem);
-
-  // Allocate memory
+  // A single sorted, indexed graph without links is searched in place rather
+  // than loaded, so the server starts straight away
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size,
-                 ncols, load_edges ? ncols : 1, kmers_in_hash,
-                 DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL |
-                   (load_covgs ? DBG_ALLOC_COVGS : 0));
+  bool graph_mmapped = (num_gfiles == 1 && gpfiles.len == 0 &&
+                        db_graph_mmap(&db_graph, &gfiles[0]));
 
-  // Paths - allocates nothing if gpfiles.len == 0
-  gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len,
-                             path_mem, load_covgs,
-                             &db_graph);
+  if(graph_mmapped) {
+    graph_file_close(&gfiles[0]);
+  }
+  else
+  {
+    //
+    // Decide on memory
+    //
+    size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem = 0;
+
+    // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
+
+    bits_per_kmer = sizeof(BinaryKmer)*8 + // kmer
+                    sizeof(Edges)*8 * (load_edges ? ncols : 1) + // edges
+                    db_graph_covg_size()*8 * (load_covgs ? ncols : 0) + // covgs
+                    (gpfiles.len > 0 ? sizeof(GPath*)*8 : 0) + // links
+                    ncols; // in colour
+
+    kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
+                                          memargs.mem_to_use_set,
+                                          memargs.num_kmers,
+                                          memargs.num_kmers_set,
+                                          bits_per_kmer,
+                                          ctx_max_kmers, ctx_sum_kmers,
+                                          false, &graph_mem);
+
+    if(gpfiles.len)
+    {
+      // Paths memory
+      size_t rem_mem = memargs.mem_to_use - MIN2(memargs.mem_to_use, graph_mem);
+      path_mem = gpath_reader_mem_req(gpfiles.b, gpfiles.len,
+                                      ncols, rem_mem,
+                                      load_covgs); // load path counts
+
+      // Shift path store memory from graphs->paths
+      graph_mem -= sizeof(GPath*)*kmers_in_hash;
+      path_mem  += sizeof(GPath*)*kmers_in_hash;
+      cmd_print_mem(path_mem, "paths");
+    }
 
-  //
-  // Load graphs
-  //
-  GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
-  gprefs.empty_colours = true;
+    size_t total_mem = graph_mem + path_mem;
+    cmd_check_mem_limit(memargs.mem_to_use, total_mem);
+
+    // Allocate memory
+    db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size,
+                   ncols, load_edges ? ncols : 1, kmers_in_hash,
+                   DBG_ALLOC_EDGES | DBG_ALLOC_NODE_IN_COL |
+                     (load_covgs ? DBG_ALLOC_COVGS : 0));
+
+    // Paths - allocates nothing if gpfiles.len == 0
+    gpath_reader_alloc_gpstore(gpfiles.b, gpfiles.len,
+                               path_mem, load_covgs,
+                               &db_graph);
+
+    //
+    // Load graphs
+    //
+    GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+    gprefs.empty_colours = true;
+
+    for(i = 0; i < num_gfiles; i++) {
+      graph_load(&gfiles[i], gprefs, NULL);
+      graph_file_close(&gfiles[i]);
+      gprefs.empty_colours = false;
+    }
 
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, NULL);
-    graph_file_close(&gfiles[i]);
-    gprefs.empty_colours = false;
+    hash_table_print_stats(&db_graph.ht);
   }
   ctx_free(gfiles);
 
-  hash_table_print_stats(&db_graph.ht);
-
   // Load path files
   for(i = 0; i < gpfiles.len; i++)
-    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&gpfiles.b[i], GPATH_DIE_MISSING_KMERS,
+                      DEFAULT_NTHREADS, &db_graph);
 
   // Create array of cJSON** from input files
   cJSON **hdrs = ctx_malloc(gpfiles.len * sizeof(cJSON*));
@@ -384,12 +399,13 @@ int ctx_server(int argc, char **argv)
       fflush(stdout);
     }
     else if(strcmp(line.b,"random") == 0) {
-      request_random(&response, pretty, &db_graph);
+      request_random(&response, pretty, load_covgs, &db_graph);
       fputs(response.b, stdout);
       fflush(stdout);
     }
     else {
-      success = query_response(line.b, &response, pretty, &db_graph);
+      success = query_response(line.b, &response, pretty, load_covgs,
+                               &db_graph);
       if(response.end) {
         fputs(response.b, stdout);
         fflush(stdout);
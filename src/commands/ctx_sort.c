@@ -4,21 +4,30 @@
 #include "file_util.h"
 #include "graphs_load.h"
 #include "graph_writer.h"
+#include "graph_block.h"
 #include "binary_kmer.h"
 
+#include <sys/resource.h> // getrlimit()
+
 // TODO: add .ctp.gz sorting
 
 const char sort_usage[] =
 "usage: "CMD" sort [options] <in.ctx>\n"
 "\n"
-"  Sort a cortex graph file.\n"
+"  Sort a cortex graph file. If the graph does not fit in <mem>, sorted runs are\n"
+"  written to temporary files then merged.\n"
 "\n"
 "  -h, --help              This help message\n"
 "  -q, --quiet             Silence status output normally printed to STDERR\n"
 "  -f, --force             Overwrite output files\n"
 "  -m, --memory <mem>      Memory to use\n"
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -o, --out <out.ctx>     Output file [default: overwrite input]\n"
+"  -T, --tmp <dir>         Directory for temporary files [default: /tmp]\n"
+"  -F, --format <v>        Format version for output: 6 or 7 [default: 6]\n"
+"                          Version 7 is block compressed and requires --out.\n"
+"                          `"CMD" index` requires version 6.\n"
 "\n";
 
 static struct option longopts[] =
@@ -27,10 +36,17 @@ static struct option longopts[] =
   {"force",        no_argument,       NULL, 'f'},
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
   {"out",          required_argument, NULL, 'o'},
+  {"tmp",          required_argument, NULL, 'T'},
+  {"format",       required_argument, NULL, 'F'},
   {NULL, 0, NULL, 0}
 };
 
+// Limit on temporary files open at once when the graph does not fit in memory.
+// Reduced to half the open file limit if that is lower.
+#define SORT_MAX_OPEN_RUNS 256
+
 static inline int binary_kmers_qcmp_ptrs(const void *aa, const void *bb)
 {
   BinaryKmer b1, b2;
@@ -40,16 +56,230 @@ static inline int binary_kmers_qcmp_ptrs(const void *aa, const void *bb)
   return binary_kmers_cmp(b1, b2);
 }
 
-// Sort either graph file or paths file. Pointers must point to binary kmer or
-// test representation of kmer
-static inline void sort_block(char **entries, size_t num)
+typedef struct
+{
+  char **kmers;
+  size_t num;
+} SortChunk;
+
+static void sort_chunk_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  SortChunk *chunk = (SortChunk*)arg;
+  qsort(chunk->kmers, chunk->num, sizeof(char*), binary_kmers_qcmp_ptrs);
+}
+
+//
+// Sorted runs of kmers, either in memory or in a temporary file, that are
+// merged into a single sorted output
+//
+typedef struct
+{
+  char **kmers; // in memory: pointers to records
+  FILE *fh; // on disk: file of records
+  char *buf; // on disk: buffer of bufkmers records
+  size_t bufkmers, bufpos, buflen;
+  uint64_t rem; // number of records remaining
+  const char *curr; // current record
+} SortRun;
+
+static inline bool sort_run_next(SortRun *run, size_t kmer_mem)
+{
+  if(run->rem == 0) return false;
+  if(run->fh == NULL) run->curr = *(run->kmers++);
+  else {
+    if(run->bufpos == run->buflen) {
+      run->buflen = MIN2(run->bufkmers, run->rem);
+      run->bufpos = 0;
+      if(fread(run->buf, kmer_mem, run->buflen, run->fh) != run->buflen)
+        die("Cannot read temporary file");
+    }
+    run->curr = run->buf + kmer_mem * run->bufpos++;
+  }
+  run->rem--;
+  return true;
+}
+
+// Write a record, or add it to `blk` if writing a block compressed file
+static inline void sort_write_kmer(const char *rec, size_t kmer_mem,
+                                   GraphBlock *blk, FILE *fout)
+{
+  if(blk == NULL) {
+    if(fwrite(rec, 1, kmer_mem, fout) != kmer_mem)
+      die("Cannot write to file");
+    return;
+  }
+
+  const size_t ncols = blk->num_of_cols;
+  BinaryKmer bkmer;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+  memcpy(bkmer.b, rec, sizeof(BinaryKmer));
+  memcpy(covgs, rec + sizeof(BinaryKmer), ncols * sizeof(Covg));
+  memcpy(edges, rec + sizeof(BinaryKmer) + ncols * sizeof(Covg),
+         ncols * sizeof(Edges));
+
+  if(!graph_block_in_order(blk, bkmer)) die("Duplicate kmer in graph");
+  graph_block_add(blk, bkmer, covgs, edges);
+  if(graph_block_full(blk)) graph_block_write(blk, fout);
+}
+
+static inline bool sort_run_less(const SortRun *a, const SortRun *b)
+{
+  return binary_kmers_qcmp_ptrs(&a->curr, &b->curr) < 0;
+}
+
+// Restore min-heap property below index i
+static inline void sort_heap_down(SortRun **heap, size_t n, size_t i)
+{
+  size_t c;
+  while((c = 2*i+1) < n) {
+    if(c+1 < n && sort_run_less(heap[c+1], heap[c])) c++;
+    if(!sort_run_less(heap[c], heap[i])) break;
+    SWAP(heap[c], heap[i]);
+    i = c;
+  }
+}
+
+// Merge sorted runs, writing records to fout (into blocks if blk != NULL)
+// Returns number of records written
+static uint64_t sort_runs_merge(SortRun *runs, size_t nruns, size_t kmer_mem,
+                                GraphBlock *blk, FILE *fout)
+{
+  SortRun **heap = ctx_malloc(nruns * sizeof(SortRun*));
+  size_t i, n = 0;
+  uint64_t nkmers = 0;
+
+  for(i = 0; i < nruns; i++)
+    if(sort_run_next(&runs[i], kmer_mem))
+      heap[n++] = &runs[i];
+
+  for(i = n/2; i > 0; i--) sort_heap_down(heap, n, i-1);
+
+  while(n > 0)
+  {
+    sort_write_kmer(heap[0]->curr, kmer_mem, blk, fout);
+    nkmers++;
+    if(!sort_run_next(heap[0], kmer_mem)) heap[0] = heap[--n];
+    sort_heap_down(heap, n, 0);
+  }
+
+  ctx_free(heap);
+  return nkmers;
+}
+
+// Sort `num` records with `nthreads`, each thread sorting a contiguous chunk
+// of pointers, then write them in order to fout
+static void sort_block(char **kmers, size_t num, size_t kmer_mem,
+                       size_t nthreads, GraphBlock *blk, FILE *fout)
+{
+  size_t i, start, end;
+  nthreads = MAX2(1, MIN2(nthreads, num));
+  SortChunk *chunks = ctx_calloc(nthreads, sizeof(SortChunk));
+  SortRun *runs = ctx_calloc(nthreads, sizeof(SortRun));
+
+  for(i = 0; i < nthreads; i++) {
+    start = (num * i) / nthreads;
+    end = (num * (i+1)) / nthreads;
+    chunks[i] = (SortChunk){.kmers = kmers+start, .num = end-start};
+    runs[i] = (SortRun){.kmers = kmers+start, .rem = end-start};
+  }
+
+  util_run_threads(chunks, nthreads, sizeof(SortChunk), nthreads,
+                   sort_chunk_thread);
+
+  sort_runs_merge(runs, nthreads, kmer_mem, blk, fout);
+
+  ctx_free(runs);
+  ctx_free(chunks);
+}
+
+// Read `num` records into `mem`, set pointers in kmers
+static void sort_read_block(GraphFileReader *gfile, char *mem, char **kmers,
+                            size_t num, size_t kmer_mem)
+{
+  size_t i, nkread = gfr_fread_bytes(gfile, mem, num*kmer_mem);
+
+  if(nkread != num*kmer_mem)
+    die("Could only read %zu bytes [<%zu]", nkread, num*kmer_mem);
+
+  for(i = 0; i < num; i++)
+    kmers[i] = mem + kmer_mem*i;
+}
+
+// Number of temporary files we can have open at once
+static size_t sort_max_open_runs()
 {
-  qsort(entries, num, sizeof(char*), binary_kmers_qcmp_ptrs);
+  struct rlimit rl;
+  size_t max_open = SORT_MAX_OPEN_RUNS;
+
+  if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    max_open = MIN2(max_open, rl.rlim_cur / 2);
+
+  if(max_open < 4)
+    die("Open file limit too low to sort (ulimit -n): %zu", max_open*2);
+
+  return max_open;
+}
+
+static void sort_tmp_rewind(FILE *fh)
+{
+  if(fflush(fh) != 0 || fseek(fh, 0, SEEK_SET) != 0)
+    die("Cannot write temporary file [%s]", strerror(errno));
+}
+
+// Read and sort `nruns` runs of up to `block_kmers` records, writing each to a
+// new temporary file. Sets the number of records in each run in `run_kmers`.
+static FILE** sort_write_runs(GraphFileReader *gfile, char *mem, char **kmers,
+                              size_t block_kmers, size_t kmer_mem,
+                              size_t nthreads, const char *tmp_dir,
+                              size_t nruns, uint64_t *nrem,
+                              uint64_t *run_kmers)
+{
+  FILE **tmp_files = futil_create_tmp_files(tmp_dir, nruns);
+  size_t i;
+
+  for(i = 0; i < nruns; i++) {
+    run_kmers[i] = MIN2(*nrem, block_kmers);
+    *nrem -= run_kmers[i];
+    sort_read_block(gfile, mem, kmers, run_kmers[i], kmer_mem);
+    sort_block(kmers, run_kmers[i], kmer_mem, nthreads, NULL, tmp_files[i]);
+    sort_tmp_rewind(tmp_files[i]);
+  }
+
+  return tmp_files;
+}
+
+// Merge `nruns` temporary files of sorted records, each read through an equal
+// share of `mem` (`mem_kmers` records). Closes the temporary files.
+// Returns number of records written
+static uint64_t sort_files_merge(FILE **tmp_files, const uint64_t *run_kmers,
+                                 size_t nruns, char *mem, size_t mem_kmers,
+                                 size_t kmer_mem, GraphBlock *blk, FILE *fout)
+{
+  SortRun *runs = ctx_calloc(nruns, sizeof(SortRun));
+  size_t i, bufkmers = mem_kmers / nruns;
+  uint64_t nkmers;
+  ctx_assert(bufkmers > 0);
+
+  for(i = 0; i < nruns; i++) {
+    runs[i] = (SortRun){.fh = tmp_files[i], .buf = mem + i*bufkmers*kmer_mem,
+                        .bufkmers = bufkmers, .bufpos = 0, .buflen = 0,
+                        .rem = run_kmers[i]};
+  }
+
+  nkmers = sort_runs_merge(runs, nruns, kmer_mem, blk, fout);
+
+  for(i = 0; i < nruns; i++) fclose(tmp_files[i]);
+  ctx_free(runs);
+  return nkmers;
 }
 
 int ctx_sort(int argc, char **argv)
 {
-  const char *out_path = NULL;
+  const char *out_path = NULL, *tmp_dir = NULL;
+  size_t nthreads = 0;
+  uint32_t out_version = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
 
   // Arg parsing
@@ -69,7 +299,10 @@ int ctx_sort(int argc, char **argv)
       case 'f': cmd_check(!futil_get_force(), cmd); futil_set_force(true); break;
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case 't': cmd_check(!nthreads, cmd); nthreads = cmd_uint32_nonzero(cmd, optarg); break;
       case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 'T': cmd_check(!tmp_dir, cmd); tmp_dir = optarg; break;
+      case 'F': cmd_check(!out_version, cmd); out_version = cmd_uint32(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -83,6 +316,18 @@ int ctx_sort(int argc, char **argv)
 
   const char *ctx_path = argv[optind];
 
+  if(nthreads == 0) nthreads = DEFAULT_NTHREADS;
+
+  if(!out_version) out_version = CTX_GRAPH_FILEFORMAT;
+  if(out_version != CTX_GRAPH_FILEFORMAT &&
+     out_version != CTX_GRAPH_FILEFORMAT_BLOCKS) {
+    cmd_print_usage("Can only write format version %i or %i",
+                    CTX_GRAPH_FILEFORMAT, CTX_GRAPH_FILEFORMAT_BLOCKS);
+  }
+  if(out_version == CTX_GRAPH_FILEFORMAT_BLOCKS && !out_path)
+    cmd_print_usage("--format %i requires --out <out.ctx>",
+                    CTX_GRAPH_FILEFORMAT_BLOCKS);
+
   //
   // Open Graph file
   //
@@ -93,6 +338,12 @@ int ctx_sort(int argc, char **argv)
   if(!file_filter_is_direct(&gfile.fltr))
     die("Cannot open graph file with a filter ('in.ctx:blah' syntax)");
 
+  if(graph_file_is_compressed(&gfile)) {
+    die("Compressed graphs are already sorted, convert with `"CMD" view "
+        "--format %i --out <out.ctx> <in.ctx>` [path: %s]", CTX_GRAPH_FILEFORMAT,
+        file_filter_path(&gfile.fltr));
+  }
+
   size_t num_kmers, memory;
 
   // Reading from a stream
@@ -106,29 +357,88 @@ int ctx_sort(int argc, char **argv)
   // Open output path (if given)
   FILE *fout = out_path ? futil_fopen_create(out_path, "w") : NULL;
 
-  size_t i;
+  size_t i, n;
   size_t ncols = gfile.hdr.num_of_cols;
   size_t kmer_mem = sizeof(BinaryKmer) + (sizeof(Edges)+sizeof(Covg))*ncols;
 
-  memory = (sizeof(char*) + kmer_mem) * num_kmers;
+  // Runs are merged in one pass if they can all be open at once, otherwise
+  // groups of runs are merged first, then the groups
+  size_t max_open = sort_max_open_runs(), group = max_open / 2;
+  size_t max_runs = MAX2(max_open, group * group);
+
+  // Number of kmers we can sort in memory at once
+  size_t block_kmers = memargs.mem_to_use / (sizeof(char*) + kmer_mem);
+  size_t nruns = block_kmers ? (num_kmers + block_kmers - 1) / block_kmers : 0;
+  block_kmers = MIN2(block_kmers, num_kmers);
+
+  memory = (sizeof(char*) + kmer_mem) * block_kmers;
 
   char mem_str[50];
   bytes_to_str(memory, 1, mem_str);
 
-  if(memory > memargs.mem_to_use)
+  // Merging needs at least one record in memory per open run
+  if(num_kmers > 0 && (block_kmers == 0 || nruns > max_runs ||
+                       (nruns > 1 && block_kmers < max_open))) {
+    size_t min_kmers = MAX2(num_kmers / max_runs + 1, max_open);
+    min_kmers = MIN2(min_kmers, num_kmers);
+    bytes_to_str((sizeof(char*) + kmer_mem) * min_kmers, 1, mem_str);
     die("Require at least %s memory", mem_str);
+  }
 
   status("[memory] Total: %s", mem_str);
 
-  char *mem = ctx_malloc(kmer_mem * num_kmers);
-  char **kmers = ctx_malloc(num_kmers*sizeof(char*));
+  char *mem = ctx_malloc(kmer_mem * block_kmers);
+  char **kmers = ctx_malloc(block_kmers * sizeof(char*));
+  FILE **tmp_files = NULL;
+  uint64_t *tmp_kmers = NULL, nrem = num_kmers;
+  size_t ntmp = 0;
 
-  // Read in whole file
+  // Read in whole file if it fits in memory, otherwise write sorted runs to
+  // temporary files
   // if(graph_file_fseek(gfile, gfile.hdr_size, SEEK_SET) != 0) die("fseek failed");
-  size_t nkread = gfr_fread_bytes(&gfile, mem, num_kmers*kmer_mem);
+  if(nruns > max_open)
+  {
+    // Too many runs to have open at once: merge each group of runs into a
+    // single temporary file as soon as the group has been written
+    size_t ngroups = (nruns + group - 1) / group;
+    uint64_t *run_kmers = ctx_malloc(group * sizeof(uint64_t));
+    FILE **run_files, **grp_file;
+
+    status("Sorting %zu kmers in %zu runs of %zu kmers, merged in %zu groups, "
+           "with %zu thread%s", num_kmers, nruns, block_kmers, ngroups,
+           nthreads, util_plural_str(nthreads));
+
+    ntmp = ngroups;
+    tmp_files = ctx_malloc(ngroups * sizeof(FILE*));
+    tmp_kmers = ctx_malloc(ngroups * sizeof(uint64_t));
+
+    for(i = 0; i < ngroups; i++) {
+      n = (nruns * (i+1)) / ngroups - (nruns * i) / ngroups;
+      run_files = sort_write_runs(&gfile, mem, kmers, block_kmers, kmer_mem,
+                                  nthreads, tmp_dir, n, &nrem, run_kmers);
+      grp_file = futil_create_tmp_files(tmp_dir, 1);
+      tmp_files[i] = grp_file[0];
+      tmp_kmers[i] = sort_files_merge(run_files, run_kmers, n, mem, block_kmers,
+                                      kmer_mem, NULL, tmp_files[i]);
+      sort_tmp_rewind(tmp_files[i]);
+      ctx_free(grp_file);
+      ctx_free(run_files);
+    }
 
-  if(nkread != num_kmers*kmer_mem)
-    die("Could only read %zu bytes [<%zu]", nkread, num_kmers*kmer_mem);
+    ctx_free(run_kmers);
+  }
+  else if(nruns > 1)
+  {
+    status("Sorting %zu kmers in %zu runs of %zu kmers with %zu thread%s",
+           num_kmers, nruns, block_kmers, nthreads, util_plural_str(nthreads));
+
+    ntmp = nruns;
+    tmp_kmers = ctx_malloc(nruns * sizeof(uint64_t));
+    tmp_files = sort_write_runs(&gfile, mem, kmers, block_kmers, kmer_mem,
+                                nthreads, tmp_dir, nruns, &nrem, tmp_kmers);
+  }
+  else
+    sort_read_block(&gfile, mem, kmers, num_kmers, kmer_mem);
 
   // check we are at the end of the file
   char tmpc;
@@ -140,15 +450,19 @@ int ctx_sort(int argc, char **argv)
   status("Read %zu kmers with %zu colour%s", num_kmers,
          ncols, util_plural_str(ncols));
 
-  for(i = 0; i < num_kmers; i++)
-    kmers[i] = mem + kmer_mem*i;
-
-  sort_block(kmers, num_kmers);
+  GraphBlock blkmem, *blk = NULL;
 
   // Print
   if(out_path != NULL) {
     // saving to a different destination - write header
-    graph_write_header(fout, &gfile.hdr);
+    GraphFileHeader outhdr = gfile.hdr;
+    outhdr.version = out_version;
+    graph_write_header(fout, &outhdr);
+
+    if(out_version == CTX_GRAPH_FILEFORMAT_BLOCKS) {
+      blk = &blkmem;
+      graph_block_alloc(blk, ncols);
+    }
   }
   else {
     // Directly manipulating gfile.fh here, using it to write later
@@ -157,9 +471,22 @@ int ctx_sort(int argc, char **argv)
     fout = gfile.fh;
   }
 
-  for(i = 0; i < num_kmers; i++)
-    if(fwrite(kmers[i], 1, kmer_mem, fout) != kmer_mem)
-      die("Cannot write to file");
+  if(ntmp > 0)
+  {
+    // Merge runs, each read through a share of the sort memory
+    ctx_free(kmers); kmers = NULL;
+    sort_files_merge(tmp_files, tmp_kmers, ntmp, mem, block_kmers, kmer_mem,
+                     blk, fout);
+    ctx_free(tmp_files);
+    ctx_free(tmp_kmers);
+  }
+  else
+    sort_block(kmers, num_kmers, kmer_mem, nthreads, blk, fout);
+
+  if(blk != NULL) {
+    graph_block_write(blk, fout);
+    graph_block_dealloc(blk);
+  }
 
   if(out_path) fclose(fout);
 
@@ -136,7 +136,7 @@ int ctx_subgraph(int argc, char **argv)
   char graph_mem_str[100], fringe_mem_str[100], num_fringe_nodes_str[100];
 
   bits_per_kmer = sizeof(BinaryKmer)*8 +
-                  ((sizeof(Edges) + sizeof(Covg))*use_ncols*8 + 1);
+                  ((sizeof(Edges) + db_graph_covg_size())*use_ncols*8 + 1);
 
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
@@ -187,6 +187,7 @@ int ctx_subgraph(int argc, char **argv)
   // Load graphs
   //
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   StrBuf intersect_gname;
   strbuf_alloc(&intersect_gname, 1024);
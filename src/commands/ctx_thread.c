@@ -137,16 +137,20 @@ int ctx_thread(int argc, char **argv)
                                         gfile->num_of_kmers,
                                         false, &graph_mem);
 
+  // Buffers for decompressing input in other threads
+  size_t io_mem = asyncio_read_mem(MIN2(inputs->len, MAX_IO_THREADS), args.nthreads);
+
   // Paths memory
   size_t min_path_mem = 0;
   gpath_reader_sum_mem(gpfiles->b, gpfiles->len, 1, true, true, &min_path_mem);
 
-  if(graph_mem + min_path_mem > args.memargs.mem_to_use) {
+  if(graph_mem + io_mem + min_path_mem > args.memargs.mem_to_use) {
     char buf[50];
-    die("Require at least %s memory", bytes_to_str(graph_mem+min_path_mem, 1, buf));
+    die("Require at least %s memory",
+        bytes_to_str(graph_mem+io_mem+min_path_mem, 1, buf));
   }
 
-  path_mem = args.memargs.mem_to_use - graph_mem;
+  path_mem = args.memargs.mem_to_use - graph_mem - io_mem;
   size_t pentry_hash_mem = sizeof(GPEntry)/0.7;
   size_t pentry_store_mem = sizeof(GPath) + 8 + // struct + sequence
                             1 + // in colour
@@ -159,13 +163,13 @@ int ctx_thread(int argc, char **argv)
   cmd_print_mem(path_hash_mem, "paths hash");
   cmd_print_mem(path_store_mem, "paths store");
 
-  total_mem = graph_mem + path_mem;
+  total_mem = graph_mem + path_mem + io_mem;
   cmd_check_mem_limit(args.memargs.mem_to_use, total_mem);
 
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_create(args.out_ctp_path, "w");
+  FILE *fout = futil_fopen_create(args.out_ctp_path, "w");
 
   status("Creating paths file: %s", futil_outpath_str(args.out_ctp_path));
 
@@ -213,6 +217,7 @@ int ctx_thread(int argc, char **argv)
   // Setup for loading graphs graph
   // Don't set gprefs.empty_colours => we've already loaded paths
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = args.nthreads;
 
   // Load graph, print stats, close file
   graph_load(gfile, gprefs, NULL);
@@ -221,7 +226,8 @@ int ctx_thread(int argc, char **argv)
 
   // Load existing paths
   for(i = 0; i < gpfiles->len; i++)
-    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS, &db_graph);
+    gpath_reader_load(&gpfiles->b[i], GPATH_DIE_MISSING_KMERS,
+                      args.nthreads, &db_graph);
 
   // zero link counts of already loaded links
   if(args.zero_link_counts) {
@@ -256,8 +262,6 @@ int ctx_thread(int argc, char **argv)
   cJSON **hdrs = ctx_malloc(gpfiles->len * sizeof(cJSON*));
   for(i = 0; i < gpfiles->len; i++) hdrs[i] = gpfiles->b[i].json;
 
-  size_t output_threads = MIN2(args.nthreads, MAX_IO_THREADS);
-
   // Generate a cJSON header for all inputs
   cJSON *thread_hdr = cJSON_CreateObject();
   cJSON *inputs_hdr = cJSON_CreateArray();
@@ -266,12 +270,12 @@ int ctx_thread(int argc, char **argv)
     cJSON_AddItemToArray(inputs_hdr, correct_aln_input_json_hdr(&inputs->b[i]));
 
   // Write output file
-  gpath_save(gzout, args.out_ctp_path, output_threads, true,
+  gpath_save(fout, args.out_ctp_path, args.nthreads, true,
              "thread", thread_hdr, hdrs, gpfiles->len,
              &aln_stats->contig_histgrm, 1,
              &db_graph);
 
-  gzclose(gzout);
+  futil_fclose(fout);
   ctx_free(hdrs);
 
   // Optionally run path checks for debugging
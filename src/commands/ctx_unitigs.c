@@ -354,6 +354,7 @@ int ctx_unitigs(int argc, char **argv)
 
   // Load graphs
   GraphLoadingPrefs gprefs = graph_loading_prefs(&db_graph);
+  gprefs.nthreads = nthreads;
 
   for(i = 0; i < num_gfiles; i++) {
     file_filter_flatten(&gfiles[i].fltr, 0);
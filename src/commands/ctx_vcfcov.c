@@ -144,7 +144,7 @@ int ctx_vcfcov(int argc, char **argv)
   //
   size_t bits_per_kmer, kmers_in_hash, graph_mem;
 
-  bits_per_kmer = sizeof(BinaryKmer)*8 + sizeof(Covg)*8 * ncols;
+  bits_per_kmer = sizeof(BinaryKmer)*8 + db_graph_covg_size()*8 * ncols;
   kmers_in_hash = cmd_get_kmers_in_hash(memargs.mem_to_use,
                                         memargs.mem_to_use_set,
                                         memargs.num_kmers,
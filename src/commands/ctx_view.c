@@ -9,6 +9,7 @@
 #include "db_node.h"
 #include "graph_info.h"
 #include "graphs_load.h"
+#include "graph_writer.h"
 #include "hash_mem.h" // for calculating mem usage
 
 #define SUBCMD "view"
@@ -24,12 +25,18 @@ const char view_usage[] =
 "  -k, --kmers  Print kmers\n"
 "  -c, --check  Check kmers\n"
 "  -i, --info   Print info\n"
+"\n"
+"  -o, --out <out.ctx>  Convert graph and save to <out.ctx>\n"
+"  -F, --format <v>     Format version for --out: 6 or 7 [default: 7]\n"
+"                       Version 7 is block compressed and requires a sorted\n"
+"                       graph: use `"CMD" sort --format 7` otherwise. Some\n"
+"                       commands, such as `"CMD" index`, require version 6.\n"
 // "\n"
 // "  -r, --readlen  Print mean read length\n"
 // "  -b, --nbases   Print number of bases read\n"
 // "  -n, --nkmers   Print number of kmers\n"
 "\n"
-" Default is [--info --check]\n"
+" Default is [--info --check], or nothing with --out\n"
 "\n";
 
 int print_info = 0, parse_kmers = 0, print_kmers = 0;
@@ -40,6 +47,8 @@ static struct option longopts[] =
   {"kmers", no_argument, &print_kmers,  1},
   {"check", no_argument, &parse_kmers,  1},
   {"info",  no_argument, &print_info,   1},
+  {"out",   required_argument, NULL,    'o'},
+  {"format",required_argument, NULL,    'F'},
   // {"help",    no_argument, NULL, 'h'},
   // {"kmers",   no_argument, NULL, 'k'},
   // {"check",   no_argument, NULL, 'c'},
@@ -120,6 +129,8 @@ int ctx_view(int argc, char **argv)
   char shortopts[300];
   cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
   int c;
+  const char *out_path = NULL;
+  uint32_t out_version = 0;
 
   // TODO:
   // print_action actions[argc];
@@ -133,6 +144,8 @@ int ctx_view(int argc, char **argv)
     switch(c) {
       case 0: /* flag set */ break;
       case 'h': cmd_print_usage(NULL); break;
+      case 'o': cmd_check(!out_path, cmd); out_path = optarg; break;
+      case 'F': cmd_check(!out_version, cmd); out_version = cmd_uint32(cmd, optarg); break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -144,8 +157,20 @@ int ctx_view(int argc, char **argv)
 
   if(print_kmers) parse_kmers = 1;
 
+  if(out_version && !out_path)
+    cmd_print_usage("--format requires --out <out.ctx>");
+  if(out_path && parse_kmers)
+    cmd_print_usage("Cannot use --kmers or --check with --out");
+
+  if(!out_version) out_version = CTX_GRAPH_FILEFORMAT_BLOCKS;
+  if(out_version != CTX_GRAPH_FILEFORMAT &&
+     out_version != CTX_GRAPH_FILEFORMAT_BLOCKS) {
+    cmd_print_usage("Can only write format version %i or %i",
+                    CTX_GRAPH_FILEFORMAT, CTX_GRAPH_FILEFORMAT_BLOCKS);
+  }
+
   bool no_flags = (!print_info && !parse_kmers && !print_kmers);
-  if(no_flags) { print_info = parse_kmers = 1; }
+  if(no_flags && !out_path) { print_info = parse_kmers = 1; }
 
   if(optind+1 != argc) cmd_print_usage("Require one input graph file (.ctx)");
 
@@ -173,6 +198,7 @@ int ctx_view(int argc, char **argv)
   GraphFileHeader hdr;
   memset(&hdr, 0, sizeof(hdr));
   graph_file_merge_header(&hdr, &gfile);
+  hdr.version = gfile.hdr.version;
 
   uint64_t nkmers_read = 0, nkmers_loaded = 0;
   uint64_t num_all_zero_kmers = 0, num_zero_covg_kmers = 0;
@@ -183,6 +209,12 @@ int ctx_view(int argc, char **argv)
   // Print header
   if(print_info) print_header(&hdr, gfile.num_of_kmers);
 
+  // Convert between fixed width (version 6) and block compressed (version 7)
+  if(out_path != NULL) {
+    hdr.version = out_version;
+    graph_writer_stream(out_path, &gfile, NULL, &hdr, NULL);
+  }
+
   BinaryKmer bkmer;
   Covg covgs[ncols], keep_kmer;
   Edges edges[ncols];
@@ -2,6 +2,13 @@
 #include "ctx_alloc.h"
 #include "util.h"
 
+#include <sys/mman.h> // mmap(), madvise()
+#include <unistd.h> // sysconf()
+
+#ifndef MAP_ANONYMOUS
+  #define MAP_ANONYMOUS MAP_ANON
+#endif
+
 static volatile size_t ctx_num_allocs = 0, ctx_num_frees = 0;
 
 static inline void _oom(void *ptr, size_t nel, size_t elsize,
@@ -50,6 +57,15 @@ void* alloc_recallocarray(void *ptr, size_t oldnel, size_t newnel, size_t elsize
   return ptr2;
 }
 
+void* alloc_aligned(size_t align, size_t mem,
+                    const char *file, const char *func, int line)
+{
+  void *ptr = NULL;
+  if(posix_memalign(&ptr, align, mem) != 0) _oom(NULL, 1, mem, file, func, line);
+  __sync_add_and_fetch(&ctx_num_allocs, 1); // ++ctx_num_allocs
+  return ptr;
+}
+
 // `ptr` can be NULL
 void alloc_free(void *ptr)
 {
@@ -67,3 +83,146 @@ size_t alloc_get_num_frees()
 {
   return (size_t)ctx_num_frees;
 }
+
+//
+// Large arrays
+//
+
+// Explicit huge pages are 2MB on x86-64, MAP_HUGETLB mappings are rounded up
+#define HUGEPAGE_BYTES (2UL<<20)
+
+// Large arrays are preceded by a header storing the length of the mapping.
+// 64 bytes keeps arrays aligned to cache lines.
+#define LARGE_HDR_BYTES 64
+
+// Don't start another thread to fill less than this
+#define LARGE_FILL_MIN_BYTES (16UL<<20)
+
+static bool ctx_use_hugepages = false;
+static volatile int ctx_warned_hugetlb = 0;
+static size_t ctx_large_nthreads = 1;
+
+void alloc_set_hugepages(bool use_hugepages)
+{
+  ctx_use_hugepages = use_hugepages;
+}
+
+bool alloc_get_hugepages()
+{
+  return ctx_use_hugepages;
+}
+
+void alloc_set_nthreads(size_t nthreads)
+{
+  ctx_large_nthreads = MAX2(nthreads, 1);
+}
+
+size_t alloc_get_nthreads()
+{
+  return ctx_large_nthreads;
+}
+
+typedef struct
+{
+  char *ptr;
+  size_t nel, elsize, nthreads, pagesize;
+  const void *fill;
+  bool touch; // memory is already zero, only write one byte per page
+} LargeFill;
+
+static void large_fill_thread(void *arg, size_t threadid)
+{
+  const LargeFill *lf = (const LargeFill*)arg;
+  size_t i, step = lf->nel / lf->nthreads;
+  size_t start = threadid * step;
+  size_t end = (threadid+1 == lf->nthreads ? lf->nel : start+step);
+  char *ptr = lf->ptr + start*lf->elsize, *endptr = lf->ptr + end*lf->elsize;
+
+  if(lf->touch) {
+    for(; ptr < endptr; ptr += lf->pagesize) *(volatile char*)ptr = 0;
+  }
+  else if(lf->fill == NULL) {
+    memset(ptr, 0, endptr - ptr);
+  }
+  else {
+    for(i = start; i < end; i++, ptr += lf->elsize)
+      memcpy(ptr, lf->fill, lf->elsize);
+  }
+}
+
+// Each thread fills a contiguous range, so pages are first touched (and
+// placed) by the thread that fills them. Uses at most ctx_large_nthreads
+// threads, and no more than there are CPUs.
+static void large_fill(void *ptr, size_t nel, size_t elsize,
+                       const void *fill, bool touch)
+{
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  long pagesize = sysconf(_SC_PAGESIZE);
+  size_t nthreads = (nel * elsize) / LARGE_FILL_MIN_BYTES;
+  nthreads = MIN2(nthreads, ctx_large_nthreads);
+  nthreads = MAX2(1, MIN2(nthreads, ncpus > 0 ? (size_t)ncpus : 1));
+
+  LargeFill lf = {.ptr = (char*)ptr, .nel = nel, .elsize = elsize,
+                  .nthreads = nthreads,
+                  .pagesize = pagesize > 0 ? (size_t)pagesize : 4096,
+                  .fill = fill, .touch = touch};
+
+  if(nel == 0) return;
+  if(nthreads == 1) large_fill_thread(&lf, 0);
+  else util_multi_thread(&lf, nthreads, large_fill_thread);
+}
+
+void alloc_large_fill(void *ptr, size_t nel, size_t elsize, const void *fill)
+{
+  large_fill(ptr, nel, elsize, fill, false);
+}
+
+void* alloc_large(size_t nel, size_t elsize, const void *fill,
+                  const char *file, const char *func, int line)
+{
+  if(nel && elsize && (SIZE_MAX - LARGE_HDR_BYTES - HUGEPAGE_BYTES) / elsize < nel)
+    _oom(NULL, nel, elsize, file, func, line);
+
+  size_t mem = LARGE_HDR_BYTES + nel*elsize, maplen = mem;
+  char *ptr = MAP_FAILED;
+
+  #ifdef MAP_HUGETLB
+    if(ctx_use_hugepages) {
+      maplen = (mem + HUGEPAGE_BYTES - 1) & ~(HUGEPAGE_BYTES - 1);
+      ptr = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if(ptr == MAP_FAILED && __sync_bool_compare_and_swap(&ctx_warned_hugetlb, 0, 1))
+        status("[memory] No huge pages reserved, using transparent huge pages");
+    }
+  #endif
+
+  if(ptr == MAP_FAILED) {
+    maplen = mem;
+    ptr = mmap(NULL, maplen, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) _oom(NULL, nel, elsize, file, func, line);
+    #ifdef MADV_HUGEPAGE
+      if(ctx_use_hugepages) madvise(ptr, maplen, MADV_HUGEPAGE);
+    #endif
+  }
+
+  __sync_add_and_fetch(&ctx_num_allocs, 1); // ++ctx_num_allocs
+
+  memcpy(ptr, &maplen, sizeof(maplen));
+  ptr += LARGE_HDR_BYTES;
+
+  // New mappings are zero'd, so only touch pages unless we have a fill value
+  large_fill(ptr, nel, elsize, fill, fill == NULL);
+  return ptr;
+}
+
+// `ptr` can be NULL
+void alloc_large_free(void *ptr)
+{
+  if(ptr == NULL) return;
+  size_t maplen;
+  char *base = (char*)ptr - LARGE_HDR_BYTES;
+  memcpy(&maplen, base, sizeof(maplen));
+  munmap(base, maplen);
+  __sync_add_and_fetch(&ctx_num_frees, 1); // ++ctx_num_frees
+}
@@ -19,6 +19,7 @@
 #define ctx_realloc(ptr,mem) alloc_mem(ptr,1,mem,false,__FILE__,__func__,__LINE__)
 #define ctx_reallocarray(ptr,nel,elsize) alloc_mem(ptr,nel,elsize,false,__FILE__,__func__,__LINE__)
 #define ctx_recallocarray(ptr,oldnel,newnel,elsize) alloc_recallocarray(ptr,oldnel,newnel,elsize,__FILE__,__func__,__LINE__)
+#define ctx_aligned_alloc(align,mem) alloc_aligned(align,mem,__FILE__,__func__,__LINE__)
 #define ctx_free(ptr) alloc_free(ptr)
 
 // Allocate / reallocate memory. `ptr` can be NULL
@@ -30,6 +31,11 @@ void* alloc_mem(void *ptr, size_t nel, size_t elsize, bool zero,
 void* alloc_recallocarray(void *ptr, size_t oldnel, size_t newnel, size_t elsize,
                           const char *file, const char *func, int line);
 
+// Allocate `mem` bytes aligned to `align` (a power of two, multiple of
+// sizeof(void*)). Memory is not zero'd. Free with ctx_free()
+void* alloc_aligned(size_t align, size_t mem,
+                    const char *file, const char *func, int line);
+
 // Free allocated memory, `ptr` is allowed to be NULL
 void alloc_free(void *ptr);
 
@@ -37,4 +43,39 @@ void alloc_free(void *ptr);
 size_t alloc_get_num_allocs();
 size_t alloc_get_num_frees();
 
+//
+// Large arrays (hash table, graph colour arrays)
+//
+// Mapped with mmap() so they can be backed by huge pages, which saves TLB misses
+// when arrays of many GB are accessed at random. Pages are first touched by
+// several threads, so on NUMA machines they are spread over the nodes those
+// threads run on, rather than all landing on the node of the allocating thread.
+//
+
+// Allocate nel*elsize bytes. If `fill` is NULL memory is zero'd, otherwise
+// every element is set to a copy of fill[0..elsize-1]. Must be free'd with
+// ctx_large_free()
+#define ctx_large_alloc(nel,elsize,fill) alloc_large(nel,elsize,fill,__FILE__,__func__,__LINE__)
+#define ctx_large_free(ptr) alloc_large_free(ptr)
+
+void* alloc_large(size_t nel, size_t elsize, const void *fill,
+                  const char *file, const char *func, int line);
+
+// `ptr` is allowed to be NULL
+void alloc_large_free(void *ptr);
+
+// Set `nel` elements of `ptr` to `fill` (zero if NULL) using multiple threads
+void alloc_large_fill(void *ptr, size_t nel, size_t elsize, const void *fill);
+
+// Maximum number of threads used to fill large arrays [default: 1]
+// Set to the command's -t,--threads value
+void alloc_set_nthreads(size_t nthreads);
+size_t alloc_get_nthreads();
+
+// Back large arrays with huge pages: explicit huge pages (MAP_HUGETLB) if any
+// are reserved, otherwise transparent huge pages (madvise MADV_HUGEPAGE).
+// Set with --hugepages. Only affects arrays allocated after it is set.
+void alloc_set_hugepages(bool use_hugepages);
+bool alloc_get_hugepages();
+
 #endif /* CTX_ALLOC_H_ */
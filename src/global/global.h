@@ -36,6 +36,7 @@
 //  MAX_KMER_SIZE    Max kmer-size compiled e.g. 31 for maxk=31, 63 for maxk=63
 //  USE_CITY_HASH=1  Use Google's CityHash instead of Bob Jenkin's lookup3
 //  USE_XXHASH=1     Use xxHash instead of Bob Jenkin's lookup3
+//  HASH_TABLE_REHASH=1 Hash tables rehash each round instead of using wyhash
 
 #define ONE_MEGABYTE (1<<20)
 #define MAX_IO_THREADS 10
@@ -154,6 +154,33 @@ BinaryKmer binary_kmer_reverse_complement(const BinaryKmer bkmer,
   return revcmp;
 }
 
+#define ROLL_BATCH 64
+
+void binary_kmer_roll_str(const char *seq, size_t len, size_t kmer_size,
+                          BinaryKmer *fw, BinaryKmer *rv,
+                          BinaryKmer *bkmers, BinaryKmer *bkeys)
+{
+  Nucleotide nucs[ROLL_BATCH];
+  BinaryKmer f = *fw, r = *rv;
+  size_t i, j, n;
+
+  for(i = 0; i < len; i += n)
+  {
+    // Convert a batch of bases at once (vectorised), then roll kmers
+    n = MIN2(len - i, ROLL_BATCH);
+    for(j = 0; j < n; j++) nucs[j] = dna_char_to_nuc_fast(seq[i+j]);
+
+    for(j = 0; j < n; j++) {
+      binary_kmer_roll(&f, &r, kmer_size, nucs[j]);
+      if(bkmers) bkmers[i+j] = f;
+      if(bkeys) bkeys[i+j] = binary_kmer_roll_key(f, r);
+    }
+  }
+
+  *fw = f;
+  *rv = r;
+}
+
 // Get a random binary kmer -- useful for testing
 BinaryKmer binary_kmer_random(size_t kmer_size)
 {
@@ -34,6 +34,24 @@ extern const BinaryKmer zero_bkmer;
   #define binary_kmer_hash(bkmer,rehash) bklk3_hashlittle((bkmer), (rehash))
 #endif
 
+// Fast 64 bit hash (wyhash style multiply-mix), one multiply per word.
+// Both halves are well mixed, so callers can derive several hash values from
+// one call instead of rehashing with a new seed.
+static inline uint64_t bkmer_wymix(uint64_t a, uint64_t b)
+{
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t binary_kmer_hash64(const BinaryKmer bkmer, uint64_t seed)
+{
+  uint64_t h = seed ^ 0xa0761d6478bd642fUL;
+  size_t i;
+  for(i = 0; i < NUM_BKMER_WORDS; i++)
+    h = bkmer_wymix(bkmer.b[i] ^ 0xe7037ed1a0b428dbUL, h ^ 0x8ebc6af09c88c6e3UL);
+  return bkmer_wymix(h ^ BKMER_BYTES, 0x589965cc75374cc3UL);
+}
+
 
 // Since kmer_size is always odd, top word always has <= 62 bits used
 // Number of bases store in all but the top word
@@ -138,6 +156,30 @@ BinaryKmer binary_kmer_right_shift_add(const BinaryKmer bkmer, size_t kmer_size,
   return b;
 }
 
+//
+// Rolling kmers
+//
+// A kmer and its reverse complement are updated a base at a time, so that the
+// key of each kmer in a sequence is found without reverse complementing it.
+// Start with fw = rv = zero_bkmer and add the first kmer_size-1 bases.
+//
+
+static inline void binary_kmer_roll(BinaryKmer *fw, BinaryKmer *rv,
+                                    size_t kmer_size, Nucleotide nuc)
+{
+  *fw = binary_kmer_left_shift_add(*fw, kmer_size, nuc);
+  *rv = binary_kmer_right_shift_add(*rv, kmer_size, (Nucleotide)(nuc ^ 3));
+}
+
+#define binary_kmer_roll_key(fw,rv) (binary_kmer_less_than(fw,rv) ? (fw) : (rv))
+
+// Add bases seq[0..len-1], which must be ACGT, to rolling kmer fw,rv.
+// The kmer and key after adding each base are stored in bkmers[i] and bkeys[i]
+// (if not NULL).
+void binary_kmer_roll_str(const char *seq, size_t len, size_t kmer_size,
+                          BinaryKmer *fw, BinaryKmer *rv,
+                          BinaryKmer *bkmers, BinaryKmer *bkeys);
+
 // Reverse complement a binary kmer from kmer into revcmp_kmer
 BinaryKmer binary_kmer_reverse_complement(const BinaryKmer bkmer, size_t kmer_size);
 
@@ -0,0 +1,389 @@
+#include "global.h"
+#include "colour_sets.h"
+#include "hash.h"
+#include "util.h"
+
+#define COLSET_CACHE_SIZE (1UL<<COLSET_CACHE_BITS)
+#define COLSET_DICT_INIT_CAP 1024
+
+// A chunk and its share of the bitmap used by colset_compact()
+#define COLSET_CHUNK_MEM (COLSET_CHUNK_WORDS * sizeof(uint32_t) + \
+                          COLSET_CHUNK_WORDS / 8)
+#define COLSET_CACHE_MEM (COLSET_CACHE_SIZE * (sizeof(uint64_t) + sizeof(uint32_t)) + \
+                          roundup_bits2bytes(COLSET_CACHE_SIZE))
+
+// Set in the length of a list whilst compacting if a kmer uses it
+#define COLSET_LIVE (1U<<31)
+
+#define colset_id(chunk,offset) ((uint32_t)(((chunk) << COLSET_CHUNK_BITS) | (offset)))
+#define colset_ptr(cs,id) ((cs)->chunks[(id)>>COLSET_CHUNK_BITS] + \
+                           ((id) & (COLSET_CHUNK_WORDS-1)))
+
+#define colset_cache_slot(key) \
+        (((key) * 0x9e3779b97f4a7c15UL) >> (64 - COLSET_CACHE_BITS))
+
+static inline uint32_t colset_hash(const uint32_t *cols, size_t n)
+{
+  return ctx_hash32(cols, n*sizeof(uint32_t), 0);
+}
+
+void colour_sets_alloc(ColourSets *cs, uint64_t capacity)
+{
+  memset(cs, 0, sizeof(ColourSets));
+  cs->ids = ctx_large_alloc(capacity, sizeof(uint32_t), NULL);
+  cs->capacity = capacity;
+  cs->cache_keys = ctx_malloc(COLSET_CACHE_SIZE * sizeof(uint64_t));
+  cs->cache_ids = ctx_malloc(COLSET_CACHE_SIZE * sizeof(uint32_t));
+  cs->cache_locks = ctx_calloc(roundup_bits2bytes(COLSET_CACHE_SIZE), 1);
+  if(pthread_mutex_init(&cs->lock, NULL) != 0) die("Mutex init failed");
+  colour_sets_reset(cs);
+}
+
+void colour_sets_dealloc(ColourSets *cs)
+{
+  size_t i;
+  for(i = 0; i < cs->num_chunks; i++) ctx_free(cs->chunks[i]);
+  ctx_large_free(cs->ids);
+  ctx_free(cs->dict);
+  ctx_free(cs->cache_keys);
+  ctx_free(cs->cache_ids);
+  ctx_free(cs->cache_locks);
+  pthread_mutex_destroy(&cs->lock);
+  memset(cs, 0, sizeof(ColourSets));
+}
+
+void colour_sets_reset(ColourSets *cs)
+{
+  size_t i;
+  for(i = 1; i < cs->num_chunks; i++) ctx_free(cs->chunks[i]);
+  if(cs->num_chunks == 0) cs->chunks[0] = ctx_malloc(COLSET_CHUNK_WORDS * sizeof(uint32_t));
+  cs->num_chunks = 1;
+
+  // Id 0 is the empty set
+  cs->chunks[0][0] = 0;
+  cs->chunk_used = 1;
+  cs->num_sets = 1;
+
+  ctx_free(cs->dict);
+  cs->dict_cap = COLSET_DICT_INIT_CAP;
+  cs->dict = ctx_calloc(cs->dict_cap, sizeof(uint32_t));
+
+  // (UINT32_MAX,UINT32_MAX) is never looked up
+  memset(cs->cache_keys, 0xff, COLSET_CACHE_SIZE * sizeof(uint64_t));
+  memset(cs->ids, 0, cs->capacity * sizeof(uint32_t));
+  cs->live_mem = colour_sets_dict_mem(cs);
+}
+
+size_t colour_sets_min_mem()
+{
+  return COLSET_CHUNK_MEM + COLSET_DICT_INIT_CAP * sizeof(uint32_t) +
+         COLSET_CACHE_MEM;
+}
+
+void colour_sets_limit_mem(ColourSets *cs, size_t max_mem)
+{
+  cs->max_mem = MAX2(max_mem, colour_sets_min_mem());
+}
+
+// Die if the dictionary cannot grow by `extra` bytes
+static void colset_check_mem(const ColourSets *cs, size_t extra)
+{
+  if(cs->max_mem && colour_sets_dict_mem(cs) + extra > cs->max_mem) {
+    char nsets_str[50], mem_str[50];
+    ulong_to_str(cs->num_sets, nsets_str);
+    bytes_to_str(cs->max_mem, 1, mem_str);
+    status("[ColourSets] %s distinct colour sets; limit: %s", nsets_str, mem_str);
+    die("Out of memory for colour sets, try increasing -m,--memory");
+  }
+}
+
+// Returns slot of list `cols`, or the empty slot it would go in
+static size_t colset_dict_slot(const ColourSets *cs, uint32_t h,
+                               const uint32_t *cols, size_t n)
+{
+  size_t mask = cs->dict_cap - 1, i = h & mask, m;
+  const uint32_t *list;
+  while(cs->dict[i] != 0) {
+    list = colour_sets_list(cs, cs->dict[i], &m);
+    if(m == n && memcmp(list, cols, n * sizeof(uint32_t)) == 0) break;
+    i = (i+1) & mask;
+  }
+  return i;
+}
+
+static void colset_dict_resize(ColourSets *cs)
+{
+  uint32_t *old = cs->dict;
+  size_t i, j, n, old_cap = cs->dict_cap;
+  const uint32_t *list;
+
+  colset_check_mem(cs, cs->dict_cap * 2 * sizeof(uint32_t));
+  cs->dict_cap *= 2;
+  cs->dict = ctx_calloc(cs->dict_cap, sizeof(uint32_t));
+
+  for(i = 0; i < old_cap; i++) {
+    if(old[i]) {
+      list = colour_sets_list(cs, old[i], &n);
+      j = colset_dict_slot(cs, colset_hash(list, n), list, n);
+      cs->dict[j] = old[i];
+    }
+  }
+
+  ctx_free(old);
+}
+
+// Get the id of a list of entries sorted by colour, adding it if needed.
+// Thread safe.
+static uint32_t colset_intern(ColourSets *cs, const uint32_t *ents, size_t n)
+{
+  if(n == 0) return 0;
+  if(n+1 > COLSET_CHUNK_WORDS) die("Too many colours for a colour set: %zu", n);
+
+  uint32_t h = colset_hash(ents, n), id;
+  size_t i;
+
+  pthread_mutex_lock(&cs->lock);
+
+  i = colset_dict_slot(cs, h, ents, n);
+
+  if(cs->dict[i] == 0)
+  {
+    // Add a new list
+    if(cs->chunk_used + n+1 > COLSET_CHUNK_WORDS) {
+      if(cs->num_chunks == COLSET_MAX_CHUNKS) die("Too many colour sets");
+      colset_check_mem(cs, COLSET_CHUNK_MEM);
+      cs->chunk_ends[cs->num_chunks-1] = cs->chunk_used;
+      cs->chunks[cs->num_chunks] = ctx_malloc(COLSET_CHUNK_WORDS * sizeof(uint32_t));
+      cs->num_chunks++;
+      cs->chunk_used = 0;
+    }
+
+    uint32_t *list = cs->chunks[cs->num_chunks-1] + cs->chunk_used;
+    list[0] = n;
+    memcpy(list+1, ents, n * sizeof(uint32_t));
+    id = colset_id(cs->num_chunks-1, cs->chunk_used);
+    cs->chunk_used += n+1;
+    cs->num_sets++;
+
+    // List must be visible before its id is
+    __sync_synchronize();
+
+    cs->dict[i] = id;
+    if(cs->num_sets*2 > cs->dict_cap) colset_dict_resize(cs);
+  }
+  else id = cs->dict[i];
+
+  pthread_mutex_unlock(&cs->lock);
+
+  return id;
+}
+
+// Id of set `id` with entries `ents` (sorted by colour) added
+static uint32_t colset_merge(ColourSets *cs, uint32_t id,
+                             const uint32_t *ents, size_t n)
+{
+  size_t i = 0, j = 0, k = 0, m;
+  const uint32_t *list = colour_sets_list(cs, id, &m);
+  uint32_t tmp[m+n];
+  bool changed = false;
+
+  while(i < m && j < n) {
+    if(colset_entry_col(list[i]) < colset_entry_col(ents[j])) {
+      tmp[k++] = list[i++];
+    }
+    else if(colset_entry_col(list[i]) > colset_entry_col(ents[j])) {
+      tmp[k++] = ents[j++];
+      changed = true;
+    }
+    else {
+      // Same colour: OR edges
+      tmp[k] = list[i] | ents[j];
+      changed |= (tmp[k] != list[i]);
+      i++; j++; k++;
+    }
+  }
+
+  if(j == n && !changed) return id;
+
+  memcpy(tmp+k, list+i, (m-i) * sizeof(uint32_t));
+  memcpy(tmp+k+m-i, ents+j, (n-j) * sizeof(uint32_t));
+  return colset_intern(cs, tmp, k+m-i+n-j);
+}
+
+// Id of set `id` with colour `col` removed
+static uint32_t colset_remove(ColourSets *cs, uint32_t id, uint32_t col)
+{
+  size_t i, n;
+  const uint32_t *list = colour_sets_list(cs, id, &n);
+
+  for(i = 0; i < n && colset_entry_col(list[i]) < col; i++) {}
+  if(i == n || colset_entry_col(list[i]) != col) return id;
+
+  uint32_t tmp[n];
+  memcpy(tmp, list, i * sizeof(uint32_t));
+  memcpy(tmp+i, list+i+1, (n-i-1) * sizeof(uint32_t));
+  return colset_intern(cs, tmp, n-1);
+}
+
+// Cached colset_merge() for adding one entry
+static uint32_t colset_add(ColourSets *cs, uint32_t id, uint32_t ent)
+{
+  uint64_t key = ((uint64_t)id << 32) | ent, slot = colset_cache_slot(key);
+  uint32_t newid;
+  bool hit;
+
+  bitlock_yield_acquire(cs->cache_locks, slot);
+  hit = (cs->cache_keys[slot] == key);
+  newid = cs->cache_ids[slot];
+  bitlock_release(cs->cache_locks, slot);
+
+  if(hit) return newid;
+
+  newid = colset_merge(cs, id, &ent, 1);
+
+  bitlock_yield_acquire(cs->cache_locks, slot);
+  cs->cache_keys[slot] = key;
+  cs->cache_ids[slot] = newid;
+  bitlock_release(cs->cache_locks, slot);
+
+  return newid;
+}
+
+void colour_sets_add_mt(ColourSets *cs, hkey_t hkey,
+                        const uint32_t *ents, size_t n)
+{
+  volatile uint32_t *ptr = &cs->ids[hkey];
+  uint32_t id, newid;
+
+  if(n == 0) return;
+
+  do {
+    id = *ptr;
+    newid = (n == 1 ? colset_add(cs, id, ents[0])
+                    : colset_merge(cs, id, ents, n));
+  } while(newid != id && !__sync_bool_compare_and_swap(ptr, id, newid));
+}
+
+void colour_sets_add_col_mt(ColourSets *cs, hkey_t hkey, size_t col)
+{
+  uint32_t ent = colset_entry(col, 0);
+  colour_sets_add_mt(cs, hkey, &ent, 1);
+}
+
+void colour_sets_del_col_mt(ColourSets *cs, hkey_t hkey, size_t col)
+{
+  volatile uint32_t *ptr = &cs->ids[hkey];
+  uint32_t id, newid;
+
+  do {
+    id = *ptr;
+    newid = colset_remove(cs, id, col);
+  } while(newid != id && !__sync_bool_compare_and_swap(ptr, id, newid));
+}
+
+//
+// Removing unused lists
+//
+
+// Words used in chunk `c`
+static inline size_t colset_chunk_end(const ColourSets *cs, size_t c)
+{
+  return c+1 < cs->num_chunks ? cs->chunk_ends[c] : cs->chunk_used;
+}
+
+// Slide lists that kmers use down over unused lists, keeping their order
+// 1. mark lists in use
+// 2. give each list in use its new id, stored in place of its length. The
+//    start of every list is saved in a bitmap, so lengths can be recovered
+// 3. update kmer ids
+// 4. move lists, which only ever move to a lower address
+static void colset_compact(ColourSets *cs)
+{
+  size_t nwords = cs->num_chunks * COLSET_CHUNK_WORDS;
+  uint64_t *starts = ctx_calloc(roundup_bits2words64(nwords), sizeof(uint64_t));
+  uint32_t *new_ends = ctx_calloc(cs->num_chunks, sizeof(uint32_t));
+  size_t h, c, x, y, end, n, base, dc = 0, dx = 1, nsets = 1;
+  uint32_t *p, *q, newid;
+
+  // Id 0 (the empty set) is at chunk 0, offset 0 and is never moved
+  for(h = 0; h < cs->capacity; h++)
+    if(cs->ids[h]) colset_ptr(cs, cs->ids[h])[0] |= COLSET_LIVE;
+
+  for(c = 0; c < cs->num_chunks; c++) {
+    end = colset_chunk_end(cs, c);
+    for(x = (c == 0); x < end; x += n+1) {
+      p = cs->chunks[c] + x;
+      n = p[0] & ~COLSET_LIVE;
+      bitset_set(starts, c*COLSET_CHUNK_WORDS + x);
+      if(p[0] & COLSET_LIVE) {
+        if(dx + n+1 > COLSET_CHUNK_WORDS) { new_ends[dc++] = dx; dx = 0; }
+        p[0] = colset_id(dc, dx);
+        dx += n+1;
+        nsets++;
+      }
+      else p[0] = 0; // not in use
+    }
+  }
+
+  for(h = 0; h < cs->capacity; h++)
+    if(cs->ids[h]) cs->ids[h] = colset_ptr(cs, cs->ids[h])[0];
+
+  for(c = 0; c < cs->num_chunks; c++) {
+    end = colset_chunk_end(cs, c);
+    base = c*COLSET_CHUNK_WORDS;
+    for(x = (c == 0); x < end; x = y) {
+      for(y = x+1; y < end && !bitset_get(starts, base+y); y++) {}
+      p = cs->chunks[c] + x;
+      if((newid = p[0]) != 0) {
+        n = y-x-1;
+        q = colset_ptr(cs, newid);
+        memmove(q+1, p+1, n * sizeof(uint32_t));
+        q[0] = n;
+      }
+    }
+  }
+
+  for(c = dc+1; c < cs->num_chunks; c++) ctx_free(cs->chunks[c]);
+  memcpy(cs->chunk_ends, new_ends, dc * sizeof(uint32_t));
+  cs->num_chunks = dc+1;
+  cs->chunk_used = dx;
+  cs->num_sets = nsets;
+
+  ctx_free(starts);
+  ctx_free(new_ends);
+
+  // Rebuild dictionary and clear cache, since ids have changed
+  const uint32_t *list;
+  memset(cs->dict, 0, cs->dict_cap * sizeof(uint32_t));
+  for(c = 0; c < cs->num_chunks; c++) {
+    end = colset_chunk_end(cs, c);
+    for(x = (c == 0); x < end; x += n+1) {
+      list = colour_sets_list(cs, colset_id(c, x), &n);
+      cs->dict[colset_dict_slot(cs, colset_hash(list, n), list, n)] = colset_id(c, x);
+    }
+  }
+
+  memset(cs->cache_keys, 0xff, COLSET_CACHE_SIZE * sizeof(uint64_t));
+}
+
+void colour_sets_collect(ColourSets *cs)
+{
+  size_t mem = colour_sets_dict_mem(cs);
+
+  if(mem < 2 * cs->live_mem && (!cs->max_mem || mem < cs->max_mem / 2))
+    return;
+
+  size_t nchunks = cs->num_chunks, nsets = cs->num_sets;
+  colset_compact(cs);
+  cs->live_mem = colour_sets_dict_mem(cs);
+
+  status("[ColourSets] Removed %zu unused colour sets, %zu -> %zu chunks",
+         nsets - cs->num_sets, nchunks, cs->num_chunks);
+}
+
+size_t colour_sets_dict_mem(const ColourSets *cs)
+{
+  return cs->num_chunks * COLSET_CHUNK_MEM +
+         cs->dict_cap * sizeof(uint32_t) +
+         COLSET_CACHE_MEM;
+}
@@ -0,0 +1,130 @@
+#ifndef COLOUR_SETS_H_
+#define COLOUR_SETS_H_
+
+#include <pthread.h>
+#include "cortex_types.h"
+
+//
+// Sparse record of which colours each kmer is in, and its edges in each colour
+//
+// With thousands of samples most kmers are in only a few colours, and many
+// kmers are in the same colours. Instead of a bit per kmer per colour we store
+// a 32 bit id per kmer, which points to a sorted list of entries in a shared
+// dictionary. Each entry is <24 bits:colour><8 bits:edges>, so lists sort by
+// colour. Each distinct list is stored once. Id 0 is the empty set.
+//
+// Lists are stored in chunks of COLSET_CHUNK_WORDS words that are not moved
+// whilst kmers are being updated, so lists can be read without locks. An id is
+// <12 bits:chunk><20 bits:offset>. Adding new lists takes a lock; a cache of
+// (id,entry) -> id transitions means most additions of a colour to a kmer
+// don't need it.
+//
+// Lists that no kmer uses any more are left in place until
+// colour_sets_collect() is called, when no kmers are being updated.
+//
+
+#define COLSET_CHUNK_BITS 20
+#define COLSET_CHUNK_WORDS (1UL<<COLSET_CHUNK_BITS)
+#define COLSET_MAX_CHUNKS (1UL<<(32-COLSET_CHUNK_BITS))
+#define COLSET_CACHE_BITS 16
+#define COLSET_MAX_COLS (1UL<<24)
+
+#define colset_entry(col,edges) (((uint32_t)(col) << 8) | (edges))
+#define colset_entry_col(ent) ((ent) >> 8)
+#define colset_entry_edges(ent) ((Edges)((ent) & 0xff))
+
+typedef struct
+{
+  uint32_t *ids; // [capacity] colour set id of each kmer
+  uint64_t capacity;
+  // Dictionary of lists: <uint32_t:n><uint32_t[n]:entries>
+  uint32_t *chunks[COLSET_MAX_CHUNKS];
+  uint32_t chunk_ends[COLSET_MAX_CHUNKS]; // words used in each full chunk
+  size_t num_chunks, chunk_used; // words used in last chunk
+  size_t num_sets;
+  size_t max_mem; // die if dictionary needs more memory, 0 if no limit
+  size_t live_mem; // dictionary memory after last colour_sets_collect()
+  // Open addressing hash of list ids, for finding existing lists
+  uint32_t *dict; // 0 is empty (the empty set is not stored)
+  size_t dict_cap;
+  // Direct mapped cache of (id<<32|col) -> id with a lock per slot
+  uint64_t *cache_keys;
+  uint32_t *cache_ids;
+  uint8_t *cache_locks;
+  pthread_mutex_t lock; // held whilst adding lists
+} ColourSets;
+
+void colour_sets_alloc(ColourSets *cs, uint64_t capacity);
+void colour_sets_dealloc(ColourSets *cs);
+
+// Set all kmers to the empty set and remove all lists
+void colour_sets_reset(ColourSets *cs);
+
+// Get list of entries for set `id`. Returns array of length *n sorted by colour.
+static inline const uint32_t* colour_sets_list(const ColourSets *cs,
+                                               uint32_t id, size_t *n)
+{
+  const uint32_t *p = cs->chunks[id>>COLSET_CHUNK_BITS] +
+                      (id & (COLSET_CHUNK_WORDS-1));
+  *n = p[0];
+  return p+1;
+}
+
+// Entry for colour `col` in the set of kmer `hkey`, NULL if not in colour
+static inline const uint32_t* colour_sets_find(const ColourSets *cs,
+                                               hkey_t hkey, size_t col)
+{
+  uint32_t id = *(volatile const uint32_t*)&cs->ids[hkey];
+  if(id == 0) return NULL;
+  size_t n, lo = 0, mid;
+  const uint32_t *ents = colour_sets_list(cs, id, &n);
+  while(lo < n) {
+    mid = (lo + n) / 2;
+    if(colset_entry_col(ents[mid]) == col) return &ents[mid];
+    if(colset_entry_col(ents[mid]) < col) lo = mid+1;
+    else n = mid;
+  }
+  return NULL;
+}
+
+static inline bool colour_sets_has_col(const ColourSets *cs, hkey_t hkey,
+                                       size_t col)
+{
+  return colour_sets_find(cs, hkey, col) != NULL;
+}
+
+static inline Edges colour_sets_edges(const ColourSets *cs, hkey_t hkey,
+                                      size_t col)
+{
+  const uint32_t *ent = colour_sets_find(cs, hkey, col);
+  return ent ? colset_entry_edges(*ent) : 0;
+}
+
+// Thread safe
+void colour_sets_add_col_mt(ColourSets *cs, hkey_t hkey, size_t col);
+void colour_sets_del_col_mt(ColourSets *cs, hkey_t hkey, size_t col);
+
+// Add entries `ents`, sorted by colour, to the set of kmer `hkey`. Edges of
+// colours already in the set are OR'd. Adding all of a kmer's colours at once
+// only stores its final list. Thread safe.
+void colour_sets_add_mt(ColourSets *cs, hkey_t hkey,
+                        const uint32_t *ents, size_t n);
+
+// Remove lists that no kmers use, if the dictionary has doubled in size since
+// the last call or is close to its memory limit. Lists are moved and kmer ids
+// updated, so this must not be called whilst kmers are being updated.
+void colour_sets_collect(ColourSets *cs);
+
+// Number of distinct colour lists stored
+#define colour_sets_num(cs) ((cs)->num_sets)
+
+// Bytes of memory used, excluding ids array
+size_t colour_sets_dict_mem(const ColourSets *cs);
+
+// Memory used by an empty dictionary
+size_t colour_sets_min_mem();
+
+// Die if the dictionary would need more than `max_mem` bytes
+void colour_sets_limit_mem(ColourSets *cs, size_t max_mem);
+
+#endif /* COLOUR_SETS_H_ */
@@ -0,0 +1,168 @@
+#include "global.h"
+#include "covg_overflow.h"
+
+#define COVG_OVF_STRIPE_BITS 12
+#define COVG_OVF_INIT_CAP 16
+
+#define covg_ovf_hash(idx) ((idx) * 0x9e3779b97f4a7c15UL)
+#define covg_ovf_stripe(h) ((h) >> (64 - COVG_OVF_STRIPE_BITS))
+
+#define covg_ovf_lock(ovf,t) bitlock_yield_acquire((volatile uint8_t*)(ovf)->locks, t)
+#define covg_ovf_unlock(ovf,t) bitlock_release((volatile uint8_t*)(ovf)->locks, t)
+
+#define covg_ovf_sum(a,b) ((uint64_t)(a)+(b) > COVG_MAX ? COVG_MAX : (a)+(b))
+
+void covg_ovf_alloc(CovgOverflow *ovf)
+{
+  ctx_assert(COVG_OVF_STRIPES == (1 << COVG_OVF_STRIPE_BITS));
+  ovf->tables = ctx_calloc(COVG_OVF_STRIPES, sizeof(CovgOverflowTable));
+  ovf->locks = ctx_calloc(roundup_bits2bytes(COVG_OVF_STRIPES), 1);
+  ovf->num_entries = 0;
+}
+
+void covg_ovf_dealloc(CovgOverflow *ovf)
+{
+  size_t i;
+  if(ovf->tables != NULL) {
+    for(i = 0; i < COVG_OVF_STRIPES; i++) {
+      ctx_free(ovf->tables[i].keys);
+      ctx_free(ovf->tables[i].covgs);
+    }
+  }
+  ctx_free(ovf->tables);
+  ctx_free(ovf->locks);
+  memset(ovf, 0, sizeof(CovgOverflow));
+}
+
+void covg_ovf_reset(CovgOverflow *ovf)
+{
+  size_t i;
+  for(i = 0; i < COVG_OVF_STRIPES; i++) {
+    ctx_free(ovf->tables[i].keys);
+    ctx_free(ovf->tables[i].covgs);
+    memset(&ovf->tables[i], 0, sizeof(CovgOverflowTable));
+  }
+  ovf->num_entries = 0;
+}
+
+// Returns slot of `idx`, or the empty slot it would go in
+static inline size_t covg_ovf_slot(const CovgOverflowTable *tbl,
+                                   uint64_t h, uint64_t idx)
+{
+  size_t mask = tbl->cap - 1, i = (h >> 16) & mask;
+  while(tbl->keys[i] != 0 && tbl->keys[i] != idx+1) i = (i+1) & mask;
+  return i;
+}
+
+static void covg_ovf_table_resize(CovgOverflowTable *tbl)
+{
+  CovgOverflowTable old = *tbl;
+  size_t i, j;
+
+  tbl->cap = old.cap ? old.cap * 2 : COVG_OVF_INIT_CAP;
+  tbl->keys = ctx_calloc(tbl->cap, sizeof(uint64_t));
+  tbl->covgs = ctx_calloc(tbl->cap, sizeof(Covg));
+
+  for(i = 0; i < old.cap; i++) {
+    if(old.keys[i]) {
+      j = covg_ovf_slot(tbl, covg_ovf_hash(old.keys[i]-1), old.keys[i]-1);
+      tbl->keys[j] = old.keys[i];
+      tbl->covgs[j] = old.covgs[i];
+    }
+  }
+
+  ctx_free(old.keys);
+  ctx_free(old.covgs);
+}
+
+// Must hold the lock for the table
+static inline void covg_ovf_set_locked(CovgOverflow *ovf, CovgOverflowTable *tbl,
+                                       uint64_t h, uint64_t idx, Covg covg)
+{
+  if((tbl->n+1)*2 > tbl->cap) covg_ovf_table_resize(tbl);
+  size_t i = covg_ovf_slot(tbl, h, idx);
+  if(tbl->keys[i] == 0) {
+    tbl->keys[i] = idx+1;
+    tbl->n++;
+    __sync_add_and_fetch(&ovf->num_entries, 1);
+  }
+  tbl->covgs[i] = covg;
+}
+
+Covg covg_ovf_get(const CovgOverflow *ovf, uint64_t idx)
+{
+  uint64_t h = covg_ovf_hash(idx), t = covg_ovf_stripe(h);
+  const CovgOverflowTable *tbl = &ovf->tables[t];
+  Covg covg;
+
+  covg_ovf_lock(ovf, t);
+  ctx_assert(tbl->cap > 0);
+  size_t i = covg_ovf_slot(tbl, h, idx);
+  ctx_assert2(tbl->keys[i] == idx+1, "Coverage not in overflow table");
+  covg = tbl->covgs[i];
+  covg_ovf_unlock(ovf, t);
+
+  return covg;
+}
+
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg)
+{
+  uint64_t h = covg_ovf_hash(idx), t = covg_ovf_stripe(h);
+  covg_ovf_lock(ovf, t);
+  covg_ovf_set_locked(ovf, &ovf->tables[t], h, idx, covg);
+  covg_ovf_unlock(ovf, t);
+}
+
+void covg_ovf_add(CovgOverflow *ovf, uint64_t idx, Covg update)
+{
+  uint64_t h = covg_ovf_hash(idx), t = covg_ovf_stripe(h);
+  CovgOverflowTable *tbl = &ovf->tables[t];
+
+  covg_ovf_lock(ovf, t);
+  ctx_assert(tbl->cap > 0);
+  size_t i = covg_ovf_slot(tbl, h, idx);
+  ctx_assert2(tbl->keys[i] == idx+1, "Coverage not in overflow table");
+  tbl->covgs[i] = covg_ovf_sum(tbl->covgs[i], update);
+  covg_ovf_unlock(ovf, t);
+}
+
+// A counter only becomes COVG8_OVERFLOW whilst holding the lock for its table,
+// so threads that see COVG8_OVERFLOW then take the lock find its entry
+void covg8_add_mt(CovgOverflow *ovf, volatile uint8_t *c, uint64_t idx,
+                  Covg update)
+{
+  uint64_t h = covg_ovf_hash(idx), t = covg_ovf_stripe(h);
+  uint8_t v;
+  bool moved;
+
+  while(1)
+  {
+    v = *c;
+
+    if(v == COVG8_OVERFLOW) {
+      covg_ovf_add(ovf, idx, update);
+      return;
+    }
+
+    if((uint64_t)v + update < COVG8_OVERFLOW) {
+      if(__sync_bool_compare_and_swap(c, v, (uint8_t)(v + update))) return;
+      continue;
+    }
+
+    // Move counter into the side table
+    covg_ovf_lock(ovf, t);
+    moved = __sync_bool_compare_and_swap(c, v, COVG8_OVERFLOW);
+    if(moved) covg_ovf_set_locked(ovf, &ovf->tables[t], h, idx, covg_ovf_sum(v, update));
+    covg_ovf_unlock(ovf, t);
+    if(moved) return;
+  }
+}
+
+size_t covg_ovf_mem(const CovgOverflow *ovf)
+{
+  size_t i, mem = COVG_OVF_STRIPES * sizeof(CovgOverflowTable) +
+                  roundup_bits2bytes(COVG_OVF_STRIPES);
+  for(i = 0; i < COVG_OVF_STRIPES; i++)
+    mem += ovf->tables[i].cap * (sizeof(uint64_t) + sizeof(Covg));
+  return mem;
+}
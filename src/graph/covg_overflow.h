@@ -0,0 +1,80 @@
+#ifndef COVG_OVERFLOW_H_
+#define COVG_OVERFLOW_H_
+
+#include "cortex_types.h"
+
+//
+// Side table of coverages too large for 8 bit counters
+//
+// Graphs allocated with DBG_ALLOC_COVGS8 store one byte per kmer per colour.
+// Coverages of COVG8_OVERFLOW or more set the byte to COVG8_OVERFLOW and are
+// stored here, keyed by their index in the counter array (hkey*ncols + col).
+//
+// Entries are split over COVG_OVF_STRIPES open addressing tables, each with a
+// lock, so updates from many threads rarely wait on each other. Tables double
+// in size when half full.
+//
+
+#define COVG8_OVERFLOW 255
+#define COVG_OVF_STRIPES 4096
+
+typedef struct
+{
+  uint64_t *keys; // index+1, zero if empty
+  Covg *covgs;
+  size_t n, cap;
+} CovgOverflowTable;
+
+typedef struct
+{
+  CovgOverflowTable *tables; // [COVG_OVF_STRIPES]
+  uint8_t *locks; // 1 bit per table, cast to volatile
+  volatile size_t num_entries;
+} CovgOverflow;
+
+void covg_ovf_alloc(CovgOverflow *ovf);
+void covg_ovf_dealloc(CovgOverflow *ovf);
+
+// Remove all entries
+void covg_ovf_reset(CovgOverflow *ovf);
+
+// Thread safe
+// Get coverage of counter `idx`, must have been set with covg_ovf_set()
+Covg covg_ovf_get(const CovgOverflow *ovf, uint64_t idx);
+
+// Thread safe
+// Set coverage of counter `idx`, adding it if it is not in the table
+void covg_ovf_set(CovgOverflow *ovf, uint64_t idx, Covg covg);
+
+// Thread safe, overflow safe
+// Add to coverage of counter `idx`, which must already be in the table
+void covg_ovf_add(CovgOverflow *ovf, uint64_t idx, Covg update);
+
+// Thread safe, overflow safe
+// Add `update` to the 8 bit counter `*c` at index `idx`, moving it into the
+// side table if it reaches COVG8_OVERFLOW
+void covg8_add_mt(CovgOverflow *ovf, volatile uint8_t *c, uint64_t idx,
+                  Covg update);
+
+// Thread safe
+// Read an 8 bit counter
+static inline Covg covg8_get(const CovgOverflow *ovf, const uint8_t *c,
+                             uint64_t idx)
+{
+  uint8_t v = *(volatile const uint8_t*)c;
+  return v < COVG8_OVERFLOW ? v : covg_ovf_get(ovf, idx);
+}
+
+// Not thread safe
+// Set an 8 bit counter
+static inline void covg8_set(CovgOverflow *ovf, uint8_t *c, uint64_t idx,
+                             Covg covg)
+{
+  if(covg < COVG8_OVERFLOW) *c = (uint8_t)covg;
+  else { covg_ovf_set(ovf, idx, covg); *c = COVG8_OVERFLOW; }
+}
+
+// Bytes of memory used
+size_t covg_ovf_mem(const CovgOverflow *ovf);
+
+#endif /* COVG_OVERFLOW_H_ */
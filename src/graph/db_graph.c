@@ -5,6 +5,8 @@
 #include "db_node.h"
 #include "graph_info.h"
 
+#include <sched.h> // sched_yield()
+
 static void db_graph_status(const dBGraph *db_graph)
 {
   char capacity_str[100];
@@ -18,6 +20,21 @@ const int DBG_ALLOC_COVGS       =  2;
 const int DBG_ALLOC_BKTLOCKS    =  4;
 const int DBG_ALLOC_READSTRT    =  8;
 const int DBG_ALLOC_NODE_IN_COL = 16;
+const int DBG_ALLOC_COVGS8      = 32;
+const int DBG_ALLOC_COL_SETS    = 64;
+
+// Allocate 8 bit coverages for DBG_ALLOC_COVGS, see db_graph_set_small_covgs()
+static bool dbg_small_covgs = false;
+
+void db_graph_set_small_covgs(bool small_covgs)
+{
+  dbg_small_covgs = small_covgs;
+}
+
+bool db_graph_get_small_covgs()
+{
+  return dbg_small_covgs;
+}
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
@@ -33,6 +50,7 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                  .ginfo = NULL,
                  .col_edges = NULL,
                  .col_covgs = NULL,
+                 .col_covgs8 = NULL,
                  .node_in_cols = NULL,
                  .readstrt = NULL};
 
@@ -50,32 +68,86 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
     graph_info_alloc(&tmp.ginfo[i]);
 
   if(alloc_flags & DBG_ALLOC_EDGES)
-    tmp.col_edges = ctx_calloc(tmp.ht.capacity * num_edge_cols, sizeof(Edges));
+    tmp.col_edges = ctx_large_alloc(tmp.ht.capacity * num_edge_cols, sizeof(Edges), NULL);
+
+  if((alloc_flags & DBG_ALLOC_COVGS) && dbg_small_covgs)
+    alloc_flags = (alloc_flags & ~DBG_ALLOC_COVGS) | DBG_ALLOC_COVGS8;
 
   if(alloc_flags & DBG_ALLOC_COVGS)
-    tmp.col_covgs = ctx_calloc(tmp.ht.capacity * num_of_cols, sizeof(Covg));
+    tmp.col_covgs = ctx_large_alloc(tmp.ht.capacity * num_of_cols, sizeof(Covg), NULL);
+
+  memset(&tmp.covg_ovf, 0, sizeof(CovgOverflow));
+  if(alloc_flags & DBG_ALLOC_COVGS8) {
+    ctx_assert(!(alloc_flags & DBG_ALLOC_COVGS));
+    tmp.col_covgs8 = ctx_large_alloc(tmp.ht.capacity * num_of_cols, sizeof(uint8_t), NULL);
+    covg_ovf_alloc(&tmp.covg_ovf);
+  }
 
   if(alloc_flags & DBG_ALLOC_BKTLOCKS)
     tmp.bktlocks = ctx_calloc(roundup_bits2bytes(tmp.ht.num_of_buckets), 1);
 
   // 1 bit for forward, 1 bit for reverse per kmer
   if(alloc_flags & DBG_ALLOC_READSTRT)
-    tmp.readstrt = ctx_calloc(roundup_bits2bytes(tmp.ht.capacity)*2, 1);
+    tmp.readstrt = ctx_large_alloc(roundup_bits2bytes(tmp.ht.capacity)*2, 1, NULL);
 
   if(alloc_flags & DBG_ALLOC_NODE_IN_COL) {
     size_t bytes_per_col = roundup_bits2bytes(tmp.ht.capacity);
-    tmp.node_in_cols = ctx_calloc(bytes_per_col*num_of_cols, 1);
+    tmp.node_in_cols = ctx_large_alloc(bytes_per_col*num_of_cols, 1, NULL);
+  }
+
+  if(alloc_flags & DBG_ALLOC_COL_SETS) {
+    ctx_assert(!(alloc_flags & DBG_ALLOC_NODE_IN_COL));
+    if(num_of_cols > COLSET_MAX_COLS)
+      die("Too many colours for colour sets: %zu", num_of_cols);
+    tmp.col_sets = ctx_malloc(sizeof(ColourSets));
+    colour_sets_alloc(tmp.col_sets, tmp.ht.capacity);
   }
 
   memcpy(db_graph, &tmp, sizeof(dBGraph));
   db_graph_status(db_graph);
 }
 
+bool db_graph_mmap(dBGraph *db_graph, const GraphFileReader *file)
+{
+  size_t i, ncols = file->hdr.num_of_cols;
+  GraphMmap gmap;
+
+  if(!graph_mmap_open(&gmap, file)) return false;
+
+  dBGraph tmp = {.kmer_size = file->hdr.kmer_size,
+                 .num_of_cols = ncols,
+                 .num_edge_cols = ncols,
+                 .num_of_cols_used = ncols};
+
+  memset(&tmp.ht, 0, sizeof(HashTable));
+  memset(&tmp.gpstore, 0, sizeof(GPathStore));
+  tmp.ht.num_kmers = gmap.num_of_kmers;
+
+  tmp.ginfo = ctx_calloc(ncols, sizeof(GraphInfo));
+  for(i = 0; i < ncols; i++) {
+    graph_info_alloc(&tmp.ginfo[i]);
+    graph_info_cpy(&tmp.ginfo[i], &file->hdr.ginfo[i]);
+  }
+
+  tmp.gmap = ctx_malloc(sizeof(GraphMmap));
+  memcpy(tmp.gmap, &gmap, sizeof(GraphMmap));
+
+  memcpy(db_graph, &tmp, sizeof(dBGraph));
+  status("[graph] kmer-size: %zu; colours: %zu; read-only memory mapped\n",
+         db_graph->kmer_size, db_graph->num_of_cols);
+  return true;
+}
+
 // Free memory used by all fields as well
 void db_graph_dealloc(dBGraph *db_graph)
 {
   size_t i;
 
+  if(db_graph->gmap != NULL) {
+    graph_mmap_close(db_graph->gmap);
+    ctx_free(db_graph->gmap);
+  }
+
   hash_table_dealloc(&db_graph->ht);
 
   for(i = 0; i < db_graph->num_of_cols; i++)
@@ -83,10 +155,16 @@ void db_graph_dealloc(dBGraph *db_graph)
   ctx_free(db_graph->ginfo);
 
   ctx_free(db_graph->bktlocks);
-  ctx_free(db_graph->col_covgs); // num_of_cols * capacity
-  ctx_free(db_graph->col_edges); // num_col_edges * capacity
-  ctx_free(db_graph->node_in_cols);
-  ctx_free(db_graph->readstrt);
+  ctx_large_free(db_graph->col_covgs); // num_of_cols * capacity
+  ctx_large_free(db_graph->col_covgs8); // num_of_cols * capacity
+  covg_ovf_dealloc(&db_graph->covg_ovf);
+  if(db_graph->col_sets != NULL) {
+    colour_sets_dealloc(db_graph->col_sets);
+    ctx_free(db_graph->col_sets);
+  }
+  ctx_large_free(db_graph->col_edges); // num_col_edges * capacity
+  ctx_large_free(db_graph->node_in_cols);
+  ctx_large_free(db_graph->readstrt);
 
   gpath_hash_dealloc(&db_graph->gphash);
   gpath_store_dealloc(&db_graph->gpstore);
@@ -94,14 +172,203 @@ void db_graph_dealloc(dBGraph *db_graph)
   memset(db_graph, 0, sizeof(dBGraph));
 }
 
+//
+// Growing the graph
+//
+
+void db_graph_set_growable(dBGraph *db_graph, size_t nthreads,
+                           uint64_t max_capacity)
+{
+  ctx_assert(nthreads > 0);
+  db_graph->ht.growable = true;
+  db_graph->grow_nthreads = nthreads;
+  db_graph->grow_max_capacity = max_capacity;
+}
+
+// Old arrays are read whilst new ones are written by hash_table_grow()
+typedef struct
+{
+  dBGraph *db_graph;
+  Edges *col_edges;
+  Covg *col_covgs;
+  uint8_t *col_covgs8;
+  CovgOverflow covg_ovf;
+  uint8_t *node_in_cols, *readstrt;
+  uint32_t *colset_ids;
+} dBGraphGrow;
+
+static void db_graph_node_moved(hkey_t old, hkey_t hkey, void *arg)
+{
+  dBGraphGrow *grow = (dBGraphGrow*)arg;
+  const dBGraph *db_graph = grow->db_graph;
+  const size_t ncols = db_graph->num_of_cols, nedgecols = db_graph->num_edge_cols;
+  size_t col;
+
+  if(grow->col_edges != NULL) {
+    memcpy(grow->col_edges + hkey*nedgecols, db_graph->col_edges + old*nedgecols,
+           nedgecols * sizeof(Edges));
+  }
+
+  if(grow->col_covgs != NULL) {
+    memcpy(grow->col_covgs + hkey*ncols, db_graph->col_covgs + old*ncols,
+           ncols * sizeof(Covg));
+  }
+
+  // Overflowed coverages are keyed by hkey, so move them to the new table
+  if(grow->col_covgs8 != NULL) {
+    memcpy(grow->col_covgs8 + hkey*ncols, db_graph->col_covgs8 + old*ncols, ncols);
+    for(col = 0; col < ncols; col++) {
+      if(db_graph->col_covgs8[old*ncols+col] == COVG8_OVERFLOW) {
+        covg_ovf_set(&grow->covg_ovf, hkey*ncols+col,
+                     covg_ovf_get(&db_graph->covg_ovf, old*ncols+col));
+      }
+    }
+  }
+
+  // Bits of other nodes share bytes, so set them atomically
+  if(grow->node_in_cols != NULL) {
+    for(col = 0; col < ncols; col++) {
+      if(db_node_has_col(db_graph, old, col)) {
+        (void)bitset2_set_mt(grow->node_in_cols,
+                             ksetw(grow->node_in_cols,ncols,hkey,col),
+                             kseto(grow->node_in_cols,hkey));
+      }
+    }
+  }
+
+  if(grow->colset_ids != NULL)
+    grow->colset_ids[hkey] = db_graph->col_sets->ids[old];
+
+  if(grow->readstrt != NULL) {
+    if(bitset_get(db_graph->readstrt, 2*old))
+      (void)bitset_set_mt(grow->readstrt, 2*hkey);
+    if(bitset_get(db_graph->readstrt, 2*old+1))
+      (void)bitset_set_mt(grow->readstrt, 2*hkey+1);
+  }
+}
+
+void db_graph_grow(dBGraph *db_graph)
+{
+  const size_t ncols = db_graph->num_of_cols, nedgecols = db_graph->num_edge_cols;
+  uint64_t capacity = db_graph->ht.capacity * 2;
+
+  if(!db_graph->grow_nthreads) {
+    ctx_msg_out = stderr;
+    hash_table_print_stats(&db_graph->ht);
+    die("Hash table is full");
+  }
+
+  if(db_graph->gpstore.paths_all != NULL)
+    die("Cannot grow graph once paths have been loaded");
+
+  // Old and new arrays are held at the same time whilst nodes are moved
+  if(db_graph->grow_max_capacity &&
+     capacity + db_graph->ht.capacity > db_graph->grow_max_capacity) {
+    ctx_msg_out = stderr;
+    hash_table_print_stats(&db_graph->ht);
+    die("Hash table is full and cannot grow within the memory limit");
+  }
+
+  char cap_str[100];
+  ulong_to_str(capacity, cap_str);
+  status("[graph] Growing hash table to %s entries", cap_str);
+
+  dBGraphGrow grow = {.db_graph = db_graph, .col_edges = NULL, .col_covgs = NULL,
+                      .col_covgs8 = NULL, .node_in_cols = NULL, .readstrt = NULL,
+                      .colset_ids = NULL};
+
+  if(db_graph->col_edges != NULL)
+    grow.col_edges = ctx_large_alloc(capacity * nedgecols, sizeof(Edges), NULL);
+  if(db_graph->col_covgs != NULL)
+    grow.col_covgs = ctx_large_alloc(capacity * ncols, sizeof(Covg), NULL);
+  if(db_graph->col_covgs8 != NULL) {
+    grow.col_covgs8 = ctx_large_alloc(capacity * ncols, sizeof(uint8_t), NULL);
+    covg_ovf_alloc(&grow.covg_ovf);
+  }
+  if(db_graph->node_in_cols != NULL)
+    grow.node_in_cols = ctx_large_alloc(roundup_bits2bytes(capacity)*ncols, 1, NULL);
+  if(db_graph->readstrt != NULL)
+    grow.readstrt = ctx_large_alloc(roundup_bits2bytes(capacity)*2, 1, NULL);
+  if(db_graph->col_sets != NULL)
+    grow.colset_ids = ctx_large_alloc(capacity, sizeof(uint32_t), NULL);
+
+  hash_table_grow(&db_graph->ht, db_graph->grow_nthreads,
+                  db_graph_node_moved, &grow);
+
+  ctx_large_free(db_graph->col_edges);
+  ctx_large_free(db_graph->col_covgs);
+  ctx_large_free(db_graph->col_covgs8);
+  ctx_large_free(db_graph->node_in_cols);
+  ctx_large_free(db_graph->readstrt);
+  db_graph->col_edges = grow.col_edges;
+  db_graph->col_covgs = grow.col_covgs;
+  db_graph->col_covgs8 = grow.col_covgs8;
+  if(grow.col_covgs8 != NULL) {
+    covg_ovf_dealloc(&db_graph->covg_ovf);
+    db_graph->covg_ovf = grow.covg_ovf;
+  }
+  db_graph->node_in_cols = grow.node_in_cols;
+  db_graph->readstrt = grow.readstrt;
+  if(db_graph->col_sets != NULL) {
+    ctx_large_free(db_graph->col_sets->ids);
+    db_graph->col_sets->ids = grow.colset_ids;
+    db_graph->col_sets->capacity = db_graph->ht.capacity;
+  }
+
+  if(db_graph->bktlocks != NULL) {
+    ctx_free(db_graph->bktlocks);
+    db_graph->bktlocks = ctx_calloc(roundup_bits2bytes(db_graph->ht.num_of_buckets), 1);
+  }
+
+  db_graph->grow_epoch++;
+  hash_table_print_stats_brief(&db_graph->ht);
+}
+
+// Threads entering wait for a pending grow to finish. A thread that wants to
+// grow sets grow_pending then waits for all threads to exit.
+size_t db_graph_grow_enter(dBGraph *db_graph)
+{
+  if(!db_graph->grow_nthreads) return 0;
+
+  while(1) {
+    while(db_graph->grow_pending) sched_yield();
+    __sync_add_and_fetch(&db_graph->grow_users, 1);
+    if(!db_graph->grow_pending) return db_graph->grow_epoch;
+    __sync_sub_and_fetch(&db_graph->grow_users, 1);
+  }
+}
+
+void db_graph_grow_exit(dBGraph *db_graph, size_t epoch)
+{
+  if(!db_graph->grow_nthreads) return;
+  __sync_sub_and_fetch(&db_graph->grow_users, 1);
+  if(hash_table_needs_grow(&db_graph->ht)) db_graph_grow_mt(db_graph, epoch);
+}
+
+void db_graph_grow_mt(dBGraph *db_graph, size_t epoch)
+{
+  if(__sync_bool_compare_and_swap(&db_graph->grow_pending, false, true)) {
+    // Another thread may have already grown the table
+    if(db_graph->grow_epoch == epoch) {
+      while(db_graph->grow_users) sched_yield();
+      db_graph_grow(db_graph);
+    }
+    __sync_synchronize();
+    db_graph->grow_pending = false;
+  }
+  else {
+    while(db_graph->grow_pending) sched_yield();
+  }
+}
+
 //
 // Add to the de bruijn graph
 //
 
 void db_graph_update_node_mt(dBGraph *db_graph, dBNode node, Colour col)
 {
-  if(db_graph->node_in_cols != NULL) db_node_set_col_mt(db_graph, node.key, col);
-  if(db_graph->col_covgs != NULL) db_node_increment_coverage_mt(db_graph, node.key, col);
+  if(db_graph_has_node_in_cols(db_graph)) db_node_set_col_mt(db_graph, node.key, col);
+  if(db_graph_covgs_alloced(db_graph)) db_node_increment_coverage_mt(db_graph, node.key, col);
 }
 
 // Not thread safe, use db_graph_find_or_add_node_mt for that
@@ -110,7 +377,9 @@ dBNode db_graph_find_or_add_node(dBGraph *db_graph, BinaryKmer bkmer,
                                  bool *foundptr)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  hkey_t hkey = hash_table_find_or_insert(&db_graph->ht, bkey, foundptr);
+  hkey_t hkey;
+  while((hkey = hash_table_find_or_insert(&db_graph->ht, bkey, foundptr)) == HASH_NOT_FOUND)
+    db_graph_grow(db_graph);
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
@@ -119,7 +388,9 @@ dBNode db_graph_find_or_add_node(dBGraph *db_graph, BinaryKmer bkmer,
 dBNode db_graph_find_node_mt(dBGraph *db_graph, BinaryKmer bkmer)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  hkey_t hkey = hash_table_find_mt(&db_graph->ht, bkey, db_graph->bktlocks);
+  hkey_t hkey = db_graph->gmap ? graph_mmap_find(db_graph->gmap, bkey)
+                               : hash_table_find_mt(&db_graph->ht, bkey,
+                                                    db_graph->bktlocks);
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
@@ -133,6 +404,41 @@ dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
+size_t db_graph_find_or_add_nodes_mt(dBGraph *db_graph, const BinaryKmer *bkmers,
+                                     const BinaryKmer *bkeys, size_t n,
+                                     dBNode *nodes, bool *found)
+{
+  BinaryKmer keybuf[HT_PREFETCH_WINDOW*4];
+  hkey_t hkeys[HT_PREFETCH_WINDOW*4];
+  const size_t kmer_size = db_graph->kmer_size, batch = sizeof(keybuf)/sizeof(keybuf[0]);
+  const BinaryKmer *keys;
+  size_t i, j, m, r;
+
+  for(i = 0; i < n; i += m)
+  {
+    m = MIN2(n-i, batch);
+
+    if(bkeys) keys = bkeys + i;
+    else {
+      for(j = 0; j < m; j++)
+        keybuf[j] = binary_kmer_get_key(bkmers[i+j], kmer_size);
+      keys = keybuf;
+    }
+
+    r = hash_table_find_or_insert_batch_mt(&db_graph->ht, keys, m, hkeys, found+i,
+                                           db_graph->bktlocks);
+
+    for(j = 0; j < r; j++) {
+      nodes[i+j] = (dBNode){.key = hkeys[j],
+                            .orient = bkmer_get_orientation(keys[j], bkmers[i+j])};
+    }
+
+    if(r < m) return i+r; // growable graph is full
+  }
+
+  return n;
+}
+
 dBNode db_graph_find_str(const dBGraph *db_graph, const char *str)
 {
   BinaryKmer bkmer;
@@ -143,7 +449,8 @@ dBNode db_graph_find_str(const dBGraph *db_graph, const char *str)
 dBNode db_graph_find_node(const dBGraph *db_graph, BinaryKmer bkmer)
 {
   BinaryKmer bkey = binary_kmer_get_key(bkmer, db_graph->kmer_size);
-  hkey_t hkey = hash_table_find(&db_graph->ht, bkey);
+  hkey_t hkey = db_graph->gmap ? graph_mmap_find(db_graph->gmap, bkey)
+                               : hash_table_find(&db_graph->ht, bkey);
   return (dBNode){.key = hkey, .orient = bkmer_get_orientation(bkey, bkmer)};
 }
 
@@ -278,10 +585,11 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
               (db_graph->num_of_cols == 1 && colour == 0) ||
               db_graph->num_of_cols == db_graph->num_edge_cols ||
               (db_graph->num_of_cols > 1 && db_graph->num_edge_cols == 1 &&
-                (db_graph->node_in_cols || db_graph->col_covgs)),
+                (db_graph_has_node_in_cols(db_graph) ||
+                 db_graph_covgs_alloced(db_graph))),
               "col: %i; cols: %zu edges: %zu node_in_cols: %i col_covgs: %i",
               colour, db_graph->num_of_cols, db_graph->num_edge_cols,
-              !!db_graph->node_in_cols, !!db_graph->col_covgs);
+              db_graph_has_node_in_cols(db_graph), db_graph_covgs_alloced(db_graph));
 
   size_t i, j;
   Edges edges;
@@ -291,9 +599,9 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
   if(colour < 0)
     edges = db_node_get_edges_union(db_graph, node.key);
   else if(db_graph->num_edge_cols < db_graph->num_of_cols)
-    edges = db_node_edges(db_graph, node.key, 0);
+    edges = db_node_get_edges(db_graph, node.key, 0);
   else
-    edges = db_node_edges(db_graph, node.key, colour);
+    edges = db_node_get_edges(db_graph, node.key, colour);
 
   bkey = db_node_get_bkmer(db_graph, node.key);
 
@@ -307,8 +615,10 @@ uint8_t db_graph_next_nodes_in_col(const dBGraph *db_graph,
   if(colour >= 0 && db_graph->num_edge_cols < db_graph->num_of_cols)
   {
     for(i = j = 0; i < count; i++) {
-      if(( db_graph->node_in_cols && db_node_has_col(db_graph, nodes[i].key, colour)) ||
-         (!db_graph->node_in_cols && db_node_covg(db_graph, nodes[i].key, colour) > 0))
+      if(( db_graph_has_node_in_cols(db_graph) &&
+           db_node_has_col(db_graph, nodes[i].key, colour)) ||
+         (!db_graph_has_node_in_cols(db_graph) &&
+           db_node_get_covg(db_graph, nodes[i].key, colour) > 0))
       {
         nodes[j] = nodes[i];
         fw_nucs[j] = fw_nucs[i];
@@ -359,7 +669,7 @@ uint8_t db_graph_prev_nodes_with_mask(const dBGraph *db_graph, dBNode node,
                                  prev_nodes, prev_bases);
 
   // If we have the ability, slim down nodes by those in this colour
-  if(colour >= 0 && db_graph->node_in_cols != NULL) {
+  if(colour >= 0 && db_graph_has_node_in_cols(db_graph)) {
     for(i = j = 0; i < num_prev; i++) {
       if(db_node_has_col(db_graph, prev_nodes[i].key, colour)) {
         prev_nodes[j] = prev_nodes[i];
@@ -466,13 +776,19 @@ void db_graph_reset(dBGraph *db_graph)
   db_graph->num_of_cols_used = 0;
 
   if(db_graph->col_edges != NULL)
-    memset(db_graph->col_edges, 0, nedgecols * sizeof(Edges) * capacity);
+    alloc_large_fill(db_graph->col_edges, nedgecols * capacity, sizeof(Edges), NULL);
   if(db_graph->col_covgs != NULL)
-    memset(db_graph->col_covgs, 0, ncols * sizeof(Covg) * capacity);
+    alloc_large_fill(db_graph->col_covgs, ncols * capacity, sizeof(Covg), NULL);
+  if(db_graph->col_covgs8 != NULL) {
+    alloc_large_fill(db_graph->col_covgs8, ncols * capacity, sizeof(uint8_t), NULL);
+    covg_ovf_reset(&db_graph->covg_ovf);
+  }
   if(db_graph->node_in_cols != NULL)
-    memset(db_graph->node_in_cols, 0, roundup_bits2bytes(capacity) * ncols);
+    alloc_large_fill(db_graph->node_in_cols, roundup_bits2bytes(capacity) * ncols, 1, NULL);
+  if(db_graph->col_sets != NULL)
+    colour_sets_reset(db_graph->col_sets);
   if(db_graph->readstrt != NULL)
-    memset(db_graph->readstrt, 0, 2 * roundup_bits2bytes(capacity) * ncols);
+    alloc_large_fill(db_graph->readstrt, 2 * roundup_bits2bytes(capacity), 1, NULL);
 
   gpath_store_reset(&db_graph->gpstore);
 }
@@ -537,6 +853,17 @@ void db_graph_get_kmer_covg(const dBGraph *db_graph, size_t nthreads,
 // Wipe
 //
 
+void db_graph_zero_covgs(dBGraph *db_graph)
+{
+  size_t n = db_graph->ht.capacity * db_graph->num_of_cols;
+  if(db_graph->col_covgs != NULL)
+    memset(db_graph->col_covgs, 0, n * sizeof(Covg));
+  if(db_graph->col_covgs8 != NULL) {
+    memset(db_graph->col_covgs8, 0, n);
+    covg_ovf_reset(&db_graph->covg_ovf);
+  }
+}
+
 // BEWARE: if num_edge_cols == 1, edges in all colours will be effectively wiped
 void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
 {
@@ -556,6 +883,12 @@ void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
       db_graph->node_in_cols[db_graph->num_of_cols*i+col] = 0;
   }
 
+  if(db_graph->col_sets != NULL) {
+    for(i = 0; i < capacity; i++)
+      if(db_graph->col_sets->ids[i])
+        colour_sets_del_col_mt(db_graph->col_sets, i, col);
+  }
+
   col_edges = (Edges (*)[db_graph->num_edge_cols])db_graph->col_edges;
   col_covgs = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
 
@@ -568,6 +901,12 @@ void db_graph_wipe_colour(dBGraph *db_graph, Colour col)
     }
   }
 
+  // Overflow entries of other colours are kept
+  if(db_graph->col_covgs8 != NULL) {
+    for(i = 0; i < capacity; i++)
+      db_graph->col_covgs8[i*db_graph->num_of_cols+col] = 0;
+  }
+
   if(db_graph->col_edges != NULL) {
     if(db_graph->num_edge_cols == 1) {
       memset(db_graph->col_edges, 0, capacity * sizeof(Edges));
@@ -678,10 +1017,18 @@ void db_graph_intersect_edges(dBGraph *db_graph, size_t nthreads, Edges *edges)
 hkey_t db_graph_rand_node(const dBGraph *db_graph, size_t ntries)
 {
   uint64_t capacity = db_graph->ht.capacity;
-  BinaryKmer *table = db_graph->ht.table;
   hkey_t hkey;
   size_t i;
 
+  // Every entry in a memory mapped graph is a node
+  if(db_graph->gmap != NULL) {
+    if(db_graph->gmap->num_of_kmers == 0) {
+      warn("No entries in graph - cannot select random");
+      return HASH_NOT_FOUND;
+    }
+    return (hkey_t)((rand() / ((double)RAND_MAX+1)) * db_graph->gmap->num_of_kmers);
+  }
+
   if(capacity == 0) {
     warn("No entries in hash table - cannot select random");
     return HASH_NOT_FOUND;
@@ -690,7 +1037,7 @@ hkey_t db_graph_rand_node(const dBGraph *db_graph, size_t ntries)
   for(i = 0; i < ntries; i++)
   {
     hkey = (hkey_t)((rand() / (double)RAND_MAX) * capacity);
-    if(HASH_ENTRY_ASSIGNED(table[hkey])) return hkey;
+    if(hash_table_assigned(&db_graph->ht, hkey)) return hkey;
   }
 
   return HASH_NOT_FOUND;
@@ -721,9 +1068,11 @@ void db_graph_print_kmer2(BinaryKmer bkmer, Covg *covgs, Edges *edges,
 void db_graph_print_kmer(hkey_t node, dBGraph *db_graph, FILE *fout)
 {
   BinaryKmer bkmer = db_node_get_bkmer(db_graph, node);
-  Covg *covgs = &db_node_covg(db_graph, node, 0);
+  Covg covgs[db_graph->num_of_cols];
   Edges *edges = &db_node_edges(db_graph, node, 0);
 
+  db_node_get_covgs(db_graph, node, 0, db_graph->num_of_cols, covgs);
+
   db_graph_print_kmer2(bkmer, covgs, edges,
                        db_graph->num_of_cols, db_graph->kmer_size,
                        fout);
@@ -10,12 +10,17 @@
 #include "graph_info.h"
 #include "gpath_store.h"
 #include "gpath_hash.h"
+#include "graph_mmap.h"
+#include "covg_overflow.h"
+#include "colour_sets.h"
 
 extern const int DBG_ALLOC_EDGES;
 extern const int DBG_ALLOC_COVGS;
 extern const int DBG_ALLOC_BKTLOCKS;
 extern const int DBG_ALLOC_READSTRT;
 extern const int DBG_ALLOC_NODE_IN_COL;
+extern const int DBG_ALLOC_COVGS8;
+extern const int DBG_ALLOC_COL_SETS;
 
 //
 // Graph
@@ -39,6 +44,12 @@ typedef struct
   Edges *col_edges; // num_of_cols*ht.capacity size addr: [hkey*num_of_cols + col]
   Covg *col_covgs; // num_edge_cols*ht.capacity size addr: [hkey*num_edge_cols + col]
 
+  // 8 bit coverages, used instead of col_covgs if allocated with
+  // DBG_ALLOC_COVGS8. Same layout as col_covgs. Coverages that don't fit are
+  // kept in covg_ovf. Read and write with db_node_get_covg() etc.
+  uint8_t *col_covgs8;
+  CovgOverflow covg_ovf;
+
   // This should be cast to volatile to read / write
   uint8_t *bktlocks;
 
@@ -47,18 +58,48 @@ typedef struct
   // [num_of_colours*hkey/64+col] >> hkey%64
   uint8_t *node_in_cols;
 
+  // Sparse alternative to node_in_cols for graphs with many colours,
+  // allocated with DBG_ALLOC_COL_SETS. Use db_node_has_col() etc.
+  ColourSets *col_sets;
+
   // New path data
   GPathStore gpstore;
   GPathHash gphash; // adding new paths quickly
 
   // Loading reads, 2 bits per kmers
   uint8_t *readstrt;
+
+  // Growing the hash table when full, see db_graph_set_growable()
+  size_t grow_nthreads; // threads used to migrate nodes, 0 if not growable
+  uint64_t grow_max_capacity; // 0 if no limit
+  volatile size_t grow_users; // threads between db_graph_grow_enter/exit
+  volatile size_t grow_epoch; // number of times the table has grown
+  volatile bool grow_pending;
+
+  // Read-only memory mapped graph file, see db_graph_mmap(). NULL otherwise.
+  // Nodes must then be read with db_node_get_*() rather than db_node_covg() etc.
+  GraphMmap *gmap;
 } dBGraph;
 
 #define db_graph_has_path_hash(graph) ((graph)->gphash.table != NULL)
-#define db_graph_node_assigned(graph,hkey) HASH_ENTRY_ASSIGNED((graph)->ht.table[hkey])
+#define db_graph_is_mmap(graph) ((graph)->gmap != NULL)
+#define db_graph_has_covgs(graph) ((graph)->col_covgs != NULL || \
+                                   (graph)->col_covgs8 != NULL || \
+                                   db_graph_is_mmap(graph))
+// Coverages stored in memory (not memory mapped)
+#define db_graph_covgs_alloced(graph) ((graph)->col_covgs != NULL || \
+                                       (graph)->col_covgs8 != NULL)
+#define db_graph_has_edges(graph) ((graph)->col_edges != NULL || db_graph_is_mmap(graph))
+#define db_graph_node_assigned(graph,hkey) hash_table_assigned(&(graph)->ht, hkey)
+// Which colours each node is in is stored (dense or sparse)
+#define db_graph_has_node_in_cols(graph) ((graph)->node_in_cols != NULL || \
+                                          (graph)->col_sets != NULL)
 
 // alloc_flags specifies where fields to malloc. OR together DBG_ALLOC_* values
+// DBG_ALLOC_COVGS8 stores coverages in 8 bit counters with an overflow table,
+// as does DBG_ALLOC_COVGS after db_graph_set_small_covgs(true)
+// DBG_ALLOC_COL_SETS stores colours of each node as a shared list instead of
+// DBG_ALLOC_NODE_IN_COL's bit per colour
 void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                     size_t num_of_cols, size_t num_edge_cols,
                     uint64_t capacity, int alloc_flags);
@@ -66,8 +107,54 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
 // Free memory used by all fields as well
 void db_graph_dealloc(dBGraph *db_graph);
 
+// Graphs allocated from now on with DBG_ALLOC_COVGS use 8 bit coverages.
+// Not thread safe.
+void db_graph_set_small_covgs(bool small_covgs);
+bool db_graph_get_small_covgs();
+
+// Bytes per kmer per colour allocated by DBG_ALLOC_COVGS, for memory estimates
+#define db_graph_covg_size() (db_graph_get_small_covgs() ? 1 : sizeof(Covg))
+
 void db_graph_reset(dBGraph *db_graph);
 
+// Open a sorted, indexed graph file (see `ctx sort`, `ctx index`) as a
+// read-only graph instead of loading it. Nodes are found by searching the file.
+// All colours are used, ginfo is copied from the file header.
+// Returns false if the file cannot be memory mapped, in which case db_graph is
+// unchanged and should be allocated and loaded as usual.
+// Free with db_graph_dealloc()
+bool db_graph_mmap(dBGraph *db_graph, const GraphFileReader *file);
+
+//
+// Growing the graph
+//
+// A growable graph doubles its hash table instead of exiting when it fills up
+// (or passes HT_GROW_OCCUPANCY). Nodes get new hkeys when the table grows, and
+// col_edges, col_covgs, node_in_cols, readstrt and bktlocks are remapped.
+// Threads that insert must hold their hkeys between db_graph_grow_enter() and
+// db_graph_grow_exit(). When an insert returns HASH_NOT_FOUND, call
+// db_graph_grow_exit(), db_graph_grow_mt(), then db_graph_grow_enter() and
+// look up any nodes still needed. Cannot grow once paths have been loaded.
+//
+
+// @nthreads is the number of threads to use when migrating nodes
+// @max_capacity is the largest hash table that fits in memory (0 for no limit)
+//   Whilst growing, the old and new arrays are both held, so the table only
+//   grows to capacity C if C + C/2 entries fit in @max_capacity
+void db_graph_set_growable(dBGraph *db_graph, size_t nthreads,
+                           uint64_t max_capacity);
+
+// Not thread safe: double the hash table
+void db_graph_grow(dBGraph *db_graph);
+
+// Thread safe: returns the current grow epoch
+size_t db_graph_grow_enter(dBGraph *db_graph);
+// Thread safe: grows the graph if it has passed HT_GROW_OCCUPANCY
+void db_graph_grow_exit(dBGraph *db_graph, size_t epoch);
+// Thread safe: double the hash table unless it has grown since `epoch`
+// Must not be called between db_graph_grow_enter() and db_graph_grow_exit()
+void db_graph_grow_mt(dBGraph *db_graph, size_t epoch);
+
 //
 // Add to the de bruijn graph
 //
@@ -78,14 +165,26 @@ void db_graph_update_node_mt(dBGraph *db_graph, dBNode node, Colour col);
 
 // Not thread safe, use db_graph_find_or_add_node_mt for that
 // Note: node may alreay exist in the graph
+// Grows the graph if it is growable and full
 dBNode db_graph_find_or_add_node(dBGraph *db_graph, BinaryKmer bkmer,
                                  bool *found);
 
 // Thread safe
 // Note: node may alreay exist in the graph
+// Returns HASH_NOT_FOUND node if the graph is growable and full
 dBNode db_graph_find_or_add_node_mt(dBGraph *db_graph, BinaryKmer bkmer,
                                     bool *found);
 
+// Thread safe
+// Find or add `n` kmers at once, prefetching hash table buckets ahead of use.
+// Results are stored in nodes[0..n-1] and found[0..n-1]
+// `bkeys` are the keys of `bkmers`, if NULL they are calculated
+// Returns number of nodes found or added, less than `n` only if the graph is
+// growable and full
+size_t db_graph_find_or_add_nodes_mt(dBGraph *db_graph, const BinaryKmer *bkmers,
+                                     const BinaryKmer *bkeys, size_t n,
+                                     dBNode *nodes, bool *found);
+
 #define db_graph_find(graph,bkmer) db_graph_find_node(graph,bkmer)
 dBNode db_graph_find_node(const dBGraph *db_graph, BinaryKmer bkmer);
 dBNode db_graph_find_node_mt(dBGraph *db_graph, BinaryKmer bkmer);
@@ -168,6 +267,9 @@ void db_graph_healthcheck(const dBGraph *db_graph);
 // remove all coverage, edges associated with a given colour
 void db_graph_wipe_colour(dBGraph *db_graph, Colour col);
 
+// Set coverage of all kmers in all colours to zero
+void db_graph_zero_covgs(dBGraph *db_graph);
+
 // Add edges between all kmers with k-1 bases overlapping
 void db_graph_add_all_edges(dBGraph *db_graph);
 
@@ -19,7 +19,7 @@ Edges db_node_edges_in_col(dBNode node, size_t col, const dBGraph *db_graph)
 
   // Edges are merged into one colour
   ctx_assert(db_graph->num_edge_cols == 1);
-  ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_has_node_in_cols(db_graph) || db_graph_covgs_alloced(db_graph));
 
   // Check which next nodes are in the given colour
   dBNode nodes[4];
@@ -128,30 +128,46 @@ char* db_node_get_edges_str(Edges edges, char *kmer_col_edge_str)
 
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
+  if(graph->col_covgs8 != NULL)
+    db_node_set_covg(graph, hkey, col,
+                     SAFE_ADD_COVG(db_node_get_covg(graph,hkey,col), update));
+  else
+    SAFE_SUM_COVG(db_node_covg(graph,hkey,col), update);
 }
 
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col)
 {
-  SAFE_SUM_COVG(db_node_covg(graph,hkey,col), 1);
+  db_node_add_col_covg(graph, hkey, col, 1);
 }
 
 // Thread safe, overflow safe, coverage increment
 void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col)
 {
+  db_node_add_col_covg_mt(graph, hkey, col, 1);
+}
+
+// Thread safe, overflow safe, coverage update
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update)
+{
+  if(graph->col_covgs8 != NULL) {
+    covg8_add_mt(&graph->covg_ovf, &db_node_covg8(graph,hkey,col),
+                 hkey*graph->num_of_cols+col, update);
+    return;
+  }
+
   Covg v;
   while((v = db_node_covg(graph,hkey,col)) < COVG_MAX &&
-        !__sync_bool_compare_and_swap(&db_node_covg(graph,hkey,col), v, v+1));
+        !__sync_bool_compare_and_swap(&db_node_covg(graph,hkey,col), v,
+                                      SAFE_ADD_COVG(v, update)));
 }
 
 Covg db_node_sum_covg(const dBGraph *graph, hkey_t hkey)
 {
-  const Covg *covgs = &db_node_covg(graph,hkey,0);
   Covg sum_covg = 0;
   size_t col;
 
   for(col = 0; col < graph->num_of_cols; col++)
-    SAFE_SUM_COVG(sum_covg, covgs[col]);
+    SAFE_SUM_COVG(sum_covg, db_node_get_covg(graph,hkey,col));
 
   return sum_covg;
 }
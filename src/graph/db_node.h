@@ -21,8 +21,15 @@ static inline uint64_t db_node_hash(dBNode node) {
 //
 // Get Binary kmers
 //
+// Accessors test for the usual in memory arrays first, so that loaded graphs
+// take a single predictable branch. Memory mapped graphs (gmap) have none of
+// them allocated and fall through to the slower cases.
 static inline BinaryKmer db_node_get_bkmer(const dBGraph *db_graph, hkey_t hkey) {
-  return db_graph->ht.table[hkey];
+  if(__builtin_expect(db_graph->ht.table != NULL, 1))
+    return db_graph->ht.table[hkey];
+  if(db_graph->gmap != NULL)
+    return graph_mmap_bkmer(db_graph->gmap, hkey);
+  return hash_table_fetch(&db_graph->ht, hkey);
 }
 
 // Get an oriented bkmer
@@ -46,6 +53,8 @@ static inline BinaryKmer db_node_get_bkmer(const dBGraph *db_graph, hkey_t hkey)
 
 static inline bool db_node_in_col(const dBGraph *graph, hkey_t hkey, size_t col)
 {
+  if(graph->col_sets != NULL)
+    return colour_sets_has_col(graph->col_sets, hkey, col);
   return graph->node_in_cols == NULL ||
          bitset2_get(graph->node_in_cols,
                      ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
@@ -54,40 +63,59 @@ static inline bool db_node_in_col(const dBGraph *graph, hkey_t hkey, size_t col)
 
 static inline bool db_node_has_col(const dBGraph *graph, hkey_t hkey, size_t col)
 {
-  return bitset2_get(graph->node_in_cols,
-                     ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
-                     kseto(graph->node_in_cols,hkey));
+  if(__builtin_expect(graph->node_in_cols != NULL, 1))
+    return bitset2_get(graph->node_in_cols,
+                       ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
+                       kseto(graph->node_in_cols,hkey));
+  if(graph->col_sets != NULL)
+    return colour_sets_has_col(graph->col_sets, hkey, col);
+  // Memory mapped graph files have no colour bitset
+  return graph_mmap_covg(graph->gmap, hkey, col) > 0 ||
+         graph_mmap_edges(graph->gmap, hkey, col) != 0;
 }
 
 static inline void db_node_set_col(const dBGraph *graph, hkey_t hkey, size_t col)
 {
-  bitset2_set(graph->node_in_cols,
-              ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
-              kseto(graph->node_in_cols,hkey));
+  if(graph->col_sets != NULL)
+    colour_sets_add_col_mt(graph->col_sets, hkey, col);
+  else
+    bitset2_set(graph->node_in_cols,
+                ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
+                kseto(graph->node_in_cols,hkey));
 }
 
 static inline void db_node_del_col_mt(const dBGraph *graph, hkey_t hkey, size_t col)
 {
-  (void)bitset2_del_mt(graph->node_in_cols,
-                       ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
-                       kseto(graph->node_in_cols,hkey));
+  if(graph->col_sets != NULL)
+    colour_sets_del_col_mt(graph->col_sets, hkey, col);
+  else
+    (void)bitset2_del_mt(graph->node_in_cols,
+                         ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
+                         kseto(graph->node_in_cols,hkey));
 }
 
 static inline void db_node_or_col(const dBGraph *graph, hkey_t hkey,
                                   size_t col, uint8_t bit)
 {
-  bitset2_or(graph->node_in_cols,
-             ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
-             kseto(graph->node_in_cols,hkey),bit);
+  if(graph->col_sets != NULL) {
+    if(bit) colour_sets_add_col_mt(graph->col_sets, hkey, col);
+  }
+  else
+    bitset2_or(graph->node_in_cols,
+               ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
+               kseto(graph->node_in_cols,hkey),bit);
 }
 
 // Threadsafe
 static inline void db_node_set_col_mt(const dBGraph *graph,
                                       hkey_t hkey, size_t col)
 {
-  (void)bitset2_set_mt(graph->node_in_cols,
-                       ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
-                       kseto(graph->node_in_cols,hkey));
+  if(graph->col_sets != NULL)
+    colour_sets_add_col_mt(graph->col_sets, hkey, col);
+  else
+    (void)bitset2_set_mt(graph->node_in_cols,
+                         ksetw(graph->node_in_cols,graph->num_of_cols,hkey,col),
+                         kseto(graph->node_in_cols,hkey));
 }
 
 
@@ -212,12 +240,20 @@ static inline Edges edges_as_nibble(Edges edges, Orientation orient) {
         ((graph)->col_edges[(hkey)*(graph)->num_edge_cols + (col)])
 
 static inline Edges db_node_get_edges(const dBGraph *graph, hkey_t hkey, Colour col) {
-  return db_node_edges(graph, hkey, col);
+  if(__builtin_expect(graph->col_edges != NULL, 1))
+    return db_node_edges(graph, hkey, col);
+  return graph_mmap_edges(graph->gmap, hkey, col);
 }
 
 static inline Edges db_node_get_edges_union(const dBGraph *graph, hkey_t hkey) {
-  return edges_get_union(graph->col_edges + hkey * graph->num_edge_cols,
-                         graph->num_edge_cols);
+  if(__builtin_expect(graph->col_edges != NULL, 1))
+    return edges_get_union(graph->col_edges + hkey * graph->num_edge_cols,
+                           graph->num_edge_cols);
+  Edges edges = 0;
+  size_t col;
+  for(col = 0; col < graph->num_edge_cols; col++)
+    edges |= graph_mmap_edges(graph->gmap, hkey, col);
+  return edges;
 }
 
 // Edges restricted to this colour, only in one direction (node.orient)
@@ -255,17 +291,56 @@ char* db_node_get_edges_str(Edges edges, char* kmer_col_edge_str);
 #define SAFE_ADD_COVG(a,b) ((uint64_t)(a)+(b) > COVG_MAX ? COVG_MAX : (a)+(b))
 #define SAFE_SUM_COVG(a,b) ((a) = SAFE_ADD_COVG((a), (b)))
 
+// Only for graphs with 32 bit coverages (col_covgs), otherwise use
+// db_node_get_covg() / db_node_set_covg()
 #define db_node_covg(graph,hkey,col) \
         ((graph)->col_covgs[(hkey)*(graph)->num_of_cols+(col)])
 
+#define db_node_covg8(graph,hkey,col) \
+        ((graph)->col_covgs8[(hkey)*(graph)->num_of_cols+(col)])
+
 static inline Covg db_node_get_covg(const dBGraph *db_graph,
                                     hkey_t hkey, Colour col) {
-  return db_node_covg(db_graph, hkey, col);
+  if(__builtin_expect(db_graph->col_covgs != NULL, 1))
+    return db_node_covg(db_graph, hkey, col);
+  if(db_graph->col_covgs8 != NULL)
+    return covg8_get(&db_graph->covg_ovf, &db_node_covg8(db_graph, hkey, col),
+                     hkey*db_graph->num_of_cols+col);
+  return graph_mmap_covg(db_graph->gmap, hkey, col);
 }
 
-#define db_node_zero_covgs(graph,hkey) \
-        memset((graph)->col_covgs + (hkey)*(graph)->num_of_cols, 0, \
-               (graph)->num_of_cols * sizeof(Covg))
+// Not thread safe
+static inline void db_node_set_covg(dBGraph *db_graph, hkey_t hkey,
+                                    Colour col, Covg covg) {
+  if(db_graph->col_covgs8 != NULL)
+    covg8_set(&db_graph->covg_ovf, &db_node_covg8(db_graph, hkey, col),
+              hkey*db_graph->num_of_cols+col, covg);
+  else
+    db_node_covg(db_graph, hkey, col) = covg;
+}
+
+// Copy coverages of colours [first_col, first_col+ncols) into `covgs`
+static inline void db_node_get_covgs(const dBGraph *db_graph, hkey_t hkey,
+                                     Colour first_col, size_t ncols,
+                                     Covg *covgs) {
+  size_t i;
+  if(db_graph->col_covgs != NULL)
+    memcpy(covgs, &db_node_covg(db_graph, hkey, first_col), ncols*sizeof(Covg));
+  else {
+    for(i = 0; i < ncols; i++)
+      covgs[i] = db_node_get_covg(db_graph, hkey, first_col+i);
+  }
+}
+
+// Overflowed 8 bit coverages keep their side table entry, which is reused if
+// the coverage overflows again
+static inline void db_node_zero_covgs(dBGraph *db_graph, hkey_t hkey) {
+  if(db_graph->col_covgs8 != NULL)
+    memset(&db_node_covg8(db_graph, hkey, 0), 0, db_graph->num_of_cols);
+  else
+    memset(&db_node_covg(db_graph, hkey, 0), 0,
+           db_graph->num_of_cols * sizeof(Covg));
+}
 
 void db_node_add_col_covg(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
 void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col);
@@ -273,6 +348,9 @@ void db_node_increment_coverage(dBGraph *graph, hkey_t hkey, Colour col);
 // Thread safe, overflow safe, coverage increment
 void db_node_increment_coverage_mt(dBGraph *graph, hkey_t hkey, Colour col);
 
+// Thread safe, overflow safe, coverage update
+void db_node_add_col_covg_mt(dBGraph *graph, hkey_t hkey, Colour col, Covg update);
+
 Covg db_node_sum_covg(const dBGraph *graph, hkey_t hkey);
 
 //
@@ -0,0 +1,255 @@
+#include "global.h"
+#include "graph_block.h"
+
+// Column encodings
+#define GBLOCK_RLE    0 // <runlen><value> pairs
+#define GBLOCK_DENSE  1 // <value> per kmer
+#define GBLOCK_SPARSE 2 // <num_nonzero> then <gap><value> per non-zero value
+
+#define VARINT_MAX_BYTES 10
+
+static inline size_t varint_len(uint64_t x)
+{
+  size_t n = 1;
+  while(x >= 0x80) { x >>= 7; n++; }
+  return n;
+}
+
+static inline uint8_t* varint_put(uint8_t *ptr, uint64_t x)
+{
+  while(x >= 0x80) { *ptr++ = (uint8_t)(x | 0x80); x >>= 7; }
+  *ptr++ = (uint8_t)x;
+  return ptr;
+}
+
+// Returns false if we run off the end of the data or value is too long
+static inline bool varint_get(const uint8_t **ptr, const uint8_t *end,
+                              uint64_t *x)
+{
+  const uint8_t *p = *ptr;
+  uint64_t v = 0;
+  size_t shift;
+  for(shift = 0; p < end && shift < 64; shift += 7) {
+    v |= (uint64_t)(*p & 0x7f) << shift;
+    if(!(*p++ & 0x80)) { *ptr = p; *x = v; return true; }
+  }
+  return false;
+}
+
+size_t graph_block_max_bytes(size_t nkmers, size_t num_of_cols)
+{
+  // Chosen column encoding is never longer than dense encoding
+  return nkmers * NUM_BKMER_WORDS * VARINT_MAX_BYTES +
+         2 * num_of_cols * (1 + nkmers * varint_len(UINT32_MAX));
+}
+
+void graph_block_alloc(GraphBlock *blk, size_t num_of_cols)
+{
+  memset(blk, 0, sizeof(GraphBlock));
+  blk->num_of_cols = num_of_cols;
+  blk->bkmers = ctx_malloc(GRAPH_BLOCK_KMERS * sizeof(BinaryKmer));
+  blk->covgs = ctx_malloc(GRAPH_BLOCK_KMERS * num_of_cols * sizeof(Covg));
+  blk->edges = ctx_malloc(GRAPH_BLOCK_KMERS * num_of_cols * sizeof(Edges));
+  blk->col = ctx_malloc(GRAPH_BLOCK_KMERS * sizeof(uint32_t));
+  blk->datacap = graph_block_max_bytes(GRAPH_BLOCK_KMERS, num_of_cols);
+  blk->data = ctx_malloc(blk->datacap);
+}
+
+void graph_block_dealloc(GraphBlock *blk)
+{
+  ctx_free(blk->bkmers);
+  ctx_free(blk->covgs);
+  ctx_free(blk->edges);
+  ctx_free(blk->col);
+  ctx_free(blk->data);
+  memset(blk, 0, sizeof(GraphBlock));
+}
+
+//
+// Encoding
+//
+
+// Encode a column of n values, choosing the smallest encoding
+static uint8_t* encode_col(uint8_t *ptr, const uint32_t *vals, size_t n)
+{
+  size_t i, j, rle = 1, dense = 1, sparse = 0, nnz = 0, last = 0;
+
+  for(i = 0; i < n; i = j) {
+    for(j = i+1; j < n && vals[j] == vals[i]; j++) {}
+    rle += varint_len(j-i) + varint_len(vals[i]);
+  }
+  for(i = 0; i < n; i++) {
+    dense += varint_len(vals[i]);
+    if(vals[i]) { sparse += varint_len(i-last) + varint_len(vals[i]); last = i+1; nnz++; }
+  }
+  sparse += 1 + varint_len(nnz);
+
+  if(rle <= dense && rle <= sparse) {
+    *ptr++ = GBLOCK_RLE;
+    for(i = 0; i < n; i = j) {
+      for(j = i+1; j < n && vals[j] == vals[i]; j++) {}
+      ptr = varint_put(ptr, j-i);
+      ptr = varint_put(ptr, vals[i]);
+    }
+  }
+  else if(dense <= sparse) {
+    *ptr++ = GBLOCK_DENSE;
+    for(i = 0; i < n; i++) ptr = varint_put(ptr, vals[i]);
+  }
+  else {
+    *ptr++ = GBLOCK_SPARSE;
+    ptr = varint_put(ptr, nnz);
+    for(i = last = 0; i < n; i++) {
+      if(vals[i]) {
+        ptr = varint_put(ptr, i-last);
+        ptr = varint_put(ptr, vals[i]);
+        last = i+1;
+      }
+    }
+  }
+
+  return ptr;
+}
+
+// Encode sorted kmers into blk->data
+static void graph_block_encode(GraphBlock *blk)
+{
+  const size_t n = blk->nkmers, ncols = blk->num_of_cols;
+  uint32_t *col = blk->col;
+  uint8_t *ptr = blk->data;
+  BinaryKmer prev = zero_bkmer, bkmer;
+  uint64_t delta, borrow;
+  size_t i, c, w;
+
+  // Kmers: difference from the previous kmer, most significant word first
+  for(i = 0; i < n; i++) {
+    bkmer = blk->bkmers[i];
+    uint64_t words[NUM_BKMER_WORDS];
+    for(borrow = 0, w = NUM_BKMER_WORDS; w-- > 0; ) {
+      delta = bkmer.b[w] - prev.b[w] - borrow;
+      borrow = (bkmer.b[w] < prev.b[w]) || (bkmer.b[w] == prev.b[w] && borrow);
+      words[w] = delta;
+    }
+    for(w = 0; w < NUM_BKMER_WORDS; w++) ptr = varint_put(ptr, words[w]);
+    prev = bkmer;
+  }
+
+  // Coverage columns then edge columns
+  for(c = 0; c < ncols; c++) {
+    for(i = 0; i < n; i++) col[i] = blk->covgs[i*ncols+c];
+    ptr = encode_col(ptr, col, n);
+  }
+  for(c = 0; c < ncols; c++) {
+    for(i = 0; i < n; i++) col[i] = blk->edges[i*ncols+c];
+    ptr = encode_col(ptr, col, n);
+  }
+
+  blk->datalen = ptr - blk->data;
+  ctx_assert(blk->datalen <= blk->datacap);
+}
+
+size_t graph_block_write(GraphBlock *blk, FILE *fh)
+{
+  if(blk->nkmers == 0) return 0;
+
+  graph_block_encode(blk);
+
+  uint32_t blkhdr[2] = {(uint32_t)blk->nkmers, (uint32_t)blk->datalen};
+  if(fwrite(blkhdr, 1, sizeof(blkhdr), fh) != sizeof(blkhdr) ||
+     fwrite(blk->data, 1, blk->datalen, fh) != blk->datalen) {
+    die("Cannot write to file [%s]", strerror(errno));
+  }
+
+  graph_block_reset(blk);
+  return sizeof(blkhdr) + blk->datalen;
+}
+
+//
+// Decoding
+//
+
+// Decode a column of n values
+// Returns false if corrupt or a value is larger than `maxval`
+static bool decode_col(const uint8_t **ptr, const uint8_t *end,
+                       uint32_t *vals, size_t n, uint64_t maxval)
+{
+  const uint8_t *p = *ptr;
+  uint64_t len, val, nnz, gap;
+  size_t i = 0, j;
+
+  if(p == end) return false;
+
+  switch(*p++) {
+    case GBLOCK_RLE:
+      while(i < n) {
+        if(!varint_get(&p, end, &len) || !varint_get(&p, end, &val) ||
+           len == 0 || len > n-i || val > maxval) return false;
+        for(j = 0; j < len; j++) vals[i++] = (uint32_t)val;
+      }
+      break;
+    case GBLOCK_DENSE:
+      for(i = 0; i < n; i++) {
+        if(!varint_get(&p, end, &val) || val > maxval) return false;
+        vals[i] = (uint32_t)val;
+      }
+      break;
+    case GBLOCK_SPARSE:
+      memset(vals, 0, n * sizeof(uint32_t));
+      if(!varint_get(&p, end, &nnz) || nnz > n) return false;
+      for(j = 0; j < nnz; j++) {
+        if(!varint_get(&p, end, &gap) || !varint_get(&p, end, &val) ||
+           gap >= n-i || val == 0 || val > maxval) return false;
+        i += gap;
+        vals[i++] = (uint32_t)val;
+      }
+      break;
+    default: return false;
+  }
+
+  *ptr = p;
+  return true;
+}
+
+bool graph_block_decode(GraphBlock *blk, size_t nkmers, size_t nbytes)
+{
+  ctx_assert(nkmers <= GRAPH_BLOCK_KMERS);
+  ctx_assert(nbytes <= blk->datacap);
+
+  const size_t ncols = blk->num_of_cols;
+  const uint8_t *ptr = blk->data, *end = blk->data + nbytes;
+  uint32_t *col = blk->col;
+  BinaryKmer prev = zero_bkmer, bkmer;
+  uint64_t words[NUM_BKMER_WORDS], carry, nonzero;
+  size_t i, c, w;
+
+  graph_block_reset(blk);
+
+  for(i = 0; i < nkmers; i++) {
+    for(w = 0, nonzero = 0; w < NUM_BKMER_WORDS; w++) {
+      if(!varint_get(&ptr, end, &words[w])) return false;
+      nonzero |= words[w];
+    }
+    for(carry = 0, w = NUM_BKMER_WORDS; w-- > 0; ) {
+      bkmer.b[w] = prev.b[w] + words[w] + carry;
+      carry = (bkmer.b[w] < prev.b[w]) || (bkmer.b[w] == prev.b[w] && carry);
+    }
+    // Kmers must increase: non-zero delta (except first) without overflow
+    if(carry || (i > 0 && !nonzero)) return false;
+    blk->bkmers[i] = prev = bkmer;
+  }
+
+  for(c = 0; c < ncols; c++) {
+    if(!decode_col(&ptr, end, col, nkmers, UINT32_MAX)) return false;
+    for(i = 0; i < nkmers; i++) blk->covgs[i*ncols+c] = col[i];
+  }
+  for(c = 0; c < ncols; c++) {
+    if(!decode_col(&ptr, end, col, nkmers, UINT8_MAX)) return false;
+    for(i = 0; i < nkmers; i++) blk->edges[i*ncols+c] = (Edges)col[i];
+  }
+
+  if(ptr != end) return false;
+
+  blk->nkmers = nkmers;
+  blk->datalen = nbytes;
+  return true;
+}
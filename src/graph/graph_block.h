@@ -0,0 +1,86 @@
+#ifndef GRAPH_BLOCK_H_
+#define GRAPH_BLOCK_H_
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+
+//
+// Block compressed graph files (.ctx version 7)
+//
+// The header is the same as version 6. Kmers are then stored in blocks of up
+// to GRAPH_BLOCK_KMERS kmers:
+//
+//   <uint32_t:nkmers><uint32_t:nbytes><uint8_t[nbytes]:data>
+//
+// Kmers are sorted across the whole file, so must be added in order (see
+// `ctx sort --format 7`). Within a block kmers are stored as varint deltas.
+// For each colour the coverages, then the edges are stored as a column of
+// varints, using whichever of run-length, dense or sparse encoding is smallest.
+//
+
+#define GRAPH_BLOCK_KMERS 4096
+
+typedef struct
+{
+  size_t num_of_cols, nkmers, next; // next: next kmer to return when reading
+  BinaryKmer *bkmers; // [GRAPH_BLOCK_KMERS]
+  Covg *covgs; // [GRAPH_BLOCK_KMERS * num_of_cols], one row per kmer
+  Edges *edges; // [GRAPH_BLOCK_KMERS * num_of_cols], one row per kmer
+  uint32_t *col; // temporary space for encoding
+  uint8_t *data; // encoded block
+  size_t datalen, datacap;
+  BinaryKmer last; // last kmer added, if any_added
+  bool any_added;
+} GraphBlock;
+
+void graph_block_alloc(GraphBlock *blk, size_t num_of_cols);
+void graph_block_dealloc(GraphBlock *blk);
+
+#define graph_block_reset(blk) ((blk)->nkmers = (blk)->next = 0)
+#define graph_block_full(blk) ((blk)->nkmers == GRAPH_BLOCK_KMERS)
+
+// Max bytes needed to encode a block of `nkmers`
+size_t graph_block_max_bytes(size_t nkmers, size_t num_of_cols);
+
+// Returns true if `bkmer` sorts after all kmers added so far
+static inline bool graph_block_in_order(const GraphBlock *blk, BinaryKmer bkmer)
+{
+  return !blk->any_added || binary_kmer_less_than(blk->last, bkmer);
+}
+
+// Kmers must be added in sorted order, across all blocks of a file
+static inline void graph_block_add(GraphBlock *blk, BinaryKmer bkmer,
+                                   const Covg *covgs, const Edges *edges)
+{
+  ctx_assert(blk->nkmers < GRAPH_BLOCK_KMERS);
+  ctx_assert(graph_block_in_order(blk, bkmer));
+  blk->last = bkmer;
+  blk->any_added = true;
+  size_t i = blk->nkmers++;
+  blk->bkmers[i] = bkmer;
+  memcpy(blk->covgs + i*blk->num_of_cols, covgs, blk->num_of_cols*sizeof(Covg));
+  memcpy(blk->edges + i*blk->num_of_cols, edges, blk->num_of_cols*sizeof(Edges));
+}
+
+// Returns false once all kmers have been read from the block
+static inline bool graph_block_next(GraphBlock *blk, BinaryKmer *bkmer,
+                                    Covg *covgs, Edges *edges)
+{
+  if(blk->next == blk->nkmers) return false;
+  size_t i = blk->next++;
+  *bkmer = blk->bkmers[i];
+  memcpy(covgs, blk->covgs + i*blk->num_of_cols, blk->num_of_cols*sizeof(Covg));
+  memcpy(edges, blk->edges + i*blk->num_of_cols, blk->num_of_cols*sizeof(Edges));
+  return true;
+}
+
+// Encode kmers added to the block, write to a file then empty the block.
+// Does nothing if the block is empty.
+// Returns number of bytes written
+size_t graph_block_write(GraphBlock *blk, FILE *fh);
+
+// Decode blk->data[0..nbytes-1], which holds `nkmers` kmers
+// Returns false if the block is corrupt or its kmers are not sorted
+bool graph_block_decode(GraphBlock *blk, size_t nkmers, size_t nbytes);
+
+#endif /* GRAPH_BLOCK_H_ */
@@ -117,7 +117,7 @@ void graph_crawler_reset_rpt_walker(RepeatWalker *rptwlk,
 
 void graph_crawler_alloc(GraphCrawler *crawler, const dBGraph *db_graph)
 {
-  ctx_assert(db_graph->node_in_cols != NULL);
+  ctx_assert(db_graph_has_node_in_cols(db_graph));
 
   size_t ncols = db_graph->num_of_cols;
 
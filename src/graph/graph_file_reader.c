@@ -4,9 +4,12 @@
 #include "cmd.h"
 #include "file_util.h"
 
+#include <unistd.h> // pread
+
 int graph_file_fseek(GraphFileReader *file, off_t offset, int whence)
 {
   if(file_filter_isstdin(&file->fltr)) die("Cannot fseek on STDIN");
+  graph_block_reset(&file->blk);
   if(graph_file_is_buffered(file))
     return fseek_buf(file->fh, offset, whence, &file->strm);
   else
@@ -256,6 +259,68 @@ size_t graph_file_read_header(GraphFileReader *file)
   return bytes_read;
 }
 
+// Block compressed files don't have fixed width records, so count kmers by
+// jumping from one block header to the next. Uses pread so doesn't move the
+// file position.
+static int64_t graph_file_count_block_kmers(GraphFileReader *file)
+{
+  const char *path = file_filter_path(&file->fltr);
+  int fd = fileno(file->fh);
+  off_t pos = file->hdr_size;
+  uint32_t blkhdr[2];
+  int64_t nkmers = 0;
+  ssize_t n;
+
+  while(pos < file->file_size)
+  {
+    n = pread(fd, blkhdr, sizeof(blkhdr), pos);
+    if(n < 0) die("Cannot read file: %s [%s]", path, strerror(errno));
+    pos += sizeof(blkhdr) + blkhdr[1];
+    if(n != sizeof(blkhdr) || pos > file->file_size) {
+      warn("Truncated graph file: %s [fsize: %zu; header: %zu; nkmers: %zu]",
+           path, (size_t)file->file_size, (size_t)file->hdr_size,
+           (size_t)nkmers);
+      break;
+    }
+    nkmers += blkhdr[0];
+  }
+
+  return nkmers;
+}
+
+// Read and decode the next block of a block compressed file
+// Returns false at the end of the file
+static bool graph_file_read_block(GraphFileReader *file)
+{
+  GraphBlock *blk = &file->blk;
+  const char *path = file_filter_path(&file->fltr);
+  uint32_t blkhdr[2];
+  size_t n = gfr_fread_bytes(file, blkhdr, sizeof(blkhdr));
+
+  if(n == 0) return false;
+  if(n != sizeof(blkhdr)) die("Unexpected end of file: %s", path);
+
+  if(blkhdr[0] == 0 || blkhdr[0] > GRAPH_BLOCK_KMERS ||
+     blkhdr[1] > graph_block_max_bytes(blkhdr[0], blk->num_of_cols)) {
+    die("Corrupt kmer block [kmers: %u; bytes: %u; path: %s]",
+        blkhdr[0], blkhdr[1], path);
+  }
+
+  // Kmers are sorted across blocks, not just within them
+  bool have_prev = (blk->nkmers > 0);
+  BinaryKmer prev = have_prev ? blk->bkmers[blk->nkmers-1] : zero_bkmer;
+
+  _gfread(file, blk->data, blkhdr[1], "kmer block");
+
+  if(!graph_block_decode(blk, blkhdr[0], blkhdr[1]))
+    die("Corrupt kmer block [kmers: %u; path: %s]", blkhdr[0], path);
+
+  if(have_prev && !binary_kmer_less_than(prev, blk->bkmers[0]))
+    die("Kmer blocks are not sorted [path: %s]", path);
+
+  return true;
+}
+
 int graph_file_open(GraphFileReader *file, const char *path)
 {
   return graph_file_open2(file, path, "r", true, 0);
@@ -300,8 +365,14 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 
   size_t bytes_per_kmer, bytes_remaining;
 
+  if(graph_file_is_compressed(file))
+  {
+    graph_block_alloc(&file->blk, hdr->num_of_cols);
+    if(file->file_size != -1)
+      file->num_of_kmers = graph_file_count_block_kmers(file);
+  }
   // If reading from STDIN we don't know file size
-  if(file->file_size != -1)
+  else if(file->file_size != -1)
   {
     // File header checks
     // Get number of kmers
@@ -325,6 +396,7 @@ int graph_file_open2(GraphFileReader *file, const char *input, const char *mode,
 // Close file
 void graph_file_close(GraphFileReader *file)
 {
+  graph_block_dealloc(&file->blk);
   strm_buf_dealloc(&file->strm);
   if(file->fh) fclose(file->fh);
   file_filter_close(&file->fltr);
@@ -342,15 +414,28 @@ size_t graph_file_read_raw(GraphFileReader *file,
   int num_bytes_read;
   char kstr[MAX_KMER_SIZE+1];
 
-  num_bytes_read = gfr_fread_bytes(file, bkmer->b, sizeof(BinaryKmer));
+  if(graph_file_is_compressed(file))
+  {
+    if(!graph_block_next(&file->blk, bkmer, covgs, edges)) {
+      if(!graph_file_read_block(file)) return 0;
+      graph_block_next(&file->blk, bkmer, covgs, edges);
+    }
+    // Return size of an uncompressed kmer record
+    num_bytes_read = sizeof(BinaryKmer) +
+                     h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+  }
+  else
+  {
+    num_bytes_read = gfr_fread_bytes(file, bkmer->b, sizeof(BinaryKmer));
 
-  if(num_bytes_read == 0) return 0;
-  if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
-    die("Unexpected end of file: %s", path);
+    if(num_bytes_read == 0) return 0;
+    if(num_bytes_read != (int)(sizeof(uint64_t)*h->num_of_bitfields))
+      die("Unexpected end of file: %s", path);
 
-  _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
-  _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
-  num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+    _gfread(file, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages");
+    _gfread(file, edges, h->num_of_cols * sizeof(uint8_t), "Edges");
+    num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+  }
 
   // Check top word of each kmer
   if(binary_kmer_oversized(*bkmer, h->kmer_size))
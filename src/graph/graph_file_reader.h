@@ -5,6 +5,7 @@
 #include "graph_format.h"
 #include "file_filter.h"
 #include "binary_kmer.h"
+#include "graph_block.h"
 
 //
 // Read graph files from disk
@@ -19,6 +20,7 @@ typedef struct
   off_t hdr_size, file_size;
   int64_t num_of_kmers; // set if reading from file (i.e. not stream) else -1
   bool error_zero_covg, error_missing_covg; // Whether we saw loading errors
+  GraphBlock blk; // current block if file is block compressed (version 7)
 } GraphFileReader;
 
 #include "madcrowlib/madcrow_buffer.h"
@@ -31,6 +33,13 @@ madcrow_buffer(gfile_buf, GraphFileBuffer, GraphFileReader);
 #define graph_file_nkmers(rdr) ((uint64_t)MAX2((rdr)->num_of_kmers, 0))
 
 #define graph_file_is_buffered(file) ((file)->strm.b != NULL)
+
+// Block compressed files do not have fixed width kmer records, so cannot be
+// memory mapped, edited in place or read in raw blocks
+#define graph_file_is_compressed(file) \
+        ((file)->hdr.version == CTX_GRAPH_FILEFORMAT_BLOCKS)
+// Seeking discards the current block of a compressed file, so should only be
+// used to return to the start of the kmers (hdr_size)
 int graph_file_fseek(GraphFileReader *file, off_t offset, int whence);
 off_t graph_file_ftell(GraphFileReader *file);
 
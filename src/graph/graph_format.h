@@ -4,6 +4,9 @@
 // graph file format version
 #define CTX_GRAPH_FILEFORMAT 6
 
+// block compressed graph file format version (see graph_block.h)
+#define CTX_GRAPH_FILEFORMAT_BLOCKS 7
+
 #include "graph_info.h"
 
 // Graph (.ctx)
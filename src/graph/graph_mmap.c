@@ -0,0 +1,258 @@
+#include "global.h"
+#include "graph_mmap.h"
+#include "cmd.h"
+#include "file_util.h"
+#include "util.h"
+
+#include <sys/mman.h> // mmap
+#include <fcntl.h> // open
+
+// Load <in.ctx>.idx, written by `ctx index`
+// Block offsets are in bytes, kmer indices are derived from them
+// Returns false if the index could not be read or doesn't match the graph
+static bool graph_mmap_load_index(GraphMmap *gmap, const char *idx_path,
+                                  size_t kmer_size, off_t hdr_size)
+{
+  FILE *fh = fopen(idx_path, "r");
+  if(fh == NULL) return false;
+
+  StrBuf line;
+  strbuf_alloc(&line, 1024);
+  char kmerstr[MAX_KMER_SIZE+2];
+  size_t block_start, next_block, kmer_idx, next_kmer_idx, nblocks = 0, cap = 64;
+  size_t expect_start = hdr_size, lineno = 0;
+  BinaryKmer bkmer;
+  bool success = true;
+
+  gmap->block_bkmers = ctx_malloc(cap * sizeof(BinaryKmer));
+  gmap->block_idx = ctx_malloc((cap+1) * sizeof(uint64_t));
+
+  while(strbuf_reset_readline(&line, fh) > 0)
+  {
+    lineno++;
+    strbuf_chomp(&line);
+    if(line.end == 0 || line.b[0] == '#') continue;
+
+    if(sscanf(line.b, "%zu\t%zu\t%"QUOTE_VALUE(MAX_KMER_SIZE)"s\t%zu\t%zu",
+              &block_start, &next_block, kmerstr,
+              &kmer_idx, &next_kmer_idx) != 5 ||
+       strlen(kmerstr) != kmer_size ||
+       block_start != expect_start || next_block <= block_start ||
+       (next_block - hdr_size) % gmap->kmer_bytes != 0)
+    {
+      warn("Bad line in index %s:%zu", idx_path, lineno);
+      success = false;
+      break;
+    }
+
+    if(nblocks == cap) {
+      cap *= 2;
+      gmap->block_bkmers = ctx_realloc(gmap->block_bkmers, cap*sizeof(BinaryKmer));
+      gmap->block_idx = ctx_realloc(gmap->block_idx, (cap+1)*sizeof(uint64_t));
+    }
+
+    gmap->block_idx[nblocks] = (block_start - hdr_size) / gmap->kmer_bytes;
+    gmap->block_bkmers[nblocks] = binary_kmer_from_str(kmerstr, kmer_size);
+    nblocks++;
+    expect_start = next_block;
+  }
+
+  if(ferror(fh)) { warn("Cannot read index: %s", idx_path); success = false; }
+
+  if(success && expect_start != hdr_size + gmap->num_of_kmers*gmap->kmer_bytes) {
+    warn("Index does not cover whole graph: %s", idx_path);
+    success = false;
+  }
+
+  gmap->nblocks = nblocks;
+  gmap->block_idx[nblocks] = gmap->num_of_kmers;
+
+  // Check index matches kmers in the graph file
+  size_t i;
+  for(i = 0; success && i < nblocks; i++) {
+    bkmer = graph_mmap_bkmer(gmap, gmap->block_idx[i]);
+    if(!binary_kmers_are_equal(bkmer, gmap->block_bkmers[i])) {
+      warn("Index does not match graph, re-run `"CMD" index`: %s", idx_path);
+      success = false;
+    }
+  }
+
+  strbuf_dealloc(&line);
+  fclose(fh);
+  return success;
+}
+
+// Returns false if the file cannot be memory mapped
+static bool graph_mmap_can_map(const GraphFileReader *file)
+{
+  return file_filter_is_direct(&file->fltr) && file->num_of_kmers >= 0 &&
+         !graph_file_is_compressed(file) &&
+         file->hdr.num_of_bitfields == NUM_BKMER_WORDS;
+}
+
+// Map kmer records of a graph file
+static void graph_mmap_map(GraphMmap *gmap, const GraphFileReader *file)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const GraphFileHeader *hdr = &file->hdr;
+
+  gmap->num_of_cols = hdr->num_of_cols;
+  gmap->num_of_kmers = file->num_of_kmers;
+  gmap->kmer_bytes = sizeof(BinaryKmer) +
+                     gmap->num_of_cols * (sizeof(Covg) + sizeof(Edges));
+  gmap->data_len = file->hdr_size + gmap->num_of_kmers * gmap->kmer_bytes;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) die("Cannot open file: %s [%s]", path, strerror(errno));
+
+  void *ptr = mmap(NULL, MAX2(gmap->data_len, 1), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(ptr == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+
+  // Lookups jump around the file
+  madvise(ptr, gmap->data_len, MADV_RANDOM);
+
+  gmap->data = ptr;
+  gmap->kmers = gmap->data + file->hdr_size;
+}
+
+// Load <in.ctx>.mphf if it exists. Check a sample of kmers to catch files
+// saved for a different version of the graph.
+static void graph_mmap_load_mphf(GraphMmap *gmap, const char *path)
+{
+  if(!futil_file_exists(path)) return;
+
+  KmerMphf *mphf = ctx_calloc(1, sizeof(KmerMphf));
+  bool valid = kmer_mphf_mmap(mphf, path) &&
+               mphf->num_of_kmers == gmap->num_of_kmers;
+  uint64_t i, step = MAX2(gmap->num_of_kmers / 64, 1);
+
+  for(i = 0; valid && i < gmap->num_of_kmers; i += step)
+    valid = (kmer_mphf_find(mphf, graph_mmap_bkmer(gmap, i)) == i);
+
+  if(!valid) {
+    warn("Minimal perfect hash does not match graph, re-run `"CMD" index "
+         "--mphf`: %s", path);
+    kmer_mphf_dealloc(mphf);
+    ctx_free(mphf);
+    return;
+  }
+
+  gmap->mphf = mphf;
+}
+
+bool graph_mmap_open(GraphMmap *gmap, const GraphFileReader *file)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const GraphFileHeader *hdr = &file->hdr;
+
+  memset(gmap, 0, sizeof(GraphMmap));
+
+  if(!graph_mmap_can_map(file)) return false;
+
+  StrBuf idx_path;
+  strbuf_alloc(&idx_path, 1024);
+  strbuf_sprintf(&idx_path, "%s.idx", path);
+
+  if(!futil_file_exists(idx_path.b)) {
+    strbuf_dealloc(&idx_path);
+    return false;
+  }
+
+  graph_mmap_map(gmap, file);
+
+  if(!graph_mmap_load_index(gmap, idx_path.b, hdr->kmer_size, file->hdr_size)) {
+    warn("Cannot use index, loading graph instead: %s", idx_path.b);
+    graph_mmap_close(gmap);
+    strbuf_dealloc(&idx_path);
+    return false;
+  }
+
+  strbuf_reset(&idx_path);
+  strbuf_sprintf(&idx_path, "%s.mphf", path);
+  graph_mmap_load_mphf(gmap, idx_path.b);
+
+  char nkmers_str[50], nblocks_str[50];
+  ulong_to_str(gmap->num_of_kmers, nkmers_str);
+  ulong_to_str(gmap->nblocks, nblocks_str);
+  status("[graph] Memory mapped %s kmers in %s blocks%s from %s",
+         nkmers_str, nblocks_str,
+         gmap->mphf ? " with minimal perfect hash" : "", futil_inpath_str(path));
+
+  strbuf_dealloc(&idx_path);
+  return true;
+}
+
+void graph_mmap_close(GraphMmap *gmap)
+{
+  if(gmap->data != NULL && munmap((void*)gmap->data, MAX2(gmap->data_len, 1)) != 0)
+    warn("Cannot release memory map [%s]", strerror(errno));
+  if(gmap->mphf != NULL) {
+    kmer_mphf_dealloc(gmap->mphf);
+    ctx_free(gmap->mphf);
+  }
+  ctx_free(gmap->block_bkmers);
+  ctx_free(gmap->block_idx);
+  memset(gmap, 0, sizeof(GraphMmap));
+}
+
+hkey_t graph_mmap_find(const GraphMmap *gmap, BinaryKmer bkey)
+{
+  if(gmap->mphf != NULL) {
+    // Fingerprints let through 1 in 256 kmers not in the graph
+    hkey_t hkey = kmer_mphf_find(gmap->mphf, bkey);
+    if(hkey == HASH_NOT_FOUND ||
+       !binary_kmers_are_equal(bkey, graph_mmap_bkmer(gmap, hkey)))
+      return HASH_NOT_FOUND;
+    return hkey;
+  }
+
+  // Find the last block starting with a kmer <= bkey
+  size_t lo = 0, hi = gmap->nblocks, mid;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(binary_kmer_less_than(bkey, gmap->block_bkmers[mid])) hi = mid;
+    else lo = mid + 1;
+  }
+
+  if(lo == 0) return HASH_NOT_FOUND;
+
+  // Search within the block
+  uint64_t start = gmap->block_idx[lo-1], end = gmap->block_idx[lo], pos;
+  int cmp;
+
+  while(start < end) {
+    pos = start + (end - start) / 2;
+    cmp = binary_kmers_cmp(bkey, graph_mmap_bkmer(gmap, pos));
+    if(cmp == 0) return pos;
+    if(cmp < 0) end = pos;
+    else start = pos + 1;
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+void graph_mmap_save_mphf(const GraphFileReader *file, const char *out_path,
+                          size_t nthreads)
+{
+  GraphMmap gmap;
+  KmerMphf mphf;
+
+  memset(&gmap, 0, sizeof(GraphMmap));
+
+  if(!graph_mmap_can_map(file)) {
+    die("Cannot memory map graph to build minimal perfect hash: %s",
+        file_filter_path(&file->fltr));
+  }
+
+  graph_mmap_map(&gmap, file);
+  madvise((void*)gmap.data, gmap.data_len, MADV_SEQUENTIAL);
+
+  kmer_mphf_build(&mphf, gmap.kmers, gmap.kmer_bytes, gmap.num_of_kmers, nthreads);
+  kmer_mphf_save(&mphf, out_path);
+
+  kmer_mphf_dealloc(&mphf);
+  graph_mmap_close(&gmap);
+}
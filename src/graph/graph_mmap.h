@@ -0,0 +1,81 @@
+#ifndef GRAPH_MMAP_H_
+#define GRAPH_MMAP_H_
+
+#include "cortex_types.h"
+#include "hash_table.h"
+#include "graph_file_reader.h"
+#include "kmer_mphf.h"
+
+//
+// Read-only access to a sorted graph file (.ctx) that has been indexed with
+// `ctx index` (.ctx.idx). The file is memory mapped rather than loaded, kmers
+// are found by binary searching the index then the block of kmers it points
+// to. hkeys are kmer indices in the file.
+//
+// Records are not aligned in the file, so fields are copied out with memcpy.
+//
+// If the graph also has a minimal perfect hash (<in.ctx>.mphf, saved by
+// `ctx index --mphf`) it is memory mapped too and used to find kmers instead
+// of binary searching.
+//
+
+typedef struct
+{
+  const char *data; // memory mapped file
+  size_t data_len;
+  const char *kmers; // first kmer record
+  size_t kmer_bytes; // bytes per kmer record
+  size_t num_of_cols;
+  uint64_t num_of_kmers;
+  // Index: first kmer of each block, kmer index of block start
+  BinaryKmer *block_bkmers; // [nblocks]
+  uint64_t *block_idx; // [nblocks+1]
+  size_t nblocks;
+  KmerMphf *mphf; // NULL if no .mphf file
+} GraphMmap;
+
+// The index is read from <in.ctx>.idx, the minimal perfect hash (if present)
+// from <in.ctx>.mphf
+// Returns false if the file cannot be memory mapped e.g. is filtered, read
+// from a stream, is block compressed or has no index file. Prints a warning if
+// the index is invalid.
+bool graph_mmap_open(GraphMmap *gmap, const GraphFileReader *file);
+void graph_mmap_close(GraphMmap *gmap);
+
+// `bkey` must be a kmer key (see binary_kmer_get_key())
+// Returns HASH_NOT_FOUND if kmer is not in the graph
+hkey_t graph_mmap_find(const GraphMmap *gmap, BinaryKmer bkey);
+
+// Build a minimal perfect hash of the kmers in a graph file and save it to
+// `out_path`, which should already have been created with
+// futil_create_output(). Graph must be uncompressed and not filtered.
+void graph_mmap_save_mphf(const GraphFileReader *file, const char *out_path,
+                          size_t nthreads);
+
+#define graph_mmap_record(gm,hkey) ((gm)->kmers + (hkey)*(gm)->kmer_bytes)
+
+static inline BinaryKmer graph_mmap_bkmer(const GraphMmap *gmap, hkey_t hkey)
+{
+  BinaryKmer bkmer;
+  memcpy(bkmer.b, graph_mmap_record(gmap,hkey), sizeof(BinaryKmer));
+  return bkmer;
+}
+
+static inline Covg graph_mmap_covg(const GraphMmap *gmap, hkey_t hkey,
+                                   size_t col)
+{
+  Covg covg;
+  memcpy(&covg, graph_mmap_record(gmap,hkey) + sizeof(BinaryKmer) +
+                col * sizeof(Covg), sizeof(Covg));
+  return covg;
+}
+
+static inline Edges graph_mmap_edges(const GraphMmap *gmap, hkey_t hkey,
+                                     size_t col)
+{
+  return (Edges)graph_mmap_record(gmap,hkey)[sizeof(BinaryKmer) +
+                                             gmap->num_of_cols * sizeof(Covg) +
+                                             col];
+}
+
+#endif /* GRAPH_MMAP_H_ */
@@ -33,7 +33,7 @@ static void print_path_list(const GPathFollowBuffer *pbuf, FILE *fout)
 
   for(i = 0; i < pbuf->len; i++) {
     path = &pbuf->b[i];
-    fprintf(fout, "   %p ", path->gpath->seq);
+    fprintf(fout, "   %p ", path->seq);
     for(j = 0; j < path->len; j++)
       fputc(dna_nuc_to_char(gpath_follow_get_base(path, j)), fout);
     fprintf(fout, " [%zu/%zu] age: %zu %c\n", (size_t)path->pos,
@@ -85,7 +85,7 @@ void graph_walker_setup(GraphWalker *wlk, bool missing_path_check,
 {
   // Check that the graph is loaded properly (all edges merged into one colour)
   ctx_assert(graph->num_edge_cols == 1);
-  ctx_assert(graph->num_of_cols == 1 || graph->node_in_cols != NULL);
+  ctx_assert(graph->num_of_cols == 1 || db_graph_has_node_in_cols(graph));
 
   wlk->db_graph = graph;
   wlk->gpstore = &graph->gpstore;
@@ -172,7 +172,7 @@ static inline size_t pickup_paths(GraphWalker *wlk, dBNode node,
 
   GPath *gpath = gpath_store_fetch_traverse(gpstore, node.key);
 
-  for(; gpath != NULL; gpath = gpath->next)
+  for(; gpath != NULL; gpath = gpath_get_next(gpath))
   {
     if(node.orient == gpath->orient && gpath_has_colour(gpath, ncols, wlk->ctpcol))
     {
@@ -389,7 +389,7 @@ GraphStep graph_walker_choose(const GraphWalker *wlk, size_t num_next,
   }
 
   if(num_next == 1) {
-    bool incol = (db_graph->node_in_cols == NULL ||
+    bool incol = (!db_graph_has_node_in_cols(db_graph) ||
                   db_node_has_col(db_graph, next_nodes[0].key, wlk->ctxcol));
     _gw_choose_return(0, incol ? GRPHWLK_COLFWD : GRPHWLK_POPFWD, 0);
   }
@@ -402,7 +402,7 @@ GraphStep graph_walker_choose(const GraphWalker *wlk, size_t num_next,
   size_t i, j;
 
   // Reduce next nodes that are in this colour
-  if(db_graph->node_in_cols != NULL)
+  if(db_graph_has_node_in_cols(db_graph))
   {
     nodes = nodes_store;
     bases = bases_store;
@@ -644,7 +644,7 @@ void graph_walker_jump_along_snode(GraphWalker *wlk, dBNode node, size_t num_nod
   #endif
 
   // Need to check if node is in colour
-  bool incol = (wlk->db_graph->node_in_cols == NULL ||
+  bool incol = (!db_graph_has_node_in_cols(wlk->db_graph) ||
                 db_node_has_col(wlk->db_graph, node.key, wlk->ctxcol));
 
   int status = incol ? GRPHWLK_COLFWD : GRPHWLK_POPFWD;
@@ -5,6 +5,9 @@
 #include "db_node.h"
 #include "util.h"
 #include "file_util.h"
+#include "cmd.h"
+
+#include "sort_r/sort_r.h"
 
 static inline void _dump_empty_bkmer(hkey_t hkey, const dBGraph *db_graph,
                                      char *buf, size_t mem, FILE *fh)
@@ -126,10 +129,11 @@ size_t graph_write_kmer(FILE *fh, size_t num_bkmer_words, size_t num_cols,
 static inline void graph_write_graph_kmer(hkey_t hkey, FILE *fh,
                                           const dBGraph *db_graph)
 {
+  Covg covgs[db_graph->num_of_cols];
+  db_node_get_covgs(db_graph, hkey, 0, db_graph->num_of_cols, covgs);
   graph_write_kmer(fh, NUM_BKMER_WORDS, db_graph->num_of_cols,
-                   db_graph->ht.table[hkey],
-                   &db_node_covg(db_graph, hkey, 0),
-                   &db_node_edges(db_graph, hkey, 0));
+                   hash_table_fetch(&db_graph->ht, hkey),
+                   covgs, &db_node_edges(db_graph, hkey, 0));
 }
 
 // Dump all kmers with all colours to given file. Return num of kmers written
@@ -139,6 +143,45 @@ size_t graph_write_all_kmers(FILE *fh, const dBGraph *db_graph)
   return db_graph->ht.num_kmers;
 }
 
+// Write a kmer as a fixed width record, or add it to `blk` if writing a
+// block compressed file (version 7). Full blocks are written to the file.
+// Kmers written to a block compressed file must be sorted.
+static inline void graph_write_kmer_blk(FILE *fh, GraphBlock *blk,
+                                        const GraphFileHeader *hdr,
+                                        const BinaryKmer bkmer,
+                                        const Covg *covgs, const Edges *edges)
+{
+  if(blk == NULL) {
+    graph_write_kmer(fh, hdr->num_of_bitfields, hdr->num_of_cols,
+                     bkmer, covgs, edges);
+  } else {
+    if(!graph_block_in_order(blk, bkmer)) {
+      die("Graph is not sorted, cannot write format version %i. Sort with `"
+          CMD" sort --format %i --out <out.ctx> <in.ctx>`",
+          CTX_GRAPH_FILEFORMAT_BLOCKS, CTX_GRAPH_FILEFORMAT_BLOCKS);
+    }
+    graph_block_add(blk, bkmer, covgs, edges);
+    if(graph_block_full(blk)) graph_block_write(blk, fh);
+  }
+}
+
+// Returns block to write kmers into or NULL if not writing a block compressed
+// file. Call graph_write_blk_finish() once all kmers have been written.
+static GraphBlock* graph_write_blk_start(GraphBlock *blk,
+                                         const GraphFileHeader *hdr)
+{
+  if(hdr->version != CTX_GRAPH_FILEFORMAT_BLOCKS) return NULL;
+  graph_block_alloc(blk, hdr->num_of_cols);
+  return blk;
+}
+
+static void graph_write_blk_finish(GraphBlock *blk, FILE *fh)
+{
+  if(blk == NULL) return;
+  graph_block_write(blk, fh);
+  graph_block_dealloc(blk);
+}
+
 
 // only called by graph_writer_update_mmap_kmers()
 static inline void _graph_write_update_kmer(hkey_t hkey,
@@ -147,13 +190,14 @@ static inline void _graph_write_update_kmer(hkey_t hkey,
                                            size_t first_filecol, size_t nfilecols,
                                            char **ptr, size_t filekmersize)
 {
-  const Covg *covgs = &db_node_covg(db_graph, hkey, first_graphcol);
   const Edges *edges = &db_node_edges(db_graph, hkey, first_graphcol);
 
   void *covgs_out = *ptr+sizeof(BinaryKmer) + sizeof(Covg)*first_filecol;
   void *edges_out = *ptr+sizeof(BinaryKmer) + sizeof(Covg)*nfilecols +
                      sizeof(Edges)*first_filecol;
 
+  Covg covgs[ngraphcols];
+  db_node_get_covgs(db_graph, hkey, first_graphcol, ngraphcols, covgs);
   memcpy(covgs_out, covgs, ngraphcols*sizeof(Covg));
   memcpy(edges_out, edges, ngraphcols*sizeof(Edges));
 
@@ -175,7 +219,7 @@ void graph_writer_update_mmap_kmers(const dBGraph *db_graph,
                                     char *mmap_ptr, size_t hdrsize)
 {
   ctx_assert(db_graph->col_edges != NULL);
-  ctx_assert(db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_covgs_alloced(db_graph));
   ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols);
   ctx_assert(first_graphcol+ngraphcols <= db_graph->num_of_cols);
 
@@ -203,7 +247,7 @@ void graph_writer_update_file_kmers(const dBGraph *db_graph,
                                     size_t hdrsize, FILE *fh, const char *path)
 {
   ctx_assert(db_graph->col_edges != NULL);
-  ctx_assert(db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_covgs_alloced(db_graph));
   ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols);
   ctx_assert(first_graphcol+ngraphcols <= db_graph->num_of_cols);
 
@@ -219,7 +263,7 @@ void graph_writer_update_file_kmers(const dBGraph *db_graph,
   size_t nkmers_printed = 0, nkmers, nbytes, end;
   uint8_t *mem = ctx_malloc(block_size), *memptr;
   hkey_t hkey = 0;
-  const Covg *covgs = db_graph->col_covgs;
+  Covg covgs[ngraphcols];
   const Edges *edges = db_graph->col_edges;
 
   if(fseek(fh, hdrsize, SEEK_SET) != 0) die("Cannot seek to file start: %s", path);
@@ -234,7 +278,7 @@ void graph_writer_update_file_kmers(const dBGraph *db_graph,
     memptr = mem;
     for(end = nkmers_printed+nkmers; nkmers_printed < end; hkey++) {
       if(db_graph_node_assigned(db_graph, hkey)) {
-        covgs = db_graph->col_covgs + hkey * db_graph->num_of_cols;
+        db_node_get_covgs(db_graph, hkey, 0, ngraphcols, covgs);
         edges = db_graph->col_edges + hkey * db_graph->num_of_cols;
         memptr += sizeof(BinaryKmer);
         memcpy(memptr + first_filecol*sizeof(Covg), covgs, ngraphcols*sizeof(Covg));
@@ -251,9 +295,41 @@ void graph_writer_update_file_kmers(const dBGraph *db_graph,
   ctx_free(mem);
 }
 
+// Coverage and edges of a node in graph colour `col`. Graphs with one edge
+// colour have the edges to neighbours in the same colour. Sparse colour sets
+// (`join --sparse`) store the edges of each colour but not coverages, so have
+// a coverage of one in colours the node is in.
+static inline void graph_write_node_col(const dBGraph *db_graph, hkey_t hkey,
+                                        size_t col, Covg *covg, Edges *edges)
+{
+  if(db_graph->col_sets != NULL) {
+    const uint32_t *ent = colour_sets_find(db_graph->col_sets, hkey, col);
+    if(db_graph_covgs_alloced(db_graph)) *covg = db_node_get_covg(db_graph, hkey, col);
+    else *covg = (ent != NULL);
+    *edges = ent ? colset_entry_edges(*ent) : 0;
+    return;
+  }
+
+  if(db_graph_covgs_alloced(db_graph)) *covg = db_node_get_covg(db_graph, hkey, col);
+  else *covg = db_node_has_col(db_graph, hkey, col);
+
+  if(db_graph->num_edge_cols == db_graph->num_of_cols)
+    *edges = db_node_edges(db_graph, hkey, col);
+  else
+    *edges = *covg ? db_node_both_edges_in_col(hkey, col, db_graph) : 0;
+}
+
+static inline bool graph_write_node_in_col(const dBGraph *db_graph, hkey_t hkey,
+                                           size_t col)
+{
+  return db_graph_covgs_alloced(db_graph) ? db_node_get_covg(db_graph, hkey, col) > 0
+                                          : db_node_has_col(db_graph, hkey, col);
+}
+
 // Dump node: only print kmers with coverages in given colours
 static void graph_write_node(hkey_t hkey, const dBGraph *db_graph,
-                             FILE *fout, const GraphFileHeader *hdr,
+                             FILE *fout, GraphBlock *blk,
+                             const GraphFileHeader *hdr,
                              size_t intocol, const Colour *colours,
                              size_t start_col, size_t num_of_cols,
                              uint64_t *num_dumped)
@@ -264,9 +340,9 @@ static void graph_write_node(hkey_t hkey, const dBGraph *db_graph,
 
   // Check this node has coverage in one of the specified colours
   if(colours != NULL)
-    while(i < num_of_cols && db_node_get_covg(db_graph,hkey,colours[i]) == 0) i++;
+    while(i < num_of_cols && !graph_write_node_in_col(db_graph,hkey,colours[i])) i++;
   else
-    while(i < num_of_cols && db_node_get_covg(db_graph,hkey,start_col+i) == 0) i++;
+    while(i < num_of_cols && !graph_write_node_in_col(db_graph,hkey,start_col+i)) i++;
 
   if(i == num_of_cols) return;
 
@@ -279,26 +355,43 @@ static void graph_write_node(hkey_t hkey, const dBGraph *db_graph,
 
   Edges (*col_edges)[db_graph->num_of_cols]
     = (Edges (*)[db_graph->num_of_cols])db_graph->col_edges;
-  Covg (*col_covgs)[db_graph->num_of_cols]
-    = (Covg (*)[db_graph->num_of_cols])db_graph->col_covgs;
 
-  if(colours != NULL) {
+  if(!db_graph_covgs_alloced(db_graph) ||
+     db_graph->num_edge_cols != db_graph->num_of_cols) {
+    for(i = 0; i < num_of_cols; i++) {
+      graph_write_node_col(db_graph, hkey, colours ? colours[i] : start_col+i,
+                           &covgs[i], &edges[i]);
+    }
+  }
+  else if(colours != NULL) {
     for(i = 0; i < num_of_cols; i++) {
-      covgs[i] = col_covgs[hkey][colours[i]];
+      covgs[i] = db_node_get_covg(db_graph, hkey, colours[i]);
       edges[i] = col_edges[hkey][colours[i]];
     }
   }
   else {
-    memcpy(covgs, col_covgs[hkey]+start_col, num_of_cols*sizeof(Covg));
+    db_node_get_covgs(db_graph, hkey, start_col, num_of_cols, covgs);
     memcpy(edges, col_edges[hkey]+start_col, num_of_cols*sizeof(Edges));
   }
 
-  graph_write_kmer(fout, hdr->num_of_bitfields, hdr->num_of_cols,
-                   bkmer, covg_store, edge_store);
+  graph_write_kmer_blk(fout, blk, hdr, bkmer, covg_store, edge_store);
 
   (*num_dumped)++;
 }
 
+static inline void _graph_write_store_hkey(hkey_t hkey, hkey_t *hkeys,
+                                           size_t *n)
+{
+  hkeys[(*n)++] = hkey;
+}
+
+static int _graph_write_hkey_cmp(const void *aa, const void *bb, void *arg)
+{
+  const HashTable *ht = (const HashTable*)arg;
+  hkey_t a = *(const hkey_t*)aa, b = *(const hkey_t*)bb;
+  return binary_kmers_cmp(hash_table_fetch(ht, a), hash_table_fetch(ht, b));
+}
+
 // Returns true if we are dumping the graph 'as-is', without dropping or
 // re-arranging colours
 static bool saving_graph_as_is(const Colour *cols, Colour start_col,
@@ -326,7 +419,7 @@ uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
   // Cannot specify both colours array and start_col
   ctx_assert(colours == NULL || start_col == 0);
   ctx_assert(db_graph->col_edges != NULL);
-  ctx_assert(db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_covgs_alloced(db_graph) || db_graph_has_node_in_cols(db_graph));
   ctx_assert(num_of_cols > 0);
   ctx_assert(colours || start_col + num_of_cols <= db_graph->num_of_cols);
   ctx_assert(intocol + num_of_cols <= header->num_of_cols);
@@ -361,15 +454,36 @@ uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
   // Write header
   graph_write_header(fout, header);
 
-  if(saving_graph_as_is(colours, start_col, num_of_cols, db_graph->num_of_cols)) {
+  GraphBlock blkmem, *blk = graph_write_blk_start(&blkmem, header);
+
+  if(blk == NULL && db_graph_covgs_alloced(db_graph) &&
+     db_graph->num_edge_cols == db_graph->num_of_cols &&
+     saving_graph_as_is(colours, start_col, num_of_cols, db_graph->num_of_cols))
+  {
     num_nodes_dumped = graph_write_all_kmers(fout, db_graph);
   }
-  else {
+  else if(blk == NULL) {
     HASH_ITERATE(&db_graph->ht, graph_write_node,
-                 db_graph, fout, header, intocol, colours, start_col, num_of_cols,
-                 &num_nodes_dumped);
+                 db_graph, fout, blk, header, intocol, colours, start_col,
+                 num_of_cols, &num_nodes_dumped);
+  }
+  else {
+    // Block compressed files are sorted
+    size_t nkmers = 0;
+    hkey_t *hkeys = ctx_malloc(db_graph->ht.num_kmers * sizeof(hkey_t));
+    HASH_ITERATE(&db_graph->ht, _graph_write_store_hkey, hkeys, &nkmers);
+    ctx_assert(nkmers == db_graph->ht.num_kmers);
+    sort_r(hkeys, nkmers, sizeof(hkey_t), _graph_write_hkey_cmp,
+           (void*)&db_graph->ht);
+
+    for(i = 0; i < nkmers; i++) {
+      graph_write_node(hkeys[i], db_graph, fout, blk, header, intocol,
+                       colours, start_col, num_of_cols, &num_nodes_dumped);
+    }
+    ctx_free(hkeys);
   }
 
+  graph_write_blk_finish(blk, fout);
   fclose(fout);
   // if(strcmp(path,"-") != 0) fclose(fout);
 
@@ -441,6 +555,8 @@ size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
   FILE *out = futil_fopen(out_ctx_path, "w");
   graph_write_header(out, hdr);
 
+  GraphBlock blkmem, *blk = graph_write_blk_start(&blkmem, hdr);
+
   size_t i, nodes_dumped = 0, ncols = file_filter_into_ncols(fltr);
 
   BinaryKmer bkmer;
@@ -468,18 +584,18 @@ size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
       }
 
       if(keep_kmer) {
-        graph_write_kmer(out, hdr->num_of_bitfields, hdr->num_of_cols,
-                         bkmer, covgs, edges);
+        graph_write_kmer_blk(out, blk, hdr, bkmer, covgs, edges);
         nodes_dumped++;
       }
     }
   }
 
+  graph_write_blk_finish(blk, out);
   fflush(out);
   fclose(out);
 
   graph_writer_print_status(nodes_dumped, hdr->num_of_cols,
-                            out_ctx_path, CTX_GRAPH_FILEFORMAT);
+                            out_ctx_path, hdr->version);
 
   return nodes_dumped;
 }
@@ -523,7 +639,8 @@ size_t graph_writer_merge(const char *out_ctx_path,
 {
   bool only_load_if_in_graph = (only_load_if_in_edges != NULL);
   ctx_assert(!only_load_if_in_graph || kmers_loaded);
-  ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols);
+  ctx_assert(db_graph->num_of_cols == db_graph->num_edge_cols ||
+             db_graph->col_sets != NULL);
   ctx_assert(!colours_loaded || kmers_loaded);
   ctx_assert(hdr != NULL);
 
@@ -563,8 +680,10 @@ size_t graph_writer_merge(const char *out_ctx_path,
     status("Loading and saving %zu colours at once", output_colours);
 
     if(!kmers_loaded) {
-      for(i = 0; i < num_files; i++)
+      for(i = 0; i < num_files; i++) {
         graph_load(&files[i], gprefs, NULL);
+        if(db_graph->col_sets != NULL) colour_sets_collect(db_graph->col_sets);
+      }
       hash_table_print_stats(&db_graph->ht);
     }
 
@@ -579,6 +698,13 @@ size_t graph_writer_merge(const char *out_ctx_path,
     status("[overwriting] Saving %zu colours, %zu colours at a time",
            output_colours, db_graph->num_of_cols);
 
+    // Colours are written into fixed width kmer records in place
+    if(hdr->version == CTX_GRAPH_FILEFORMAT_BLOCKS) {
+      warn("Cannot compress graph when saving colours in batches, "
+           "using format version %i", CTX_GRAPH_FILEFORMAT);
+      hdr->version = CTX_GRAPH_FILEFORMAT;
+    }
+
     // Open file, write header
     FILE *fout = futil_fopen(out_ctx_path, "r+");
 
@@ -618,7 +744,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
       if(firstcol == 0 || files_loaded) {
         status("Wiping colours");
         memset(db_graph->col_edges, 0, num_kmer_cols * sizeof(Edges));
-        memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(Covg));
+        db_graph_zero_covgs(db_graph);
       }
 
       files_loaded = false;
@@ -676,7 +802,7 @@ size_t graph_writer_merge(const char *out_ctx_path,
 
     // Print output status
     graph_writer_print_status(db_graph->ht.num_kmers, output_colours,
-                              out_ctx_path, CTX_GRAPH_FILEFORMAT);
+                              out_ctx_path, hdr->version);
   }
 
   return db_graph->ht.num_kmers;
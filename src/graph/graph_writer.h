@@ -66,6 +66,8 @@ uint64_t graph_writer_save_mkhdr(const char *path, const dBGraph *graph,
                                  size_t num_of_cols);
 
 // Pass your own header
+// Kmers are block compressed if header->version is CTX_GRAPH_FILEFORMAT_BLOCKS,
+// in which case they are first sorted using 8 bytes per kmer
 uint64_t graph_writer_save(const char *path, const dBGraph *db_graph,
                            const GraphFileHeader *header, size_t intocol,
                            const Colour *colours, Colour start_col,
@@ -83,6 +85,8 @@ void graph_writer_print_status(uint64_t nkmers, size_t ncols,
 //   (i.e. only keep nodes and edges that are in the graph)
 // Same functionality as graph_writer_merge, but faster if dealing with only one
 // input file. Reads in and dumps one kmer at a time
+// Kmers are block compressed if hdr->version is CTX_GRAPH_FILEFORMAT_BLOCKS,
+// which requires the input file to be sorted
 size_t graph_writer_stream(const char *out_ctx_path, GraphFileReader *file,
                            const dBGraph *db_graph, const GraphFileHeader *hdr,
                            const Edges *only_load_if_in_edges);
@@ -6,6 +6,9 @@
 #include "db_node.h"
 #include "graph_info.h"
 
+#include <pthread.h>
+#include "msg-pool/msgpool.h"
+
 //
 // Graph loading stats
 //
@@ -43,6 +46,285 @@ void graph_loading_print_status(const GraphFileReader *file)
   }
 }
 
+// Returns false if kmer has no coverage and should not be loaded
+// Updates stats and applies prefs->boolean_covgs to covgs
+static inline bool graph_load_keep_kmer(const GraphLoadingPrefs *prefs,
+                                        GraphLoadingStats *stats,
+                                        Covg *covgs, size_t ncols)
+{
+  size_t i;
+
+  // If kmer has no covg -> don't load
+  Covg keep_kmer = 0;
+  for(i = 0; i < ncols; i++) keep_kmer |= covgs[i];
+  if(keep_kmer == 0) return false;
+
+  if(stats) {
+    for(i = 0; i < ncols; i++) {
+      stats->nkmers[i] += covgs[i] > 0;
+      stats->sumcov[i] += covgs[i];
+    }
+  }
+
+  if(prefs->boolean_covgs)
+    for(i = 0; i < ncols; i++)
+      covgs[i] = covgs[i] > 0;
+
+  return true;
+}
+
+// Add colours, coverage and edges of a kmer to a node
+// If `mt` is true, updates are thread safe
+static inline void graph_load_node(const GraphLoadingPrefs *prefs, hkey_t hkey,
+                                   const Covg *covgs, const Edges *edges,
+                                   size_t ncols, bool mt)
+{
+  dBGraph *graph = prefs->db_graph;
+  size_t i;
+
+  // Set presence in colours
+  if(graph->col_sets != NULL) {
+    // Sparse colours also store edges in each colour. Add all colours of the
+    // kmer at once so that only its final colour list is stored.
+    uint32_t ents[ncols];
+    size_t n = 0;
+    for(i = 0; i < ncols; i++)
+      if(covgs[i] || edges[i]) ents[n++] = colset_entry(i, edges[i]);
+    colour_sets_add_mt(graph->col_sets, hkey, ents, n);
+  }
+  else if(graph->node_in_cols != NULL) {
+    for(i = 0; i < ncols; i++) {
+      if(!mt) db_node_or_col(graph, hkey, i, (covgs[i] || edges[i]));
+      else if(covgs[i] || edges[i]) db_node_set_col_mt(graph, hkey, i);
+    }
+  }
+
+  if(db_graph_covgs_alloced(graph)) {
+    for(i = 0; i < ncols; i++) {
+      if(!mt) db_node_add_col_covg(graph, hkey, i, covgs[i]);
+      else if(covgs[i]) db_node_add_col_covg_mt(graph, hkey, i, covgs[i]);
+    }
+  }
+
+  // Merge all edges into one colour
+  if(graph->col_edges != NULL)
+  {
+    // Edges edge_mask = db_node_get_edges_union(graph, hkey);
+    Edges edge_mask = 0xff, union_edges = 0;
+
+    if(prefs->must_exist_in_edges)
+      edge_mask = prefs->must_exist_in_edges[hkey];
+    else if(prefs->must_exist_in_graph)
+      edge_mask = db_node_get_edges_union(graph, hkey);
+
+    Edges *col_edges = &db_node_edges(graph, hkey, 0);
+
+    if(graph->num_edge_cols == 1) {
+      for(i = 0; i < ncols; i++)
+        union_edges |= edges[i] & edge_mask;
+      if(!mt) col_edges[0] |= union_edges;
+      else if(union_edges) __sync_or_and_fetch(&col_edges[0], union_edges);
+    }
+    else {
+      for(i = 0; i < ncols; i++) {
+        if(!mt) col_edges[i] |= edges[i] & edge_mask;
+        else if(edges[i] & edge_mask)
+          __sync_or_and_fetch(&col_edges[i], edges[i] & edge_mask);
+      }
+    }
+  }
+}
+
+//
+// Multithreaded loading
+// One thread reads blocks of kmers from the file into a pool, which are
+// added to the graph by prefs.nthreads threads
+//
+
+#define GRAPH_LOAD_BLOCK 4096 // kmers per block
+
+typedef struct
+{
+  size_t n; // number of kmers in the block
+  BinaryKmer *bkmers; // [GRAPH_LOAD_BLOCK]
+  Covg *covgs; // [GRAPH_LOAD_BLOCK*ncols]
+  Edges *edges; // [GRAPH_LOAD_BLOCK*ncols]
+} GraphLoadBlock;
+
+typedef struct
+{
+  GraphFileReader *file;
+  const GraphLoadingPrefs *prefs;
+  GraphLoadingStats *stats; // only updated by the reader
+  size_t ncols;
+  MsgPool pool; // pool of GraphLoadBlock*
+  uint64_t nkmers_read;
+  volatile uint64_t nkmers_loaded, nkmers_novel;
+} GraphLoader;
+
+static void graph_load_block_pool_init(void *el, size_t idx, void *args)
+{
+  GraphLoadBlock *blocks = (GraphLoadBlock*)args, *blk = blocks + idx;
+  memcpy(el, &blk, sizeof(GraphLoadBlock*));
+}
+
+static void* graph_load_reader(void *arg)
+{
+  GraphLoader *ldr = (GraphLoader*)arg;
+  const size_t ncols = ldr->ncols;
+  GraphLoadBlock *blk;
+  BinaryKmer *bkmer;
+  Covg *covgs;
+  Edges *edges;
+  int pos;
+  bool more = true;
+
+  while(more)
+  {
+    pos = msgpool_claim_write(&ldr->pool);
+    memcpy(&blk, msgpool_get_ptr(&ldr->pool, pos), sizeof(GraphLoadBlock*));
+
+    for(blk->n = 0; blk->n < GRAPH_LOAD_BLOCK; ldr->nkmers_read++)
+    {
+      bkmer = blk->bkmers + blk->n;
+      covgs = blk->covgs + blk->n * ncols;
+      edges = blk->edges + blk->n * ncols;
+      if(!graph_file_read_reset(ldr->file, bkmer, covgs, edges)) { more = false; break; }
+      blk->n += graph_load_keep_kmer(ldr->prefs, ldr->stats, covgs, ncols);
+    }
+
+    msgpool_release(&ldr->pool, pos, MPOOL_FULL);
+  }
+
+  msgpool_close(&ldr->pool);
+  return NULL;
+}
+
+static void graph_load_add_block(GraphLoader *ldr, const GraphLoadBlock *blk)
+{
+  const GraphLoadingPrefs *prefs = ldr->prefs;
+  dBGraph *graph = prefs->db_graph;
+  const size_t ncols = ldr->ncols;
+  dBNode nodes[GRAPH_LOAD_BLOCK];
+  bool found[GRAPH_LOAD_BLOCK];
+  size_t i, j, n, nkmers_loaded = 0, nkmers_novel = 0;
+  size_t epoch = db_graph_grow_enter(graph);
+
+  for(i = 0; i < blk->n; i += n)
+  {
+    // Fetch nodes in the de bruijn graph
+    if(prefs->must_exist_in_graph)
+    {
+      n = blk->n - i;
+      for(j = 0; j < n; j++) {
+        nodes[j].key = hash_table_find(&graph->ht, blk->bkmers[i+j]);
+        found[j] = true;
+      }
+    }
+    else
+    {
+      // Kmers in graph files are keys
+      n = db_graph_find_or_add_nodes_mt(graph, blk->bkmers+i, blk->bkmers+i,
+                                        blk->n - i, nodes, found);
+    }
+
+    for(j = 0; j < n; j++)
+    {
+      if(nodes[j].key == HASH_NOT_FOUND) continue;
+      if(prefs->empty_colours && found[j]) die("Duplicate kmer loaded");
+      nkmers_novel += !found[j];
+      graph_load_node(prefs, nodes[j].key,
+                      blk->covgs + (i+j)*ncols, blk->edges + (i+j)*ncols,
+                      ncols, true);
+      nkmers_loaded++;
+    }
+
+    // Graph is full, wait for it to grow
+    if(i + n < blk->n) {
+      db_graph_grow_exit(graph, epoch);
+      db_graph_grow_mt(graph, epoch);
+      epoch = db_graph_grow_enter(graph);
+    }
+  }
+
+  db_graph_grow_exit(graph, epoch);
+
+  __sync_fetch_and_add(&ldr->nkmers_loaded, nkmers_loaded);
+  __sync_fetch_and_add(&ldr->nkmers_novel, nkmers_novel);
+}
+
+static void graph_load_worker(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GraphLoader *ldr = (GraphLoader*)arg;
+  GraphLoadBlock *blk;
+  int pos;
+
+  while((pos = msgpool_claim_read(&ldr->pool)) != -1)
+  {
+    memcpy(&blk, msgpool_get_ptr(&ldr->pool, pos), sizeof(GraphLoadBlock*));
+    graph_load_add_block(ldr, blk);
+    msgpool_release(&ldr->pool, pos, MPOOL_EMPTY);
+  }
+}
+
+static void graph_load_mt(GraphFileReader *file, const GraphLoadingPrefs *prefs,
+                          GraphLoadingStats *stats, size_t ncols,
+                          uint64_t *nkmers_read, uint64_t *nkmers_loaded,
+                          uint64_t *nkmers_novel)
+{
+  dBGraph *graph = prefs->db_graph;
+  size_t i, nthreads = prefs->nthreads, nblocks = 2 * nthreads;
+  int rc;
+
+  // Insert threads need bucket locks unless the hash table is lock-free
+  bool tmp_bktlocks = (graph->bktlocks == NULL && !prefs->must_exist_in_graph &&
+                       !hash_table_get_lockfree());
+  if(tmp_bktlocks)
+    graph->bktlocks = ctx_calloc(roundup_bits2bytes(graph->ht.num_of_buckets), 1);
+
+  GraphLoadBlock *blocks = ctx_calloc(nblocks, sizeof(GraphLoadBlock));
+  for(i = 0; i < nblocks; i++) {
+    blocks[i].bkmers = ctx_malloc(GRAPH_LOAD_BLOCK * sizeof(BinaryKmer));
+    blocks[i].covgs = ctx_malloc(GRAPH_LOAD_BLOCK * ncols * sizeof(Covg));
+    blocks[i].edges = ctx_malloc(GRAPH_LOAD_BLOCK * ncols * sizeof(Edges));
+  }
+
+  GraphLoader ldr = {.file = file, .prefs = prefs, .stats = stats,
+                     .ncols = ncols, .nkmers_read = 0,
+                     .nkmers_loaded = 0, .nkmers_novel = 0};
+
+  msgpool_alloc(&ldr.pool, nblocks, sizeof(GraphLoadBlock*), USE_MSG_POOL);
+  msgpool_iterate(&ldr.pool, graph_load_block_pool_init, blocks);
+
+  pthread_t reader;
+  rc = pthread_create(&reader, NULL, graph_load_reader, &ldr);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+
+  util_multi_thread(&ldr, nthreads, graph_load_worker);
+
+  rc = pthread_join(reader, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  msgpool_dealloc(&ldr.pool);
+
+  for(i = 0; i < nblocks; i++) {
+    ctx_free(blocks[i].bkmers);
+    ctx_free(blocks[i].covgs);
+    ctx_free(blocks[i].edges);
+  }
+  ctx_free(blocks);
+
+  if(tmp_bktlocks) {
+    ctx_free(graph->bktlocks);
+    graph->bktlocks = NULL;
+  }
+
+  *nkmers_read = ldr.nkmers_read;
+  *nkmers_loaded = ldr.nkmers_loaded;
+  *nkmers_novel = ldr.nkmers_novel;
+}
+
 // if only_load_if_in_colour is >= 0, only kmers with coverage in existing
 // colour only_load_if_in_colour will be loaded.
 // We assume only_load_if_in_colour < load_first_colour_into
@@ -98,83 +380,44 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
   // Update number of colours loaded
   graph->num_of_cols_used = MAX2(graph->num_of_cols_used, ncols);
 
-  // Read kmers, align colours to those they are updating
-  //  e.g. covgs[i] -> colour i in the graph
-  BinaryKmer bkmer;
-  Covg covgs[ncols];
-  Edges edges[ncols];
-  hkey_t hkey;
-  size_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
+  uint64_t nkmers_read = 0, nkmers_loaded = 0, nkmers_novel = 0;
 
   if(stats) graph_loading_stats_capacity(stats, ncols);
 
-  for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++)
+  if(prefs.nthreads > 1)
   {
-    // If kmer has no covg -> don't load
-    Covg keep_kmer = 0;
-    for(i = 0; i < ncols; i++) keep_kmer |= covgs[i];
-    if(keep_kmer == 0) continue;
-
-    if(stats) {
-      for(i = 0; i < ncols; i++) {
-        stats->nkmers[i] += covgs[i] > 0;
-        stats->sumcov[i] += covgs[i];
-      }
-    }
-
-    if(prefs.boolean_covgs)
-      for(i = 0; i < ncols; i++)
-        covgs[i] = covgs[i] > 0;
-
-    // Fetch node in the de bruijn graph
-    if(prefs.must_exist_in_graph)
-    {
-      if((hkey = hash_table_find(&graph->ht, bkmer)) == HASH_NOT_FOUND) continue;
-    }
-    else
-    {
-      bool found;
-      hkey = hash_table_find_or_insert(&graph->ht, bkmer, &found);
-      if(prefs.empty_colours && found) die("Duplicate kmer loaded");
-      nkmers_novel += !found;
-    }
-
-    // Set presence in colours
-    if(graph->node_in_cols != NULL) {
-      for(i = 0; i < ncols; i++) {
-        db_node_or_col(graph, hkey, i, (covgs[i] || edges[i]));
-      }
-    }
-
-    if(graph->col_covgs != NULL) {
-      for(i = 0; i < ncols; i++)
-        db_node_add_col_covg(graph, hkey, i, covgs[i]);
-    }
-
-    // Merge all edges into one colour
-    if(graph->col_edges != NULL)
+    graph_load_mt(file, &prefs, stats, ncols,
+                  &nkmers_read, &nkmers_loaded, &nkmers_novel);
+  }
+  else
+  {
+    // Read kmers, align colours to those they are updating
+    //  e.g. covgs[i] -> colour i in the graph
+    BinaryKmer bkmer;
+    Covg covgs[ncols];
+    Edges edges[ncols];
+    hkey_t hkey;
+
+    for(; graph_file_read_reset(file, &bkmer, covgs, edges); nkmers_read++)
     {
-      // Edges edge_mask = db_node_get_edges_union(graph, hkey);
-      Edges edge_mask = 0xff;
-
-      if(prefs.must_exist_in_edges)
-        edge_mask = prefs.must_exist_in_edges[hkey];
-      else if(prefs.must_exist_in_graph)
-        edge_mask = db_node_get_edges_union(graph, hkey);
+      if(!graph_load_keep_kmer(&prefs, stats, covgs, ncols)) continue;
 
-      Edges *col_edges = &db_node_edges(graph, hkey, 0);
-
-      if(graph->num_edge_cols == 1) {
-        for(i = 0; i < ncols; i++)
-          col_edges[0] |= edges[i] & edge_mask;
+      // Fetch node in the de bruijn graph
+      if(prefs.must_exist_in_graph)
+      {
+        if((hkey = hash_table_find(&graph->ht, bkmer)) == HASH_NOT_FOUND) continue;
       }
-      else {
-        for(i = 0; i < ncols; i++)
-          col_edges[i] |= edges[i] & edge_mask;
+      else
+      {
+        bool found;
+        hkey = db_graph_find_or_add_node(graph, bkmer, &found).key;
+        if(prefs.empty_colours && found) die("Duplicate kmer loaded");
+        nkmers_novel += !found;
       }
-    }
 
-    nkmers_loaded++;
+      graph_load_node(&prefs, hkey, covgs, edges, ncols, false);
+      nkmers_loaded++;
+    }
   }
 
   if(file->num_of_kmers >= 0 && nkmers_read != (uint64_t)file->num_of_kmers)
@@ -182,7 +425,7 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
     warn("%s kmers in the graph file than expected "
          "[exp: %zu; act: %zu; path: %s]",
          nkmers_read > (uint64_t)file->num_of_kmers ? "More" : "Fewer",
-         (size_t)file->num_of_kmers, nkmers_read, fltr->path.b);
+         (size_t)file->num_of_kmers, (size_t)nkmers_read, fltr->path.b);
   }
 
   if(stats != NULL)
@@ -18,6 +18,9 @@ typedef struct
   // if empty_colours is true an error is thrown if a kmer from a graph file
   // is already in the graph
   bool empty_colours;
+  // number of threads to add kmers to the graph with, kmers are read by an
+  // extra thread in blocks. Use 1 to load on the calling thread.
+  size_t nthreads;
 } GraphLoadingPrefs;
 
 typedef struct
@@ -38,7 +41,8 @@ static inline GraphLoadingPrefs graph_loading_prefs(dBGraph *graph)
     .boolean_covgs = false,
     .must_exist_in_graph = false,
     .must_exist_in_edges = NULL,
-    .empty_colours = false
+    .empty_colours = false,
+    .nthreads = 1
   };
   return prefs;
 }
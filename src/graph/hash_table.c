@@ -11,21 +11,132 @@
 
 static const BinaryKmer unset_bkmer = {.b = {UNSET_BKMER_WORD}};
 
+// Method used to search buckets, see hash_table_set_scan()
+static HashTableScan ht_scan = HT_SCAN_AUTO;
+
+// Use CAS insertion instead of bucket locks, see hash_table_set_lockfree()
+static bool ht_lockfree = HASH_LOCKFREE;
+
+// Allocate compact tables, see hash_table_set_compact()
+static bool ht_compact = false;
+
+// Hash for new tables, see hash_table_set_hash()
+#ifdef HASH_TABLE_REHASH
+  static HashTableHash ht_hash = HT_HASH_REHASH;
+#else
+  static HashTableHash ht_hash = HT_HASH_WYHASH;
+#endif
+
 #define ht_bckt_ptr(ht,bckt) ((ht)->table + (size_t)bckt * (ht)->bucket_size)
+
+// Address of the start of a bucket, for prefetching
+#define ht_bckt_addr(ht,bckt) ((ht)->entries != NULL ? \
+  (const void*)((ht)->entries + (((size_t)(bckt) * (ht)->bucket_size * (ht)->entry_bits) >> 6)) : \
+  (const void*)ht_bckt_ptr(ht,bckt))
 #define hash_table_bsize(ht,bkt) ((ht)->buckets[bkt][HT_BSIZE])
 #define hash_table_bitems(ht,bkt) ((ht)->buckets[bkt][HT_BITEMS])
 #define hash_table_bsize_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BSIZE])
 #define hash_table_bitems_mt(ht,bkt) (*(volatile uint8_t*)&ht->buckets[bkt][HT_BITEMS])
 
-void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
+//
+// Hashing
+//
+// ht_hash0() is called once per kmer, ht_bucket() then gives the bucket for
+// each rehash round. With HT_HASH_WYHASH every round comes from the one 64 bit
+// hash: lo + i*hi, with hi odd so that rounds never repeat a bucket. With
+// HT_HASH_REHASH each round after the first hashes the kmer again.
+//
+
+static const char *ht_hash_names[] = {"rehash", "wyhash"};
+
+// Compact tables use the scrambled key as h0, see hash_table.h
+static inline uint64_t ht_ckey_scramble(const HashTable *ht, uint64_t x)
 {
-  uint64_t num_of_buckets, capacity;
-  uint8_t bucket_size;
+  const uint64_t mask = bitmask64(HT_CKEY_BITS);
+  x ^= hash_table_ckey_seed(ht);
+  x ^= x >> HT_CKEY_SHIFT;
+  x = (x * HT_CKEY_MUL1) & mask;
+  x ^= x >> HT_CKEY_SHIFT;
+  x = (x * HT_CKEY_MUL2) & mask;
+  x ^= x >> HT_CKEY_SHIFT;
+  return x;
+}
+
+static inline uint64_t ht_hash0(const HashTable *ht, const BinaryKmer key)
+{
+  if(ht->entries != NULL) return ht_ckey_scramble(ht, key.b[0]);
+  if(ht->hash == HT_HASH_WYHASH) return binary_kmer_hash64(key, ht->seed);
+  return binary_kmer_hash(key, ht->seed);
+}
+
+static inline uint_fast32_t ht_bucket(const HashTable *ht, const BinaryKmer key,
+                                      uint64_t h0, size_t i)
+{
+  if(ht->entries != NULL)
+    return (h0 + i * ((h0 >> ht->bucket_bits) | 1)) & ht->hash_mask;
+  if(ht->hash == HT_HASH_WYHASH)
+    return (uint32_t)(h0 + i * ((h0 >> 32) | 1)) & ht->hash_mask;
+  if(i > 0) h0 = binary_kmer_hash(key, ht->seed+i);
+  return (uint_fast32_t)h0 & ht->hash_mask;
+}
+
+void hash_table_set_hash(HashTableHash hash)
+{
+  ctx_assert((size_t)hash < HT_NUM_HASHES);
+  ht_hash = hash;
+}
+
+HashTableHash hash_table_get_hash()
+{
+  return ht_hash;
+}
+
+const char* hash_table_hash_str(HashTableHash hash)
+{
+  ctx_assert((size_t)hash < HT_NUM_HASHES);
+  return ht_hash_names[hash];
+}
+
+bool hash_table_hash_parse(const char *str, HashTableHash *hash)
+{
+  size_t i;
+  for(i = 0; i < HT_NUM_HASHES; i++) {
+    if(strcasecmp(str, ht_hash_names[i]) == 0) {
+      *hash = (HashTableHash)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void hash_table_set_compact(bool compact)
+{
+  if(compact && !HT_COMPACT_SUPPORTED) {
+    warn("Compact hash tables need k <= 31 (compiled with MAXK=%i)", MAX_KMER_SIZE);
+    compact = false;
+  }
+  ht_compact = compact;
+}
+
+bool hash_table_get_compact()
+{
+  return ht_compact;
+}
 
-  capacity = hash_table_cap(req_capacity, &num_of_buckets, &bucket_size);
+static void _hash_table_alloc(HashTable *ht, uint64_t num_of_buckets,
+                              uint8_t bucket_size, uint32_t seed,
+                              HashTableHash hash, bool compact)
+{
+  uint64_t capacity = num_of_buckets * bucket_size;
   uint_fast32_t hash_mask = (uint_fast32_t)(num_of_buckets - 1);
+  size_t bucket_bits = (size_t)__builtin_ctzl(num_of_buckets);
+  size_t entry_bits = compact ? HT_CKEY_BITS - bucket_bits + HT_CROUND_BITS : 0;
+  size_t nwords = compact ? (capacity * entry_bits + 63) / 64 + 1 : 0;
+
+  // Entries up to 57 bits can be read with a shift of up to 7 bits
+  ctx_assert(!compact || (HT_COMPACT_SUPPORTED && entry_bits <= 57));
 
-  size_t mem = capacity * sizeof(BinaryKmer) +
+  size_t mem = (compact ? nwords * sizeof(uint64_t) : capacity * sizeof(BinaryKmer)) +
                num_of_buckets * sizeof(uint8_t[2]);
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
@@ -34,18 +145,28 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
   ulong_to_str(capacity, cap_str);
   bytes_to_str(mem, 1, mem_str);
   status("[hasht] Allocating table with %s entries, using %s", cap_str, mem_str);
-  status("[hasht]  number of buckets: %s, bucket size: %s", num_bkts_str, bkt_size_str);
+  if(compact) {
+    status("[hasht]  number of buckets: %s, bucket size: %s, compact: %zu bits/entry",
+           num_bkts_str, bkt_size_str, entry_bits);
+  } else {
+    status("[hasht]  number of buckets: %s, bucket size: %s, hash: %s",
+           num_bkts_str, bkt_size_str, hash_table_hash_str(hash));
+  }
 
-  // calloc is required for bucket_data to set the first element of each bucket
-  // to the 0th pos
-  BinaryKmer *table = ctx_malloc(capacity * sizeof(BinaryKmer));
-  uint8_t (*const buckets)[2] = ctx_calloc(num_of_buckets, sizeof(uint8_t[2]));
-
-  size_t i;
-  for(i = 0; i < capacity; i++) table[i] = unset_bkmer;
+  // Bucket sizes must start at zero. Entries are set to unset_bkmer by
+  // multiple threads, so the table is spread across NUMA nodes. Zero is an
+  // unset compact entry.
+  BinaryKmer *table = NULL;
+  uint64_t *entries = NULL;
+  if(compact) entries = ctx_large_alloc(nwords, sizeof(uint64_t), NULL);
+  else table = ctx_large_alloc(capacity, sizeof(BinaryKmer), &unset_bkmer);
+  uint8_t (*const buckets)[2] = ctx_large_alloc(num_of_buckets, sizeof(uint8_t[2]), NULL);
 
   HashTable data = {
     .table = table,
+    .entries = entries,
+    .entry_bits = (uint8_t)entry_bits,
+    .bucket_bits = (uint8_t)bucket_bits,
     .num_of_buckets = num_of_buckets,
     .hash_mask = hash_mask,
     .bucket_size = bucket_size,
@@ -53,37 +174,224 @@ void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
     .buckets = buckets,
     .num_kmers = 0,
     .collisions = {0},
-    .seed = rand()};
+    .seed = seed,
+    .hash = hash,
+    .growable = false};
 
   memcpy(ht, &data, sizeof(data));
 }
 
+void hash_table_alloc(HashTable *ht, uint64_t req_capacity)
+{
+  uint64_t num_of_buckets;
+  uint8_t bucket_size;
+
+  if(ht_scan == HT_SCAN_AUTO) hash_table_set_scan(HT_SCAN_AUTO);
+
+  hash_table_cap(req_capacity, &num_of_buckets, &bucket_size);
+  _hash_table_alloc(ht, num_of_buckets, bucket_size, rand(), ht_hash,
+                    ht_compact && HT_COMPACT_SUPPORTED);
+}
+
 void hash_table_dealloc(HashTable *hash_table)
 {
-  ctx_free(hash_table->table);
-  ctx_free(hash_table->buckets);
+  ctx_large_free(hash_table->table);
+  ctx_large_free(hash_table->entries);
+  ctx_large_free(hash_table->buckets);
 }
 
 void hash_table_empty(HashTable *const ht)
 {
-  size_t i;
-  BinaryKmer *table = ht->table;
-  for(i = 0; i < ht->capacity; i++) table[i] = unset_bkmer;
-  memset(ht->buckets, 0, ht->num_of_buckets * sizeof(uint8_t[2]));
+  if(ht->entries != NULL) {
+    size_t nwords = (ht->capacity * ht->entry_bits + 63) / 64 + 1;
+    alloc_large_fill(ht->entries, nwords, sizeof(uint64_t), NULL);
+  } else {
+    alloc_large_fill(ht->table, ht->capacity, sizeof(BinaryKmer), &unset_bkmer);
+  }
+  alloc_large_fill(ht->buckets, ht->num_of_buckets, sizeof(uint8_t[2]), NULL);
 
   HashTable data = {
     .table = ht->table,
+    .entries = ht->entries,
+    .entry_bits = ht->entry_bits,
+    .bucket_bits = ht->bucket_bits,
     .num_of_buckets = ht->num_of_buckets,
     .hash_mask = ht->hash_mask,
     .bucket_size = ht->bucket_size,
     .capacity = ht->capacity,
     .buckets = ht->buckets,
     .num_kmers = 0,
-    .collisions = {0}};
+    .collisions = {0},
+    .seed = ht->seed,
+    .hash = ht->hash,
+    .growable = ht->growable};
 
   memcpy(ht, &data, sizeof(data));
 }
 
+//
+// Bucket scanning
+//
+// Buckets are contiguous arrays of BinaryKmers, so with one or two words per
+// kmer we can compare several entries per instruction with SSE4.1 / AVX2.
+// The instruction set is picked at runtime since binaries are often built on
+// one machine and run on others. Unset entries have the top bit set, which a
+// valid key never does, so they never match.
+//
+
+static const char *ht_scan_names[] = {"auto", "scalar", "sse4.1", "avx2"};
+
+static inline const BinaryKmer* bucket_scan_scalar(const BinaryKmer *ptr,
+                                                   const BinaryKmer *end,
+                                                   const BinaryKmer bkmer)
+{
+  while(ptr < end) {
+    if(binary_kmers_are_equal(bkmer, *ptr)) return ptr;
+    ptr++;
+  }
+  return NULL; // Not found
+}
+
+#if HT_SIMD_SCAN
+
+#include <immintrin.h>
+
+#if NUM_BKMER_WORDS == 1
+
+__attribute__((target("sse4.1")))
+static const BinaryKmer* bucket_scan_sse4(const BinaryKmer *ptr,
+                                          const BinaryKmer *end,
+                                          const BinaryKmer bkmer)
+{
+  const __m128i q = _mm_set1_epi64x((long long)bkmer.b[0]);
+  __m128i v0, v1;
+  int m;
+
+  // 4 kmers per iteration, 2 per compare
+  for(; ptr+4 <= end; ptr += 4) {
+    v0 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)ptr), q);
+    v1 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(ptr+2)), q);
+    m = _mm_movemask_pd(_mm_castsi128_pd(v0)) |
+        (_mm_movemask_pd(_mm_castsi128_pd(v1)) << 2);
+    if(m) return ptr + __builtin_ctz(m);
+  }
+
+  return bucket_scan_scalar(ptr, end, bkmer);
+}
+
+__attribute__((target("avx2")))
+static const BinaryKmer* bucket_scan_avx2(const BinaryKmer *ptr,
+                                          const BinaryKmer *end,
+                                          const BinaryKmer bkmer)
+{
+  const __m256i q = _mm256_set1_epi64x((long long)bkmer.b[0]);
+  __m256i v0, v1;
+  int m;
+
+  // 8 kmers per iteration, 4 per compare
+  for(; ptr+8 <= end; ptr += 8) {
+    v0 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)ptr), q);
+    v1 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(ptr+4)), q);
+    m = _mm256_movemask_pd(_mm256_castsi256_pd(v0)) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(v1)) << 4);
+    if(m) return ptr + __builtin_ctz(m);
+  }
+
+  if(ptr+4 <= end) {
+    v0 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)ptr), q);
+    m = _mm256_movemask_pd(_mm256_castsi256_pd(v0));
+    if(m) return ptr + __builtin_ctz(m);
+    ptr += 4;
+  }
+
+  return bucket_scan_scalar(ptr, end, bkmer);
+}
+
+#else /* NUM_BKMER_WORDS == 2 */
+
+// A kmer matches when both of its 64 bit words match. With a mask of matching
+// words, (m & m>>1) has bit 2*i set if the i-th kmer in the register matched
+__attribute__((target("sse4.1")))
+static const BinaryKmer* bucket_scan_sse4(const BinaryKmer *ptr,
+                                          const BinaryKmer *end,
+                                          const BinaryKmer bkmer)
+{
+  const __m128i q = _mm_set_epi64x((long long)bkmer.b[1], (long long)bkmer.b[0]);
+  __m128i v0, v1;
+  int m;
+
+  // 2 kmers per iteration, 1 per compare
+  for(; ptr+2 <= end; ptr += 2) {
+    v0 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)ptr), q);
+    v1 = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(ptr+1)), q);
+    m = _mm_movemask_pd(_mm_castsi128_pd(v0)) |
+        (_mm_movemask_pd(_mm_castsi128_pd(v1)) << 2);
+    m &= (m >> 1) & 0x5;
+    if(m) return ptr + (__builtin_ctz(m) >> 1);
+  }
+
+  return bucket_scan_scalar(ptr, end, bkmer);
+}
+
+__attribute__((target("avx2")))
+static const BinaryKmer* bucket_scan_avx2(const BinaryKmer *ptr,
+                                          const BinaryKmer *end,
+                                          const BinaryKmer bkmer)
+{
+  const __m256i q = _mm256_set_epi64x((long long)bkmer.b[1], (long long)bkmer.b[0],
+                                      (long long)bkmer.b[1], (long long)bkmer.b[0]);
+  __m256i v0, v1;
+  int m;
+
+  // 4 kmers per iteration, 2 per compare
+  for(; ptr+4 <= end; ptr += 4) {
+    v0 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)ptr), q);
+    v1 = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(ptr+2)), q);
+    m = _mm256_movemask_pd(_mm256_castsi256_pd(v0)) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(v1)) << 4);
+    m &= (m >> 1) & 0x55;
+    if(m) return ptr + (__builtin_ctz(m) >> 1);
+  }
+
+  return bucket_scan_sse4(ptr, end, bkmer);
+}
+
+#endif /* NUM_BKMER_WORDS */
+
+#endif /* HT_SIMD_SCAN */
+
+// Returns the fastest bucket scan supported by this CPU
+static HashTableScan hash_table_best_scan()
+{
+  #if HT_SIMD_SCAN
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return HT_SCAN_AVX2;
+    if(__builtin_cpu_supports("sse4.1")) return HT_SCAN_SSE4;
+  #endif
+  return HT_SCAN_SCALAR;
+}
+
+// Set bucket scan method. Falls back to the best available if the CPU does not
+// support the one requested. Not thread safe: call before using hash tables.
+// Returns method now in use
+HashTableScan hash_table_set_scan(HashTableScan scan)
+{
+  HashTableScan best = hash_table_best_scan();
+  ht_scan = (scan == HT_SCAN_AUTO || scan > best) ? best : scan;
+  return ht_scan;
+}
+
+HashTableScan hash_table_get_scan()
+{
+  return ht_scan;
+}
+
+const char* hash_table_scan_str(HashTableScan scan)
+{
+  ctx_assert((size_t)scan < sizeof(ht_scan_names)/sizeof(ht_scan_names[0]));
+  return ht_scan_names[scan];
+}
+
 static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const ht,
                                                           uint_fast32_t bucket,
                                                           const BinaryKmer bkmer)
@@ -91,11 +399,64 @@ static inline const BinaryKmer* hash_table_find_in_bucket(const HashTable *const
   const BinaryKmer *ptr = ht_bckt_ptr(ht, bucket);
   const BinaryKmer *end = ptr + hash_table_bsize(ht, bucket);
 
-  while(ptr < end) {
-    if(binary_kmers_are_equal(bkmer, *ptr)) return ptr;
-    ptr++;
+  #if HT_SIMD_SCAN
+    switch(ht_scan) {
+      case HT_SCAN_AVX2: return bucket_scan_avx2(ptr, end, bkmer);
+      case HT_SCAN_SSE4: return bucket_scan_sse4(ptr, end, bkmer);
+      default: break;
+    }
+  #endif
+
+  return bucket_scan_scalar(ptr, end, bkmer);
+}
+
+//
+// Compact entries
+//
+// Entries are bit packed into 64 bit words. They are set and cleared with
+// atomic OR/AND, so entries sharing a word can be written by different threads
+// (e.g. holding locks on neighbouring buckets, or deleting).
+//
+
+static inline uint64_t ht_centry_word(const HashTable *ht, uint64_t h0, size_t i)
+{
+  return ((h0 >> ht->bucket_bits) << HT_CROUND_BITS) | (i+1);
+}
+
+static inline void ht_centry_or(HashTable *ht, hkey_t hkey, uint64_t v)
+{
+  uint64_t bit = (uint64_t)hkey * ht->entry_bits;
+  volatile uint64_t *w = (volatile uint64_t*)ht->entries + (bit >> 6);
+  size_t s = bit & 63;
+  __sync_fetch_and_or(w, v << s);
+  if(s + ht->entry_bits > 64) __sync_fetch_and_or(w+1, v >> (64 - s));
+}
+
+static inline void ht_centry_clear(HashTable *ht, hkey_t hkey)
+{
+  uint64_t bit = (uint64_t)hkey * ht->entry_bits, mask = bitmask64(ht->entry_bits);
+  volatile uint64_t *w = (volatile uint64_t*)ht->entries + (bit >> 6);
+  size_t s = bit & 63;
+  __sync_fetch_and_and(w, ~(mask << s));
+  if(s + ht->entry_bits > 64) __sync_fetch_and_and(w+1, ~(mask >> (64 - s)));
+}
+
+// Find a key in bucket `bucket`, which is its bucket for rehash round `i`.
+// `h0` is ht_hash0() of the key. Returns HASH_NOT_FOUND if not in the bucket.
+static inline hkey_t ht_find_in_bucket(const HashTable *ht, uint_fast32_t bucket,
+                                       const BinaryKmer key, uint64_t h0, size_t i)
+{
+  if(ht->entries != NULL) {
+    uint64_t e = ht_centry_word(ht, h0, i);
+    hkey_t pos = (hkey_t)bucket * ht->bucket_size;
+    hkey_t end = pos + hash_table_bsize(ht, bucket);
+    for(; pos < end; pos++)
+      if(hash_table_centry(ht, pos) == e) return pos;
+    return HASH_NOT_FOUND;
   }
-  return NULL; // Not found
+
+  const BinaryKmer *ptr = hash_table_find_in_bucket(ht, bucket, key);
+  return ptr != NULL ? (hkey_t)(ptr - ht->table) : HASH_NOT_FOUND;
 }
 
 // static inline const BinaryKmer* hash_table_find_in_bucket_mt(const HashTable *const ht,
@@ -138,6 +499,35 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
   return ptr;
 }
 
+// Insert key into bucket `bucket`, its bucket for round `i`. `h0` is ht_hash0()
+// of the key. Remember to increment ht->num_kmers
+static inline hkey_t ht_insert_in_bucket(HashTable *ht, uint_fast32_t bucket,
+                                         const BinaryKmer key, uint64_t h0,
+                                         size_t i)
+{
+  if(ht->entries == NULL)
+    return (hkey_t)(hash_table_insert_in_bucket(ht, bucket, key) - ht->table);
+
+  size_t bsize = hash_table_bsize(ht, bucket);
+  size_t bitems = hash_table_bitems(ht, bucket);
+  ctx_assert(bitems < ht->bucket_size);
+  ctx_assert(bitems <= bsize);
+  hkey_t pos = (hkey_t)bucket * ht->bucket_size;
+
+  if(bitems == bsize) {
+    pos += bsize;
+    ht->buckets[bucket][HT_BSIZE]++;
+  }
+  else {
+    // Find an entry that has been deleted from this bucket previously
+    while(hash_table_centry(ht, pos)) pos++;
+  }
+
+  ht_centry_or(ht, pos, ht_centry_word(ht, h0, i));
+  ht->buckets[bucket][HT_BITEMS]++;
+  return pos;
+}
+
 // static inline BinaryKmer* hash_table_insert_in_bucket_mt(HashTable *ht,
 //                                                          uint_fast32_t bucket,
 //                                                          const BinaryKmer bkmer)
@@ -162,7 +552,9 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
 //   return ptr;
 // }
 
+// Growable tables return HASH_NOT_FOUND when full, so the caller can grow them
 #define rehash_error_exit(ht) do { \
+  if((ht)->growable) return HASH_NOT_FOUND; \
   ctx_msg_out = stderr; \
   hash_table_print_stats(ht); \
   die("Hash table is full"); \
@@ -170,13 +562,14 @@ static inline BinaryKmer* hash_table_insert_in_bucket(HashTable *ht,
 
 hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
 {
-  const BinaryKmer *ptr;
+  hkey_t hkey;
   size_t i;
   uint_fast32_t h;
+  uint64_t h0 = ht_hash0(ht, key);
 
   #ifdef HASH_PREFETCH
-    uint_fast32_t h2 = binary_kmer_hash(key,ht->seed+0) & ht->hash_mask;
-    __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
+    uint_fast32_t h2 = ht_bucket(ht, key, h0, 0);
+    __builtin_prefetch(ht_bckt_addr(ht, h2), 0, 1);
   #endif
 
   for(i = 0; i < REHASH_LIMIT; i++)
@@ -184,37 +577,204 @@ hkey_t hash_table_find(const HashTable *const ht, const BinaryKmer key)
     #ifdef HASH_PREFETCH
       h = h2;
       if(ht->buckets[h][HT_BSIZE] == ht->bucket_size) {
-        h2 = binary_kmer_hash(key,ht->seed+i+1) & ht->hash_mask;
-        __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
+        h2 = ht_bucket(ht, key, h0, i+1);
+        __builtin_prefetch(ht_bckt_addr(ht, h2), 0, 1);
       }
     #else
-      h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+      h = ht_bucket(ht, key, h0, i);
     #endif
 
-    ptr = hash_table_find_in_bucket(ht, h, key);
-    if(ptr != NULL) return (hkey_t)(ptr - ht->table);
+    hkey = ht_find_in_bucket(ht, h, key, h0, i);
+    if(hkey != HASH_NOT_FOUND) return hkey;
     if(ht->buckets[h][HT_BSIZE] < ht->bucket_size) break;
   }
 
   return HASH_NOT_FOUND;
 }
 
+//
+// Lock-free mode
+//
+// Entries are claimed with a compare-and-swap on the first word of an unset
+// entry (UNSET_BKMER_WORD), bucket sizes are then raised with atomics. Entries
+// only go from unset to set whilst inserting, so every thread inserting the
+// same kmer walks the unset entries of a bucket in the same order and they all
+// meet at the first one claimed. Kmers with more than one word are claimed by
+// swapping in LOCKED_BKMER_WORD, writing the remaining words, then publishing
+// the first word. Readers skip locked entries, so finds never wait.
+//
+
+#define LOCKED_BKMER_WORD (UNSET_BKMER_WORD | (1UL<<62))
+
+#define ht_word0_mt(ptr) (*(volatile const uint64_t*)&(ptr)->b[0])
+
+// `w` is the first word of the entry already read with ht_word0_mt()
+static inline bool lockfree_entry_matches(const BinaryKmer *ptr, uint64_t w,
+                                          const BinaryKmer key)
+{
+  if(w != key.b[0]) return false;
+  #if NUM_BKMER_WORDS > 1
+    __sync_synchronize(); // remaining words were written before the first
+    return !memcmp(ptr->b+1, key.b+1, (NUM_BKMER_WORDS-1)*sizeof(uint64_t));
+  #else
+    (void)ptr;
+    return true;
+  #endif
+}
+
+// Search entries up to bsize, then keep going until we hit an entry that has
+// never been used, in case bsize has not been raised yet by another thread.
+// Sets *full to true if every entry in the bucket has been used.
+static inline const BinaryKmer* lockfree_find_in_bucket(const HashTable *ht,
+                                                        uint_fast32_t bucket,
+                                                        const BinaryKmer key,
+                                                        bool *full)
+{
+  const BinaryKmer *ptr = ht_bckt_ptr(ht, bucket);
+  size_t i, bsize = hash_table_bsize_mt(ht, bucket);
+  uint64_t w;
+
+  for(i = 0; i < ht->bucket_size; i++) {
+    w = ht_word0_mt(ptr+i);
+    if(w == UNSET_BKMER_WORD && i >= bsize) break;
+    if(lockfree_entry_matches(ptr+i, w, key)) { *full = true; return ptr+i; }
+  }
+
+  *full = (i == ht->bucket_size);
+  return NULL;
+}
+
+// Claim entry `pos` in bucket if it is unset. Returns true on success.
+static inline bool lockfree_claim(HashTable *ht, uint_fast32_t bucket,
+                                  size_t pos, const BinaryKmer key)
+{
+  BinaryKmer *ptr = ht_bckt_ptr(ht, bucket) + pos;
+
+  #if NUM_BKMER_WORDS == 1
+    if(!__sync_bool_compare_and_swap((volatile uint64_t*)&ptr->b[0],
+                                     UNSET_BKMER_WORD, key.b[0])) return false;
+  #else
+    if(!__sync_bool_compare_and_swap((volatile uint64_t*)&ptr->b[0],
+                                     UNSET_BKMER_WORD, LOCKED_BKMER_WORD)) return false;
+    memcpy(ptr->b+1, key.b+1, (NUM_BKMER_WORDS-1)*sizeof(uint64_t));
+    __sync_synchronize(); // publish remaining words before the first
+    *(volatile uint64_t*)&ptr->b[0] = key.b[0];
+  #endif
+
+  // Publish bucket size and number of items
+  volatile uint8_t *bsizeptr = &ht->buckets[bucket][HT_BSIZE];
+  uint8_t bsize = *bsizeptr;
+  while(bsize < pos+1 && !__sync_bool_compare_and_swap(bsizeptr, bsize, pos+1))
+    bsize = *bsizeptr;
+
+  __sync_add_and_fetch((volatile uint8_t*)&ht->buckets[bucket][HT_BITEMS], 1);
+  return true;
+}
+
+static inline hkey_t lockfree_find(const HashTable *ht, const BinaryKmer key)
+{
+  const BinaryKmer *ptr;
+  size_t i;
+  uint_fast32_t h;
+  uint64_t h0;
+  bool full;
+
+  // Compact tables are only searched without locks when there are none,
+  // i.e. nothing is inserting (see hash_table_find_mt)
+  if(ht->entries != NULL) return hash_table_find(ht, key);
+
+  h0 = ht_hash0(ht, key);
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h0, i);
+    ptr = lockfree_find_in_bucket(ht, h, key, &full);
+    if(ptr != NULL) return (hkey_t)(ptr - ht->table);
+    if(!full) break;
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+static inline hkey_t lockfree_find_or_insert(HashTable *ht, const BinaryKmer key,
+                                             uint64_t h0, bool *found)
+{
+  const BinaryKmer *ptr;
+  size_t i, pos;
+  uint_fast32_t h;
+  uint64_t w;
+  bool full;
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h0, i);
+
+    // Check existing entries first, deletions may have left unset entries
+    // in front of our kmer
+    ptr = lockfree_find_in_bucket(ht, h, key, &full);
+    if(ptr != NULL) { *found = true; return (hkey_t)(ptr - ht->table); }
+
+    // Claim the first unset entry, checking those claimed by other threads
+    ptr = ht_bckt_ptr(ht, h);
+    for(pos = 0; pos < ht->bucket_size; pos++)
+    {
+      while((w = ht_word0_mt(ptr+pos)) == UNSET_BKMER_WORD) {
+        if(lockfree_claim(ht, h, pos, key)) {
+          __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
+          __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+          *found = false;
+          return (hkey_t)(ptr + pos - ht->table);
+        }
+      }
+
+      // Another thread is writing this entry, it may be our kmer
+      while(w == LOCKED_BKMER_WORD) w = ht_word0_mt(ptr+pos);
+
+      if(lockfree_entry_matches(ptr+pos, w, key)) {
+        *found = true;
+        return (hkey_t)(ptr + pos - ht->table);
+      }
+    }
+  }
+
+  rehash_error_exit(ht);
+}
+
+void hash_table_set_lockfree(bool lockfree)
+{
+  ht_lockfree = lockfree;
+}
+
+bool hash_table_get_lockfree()
+{
+  return ht_lockfree;
+}
+
+// Lock-free if bktlocks is NULL or in lock-free mode
 hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
                           volatile uint8_t *bktlocks)
 {
-  const BinaryKmer *ptr;
+  hkey_t hkey;
   size_t i, bsize;
   uint_fast32_t h;
 
+  // Compact entries that span two words are set with two atomic ORs, so a
+  // reader without the bucket lock could see half an entry and match the
+  // wrong kmer. Compact tables take bucket locks even in lock-free mode.
+  if(bktlocks == NULL || (ht_lockfree && ht->entries == NULL))
+    return lockfree_find(ht, key);
+
+  uint64_t h0 = ht_hash0(ht, key);
+
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+    h = ht_bucket(ht, key, h0, i);
     bitlock_yield_acquire(bktlocks, h);
-    ptr = hash_table_find_in_bucket(ht, h, key);
+    hkey = ht_find_in_bucket(ht, h, key, h0, i);
 
-    if(ptr != NULL) {
+    if(hkey != HASH_NOT_FOUND) {
       bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
 
     bsize = hash_table_bsize(ht, h);
@@ -232,19 +792,20 @@ hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
 // input have different key
 hkey_t hash_table_insert(HashTable *const ht, const BinaryKmer key)
 {
-  const BinaryKmer *ptr;
+  hkey_t hkey;
   size_t i;
   uint_fast32_t h;
+  uint64_t h0 = ht_hash0(ht, key);
   // prefetch doesn't make sense when not searching..
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+    h = ht_bucket(ht, key, h0, i);
     if(ht->buckets[h][HT_BITEMS] < ht->bucket_size) {
-      ptr = hash_table_insert_in_bucket(ht, h, key);
+      hkey = ht_insert_in_bucket(ht, h, key, h0, i);
       ht->collisions[i]++; // only increment collisions when inserting
       ht->num_kmers++;
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
   }
 
@@ -254,13 +815,14 @@ hkey_t hash_table_insert(HashTable *const ht, const BinaryKmer key)
 hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
                                  bool *found)
 {
-  const BinaryKmer *ptr;
+  hkey_t hkey;
   size_t i;
   uint_fast32_t h;
+  uint64_t h0 = ht_hash0(ht, key);
 
   #ifdef HASH_PREFETCH
-    uint_fast32_t h2 = binary_kmer_hash(key,ht->seed+0) & ht->hash_mask;
-    __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
+    uint_fast32_t h2 = ht_bucket(ht, key, h0, 0);
+    __builtin_prefetch(ht_bckt_addr(ht, h2), 0, 1);
   #endif
 
   for(i = 0; i < REHASH_LIMIT; i++)
@@ -268,56 +830,62 @@ hkey_t hash_table_find_or_insert(HashTable *ht, const BinaryKmer key,
     #ifdef HASH_PREFETCH
       h = h2;
       if(ht->buckets[h][HT_BSIZE] == ht->bucket_size) {
-        h2 = binary_kmer_hash(key,ht->seed+i+1) & ht->hash_mask;
-        __builtin_prefetch(ht_bckt_ptr(ht, h2), 0, 1);
+        h2 = ht_bucket(ht, key, h0, i+1);
+        __builtin_prefetch(ht_bckt_addr(ht, h2), 0, 1);
       }
     #else
-      h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+      h = ht_bucket(ht, key, h0, i);
     #endif
 
-    ptr = hash_table_find_in_bucket(ht, h, key);
+    hkey = ht_find_in_bucket(ht, h, key, h0, i);
 
-    if(ptr != NULL)  {
+    if(hkey != HASH_NOT_FOUND)  {
       *found = true;
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
     else if(ht->buckets[h][HT_BITEMS] < ht->bucket_size) {
       *found = false;
-      ptr = hash_table_insert_in_bucket(ht, h, key);
+      hkey = ht_insert_in_bucket(ht, h, key, h0, i);
       ht->collisions[i]++; // only increment collisions when inserting
       ht->num_kmers++;
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
   }
 
   rehash_error_exit(ht);
 }
 
-hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
-                                    bool *found, volatile uint8_t *bktlocks)
+// `h0` is ht_hash0() of the key, used by the batch insert which has already
+// computed it
+static inline hkey_t _find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                        uint64_t h0, bool *found,
+                                        volatile uint8_t *bktlocks)
 {
-  const BinaryKmer *ptr;
+  hkey_t hkey;
   size_t i;
   uint_fast32_t h;
 
+  // Compact tables always use bucket locks
+  if(ht_lockfree && ht->entries == NULL) return lockfree_find_or_insert(ht, key, h0, found);
+
   for(i = 0; i < REHASH_LIMIT; i++)
   {
-    h = binary_kmer_hash(key,ht->seed+i) & ht->hash_mask;
+    h = ht_bucket(ht, key, h0, i);
     bitlock_yield_acquire(bktlocks, h);
-    ptr = hash_table_find_in_bucket(ht, h, key);
+    hkey = ht_find_in_bucket(ht, h, key, h0, i);
 
-    if(ptr != NULL)  {
+    if(hkey != HASH_NOT_FOUND)  {
       *found = true;
       bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
     else if(hash_table_bitems(ht, h) < ht->bucket_size) {
       *found = false;
-      ptr = hash_table_insert_in_bucket(ht, h, key);
+      hkey = ht_insert_in_bucket(ht, h, key, h0, i);
       __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
       __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
       bitlock_release(bktlocks, h);
-      return (hkey_t)(ptr - ht->table);
+      return hkey;
     }
 
     bitlock_release(bktlocks, h);
@@ -326,6 +894,143 @@ hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
   rehash_error_exit(ht);
 }
 
+hkey_t hash_table_find_or_insert_mt(HashTable *ht, const BinaryKmer key,
+                                    bool *found, volatile uint8_t *bktlocks)
+{
+  return _find_or_insert_mt(ht, key, ht_hash0(ht, key), found, bktlocks);
+}
+
+// Prefetch everything we touch when searching a bucket: the first cache line
+// of its entries, its size/items counters and its lock bit
+static inline void ht_prefetch_bucket(const HashTable *ht, uint_fast32_t h,
+                                      volatile uint8_t *bktlocks)
+{
+  __builtin_prefetch(ht_bckt_addr(ht, h), 1, 1);
+  __builtin_prefetch(&ht->buckets[h], 1, 1);
+  if(!ht_lockfree || ht->entries) __builtin_prefetch((const uint8_t*)bktlocks + h/8, 1, 1);
+}
+
+// Threadsafe find or insert of `n` kmers. Kmers are hashed and their buckets
+// prefetched HT_PREFETCH_WINDOW at a time, so the cache misses for a window
+// overlap rather than each lookup stalling in turn. Kmers are resolved in
+// order, so a kmer repeated in the batch is inserted once then found.
+size_t hash_table_find_or_insert_batch_mt(HashTable *ht, const BinaryKmer *keys,
+                                          size_t n, hkey_t *hkeys, bool *found,
+                                          volatile uint8_t *bktlocks)
+{
+  uint64_t hashes[HT_PREFETCH_WINDOW];
+  size_t i, j, end;
+
+  for(i = 0; i < n; i = end)
+  {
+    end = MIN2(n, i + HT_PREFETCH_WINDOW);
+
+    for(j = i; j < end; j++) {
+      hashes[j-i] = ht_hash0(ht, keys[j]);
+      ht_prefetch_bucket(ht, ht_bucket(ht, keys[j], hashes[j-i], 0), bktlocks);
+    }
+
+    for(j = i; j < end; j++) {
+      hkeys[j] = _find_or_insert_mt(ht, keys[j], hashes[j-i], &found[j], bktlocks);
+      if(hkeys[j] == HASH_NOT_FOUND) return j; // growable table is full
+    }
+  }
+
+  return n;
+}
+
+//
+// Growing
+//
+
+typedef struct
+{
+  const HashTable *old;
+  HashTable *ht;
+  volatile uint8_t *bktlocks;
+  size_t nthreads;
+  void (*moved)(hkey_t _old, hkey_t _new, void *_arg);
+  void *arg;
+} HashTableGrow;
+
+// Insert a kmer we know is not in the table
+static inline hkey_t _insert_mt(HashTable *ht, const BinaryKmer key,
+                                volatile uint8_t *bktlocks)
+{
+  hkey_t hkey;
+  size_t i;
+  uint_fast32_t h;
+  uint64_t h0 = ht_hash0(ht, key);
+
+  for(i = 0; i < REHASH_LIMIT; i++)
+  {
+    h = ht_bucket(ht, key, h0, i);
+    bitlock_yield_acquire(bktlocks, h);
+
+    if(hash_table_bitems(ht, h) < ht->bucket_size) {
+      hkey = ht_insert_in_bucket(ht, h, key, h0, i);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->collisions[i], 1);
+      __sync_add_and_fetch((volatile uint64_t*)&ht->num_kmers, 1);
+      bitlock_release(bktlocks, h);
+      return hkey;
+    }
+
+    bitlock_release(bktlocks, h);
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+static void hash_table_migrate(void *arg, size_t threadid)
+{
+  const HashTableGrow *grow = (const HashTableGrow*)arg;
+  const HashTable *old = grow->old;
+  const size_t step = old->capacity / grow->nthreads;
+  const size_t start = threadid * step;
+  const size_t end = threadid+1 == grow->nthreads ? old->capacity : start+step;
+  size_t i;
+  hkey_t hkey;
+
+  for(i = start; i < end; i++) {
+    if(hash_table_assigned(old, i)) {
+      hkey = _insert_mt(grow->ht, hash_table_fetch(old, i), grow->bktlocks);
+      if(hkey == HASH_NOT_FOUND) die("Hash table is full after growing");
+      if(grow->moved) grow->moved((hkey_t)i, hkey, grow->arg);
+    }
+  }
+}
+
+void hash_table_grow(HashTable *ht, size_t nthreads,
+                     void (*moved)(hkey_t _old, hkey_t _new, void *_arg),
+                     void *arg)
+{
+  ctx_assert(nthreads > 0);
+  HashTable old;
+  memcpy(&old, ht, sizeof(HashTable));
+
+  // Hash values are 32 bits
+  if(old.num_of_buckets*2 > (1UL<<32))
+    die("Cannot grow hash table beyond 2^32 buckets");
+
+  // Keep the same seed and hash, each bucket splits in two
+  _hash_table_alloc(ht, old.num_of_buckets*2, old.bucket_size, old.seed,
+                    old.hash, old.entries != NULL);
+  ht->growable = old.growable;
+
+  uint8_t *bktlocks = ctx_calloc(roundup_bits2bytes(ht->num_of_buckets), 1);
+
+  HashTableGrow grow = {.old = &old, .ht = ht, .bktlocks = bktlocks,
+                        .nthreads = nthreads, .moved = moved, .arg = arg};
+
+  util_multi_thread(&grow, nthreads, hash_table_migrate);
+
+  ctx_assert2(ht->num_kmers == old.num_kmers, "%zu vs %zu",
+              (size_t)ht->num_kmers, (size_t)old.num_kmers);
+
+  ctx_free(bktlocks);
+  hash_table_dealloc(&old);
+}
+
 // Safe to call on different entries at the same time
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const ht, hkey_t pos)
@@ -333,23 +1038,25 @@ void hash_table_delete(HashTable *const ht, hkey_t pos)
   uint64_t bucket = pos / ht->bucket_size, n, m;
 
   ctx_assert(pos != HASH_NOT_FOUND);
-  ctx_assert(HASH_ENTRY_ASSIGNED(ht->table[pos]));
+  ctx_assert(hash_table_assigned(ht, pos));
 
-  ht->table[pos] = unset_bkmer;
+  if(ht->entries != NULL) ht_centry_clear(ht, pos);
+  else ht->table[pos] = unset_bkmer;
   n = __sync_fetch_and_sub((volatile uint64_t *)&ht->num_kmers, 1);
   m = __sync_fetch_and_sub((volatile uint8_t *)&ht->buckets[bucket][HT_BITEMS], 1);
 
   ctx_assert2(n > 0, "Deleted from empty table");
   ctx_assert2(m > 0, "Deleted from empty bucket");
-  ctx_assert(!HASH_ENTRY_ASSIGNED(ht->table[pos]));
+  ctx_assert(!hash_table_assigned(ht, pos));
 }
 
 void hash_table_print_stats_brief(const HashTable *const ht)
 {
   size_t nbytes, nkeybits;
   double occupancy = (100.0 * ht->num_kmers) / ht->capacity;
-  nbytes = ht->capacity * sizeof(BinaryKmer) +
-           ht->num_of_buckets * sizeof(uint8_t[2]);
+  if(ht->entries != NULL) nbytes = (ht->capacity * ht->entry_bits + 7) / 8;
+  else nbytes = ht->capacity * sizeof(BinaryKmer);
+  nbytes += ht->num_of_buckets * sizeof(uint8_t[2]);
   nkeybits = (size_t)__builtin_ctzl(ht->num_of_buckets);
 
   char mem_str[50], num_buckets_str[100], num_entries_str[100], capacity_str[100];
@@ -18,7 +18,11 @@
 // Struct is public so ITERATE macros can operate on it
 typedef struct
 {
-  BinaryKmer *const table;
+  BinaryKmer *const table; // NULL if compact
+  // Compact tables store `entry_bits` per entry in `entries` instead of a
+  // BinaryKmer in `table`, see hash_table_set_compact()
+  uint64_t *const entries;
+  const uint8_t entry_bits, bucket_bits;
   const uint64_t num_of_buckets; // needs to store maximum of 1<<32
   const uint_fast32_t hash_mask; // this is num_of_buckets - 1
   const uint8_t bucket_size; // max value 255
@@ -29,25 +33,197 @@ typedef struct
   uint64_t num_kmers;
   uint64_t collisions[REHASH_LIMIT];
   const uint32_t seed; // random seed used in hashing
+  const uint8_t hash; // HashTableHash used to pick buckets
+  // If growable, inserting into a full table returns HASH_NOT_FOUND instead of
+  // exiting, so the caller can hash_table_grow() and retry
+  bool growable;
 } HashTable;
 
+//
+// Compact tables
+//
+// For kmers of one word (k <= 31). Keys are scrambled with an invertible
+// function, the low bucket_bits of which give the first bucket. Entries store
+// only the remaining high bits R and the rehash round i (plus one, so zero
+// means unset), bit packed:
+//
+//   entry = R << HT_CROUND_BITS | (i+1)
+//   bucket for round i = (scrambled + i*(R|1)) & hash_mask
+//
+// so the kmer is recovered from an entry and its bucket. At k=31 with 2^25
+// buckets an entry is 42 bits rather than 64.
+//
+
+#if NUM_BKMER_WORDS == 1
+  #define HT_COMPACT_SUPPORTED 1
+#else
+  #define HT_COMPACT_SUPPORTED 0
+#endif
+
+#define HT_CKEY_BITS 62
+#define HT_CROUND_BITS 5
+
+// Tables allocated from now on are compact. Ignored (with a warning) if
+// compiled for k > 31. Not thread safe.
+void hash_table_set_compact(bool compact);
+bool hash_table_get_compact();
+
+// Packed entry at `hkey` of a compact table
+static inline uint64_t hash_table_centry(const HashTable *ht, hkey_t hkey)
+{
+  uint64_t bit = (uint64_t)hkey * ht->entry_bits, v;
+  const uint64_t *w = ht->entries + (bit >> 6);
+  size_t s = bit & 63;
+  v = w[0] >> s;
+  if(s + ht->entry_bits > 64) v |= w[1] << (64 - s);
+  return v & bitmask64(ht->entry_bits);
+}
+
+#define HT_CKEY_MUL1 0xff51afd7ed558ccdUL
+#define HT_CKEY_MUL2 0xc4ceb9fe1a85ec53UL
+#define HT_CKEY_INV1 0x4f74430c22a54005UL // HT_CKEY_MUL1^-1 mod 2^64
+#define HT_CKEY_INV2 0x9cb4b2f8129337dbUL // HT_CKEY_MUL2^-1 mod 2^64
+#define HT_CKEY_SHIFT (HT_CKEY_BITS/2) // x ^= x>>SHIFT is its own inverse
+
+static inline uint64_t hash_table_ckey_seed(const HashTable *ht)
+{
+  return (ht->seed * 0x9e3779b97f4a7c15UL) & bitmask64(HT_CKEY_BITS);
+}
+
+static inline BinaryKmer hash_table_ckmer(const HashTable *ht, hkey_t hkey)
+{
+  const uint64_t mask = bitmask64(HT_CKEY_BITS);
+  uint64_t e = hash_table_centry(ht, hkey);
+  uint64_t r = e >> HT_CROUND_BITS, i = (e & bitmask64(HT_CROUND_BITS)) - 1;
+  uint64_t b = hkey / ht->bucket_size, x;
+  x = (r << ht->bucket_bits) | ((b - i * (r | 1)) & ht->hash_mask);
+  x ^= x >> HT_CKEY_SHIFT;
+  x = (x * HT_CKEY_INV2) & mask;
+  x ^= x >> HT_CKEY_SHIFT;
+  x = (x * HT_CKEY_INV1) & mask;
+  x ^= x >> HT_CKEY_SHIFT;
+  BinaryKmer bkmer = {.b = {x ^ hash_table_ckey_seed(ht)}};
+  return bkmer;
+}
+
+static inline bool hash_table_assigned(const HashTable *ht, hkey_t hkey)
+{
+  if(ht->entries != NULL) return hash_table_centry(ht, hkey) != 0;
+  return HASH_ENTRY_ASSIGNED(ht->table[hkey]);
+}
+
+// Kmer stored at `hkey`
+static inline BinaryKmer hash_table_fetch(const HashTable *ht, hkey_t hkey)
+{
+  #if HT_COMPACT_SUPPORTED
+    if(ht->entries != NULL) return hash_table_ckmer(ht, hkey);
+  #endif
+  return ht->table[hkey];
+}
+
+// SIMD bucket scanning is available for kmers of one or two 64 bit words
+// on x86-64 with gcc/clang. Compile with -DHASH_NO_SIMD=1 to disable.
+#if defined(__x86_64__) && defined(__GNUC__) && \
+    !defined(HASH_NO_SIMD) && NUM_BKMER_WORDS <= 2
+  #define HT_SIMD_SCAN 1
+#else
+  #define HT_SIMD_SCAN 0
+#endif
+
+// How to search a bucket for a kmer
+typedef enum
+{
+  HT_SCAN_AUTO   = 0, // pick the best supported by the CPU
+  HT_SCAN_SCALAR = 1,
+  HT_SCAN_SSE4   = 2,
+  HT_SCAN_AVX2   = 3
+} HashTableScan;
+
+// Set bucket scan method, falls back to the best supported by the CPU.
+// Picked automatically on the first hash_table_alloc() call if not set.
+// Not thread safe: call before using any hash tables.
+// Returns the method now in use
+HashTableScan hash_table_set_scan(HashTableScan scan);
+HashTableScan hash_table_get_scan();
+const char* hash_table_scan_str(HashTableScan scan);
+
+// How to pick the bucket for each of the REHASH_LIMIT rounds
+typedef enum
+{
+  // binary_kmer_hash() with seed+i for round i (lookup3, or City/xxHash if
+  // compiled with HASH=...)
+  HT_HASH_REHASH = 0,
+  // One binary_kmer_hash64() per kmer, round i uses bucket lo+i*hi of its
+  // 32 bit halves
+  HT_HASH_WYHASH = 1
+} HashTableHash;
+
+#define HT_NUM_HASHES 2
+
+// Hash used by tables allocated from now on, existing tables keep theirs.
+// Default is wyhash unless compiled with -DHASH_TABLE_REHASH=1
+void hash_table_set_hash(HashTableHash hash);
+HashTableHash hash_table_get_hash();
+const char* hash_table_hash_str(HashTableHash hash);
+// Returns false if `str` is not a known hash name
+bool hash_table_hash_parse(const char *str, HashTableHash *hash);
+
 // Returns NULL if not enough memory
 void hash_table_alloc(HashTable *htable, uint64_t capacity);
 void hash_table_dealloc(HashTable *hash_table);
 
+// Grow a growable table once it is this full
+#define HT_GROW_OCCUPANCY 0.85f
+
+#define hash_table_needs_grow(ht) \
+        ((ht)->growable && (ht)->num_kmers > (ht)->capacity * HT_GROW_OCCUPANCY)
+
+// Double the number of buckets, migrating entries using `nthreads`.
+// moved(old_hkey,new_hkey,arg) is called (from any of the threads) for each
+// entry moved, so arrays indexed by hkey can be remapped. Entries get new
+// hkeys, nothing else can use the table whilst it is growing.
+void hash_table_grow(HashTable *htable, size_t nthreads,
+                     void (*moved)(hkey_t _old, hkey_t _new, void *_arg),
+                     void *arg);
+
 hkey_t hash_table_find(const HashTable *const htable, const BinaryKmer bkmer);
 hkey_t hash_table_insert(HashTable *const htable, const BinaryKmer bkmer);
 hkey_t hash_table_find_or_insert(HashTable *htable, const BinaryKmer bkmer,
                                  bool *found);
 
+// Lock-free mode: threadsafe inserts claim entries with compare-and-swap
+// instead of taking bucket locks, and threadsafe finds never wait.
+// Default is set at compile time with -DHASH_LOCKFREE=1.
+// Not thread safe: only switch between multithreaded phases.
+#ifndef HASH_LOCKFREE
+  #define HASH_LOCKFREE 0
+#endif
+
+void hash_table_set_lockfree(bool lockfree);
+bool hash_table_get_lockfree();
+
 // Threadsafe find, using bucket level locks
+// Wait-free if bktlocks is NULL (e.g. read-only phases), or in lock-free mode
+// unless the table is compact
 hkey_t hash_table_find_mt(HashTable *ht, const BinaryKmer key,
                           volatile uint8_t *bktlocks);
 
-// Threadsafe find or insert, using bucket level locks
+// Threadsafe find or insert, using bucket level locks or CAS in lock-free mode
 hkey_t hash_table_find_or_insert_mt(HashTable *htable, const BinaryKmer key,
                                     bool *found, volatile uint8_t *bktlocks);
 
+// Number of kmers hashed and prefetched ahead in batch operations
+#define HT_PREFETCH_WINDOW 16
+
+// Threadsafe find or insert of `n` kmers, using bucket level locks.
+// Buckets are prefetched ahead of being searched, to hide memory latency.
+// Results are stored in hkeys[0..n-1] and found[0..n-1]
+// Returns number of kmers resolved, which is less than `n` only if a growable
+// table is full
+size_t hash_table_find_or_insert_batch_mt(HashTable *htable, const BinaryKmer *keys,
+                                          size_t n, hkey_t *hkeys, bool *found,
+                                          volatile uint8_t *bktlocks);
+
 // Safe to call on different entries at the same time
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const htable, hkey_t pos);
@@ -70,10 +246,11 @@ uint64_t hash_table_count_kmers(const HashTable *const htable);
 
 // Iterate over all entries
 #define HASH_ITERATE1(ht,func, ...) do {                                       \
-  const BinaryKmer *_table = (ht)->table, *htt_ptr, *htt_end = _table+(ht)->capacity;\
-  for(htt_ptr = _table; htt_ptr < htt_end; htt_ptr++) {                        \
-    if(HASH_ENTRY_ASSIGNED(*htt_ptr)) {                                        \
-      func((hkey_t)(htt_ptr - _table), ##__VA_ARGS__);                         \
+  const HashTable *_ht = (ht);                                                 \
+  hkey_t _hkey, _hend = _ht->capacity;                                         \
+  for(_hkey = 0; _hkey < _hend; _hkey++) {                                     \
+    if(hash_table_assigned(_ht, _hkey)) {                                      \
+      func(_hkey, ##__VA_ARGS__);                                              \
     }                                                                          \
   }                                                                            \
 } while(0)
@@ -82,12 +259,13 @@ uint64_t hash_table_count_kmers(const HashTable *const htable);
 // Faster in low density hash tables
 // Don't use this iterator if your func adds or removes elements
 #define HASH_ITERATE2(ht,func, ...) do {                                       \
-  const BinaryKmer *_table = (ht)->table, *bkt_strt = _table, *htt_ptr;        \
+  const HashTable *_ht = (ht);                                                 \
+  hkey_t _hkey, _bkt_strt = 0;                                                 \
   size_t _b, _c;                                                               \
-  for(_b = 0; _b < (ht)->num_of_buckets; _b++, bkt_strt += (ht)->bucket_size) {\
-    for(htt_ptr = bkt_strt, _c = 0; _c < (ht)->buckets[_b][HT_BITEMS]; htt_ptr++){\
-      if(HASH_ENTRY_ASSIGNED(*htt_ptr)) {                                      \
-        _c++; func((hkey_t)(htt_ptr - _table), ##__VA_ARGS__);                 \
+  for(_b = 0; _b < _ht->num_of_buckets; _b++, _bkt_strt += _ht->bucket_size) { \
+    for(_hkey = _bkt_strt, _c = 0; _c < _ht->buckets[_b][HT_BITEMS]; _hkey++){\
+      if(hash_table_assigned(_ht, _hkey)) {                                    \
+        _c++; func(_hkey, ##__VA_ARGS__);                                      \
       }                                                                        \
     }                                                                          \
   }                                                                            \
@@ -97,13 +275,13 @@ uint64_t hash_table_count_kmers(const HashTable *const htable);
 // Stops if func() returns non-zero value
 #define HASH_ITERATE_PART(ht,job,njobs,func, ...) do {                         \
   ctx_assert((job) < (njobs));                                                 \
-  const BinaryKmer *_table = (ht)->table, *_start, *_end, *_bkptr;             \
-  const size_t _step = (ht)->capacity / (njobs);                               \
-  _start = _table + (job) * _step;                                             \
-  _end = ((job)+1 == (njobs) ? _table + (ht)->capacity : _start+_step);        \
-  for(_bkptr = _start; _bkptr < _end; _bkptr++) {                              \
-    if(HASH_ENTRY_ASSIGNED(*_bkptr)) {                                         \
-      if(func((hkey_t)(_bkptr - _table), ##__VA_ARGS__)) break;                \
+  const HashTable *_ht = (ht);                                                 \
+  const size_t _step = _ht->capacity / (njobs);                                \
+  hkey_t _hkey = (job) * _step;                                                \
+  hkey_t _hend = ((job)+1 == (njobs) ? _ht->capacity : _hkey+_step);           \
+  for(; _hkey < _hend; _hkey++) {                                              \
+    if(hash_table_assigned(_ht, _hkey)) {                                      \
+      if(func(_hkey, ##__VA_ARGS__)) break;                                    \
     }                                                                          \
   }                                                                            \
 } while(0)
@@ -0,0 +1,100 @@
+#include "global.h"
+#include "kmer_bloom.h"
+#include "util.h"
+
+// Counters are 2 bits, 32 per 64 bit word
+#define kb_word(kb,i) ((kb)->counters[(i)/32])
+#define kb_shift(i) (((i)%32)*2)
+
+// Smallest power of two number of counters that fits in `mem_bytes`
+static uint64_t kmer_bloom_ncounters(size_t mem_bytes)
+{
+  ctx_assert(mem_bytes >= sizeof(uint64_t));
+  return 1UL << (63 - __builtin_clzl((uint64_t)mem_bytes * 4));
+}
+
+size_t kmer_bloom_mem(size_t mem_bytes)
+{
+  return kmer_bloom_ncounters(mem_bytes) / 4;
+}
+
+void kmer_bloom_alloc(KmerBloom *kb, size_t mem_bytes)
+{
+  uint64_t ncounters = kmer_bloom_ncounters(mem_bytes);
+  size_t nwords = (ncounters+31)/32;
+
+  char mem_str[50];
+  bytes_to_str(nwords * sizeof(uint64_t), 1, mem_str);
+  status("[bloom] Allocating kmer counting filter using %s", mem_str);
+
+  KmerBloom tmp = {.counters = ctx_calloc(nwords, sizeof(uint64_t)),
+                   .mask = ncounters - 1,
+                   .mem_bytes = nwords * sizeof(uint64_t),
+                   .seed = rand(),
+                   .num_kmers = 0, .num_solid = 0};
+
+  memcpy(kb, &tmp, sizeof(KmerBloom));
+}
+
+void kmer_bloom_dealloc(KmerBloom *kb)
+{
+  ctx_free(kb->counters);
+  memset(kb, 0, sizeof(KmerBloom));
+}
+
+// Double hashing: counter i is (a + i*b) & mask
+static inline void kmer_bloom_idxs(const KmerBloom *kb, const BinaryKmer bkey,
+                                   uint64_t idxs[KMER_BLOOM_NHASH])
+{
+  uint64_t h0 = binary_kmer_hash(bkey, kb->seed);
+  uint64_t h1 = binary_kmer_hash(bkey, kb->seed+1);
+  uint64_t a = (h0 << 32) | h1, b = (h1 << 32) | h0 | 1;
+  size_t i;
+  for(i = 0; i < KMER_BLOOM_NHASH; i++)
+    idxs[i] = (a + i*b) & kb->mask;
+}
+
+#define kb_get(kb,i) ((kb_word(kb,i) >> kb_shift(i)) & 3)
+
+uint8_t kmer_bloom_count(const KmerBloom *kb, const BinaryKmer bkey)
+{
+  uint64_t idxs[KMER_BLOOM_NHASH];
+  uint8_t c, count = KMER_BLOOM_MAX_COUNT;
+  size_t i;
+
+  kmer_bloom_idxs(kb, bkey, idxs);
+
+  for(i = 0; i < KMER_BLOOM_NHASH && count > 0; i++) {
+    c = kb_get(kb, idxs[i]);
+    count = MIN2(count, c);
+  }
+
+  return count;
+}
+
+uint8_t kmer_bloom_add_mt(KmerBloom *kb, const BinaryKmer bkey)
+{
+  uint64_t idxs[KMER_BLOOM_NHASH], w;
+  volatile uint64_t *wptr;
+  uint8_t c, count = KMER_BLOOM_MAX_COUNT;
+  size_t i;
+
+  kmer_bloom_idxs(kb, bkey, idxs);
+
+  for(i = 0; i < KMER_BLOOM_NHASH; i++) {
+    c = (*(volatile uint64_t*)&kb_word(kb, idxs[i]) >> kb_shift(idxs[i])) & 3;
+    count = MIN2(count, c);
+  }
+
+  if(count == KMER_BLOOM_MAX_COUNT) return count;
+
+  // Only increment the smallest counters. Another thread may have raised a
+  // counter since we read it, in which case leave it.
+  for(i = 0; i < KMER_BLOOM_NHASH; i++) {
+    wptr = (volatile uint64_t*)&kb_word(kb, idxs[i]);
+    while((((w = *wptr) >> kb_shift(idxs[i])) & 3) == count &&
+          !__sync_bool_compare_and_swap(wptr, w, w + (1UL << kb_shift(idxs[i])))) {}
+  }
+
+  return count;
+}
@@ -0,0 +1,43 @@
+#ifndef KMER_BLOOM_H_
+#define KMER_BLOOM_H_
+
+#include "binary_kmer.h"
+
+//
+// Counting Bloom filter of kmers, used to find solid kmers (seen at least
+// KMER_BLOOM_SOLID times) before building a graph. Each kmer maps to
+// KMER_BLOOM_NHASH 2-bit saturating counters; its count is the smallest of
+// them. Only the smallest counters are incremented (conservative update), so
+// collisions overestimate counts less often.
+//
+
+#define KMER_BLOOM_NHASH 4
+#define KMER_BLOOM_SOLID 2
+#define KMER_BLOOM_MAX_COUNT 3
+
+typedef struct
+{
+  uint64_t *const counters; // 2 bit counters, 32 per word
+  const uint64_t mask; // number of counters - 1
+  const size_t mem_bytes;
+  const uint32_t seed;
+  // Estimates, updated by callers
+  uint64_t num_kmers, num_solid;
+} KmerBloom;
+
+// Memory actually used for a filter of at most `mem_bytes`
+size_t kmer_bloom_mem(size_t mem_bytes);
+
+void kmer_bloom_alloc(KmerBloom *kb, size_t mem_bytes);
+void kmer_bloom_dealloc(KmerBloom *kb);
+
+// Threadsafe. `bkey` must be a kmer key (see binary_kmer_get_key()).
+// Returns the count before adding, saturating at KMER_BLOOM_MAX_COUNT
+uint8_t kmer_bloom_add_mt(KmerBloom *kb, const BinaryKmer bkey);
+
+// Returns the count of a kmer key, may be overestimated
+uint8_t kmer_bloom_count(const KmerBloom *kb, const BinaryKmer bkey);
+
+#define kmer_bloom_is_solid(kb,bkey) (kmer_bloom_count(kb,bkey) >= KMER_BLOOM_SOLID)
+
+#endif /* KMER_BLOOM_H_ */
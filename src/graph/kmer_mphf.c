@@ -0,0 +1,389 @@
+#include "global.h"
+#include "kmer_mphf.h"
+#include "util.h"
+#include "file_util.h"
+
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open
+
+static const char mphf_magic[8] = "CTXMPHF";
+
+static inline uint64_t mphf_level_hash(const KmerMphf *mphf,
+                                       const BinaryKmer bkey, size_t level)
+{
+  return binary_kmer_hash64(bkey, mphf->seed + level * 0x9e3779b97f4a7c15UL);
+}
+
+static inline uint8_t mphf_fprint(const KmerMphf *mphf, const BinaryKmer bkey)
+{
+  return (uint8_t)(binary_kmer_hash64(bkey, ~mphf->seed) >> 56);
+}
+
+// Bit of `bkey` in level `level`
+static inline uint64_t mphf_level_bit(const KmerMphf *mphf,
+                                      const BinaryKmer bkey, size_t level)
+{
+  uint64_t start = mphf->level_start[level];
+  uint64_t m = mphf->level_start[level+1] - start;
+  uint64_t h = mphf_level_hash(mphf, bkey, level);
+  return start + (uint64_t)(((__uint128_t)h * m) >> 64);
+}
+
+#define mphf_bit_get(arr,i) (((arr)[(i)>>6] >> ((i)&63)) & 1)
+
+#define mphf_num_rank_words(nbits) ((nbits)/512+1)
+#define mphf_num_pos_words(n,pbits) (((n)*(pbits)+63)/64+1)
+
+// Number of set bits before bit `i`
+static inline uint64_t mphf_rank(const KmerMphf *mphf, uint64_t i)
+{
+  uint64_t r = mphf->ranks[i>>9], w = (i>>9)<<3, end = i>>6;
+  for(; w < end; w++) r += (uint64_t)__builtin_popcountl(mphf->bits[w]);
+  return r + (uint64_t)__builtin_popcountl(mphf->bits[end] & bitmask64(i&63));
+}
+
+static inline uint64_t mphf_pos_get(const KmerMphf *mphf, uint64_t idx)
+{
+  uint64_t bit = idx * mphf->pos_bits, v;
+  const uint64_t *w = mphf->pos + (bit >> 6);
+  size_t s = bit & 63;
+  v = w[0] >> s;
+  if(s + mphf->pos_bits > 64) v |= w[1] << (64 - s);
+  return v & bitmask64(mphf->pos_bits);
+}
+
+// Entries sharing a word are set by different threads
+static inline void mphf_pos_set(KmerMphf *mphf, uint64_t idx, uint64_t v)
+{
+  uint64_t bit = idx * mphf->pos_bits;
+  volatile uint64_t *w = (volatile uint64_t*)mphf->pos + (bit >> 6);
+  size_t s = bit & 63;
+  __sync_fetch_and_or(w, v << s);
+  if(s + mphf->pos_bits > 64) __sync_fetch_and_or(w+1, v >> (64 - s));
+}
+
+uint64_t kmer_mphf_index(const KmerMphf *mphf, const BinaryKmer bkey)
+{
+  size_t l;
+  uint64_t i;
+
+  for(l = 0; l < mphf->num_of_levels; l++) {
+    i = mphf_level_bit(mphf, bkey, l);
+    if(mphf_bit_get(mphf->bits, i)) return mphf_rank(mphf, i);
+  }
+
+  // Binary search kmers that were never placed
+  size_t lo = 0, hi = mphf->num_of_fallback, mid;
+  int cmp;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    cmp = binary_kmers_cmp(bkey, mphf->fallback[mid]);
+    if(cmp == 0) return mphf->num_of_kmers - mphf->num_of_fallback + mid;
+    if(cmp < 0) hi = mid;
+    else lo = mid + 1;
+  }
+
+  return HASH_NOT_FOUND;
+}
+
+hkey_t kmer_mphf_find(const KmerMphf *mphf, const BinaryKmer bkey)
+{
+  uint64_t idx = kmer_mphf_index(mphf, bkey);
+  if(idx == HASH_NOT_FOUND || mphf->fprints[idx] != mphf_fprint(mphf, bkey))
+    return HASH_NOT_FOUND;
+  return mphf_pos_get(mphf, idx);
+}
+
+//
+// Building
+//
+
+typedef struct
+{
+  KmerMphf *mphf;
+  const char *keys; // keys for this level
+  size_t stride;
+  uint64_t n;
+  size_t level, nthreads;
+  uint64_t *collide; // bits set by more than one key in this level
+  BinaryKmer *next; // keys that move to the next level
+  volatile uint64_t nnext;
+} MphfBuilder;
+
+// Keys may not be aligned (e.g. records in a graph file)
+static inline BinaryKmer builder_key(const MphfBuilder *b, uint64_t i)
+{
+  BinaryKmer bkey;
+  memcpy(bkey.b, b->keys + i * b->stride, sizeof(BinaryKmer));
+  return bkey;
+}
+
+#define builder_start(b,tid) (((b)->n * (tid)) / (b)->nthreads)
+#define builder_end(b,tid) (((b)->n * ((tid)+1)) / (b)->nthreads)
+
+// Set the bit of each key in this level, recording bits set twice
+static void mphf_mark(void *arg, size_t threadid)
+{
+  MphfBuilder *b = (MphfBuilder*)arg;
+  uint64_t i, j, bit, old, end = builder_end(b, threadid);
+  volatile uint64_t *bits = (volatile uint64_t*)b->mphf->bits;
+  volatile uint64_t *collide = (volatile uint64_t*)b->collide;
+
+  for(i = builder_start(b, threadid); i < end; i++) {
+    j = mphf_level_bit(b->mphf, builder_key(b, i), b->level);
+    bit = 1UL << (j & 63);
+    old = __sync_fetch_and_or(&bits[j>>6], bit);
+    if(old & bit) __sync_fetch_and_or(&collide[j>>6], bit);
+  }
+}
+
+// Collect keys whose bit was set by more than one key
+static void mphf_collect(void *arg, size_t threadid)
+{
+  MphfBuilder *b = (MphfBuilder*)arg;
+  uint64_t i, j, end = builder_end(b, threadid);
+  BinaryKmer bkey;
+
+  for(i = builder_start(b, threadid); i < end; i++) {
+    bkey = builder_key(b, i);
+    j = mphf_level_bit(b->mphf, bkey, b->level);
+    if(mphf_bit_get(b->collide, j))
+      b->next[__sync_fetch_and_add(&b->nnext, 1)] = bkey;
+  }
+}
+
+// Store fingerprint and position of every key
+static void mphf_set_positions(void *arg, size_t threadid)
+{
+  MphfBuilder *b = (MphfBuilder*)arg;
+  uint64_t i, idx, end = builder_end(b, threadid);
+  BinaryKmer bkey;
+
+  for(i = builder_start(b, threadid); i < end; i++) {
+    bkey = builder_key(b, i);
+    idx = kmer_mphf_index(b->mphf, bkey);
+    ctx_assert(idx < b->mphf->num_of_kmers);
+    b->mphf->fprints[idx] = mphf_fprint(b->mphf, bkey);
+    mphf_pos_set(b->mphf, idx, i);
+  }
+}
+
+void kmer_mphf_build(KmerMphf *mphf, const void *keys, size_t stride,
+                     uint64_t n, size_t nthreads)
+{
+  memset(mphf, 0, sizeof(KmerMphf));
+  mphf->num_of_kmers = n;
+  mphf->seed = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+  mphf->pos_bits = n > 1 ? 64 - __builtin_clzl(n-1) : 1;
+
+  MphfBuilder b = {.mphf = mphf, .keys = keys, .stride = stride, .n = n};
+
+  size_t l, nwords, m, w;
+  BinaryKmer *cur = NULL;
+
+  for(l = 0; l < KMER_MPHF_MAX_LEVELS && b.n > 0; l++)
+  {
+    m = ((MAX2(b.n * KMER_MPHF_GAMMA, 64) + 63) / 64) * 64;
+    mphf->level_start[l+1] = mphf->level_start[l] + m;
+    mphf->num_of_levels = l+1;
+
+    nwords = mphf->level_start[l] / 64;
+    mphf->bits = ctx_recallocarray(mphf->bits, nwords, nwords + m/64,
+                                   sizeof(uint64_t));
+    b.collide = ctx_calloc(nwords + m/64, sizeof(uint64_t));
+    b.next = ctx_malloc(b.n * sizeof(BinaryKmer));
+    b.nnext = 0;
+    b.level = l;
+    b.nthreads = MAX2(1, MIN2(nthreads, b.n / 4096));
+
+    util_multi_thread(&b, b.nthreads, mphf_mark);
+
+    for(w = nwords; w < nwords + m/64; w++) mphf->bits[w] &= ~b.collide[w];
+
+    util_multi_thread(&b, b.nthreads, mphf_collect);
+
+    ctx_free(b.collide);
+    ctx_free(cur);
+    cur = b.next;
+    b.keys = (const char*)cur;
+    b.stride = sizeof(BinaryKmer);
+    b.n = b.nnext;
+  }
+
+  // Keys that are still colliding are stored in a sorted list
+  qsort(cur, b.n, sizeof(BinaryKmer), binary_kmers_qcmp);
+  mphf->fallback = cur;
+  mphf->num_of_fallback = b.n;
+
+  mphf->num_of_bits = mphf->level_start[mphf->num_of_levels];
+  nwords = mphf->num_of_bits / 64;
+  mphf->ranks = ctx_malloc(mphf_num_rank_words(mphf->num_of_bits) * sizeof(uint64_t));
+
+  uint64_t r = 0;
+  for(w = 0; w < nwords; w++) {
+    if(w % 8 == 0) mphf->ranks[w/8] = r;
+    r += (uint64_t)__builtin_popcountl(mphf->bits[w]);
+  }
+  if(w % 8 == 0) mphf->ranks[w/8] = r;
+
+  ctx_assert2(r + mphf->num_of_fallback == n, "%zu + %zu != %zu",
+              (size_t)r, mphf->num_of_fallback, (size_t)n);
+
+  mphf->pos = ctx_calloc(mphf_num_pos_words(n, mphf->pos_bits), sizeof(uint64_t));
+  mphf->fprints = ctx_malloc(MAX2(n, 1));
+
+  b.keys = keys;
+  b.stride = stride;
+  b.n = n;
+  b.nthreads = MAX2(1, MIN2(nthreads, n / 4096));
+  util_multi_thread(&b, b.nthreads, mphf_set_positions);
+
+  char nkmers_str[50], mem_str[50];
+  ulong_to_str(n, nkmers_str);
+  bytes_to_str(kmer_mphf_mem(mphf), 1, mem_str);
+  status("[mphf] %s kmers, %zu levels, %zu not placed, %.2f bits per kmer "
+         "(%.2f with positions) %s",
+         nkmers_str, mphf->num_of_levels, mphf->num_of_fallback,
+         n ? (double)mphf->num_of_bits / n : 0.0,
+         n ? (8.0 * kmer_mphf_mem(mphf)) / n : 0.0, mem_str);
+}
+
+void kmer_mphf_dealloc(KmerMphf *mphf)
+{
+  if(mphf->mmap_data != NULL) {
+    if(munmap(mphf->mmap_data, mphf->mmap_len) != 0)
+      warn("Cannot release memory map [%s]", strerror(errno));
+  }
+  else {
+    ctx_free(mphf->bits);
+    ctx_free(mphf->ranks);
+    ctx_free(mphf->fallback);
+    ctx_free(mphf->pos);
+    ctx_free(mphf->fprints);
+  }
+  memset(mphf, 0, sizeof(KmerMphf));
+}
+
+size_t kmer_mphf_mem(const KmerMphf *mphf)
+{
+  return (mphf->num_of_bits / 64 + mphf_num_rank_words(mphf->num_of_bits) +
+          mphf_num_pos_words(mphf->num_of_kmers, mphf->pos_bits)) * sizeof(uint64_t) +
+         mphf->num_of_fallback * sizeof(BinaryKmer) + mphf->num_of_kmers;
+}
+
+//
+// Files
+//
+
+static void mphf_fwrite(const void *ptr, size_t nbytes, FILE *fh,
+                        const char *path)
+{
+  if(nbytes && fwrite(ptr, 1, nbytes, fh) != nbytes)
+    die("Cannot write to file: %s [%s]", path, strerror(errno));
+}
+
+void kmer_mphf_save(const KmerMphf *mphf, const char *path)
+{
+  uint64_t hdr[KMER_MPHF_HDR_WORDS];
+  memcpy(&hdr[0], mphf_magic, sizeof(uint64_t));
+  hdr[1] = KMER_MPHF_VERSION;
+  hdr[2] = NUM_BKMER_WORDS;
+  hdr[3] = mphf->num_of_kmers;
+  hdr[4] = mphf->num_of_bits;
+  hdr[5] = mphf->seed;
+  hdr[6] = mphf->num_of_levels;
+  hdr[7] = mphf->num_of_fallback;
+
+  FILE *fh = futil_fopen(path, "w");
+  mphf_fwrite(hdr, sizeof(hdr), fh, path);
+  mphf_fwrite(mphf->level_start, (mphf->num_of_levels+1) * sizeof(uint64_t), fh, path);
+  mphf_fwrite(mphf->bits, mphf->num_of_bits / 8, fh, path);
+  mphf_fwrite(mphf->ranks, mphf_num_rank_words(mphf->num_of_bits) * sizeof(uint64_t),
+              fh, path);
+  mphf_fwrite(mphf->fallback, mphf->num_of_fallback * sizeof(BinaryKmer), fh, path);
+  mphf_fwrite(mphf->pos, mphf_num_pos_words(mphf->num_of_kmers, mphf->pos_bits) *
+                         sizeof(uint64_t), fh, path);
+  mphf_fwrite(mphf->fprints, mphf->num_of_kmers, fh, path);
+  fclose(fh);
+
+  status("[mphf] Saved to %s", futil_outpath_str(path));
+}
+
+bool kmer_mphf_mmap(KmerMphf *mphf, const char *path)
+{
+  memset(mphf, 0, sizeof(KmerMphf));
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) { warn("Cannot open file: %s [%s]", path, strerror(errno)); return false; }
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)(KMER_MPHF_HDR_WORDS*sizeof(uint64_t))) {
+    warn("Not a valid mphf file: %s", path);
+    close(fd);
+    return false;
+  }
+
+  size_t len = st.st_size;
+  void *data = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if(data == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+
+  // Lookups jump around the file
+  madvise(data, len, MADV_RANDOM);
+
+  const uint64_t *hdr = (const uint64_t*)data, *ptr = hdr + KMER_MPHF_HDR_WORDS;
+  bool valid = (memcmp(hdr, mphf_magic, sizeof(uint64_t)) == 0 &&
+                hdr[1] == KMER_MPHF_VERSION && hdr[2] == NUM_BKMER_WORDS &&
+                hdr[6] <= KMER_MPHF_MAX_LEVELS &&
+                hdr[7] <= hdr[3] && hdr[4] % 64 == 0);
+
+  if(valid) {
+    mphf->num_of_kmers = hdr[3];
+    mphf->num_of_bits = hdr[4];
+    mphf->seed = hdr[5];
+    mphf->num_of_levels = hdr[6];
+    mphf->num_of_fallback = hdr[7];
+    mphf->pos_bits = mphf->num_of_kmers > 1 ? 64 - __builtin_clzl(mphf->num_of_kmers-1) : 1;
+
+    size_t expect = (KMER_MPHF_HDR_WORDS + mphf->num_of_levels+1 +
+                     mphf->num_of_bits / 64 +
+                     mphf_num_rank_words(mphf->num_of_bits) +
+                     mphf->num_of_fallback * NUM_BKMER_WORDS +
+                     mphf_num_pos_words(mphf->num_of_kmers, mphf->pos_bits)) *
+                    sizeof(uint64_t) + mphf->num_of_kmers;
+
+    valid = (len == expect);
+  }
+
+  if(valid) {
+    memcpy(mphf->level_start, ptr, (mphf->num_of_levels+1) * sizeof(uint64_t));
+    ptr += mphf->num_of_levels+1;
+    valid = (mphf->level_start[0] == 0 &&
+             mphf->level_start[mphf->num_of_levels] == mphf->num_of_bits);
+  }
+
+  if(!valid) {
+    warn("Not a valid mphf file: %s", path);
+    munmap(data, len);
+    memset(mphf, 0, sizeof(KmerMphf));
+    return false;
+  }
+
+  // Arrays are used in place, they are read-only
+  mphf->bits = (uint64_t*)ptr;
+  ptr += mphf->num_of_bits / 64;
+  mphf->ranks = (uint64_t*)ptr;
+  ptr += mphf_num_rank_words(mphf->num_of_bits);
+  mphf->fallback = (BinaryKmer*)ptr;
+  ptr += mphf->num_of_fallback * NUM_BKMER_WORDS;
+  mphf->pos = (uint64_t*)ptr;
+  ptr += mphf_num_pos_words(mphf->num_of_kmers, mphf->pos_bits);
+  mphf->fprints = (uint8_t*)ptr;
+
+  mphf->mmap_data = data;
+  mphf->mmap_len = len;
+  return true;
+}
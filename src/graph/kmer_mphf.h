@@ -0,0 +1,76 @@
+#ifndef KMER_MPHF_H_
+#define KMER_MPHF_H_
+
+#include "cortex_types.h"
+#include "binary_kmer.h"
+#include "hash_table.h" // HASH_NOT_FOUND
+
+//
+// Minimal perfect hash of a static set of kmers (BBHash style)
+//
+// Kmers are hashed into a bit array of KMER_MPHF_GAMMA bits per kmer. Kmers
+// that don't collide with another kmer set their bit, the rest move on to the
+// next level, which is sized for the kmers that are left. The index of a kmer
+// is the number of set bits before its bit (its rank), so n kmers map to
+// 0..n-1 with no empty slots. Kmers still colliding after KMER_MPHF_MAX_LEVELS
+// levels are kept in a sorted array and get the last indices.
+//
+// For each index we store an 8 bit fingerprint of the kmer and its position in
+// the array the kmers were built from (bit packed, ceil(log2(n)) bits). Most
+// kmers not in the set are rejected by the fingerprint, the rest must be
+// checked by the caller against the kmer at the returned position.
+//
+// Saved as <in.ctx>.mphf by `ctx index --mphf`. Files are memory mapped and
+// used in place:
+//
+//   <uint64_t[KMER_MPHF_HDR_WORDS]:header><uint64_t[num_of_levels+1]:levels>
+//   <uint64_t[]:bits><uint64_t[]:ranks><BinaryKmer[]:fallback>
+//   <uint64_t[]:positions><uint8_t[num_of_kmers]:fingerprints>
+//
+
+#define KMER_MPHF_VERSION 1
+#define KMER_MPHF_GAMMA 2
+#define KMER_MPHF_MAX_LEVELS 32
+#define KMER_MPHF_HDR_WORDS 8
+
+typedef struct
+{
+  uint64_t num_of_kmers, num_of_bits, seed;
+  size_t num_of_levels, num_of_fallback, pos_bits;
+  uint64_t level_start[KMER_MPHF_MAX_LEVELS+1]; // bit offset of each level
+  // Read-only if memory mapped
+  uint64_t *bits; // [num_of_bits/64]
+  uint64_t *ranks; // [num_of_bits/512+1] set bits before every 512 bits
+  BinaryKmer *fallback; // [num_of_fallback] sorted
+  uint64_t *pos; // bit packed, pos_bits per kmer
+  uint8_t *fprints; // [num_of_kmers]
+  void *mmap_data; // NULL if not memory mapped
+  size_t mmap_len;
+} KmerMphf;
+
+// Build from `n` unique kmer keys, key i at (char*)keys + i*stride
+void kmer_mphf_build(KmerMphf *mphf, const void *keys, size_t stride,
+                     uint64_t n, size_t nthreads);
+
+void kmer_mphf_dealloc(KmerMphf *mphf);
+
+// Dies if we cannot write to `path`. Use futil_create_output() to check it
+// doesn't already exist first.
+void kmer_mphf_save(const KmerMphf *mphf, const char *path);
+
+// Returns false with a warning if the file is not a valid mphf file
+bool kmer_mphf_mmap(KmerMphf *mphf, const char *path);
+
+// Index in 0..n-1 of a kmer in the set. Kmers not in the set give an
+// arbitrary index or HASH_NOT_FOUND.
+uint64_t kmer_mphf_index(const KmerMphf *mphf, const BinaryKmer bkey);
+
+// Position of `bkey` in the array the mphf was built from. Returns
+// HASH_NOT_FOUND if the kmer is not in the set. May return a position for a
+// kmer not in the set (1 in 256 chance), so check the kmer at the position.
+hkey_t kmer_mphf_find(const KmerMphf *mphf, const BinaryKmer bkey);
+
+// Bytes of memory used
+size_t kmer_mphf_mem(const KmerMphf *mphf);
+
+#endif /* KMER_MPHF_H_ */
@@ -15,10 +15,10 @@ void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey)
   if(db_graph->col_edges != NULL)
     db_node_zero_edges(db_graph,hkey);
 
-  if(db_graph->col_covgs != NULL)
+  if(db_graph_covgs_alloced(db_graph))
     db_node_zero_covgs(db_graph, hkey);
 
-  if(db_graph->node_in_cols != NULL)
+  if(db_graph_has_node_in_cols(db_graph))
     for(col = 0; col < db_graph->num_of_cols; col++)
       db_node_del_col_mt(db_graph, hkey, col);
 
@@ -216,7 +216,7 @@ size_t gpath_fetch(dBNode node, const GPath *gpath,
     ctx_assert(n > 0);
 
     if(n > 1) {
-      Nucleotide expbase = binary_seq_get(gpath->seq, njuncs);
+      Nucleotide expbase = binary_seq_get(gpath_get_seq(gpath), njuncs);
       for(i = 0; i < n && nucs[i] != expbase; i++);
       ctx_assert(i < n);
       node = nodes[i];
@@ -244,7 +244,7 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
                            size_t ctxcol, const dBGraph *db_graph)
 {
   ctx_assert_ret(db_graph->num_edge_cols == db_graph->num_of_cols ||
-                 db_graph->node_in_cols != NULL);
+                 db_graph_has_node_in_cols(db_graph));
 
   BinaryKmer bkmer;
   Edges edges;
@@ -262,9 +262,9 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
     edges = db_node_get_edges(db_graph, node.key, edgecol);
 
     // Check this node is in this colour
-    if(db_graph->node_in_cols != NULL) {
+    if(db_graph_has_node_in_cols(db_graph)) {
       ctx_assert_ret(db_node_has_col(db_graph, node.key, ctxcol));
-    } else if(db_graph->col_covgs != NULL) {
+    } else if(db_graph_covgs_alloced(db_graph)) {
       ctx_assert_ret(db_node_get_covg(db_graph, node.key, ctxcol) > 0);
     }
 
@@ -294,7 +294,7 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
     ctx_assert_ret(n > 0);
 
     // Reduce to nodes in our colour if edges limited
-    if(db_graph->num_edge_cols == 1 && db_graph->node_in_cols != NULL) {
+    if(db_graph->num_edge_cols == 1 && db_graph_has_node_in_cols(db_graph)) {
       for(i = 0, j = 0; i < n; i++) {
         if(db_node_has_col(db_graph, nodes[i].key, ctxcol)) {
           nodes[j] = nodes[i];
@@ -308,7 +308,7 @@ bool gpath_checks_path_col(dBNode node, const GPath *gpath,
 
     // If fork check nucleotide
     if(n > 1) {
-      Nucleotide expbase = binary_seq_get(gpath->seq, plen);
+      Nucleotide expbase = binary_seq_get(gpath_get_seq(gpath), plen);
 
       for(i = 0; i < n && nucs[i] != expbase; i++);
       if(i == n) {
@@ -362,7 +362,7 @@ static int _kmer_check_paths(hkey_t hkey, const dBGraph *db_graph,
   size_t num_gpaths = 0;
   GPath *gpath;
 
-  for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath->next)
+  for(gpath = gpstore->paths_all[hkey]; gpath != NULL; gpath = gpath_get_next(gpath))
   {
     ctx_assert_ret(gpath_checks_path(hkey, gpath, db_graph));
     num_gpaths++;
@@ -407,7 +407,7 @@ bool gpath_checks_all_paths(const dBGraph *db_graph, size_t nthreads)
   size_t num_gpaths = checking.num_gpaths;
   size_t num_kmers = checking.num_kmers;
 
-  size_t act_num_gpaths = db_graph->gpstore.gpset.entries.len;
+  size_t act_num_gpaths = gpath_set_num_paths(&db_graph->gpstore.gpset);
   size_t act_num_kmers = db_graph->gpstore.num_kmers_with_paths;
 
   ctx_assert_ret2(num_gpaths == act_num_gpaths, "%zu vs %zu", num_gpaths, act_num_gpaths);
@@ -431,7 +431,7 @@ static void _gpstore_update_counts(hkey_t hkey, const dBGraph *db_graph,
   (*nkmers_ptr)++;
 
   // Count paths and coloured paths
-  for(npaths = 0; gpath != NULL; gpath = gpath->next, npaths++) {}
+  for(npaths = 0; gpath != NULL; gpath = gpath_get_next(gpath), npaths++) {}
 
   (*npaths_ptr) += npaths;
 }
@@ -448,6 +448,6 @@ void gpath_checks_counts(const dBGraph *db_graph)
               nvisited, (size_t)db_graph->ht.num_kmers);
   ctx_assert2(nkmers == gpstore->num_kmers_with_paths, "%zu vs %zu",
               nkmers, (size_t)gpstore->num_kmers_with_paths);
-  ctx_assert2(npaths == gpstore->gpset.entries.len, "%zu vs %zu",
-              npaths, (size_t)gpstore->gpset.entries.len);
+  ctx_assert2(npaths == gpath_set_num_paths(&gpstore->gpset), "%zu vs %zu",
+              npaths, gpath_set_num_paths(&gpstore->gpset));
 }
@@ -12,14 +12,33 @@
 #include "gpath_store.h"
 #include "gpath_subset.h"
 #include "json_hdr.h"
+#include "gz_blocks.h"
+
+#include <sys/mman.h> // mmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open
 
 /*
 // File format:
 <JSON_HEADER>
 kmer [num] .. ignored
 [FR] [njuncs] [nseen,nseen,nseen] [seq:ACAGT] .. ignored
+
+Text files written by gpath_save() are a series of gzip blocks (gz_blocks.h).
+The first block holds the header, the others hold all the links of a set of
+kmers, so blocks can be parsed in parallel.
+
+// Binary file format (see gpath_save_bin()):
+<uint64_t[CTP_BIN_HDR_WORDS]:header><JSON_HEADER>
+<BinaryKmer><uint32_t:num_links>
+  <uint16_t:num_juncs|orient<<15><uint8_t[ncols]:nseen><colset><seq> ...
+<BinaryKmer[nblocks]:block first kmers><uint64_t[nblocks+1]:block offsets>
+Header and index start at 8 byte aligned offsets. The last block offset is
+the end of the records.
 */
 
+const char ctp_bin_magic[8] = "CTPBIN";
+
 #define load_check(x,msg,...) if(!(x)) { die("[LoadPathError] "msg, ##__VA_ARGS__); }
 
 size_t gpath_reader_get_kmer_size(const GPathReader *file)
@@ -158,6 +177,102 @@ void _parse_json_header(GPathReader *file)
   if(file->ncolours == 0) die("No colours in JSON header");
 }
 
+static bool _gpath_reader_is_binary(const char *path)
+{
+  if(strcmp(path,"-") == 0) return false;
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) return false; // let gzopen report the error
+  char magic[sizeof(ctp_bin_magic)];
+  bool isbin = (fread(magic, 1, sizeof(magic), fh) == sizeof(magic) &&
+                memcmp(magic, ctp_bin_magic, sizeof(magic)) == 0);
+  fclose(fh);
+  return isbin;
+}
+
+#define bad_bin_file(path) die("Corrupt binary link file: %s", path)
+
+// Memory map a regular file read only
+// Returns NULL on failure, with errno set
+static uint8_t* _gpath_reader_map_file(const char *path, size_t *len)
+{
+  struct stat st;
+  uint8_t *data = NULL;
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) return NULL;
+
+  if(fstat(fd, &st) != 0) {}
+  else if(!S_ISREG(st.st_mode) || st.st_size == 0) errno = EINVAL;
+  else {
+    *len = st.st_size;
+    data = mmap(NULL, *len, PROT_READ, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED) data = NULL;
+    // Records are read in order
+    else madvise(data, *len, MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+  return data;
+}
+
+// Memory map a binary file, load JSON header into hdrstr and set up index
+static void _gpath_reader_mmap(GPathReader *file, const char *path,
+                               StrBuf *hdrstr)
+{
+  size_t len = 0;
+  uint8_t *data = _gpath_reader_map_file(path, &len);
+
+  if(data == NULL)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+
+  if(len < CTP_BIN_HDR_WORDS*sizeof(uint64_t)) bad_bin_file(path);
+
+  const uint64_t *hdr = (const uint64_t*)data;
+  size_t json_len = hdr[4], data_offset = hdr[5];
+  size_t index_offset = hdr[6], nblocks = hdr[7];
+
+  if(hdr[1] != CTP_BIN_FORMAT_VERSION)
+    die("Unsupported binary link file version %zu: %s", (size_t)hdr[1], path);
+  if(hdr[2] != NUM_BKMER_WORDS)
+    die("Binary link file has kmers of %zu words, compiled for %i: %s",
+        (size_t)hdr[2], NUM_BKMER_WORDS, path);
+
+  if(data_offset < CTP_BIN_HDR_WORDS*sizeof(uint64_t) + json_len ||
+     index_offset < data_offset || index_offset % sizeof(uint64_t) ||
+     nblocks > len ||
+     index_offset + nblocks*sizeof(BinaryKmer) +
+                    (nblocks+1)*sizeof(uint64_t) != len)
+  {
+    bad_bin_file(path);
+  }
+
+  file->binary = true;
+  file->mmap_data = data;
+  file->mmap_len = len;
+  file->bin_ncols = hdr[3];
+  file->bin_nblocks = nblocks;
+  file->bin_index_kmers = (const BinaryKmer*)(data + index_offset);
+  file->bin_index_offsets = (const uint64_t*)(file->bin_index_kmers + nblocks);
+
+  // Last offset is the end of the records
+  if(file->bin_index_offsets[0] != data_offset ||
+     file->bin_index_offsets[nblocks] > index_offset) {
+    bad_bin_file(path);
+  }
+
+  // Blocks are loaded in parallel, so check they are in order
+  size_t i;
+  for(i = 0; i < nblocks; i++)
+    if(file->bin_index_offsets[i] > file->bin_index_offsets[i+1])
+      bad_bin_file(path);
+
+  file->bin.ptr = data + data_offset;
+  file->bin.end = data + file->bin_index_offsets[nblocks];
+  file->bin.links_left = 0;
+
+  strbuf_reset(hdrstr);
+  strbuf_append_strn(hdrstr, (const char*)(hdr+CTP_BIN_HDR_WORDS), json_len);
+}
+
 // Open file, exit on error
 // if successful creates a new GPathReader and returns 1
 void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
@@ -166,16 +281,23 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
   FileFilter *fltr = &file->fltr;
   file_filter_open(fltr, path); // calls die() on error
 
-  file->gz = futil_gzopen(fltr->path.b, mode);
-  strm_buf_alloc(&file->strmbuf, 4*ONE_MEGABYTE);
-
   // Temporary variable for loading
   strbuf_alloc(&file->line, 1024);
 
   // Load JSON header into file->hdrstr
   StrBuf *hdrstr = &file->hdrstr;
   if(hdrstr->b == NULL) strbuf_alloc(hdrstr, 1024);
-  json_hdr_read(NULL, file->gz, path, hdrstr);
+
+  if(_gpath_reader_is_binary(fltr->path.b)) {
+    if(strcmp(mode,"r") != 0) die("Binary link files are read only: %s", path);
+    _gpath_reader_mmap(file, fltr->path.b, hdrstr);
+  }
+  else {
+    file->gz = futil_gzopen(fltr->path.b, mode);
+    strm_buf_alloc(&file->strmbuf, 4*ONE_MEGABYTE);
+    json_hdr_read(NULL, file->gz, path, hdrstr);
+  }
+
   file->json = cJSON_Parse(hdrstr->b);
   if(file->json == NULL) die("Invalid JSON header: %s", path);
 
@@ -198,6 +320,12 @@ void gpath_reader_open2(GPathReader *file, const char *path, const char *mode,
 
   // Check we can handle the kmer size
   db_graph_check_kmer_size(kmer_size, file->fltr.path.b);
+
+  if(file->binary) {
+    if(file->version != CTP_BIN_FORMAT_VERSION || file->bin_ncols != filencols)
+      bad_bin_file(path);
+    file->bin_kmer_size = kmer_size;
+  }
 }
 
 void gpath_reader_open(GPathReader *file, const char *path)
@@ -208,6 +336,8 @@ void gpath_reader_open(GPathReader *file, const char *path)
 void gpath_reader_close(GPathReader *file)
 {
   if(file->gz) gzclose(file->gz);
+  if(file->mmap_data != NULL && munmap(file->mmap_data, file->mmap_len) != 0)
+    warn("Cannot release memory map [%s]", strerror(errno));
   strm_buf_dealloc(&file->strmbuf);
   strbuf_dealloc(&file->line);
   file_filter_close(&file->fltr);
@@ -233,6 +363,57 @@ void gpath_reader_check(const GPathReader *file, size_t db_kmer_size,
   }
 }
 
+//
+// Binary files
+//
+
+// Read the next link of the current kmer, pointers are into the memory map
+static void _bin_read_link(CtpBinCursor *cur, size_t ncols, const char *path,
+                           Orientation *orient, size_t *njuncs,
+                           const uint8_t **nseen, const uint8_t **colset,
+                           const uint8_t **seq)
+{
+  const uint8_t *ptr = cur->ptr;
+  uint16_t word;
+
+  if(ptr + ctp_bin_link_mem(ncols, 0) > cur->end) bad_bin_file(path);
+
+  memcpy(&word, ptr, sizeof(uint16_t));
+  *njuncs = word & 0x7fff;
+  *orient = word >> 15;
+  *nseen = ptr + sizeof(uint16_t);
+  *colset = *nseen + ncols;
+  *seq = *colset + roundup_bits2bytes(ncols);
+
+  cur->ptr += ctp_bin_link_mem(ncols, *njuncs);
+  if(cur->ptr > cur->end) bad_bin_file(path);
+  cur->links_left--;
+}
+
+// Skips any unread links of the previous kmer
+// Returns false at the end of the records
+static bool _bin_read_kmer(CtpBinCursor *cur, size_t ncols, const char *path,
+                           BinaryKmer *bkey, size_t *num_links)
+{
+  Orientation orient;
+  size_t njuncs;
+  const uint8_t *nseen, *colset, *seq;
+  uint32_t n;
+
+  while(cur->links_left)
+    _bin_read_link(cur, ncols, path, &orient, &njuncs, &nseen, &colset, &seq);
+
+  if(cur->ptr == cur->end) return false;
+  if(cur->ptr + sizeof(BinaryKmer) + sizeof(uint32_t) > cur->end)
+    bad_bin_file(path);
+
+  memcpy(bkey, cur->ptr, sizeof(BinaryKmer));
+  memcpy(&n, cur->ptr + sizeof(BinaryKmer), sizeof(uint32_t));
+  cur->ptr += sizeof(BinaryKmer) + sizeof(uint32_t);
+  cur->links_left = *num_links = n;
+  return true;
+}
+
 // Reads line <kmer> <num_links>
 // Calls die() on error
 // Returns true unless end of file
@@ -241,6 +422,16 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
   strbuf_reset(kmer);
   *num_links = 0;
 
+  if(file->binary) {
+    BinaryKmer bkey;
+    if(!_bin_read_kmer(&file->bin, file->bin_ncols, file_filter_path(&file->fltr),
+                       &bkey, num_links)) return false;
+    strbuf_ensure_capacity(kmer, file->bin_kmer_size);
+    binary_kmer_to_str(bkey, file->bin_kmer_size, kmer->b);
+    kmer->end = file->bin_kmer_size;
+    return true;
+  }
+
   const char *path = file_filter_path(&file->fltr);
   int c;
   char *space;
@@ -268,6 +459,23 @@ bool gpath_reader_read_kmer(GPathReader *file, StrBuf *kmer, size_t *num_links)
   return false;
 }
 
+// Convert counts for file colours into counts for colours loaded into
+static void _link_counts_filter(SizeBuffer *counts, const FileFilter *fltr)
+{
+  size_t i, fromcol, intocol;
+
+  // Use filter - append zeros first
+  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
+  size_buf_push_zero(counts, num_into);
+  for(i = 0; i < file_filter_num(fltr); i++) {
+    fromcol = file_filter_fromcol(fltr, i);
+    intocol = file_filter_intocol(fltr, i);
+    counts->b[offset+intocol] += counts->b[fromcol];
+  }
+  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
+  counts->len = num_into;
+}
+
 #define bad_link_line(path,line) die("Bad link line [%s]: %s", path, (line)->b)
 
 /**
@@ -282,7 +490,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
                      StrBuf *seq, SizeBuffer *juncpos)
 {
   const char *path = file_filter_path(fltr);
-  size_t i, fromcol, intocol;
+  size_t i;
   char *end = NULL;
 
   // First first 5 required columns
@@ -328,17 +536,7 @@ void link_line_parse(const StrBuf *line, int version, const FileFilter *fltr,
   else if(counts->len != fltr->filencols)
     bad_link_line(path,line);
 
-  // Use filter - append zeros first
-  // size_buf_reset(counts);
-  size_t offset = counts->len, num_into = file_filter_into_ncols(fltr);
-  size_buf_push_zero(counts, num_into);
-  for(i = 0; i < file_filter_num(fltr); i++) {
-    fromcol = file_filter_fromcol(fltr, i);
-    intocol = file_filter_intocol(fltr, i);
-    counts->b[offset+intocol] += counts->b[fromcol];
-  }
-  memmove(counts->b, counts->b+offset, num_into*sizeof(counts->b[0]));
-  counts->len = num_into;
+  _link_counts_filter(counts, fltr);
 
   // 4:[juncs:ACAGA]
   strbuf_reset(juncs);
@@ -407,6 +605,33 @@ bool gpath_reader_read_link(GPathReader *file,
                             SizeBuffer *countbuf, StrBuf *juncs,
                             StrBuf *seq, SizeBuffer *juncpos)
 {
+  if(file->binary)
+  {
+    if(file->bin.links_left == 0) return false;
+
+    Orientation orient;
+    const uint8_t *nseen, *colset, *bseq;
+    size_t i;
+
+    _bin_read_link(&file->bin, file->bin_ncols, file_filter_path(&file->fltr),
+                   &orient, njuncs, &nseen, &colset, &bseq);
+    *fw = (orient == FORWARD);
+
+    size_buf_reset(countbuf);
+    size_buf_capacity(countbuf, file->bin_ncols);
+    for(i = 0; i < file->bin_ncols; i++) countbuf->b[i] = nseen[i];
+    countbuf->len = file->bin_ncols;
+    _link_counts_filter(countbuf, &file->fltr);
+
+    strbuf_ensure_capacity(juncs, *njuncs);
+    binary_seq_to_str(bseq, *njuncs, juncs->b);
+    juncs->end = *njuncs;
+
+    if(seq) strbuf_reset(seq);
+    if(juncpos) size_buf_reset(juncpos);
+    return true;
+  }
+
   int c;
   const char *path = file_filter_path(&file->fltr);
   StrBuf *line = &file->line;
@@ -437,7 +662,7 @@ bool gpath_reader_read_link(GPathReader *file,
   return false;
 }
 
-static hkey_t find_link_kmer(BinaryKmer bkey, int flags,
+static hkey_t find_link_kmer(BinaryKmer bkey, int flags, bool threaded,
                              const char *path, dBGraph *db_graph)
 {
   hkey_t hkey = HASH_NOT_FOUND;
@@ -445,7 +670,11 @@ static hkey_t find_link_kmer(BinaryKmer bkey, int flags,
 
   switch(flags) {
     case GPATH_ADD_MISSING_KMERS:
-      hkey = hash_table_find_or_insert(&db_graph->ht, bkey, &found);
+      if(threaded)
+        hkey = hash_table_find_or_insert_mt(&db_graph->ht, bkey, &found,
+                                            db_graph->bktlocks);
+      else
+        hkey = hash_table_find_or_insert(&db_graph->ht, bkey, &found);
       break;
     case GPATH_DIE_MISSING_KMERS:
       hkey = hash_table_find(&db_graph->ht, bkey);
@@ -509,130 +738,415 @@ static size_t _load_paths_from_set(dBGraph *db_graph, GPathSet *gpset,
   return subset1->list.len;
 }
 
-/**
- * @param kmer_flags must be one of:
- *   * GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
- *   * GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
- *   * GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
- */
-void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph)
+typedef struct
 {
-  const char *path = file_filter_path(&file->fltr);
+  size_t num_kmers_seen, num_links_seen;
+  size_t num_kmers_loaded, num_links_loaded;
+} GPathLoadCounts;
 
-  file_filter_status(&file->fltr);
+// Temporary memory for loading links, one per thread
+typedef struct
+{
+  GPathSet gpset; // links of each kmer are loaded into this set first
+  GPathSubset subset0, subset1;
+  SizeBuffer counts;
+  StrBuf juncs;
+  ByteBuffer seqbuf, txtbuf;
+  GPathLoadCounts cnts;
+  bool threaded, warn_nlink_mismatch;
+} GPathLoader;
 
-  size_t into_ncols = file_filter_into_ncols(&file->fltr);
+static void _gpath_loader_alloc(GPathLoader *ldr, size_t ncols, bool threaded)
+{
+  memset(ldr, 0, sizeof(GPathLoader));
+  gpath_set_alloc(&ldr->gpset, ncols, ONE_MEGABYTE, true, true);
+  gpath_subset_alloc(&ldr->subset0);
+  gpath_subset_alloc(&ldr->subset1);
+  size_buf_alloc(&ldr->counts, 256);
+  strbuf_alloc(&ldr->juncs, 256);
+  byte_buf_alloc(&ldr->seqbuf, 64);
+  byte_buf_alloc(&ldr->txtbuf, 1024);
+  ldr->threaded = threaded;
+}
 
-  // Load paths into this temporary set for each kmer
-  GPathSet gpset;
-  gpath_set_alloc(&gpset, db_graph->num_of_cols, ONE_MEGABYTE, true, true);
+static void _gpath_loader_dealloc(GPathLoader *ldr)
+{
+  gpath_set_dealloc(&ldr->gpset);
+  gpath_subset_dealloc(&ldr->subset0);
+  gpath_subset_dealloc(&ldr->subset1);
+  size_buf_dealloc(&ldr->counts);
+  strbuf_dealloc(&ldr->juncs);
+  byte_buf_dealloc(&ldr->seqbuf);
+  byte_buf_dealloc(&ldr->txtbuf);
+}
 
-  GPathSubset subset0, subset1;
-  gpath_subset_alloc(&subset0);
-  gpath_subset_alloc(&subset1);
+// Add a link to the temporary set for a kmer, if it has coverage in any of
+// the colours we are loading into.
+// Our temporary gpset always stores nseen counts
+static void _load_link_into_set(GPathSet *gpset, const uint8_t *seq,
+                                size_t njuncs, Orientation orient,
+                                const size_t *counts, size_t into_ncols)
+{
+  size_t i, link_covg = 0;
+  for(i = 0; i < into_ncols; i++) link_covg |= counts[i];
+  if(!link_covg) return;
+
+  // Add to GPathSet
+  GPathNew newgpath = {.seq = (uint8_t*)seq,
+                       .colset = NULL, .nseen = NULL,
+                       .orient = orient,
+                       .num_juncs = njuncs};
+
+  GPath *gpath = gpath_set_add_mt(gpset, newgpath);
+
+  // Update nseen and colset
+  uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
+  uint8_t *colset = gpath_get_colset(gpath, gpset->ncols);
+  for(i = 0; i < into_ncols; i++) {
+    nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts[i]);
+    bitset_or(colset, i, counts[i] > 0);
+  }
+}
 
-  size_t i, nlink, num_links_exp = 0;
-  size_t total_kmers_exp = gpath_reader_get_num_kmers(file);
-  size_t total_links_exp = gpath_reader_get_num_paths(file);
-  size_t num_kmers_seen = 0, num_links_seen = 0;
-  size_t num_kmers_loaded = 0, num_links_loaded = 0;
-  bool warn_nlink_mismatch = false;
+// Add a link parsed from text to the temporary set
+static void _load_txt_link_into_set(GPathLoader *ldr, bool fw, size_t into_ncols)
+{
+  const StrBuf *juncs = &ldr->juncs;
+  byte_buf_capacity(&ldr->seqbuf, binary_seq_mem(juncs->end));
+  binary_seq_from_str(juncs->b, juncs->end, ldr->seqbuf.b);
+  _load_link_into_set(&ldr->gpset, ldr->seqbuf.b, juncs->end,
+                      fw ? FORWARD : REVERSE, ldr->counts.b, into_ncols);
+}
+
+// Load paths for a kmer from the temporary set into the graph
+static void _load_set_into_graph(BinaryKmer bkey, int kmer_flags,
+                                 GPathLoader *ldr, const char *path,
+                                 dBGraph *db_graph)
+{
+  GPathSet *gpset = &ldr->gpset;
+  ldr->cnts.num_kmers_loaded += (gpath_set_num_paths(gpset) > 0);
+
+  if(gpath_set_num_paths(gpset) > 0) {
+    hkey_t hkey = find_link_kmer(bkey, kmer_flags, ldr->threaded,
+                                 path, db_graph);
+
+    if(hkey != HASH_NOT_FOUND) {
+      ldr->cnts.num_links_loaded += _load_paths_from_set(db_graph, gpset,
+                                                         &ldr->subset0,
+                                                         &ldr->subset1,
+                                                         hkey);
+    }
+  }
+}
+
+// Called once all the links of a kmer read from text have been seen
+static void _load_txt_kmer_end(const char *kmerstr, size_t nlink,
+                               size_t num_links_exp, int kmer_flags,
+                               GPathLoader *ldr, const char *path,
+                               dBGraph *db_graph)
+{
+  if(nlink != num_links_exp && !ldr->warn_nlink_mismatch) {
+    warn("Number of links mismatches: %s %zu != %zu [%s]",
+         kmerstr, num_links_exp, nlink, path);
+    ldr->warn_nlink_mismatch = true;
+  }
+
+  ldr->cnts.num_links_seen += nlink;
+
+  if(gpath_set_num_paths(&ldr->gpset) > 0) {
+    BinaryKmer bkey = binary_kmer_from_str(kmerstr, db_graph->kmer_size);
+    _load_set_into_graph(bkey, kmer_flags, ldr, path, db_graph);
+  }
+}
+
+// Read links from a gzip stream one line at a time
+static void _gpath_reader_load_txt(GPathReader *file, int kmer_flags,
+                                   GPathLoader *ldr, dBGraph *db_graph)
+{
+  const char *path = file_filter_path(&file->fltr);
+  size_t into_ncols = file_filter_into_ncols(&file->fltr);
+  size_t nlink, num_links_exp = 0;
 
   StrBuf kmerstr;
   strbuf_alloc(&kmerstr, 64);
   bool fw = true;
   size_t njuncs = 0;
-  StrBuf juncs;
-  SizeBuffer counts;
-  strbuf_alloc(&juncs, 256);
-  size_buf_alloc(&counts, 256);
-
-  // Buffer is collapsed into here
-  ByteBuffer seqbuf;
-  byte_buf_alloc(&seqbuf, 64);
 
-  for(num_kmers_seen = 0;
-      gpath_reader_read_kmer(file, &kmerstr, &num_links_exp);
-      num_kmers_seen++)
+  for(; gpath_reader_read_kmer(file, &kmerstr, &num_links_exp);
+      ldr->cnts.num_kmers_seen++)
   {
-    gpath_set_reset(&gpset);
+    gpath_set_reset(&ldr->gpset);
 
     for(nlink = 0;
         gpath_reader_read_link(file, &fw, &njuncs,
-                               &counts, &juncs, NULL, NULL);
+                               &ldr->counts, &ldr->juncs, NULL, NULL);
         nlink++)
     {
-      // Check if link has coverage in any colours
-      size_t link_covg = 0;
-      for(i = 0; i < into_ncols; i++) link_covg |= counts.b[i];
+      _load_txt_link_into_set(ldr, fw, into_ncols);
+    }
 
-      if(link_covg)
+    _load_txt_kmer_end(kmerstr.b, nlink, num_links_exp, kmer_flags,
+                       ldr, path, db_graph);
+  }
+
+  strbuf_dealloc(&kmerstr);
+}
+
+// Parse a decompressed block of text holding all the links of a set of kmers
+// Lines are NUL terminated in place
+static void _gpath_reader_load_txt_block(char *txt, size_t len,
+                                         const GPathReader *file, int kmer_flags,
+                                         GPathLoader *ldr, dBGraph *db_graph)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const size_t kmer_size = db_graph->kmer_size;
+  size_t into_ncols = file_filter_into_ncols(&file->fltr);
+  size_t linelen, nlink = 0, num_links_exp = 0, njuncs;
+  char *line, *nl, *space, *end = txt + len;
+  const char *kmerstr = NULL;
+  StrBuf linebuf;
+  bool fw;
+
+  for(line = txt; line < end; line = nl + 1)
+  {
+    if((nl = memchr(line, '\n', end - line)) == NULL) nl = end;
+    *nl = '\0';
+    linelen = nl - line;
+    if(linelen > 0 && line[linelen-1] == '\r') line[--linelen] = '\0';
+
+    if(linelen == 0 || line[0] == '#') continue;
+
+    if(char_is_acgt(line[0]))
+    {
+      // <kmer> <num_links>
+      if(kmerstr != NULL)
+        _load_txt_kmer_end(kmerstr, nlink, num_links_exp, kmer_flags,
+                           ldr, path, db_graph);
+
+      if((space = strchr(line, ' ')) == NULL ||
+         (size_t)(space - line) != kmer_size ||
+         !parse_entire_size(space+1, &num_links_exp))
       {
-        byte_buf_capacity(&seqbuf, binary_seq_mem(juncs.end));
-        binary_seq_from_str(juncs.b, juncs.end, seqbuf.b);
-
-        // Add to GPathSet
-        GPathNew newgpath = {.seq = seqbuf.b,
-                             .colset = NULL, .nseen = NULL,
-                             .orient = fw ? FORWARD : REVERSE,
-                             .num_juncs = juncs.end};
-
-        GPath *gpath = gpath_set_add_mt(&gpset, newgpath);
-
-        // Update nseen and colset
-        // Our temporary gpset always stores nseen counts
-        uint8_t *nseen = gpath_set_get_nseen(&gpset, gpath);
-        uint8_t *colset = gpath_get_colset(gpath, gpset.ncols);
-        for(i = 0; i < into_ncols; i++) {
-          nseen[i] = MIN2((size_t)UINT8_MAX, (size_t)nseen[i] + counts.b[i]);
-          bitset_or(colset, i, counts.b[i] > 0);
-        }
+        die("Bad kmer line [%s]: %s", path, line);
       }
+
+      *space = '\0';
+      kmerstr = line;
+      nlink = 0;
+      gpath_set_reset(&ldr->gpset);
+      ldr->cnts.num_kmers_seen++;
     }
+    else
+    {
+      if(kmerstr == NULL) die("Link before first kmer [%s]: %s", path, line);
 
-    if(nlink != num_links_exp && !warn_nlink_mismatch) {
-      warn("Number of links mismatches: %s %zu != %zu [%s]",
-           kmerstr.b, num_links_exp, nlink, path);
-      warn_nlink_mismatch = true;
+      linebuf = (StrBuf){.b = line, .end = linelen, .size = linelen+1};
+      link_line_parse(&linebuf, file->version, &file->fltr,
+                      &fw, &njuncs, &ldr->counts, &ldr->juncs, NULL, NULL);
+      _load_txt_link_into_set(ldr, fw, into_ncols);
+      nlink++;
     }
+  }
+
+  if(kmerstr != NULL)
+    _load_txt_kmer_end(kmerstr, nlink, num_links_exp, kmer_flags,
+                       ldr, path, db_graph);
+}
+
+// Binary files need no parsing: kmers and junctions are copied from the
+// memory map, only colours are remapped through the file filter
+static void _gpath_reader_load_bin(const GPathReader *file, CtpBinCursor *cur,
+                                   int kmer_flags, GPathLoader *ldr,
+                                   dBGraph *db_graph)
+{
+  const char *path = file_filter_path(&file->fltr);
+  const FileFilter *fltr = &file->fltr;
+  const size_t ncols = file->bin_ncols;
+  size_t i, nlink, num_links, njuncs, into_ncols = file_filter_into_ncols(fltr);
+  const uint8_t *nseen, *colset, *seq;
+  Orientation orient;
+  BinaryKmer bkey;
+  size_t counts[into_ncols];
+
+  for(; _bin_read_kmer(cur, ncols, path, &bkey, &num_links);
+      ldr->cnts.num_kmers_seen++)
+  {
+    gpath_set_reset(&ldr->gpset);
 
-    num_links_seen += nlink;
-    num_kmers_loaded += (gpset.entries.len > 0);
+    for(nlink = 0; nlink < num_links; nlink++)
+    {
+      _bin_read_link(cur, ncols, path, &orient, &njuncs, &nseen, &colset, &seq);
 
-    if(gpset.entries.len > 0) {
-      BinaryKmer bkey = binary_kmer_from_str(kmerstr.b, db_graph->kmer_size);
-      hkey_t hkey = find_link_kmer(bkey, kmer_flags, path, db_graph);
+      memset(counts, 0, sizeof(counts));
+      for(i = 0; i < file_filter_num(fltr); i++)
+        counts[file_filter_intocol(fltr,i)] += nseen[file_filter_fromcol(fltr,i)];
 
-      if(hkey != HASH_NOT_FOUND) {
-        num_links_loaded += _load_paths_from_set(db_graph, &gpset,
-                                                 &subset0, &subset1,
-                                                 hkey);
-      }
+      _load_link_into_set(&ldr->gpset, seq, njuncs, orient, counts, into_ncols);
     }
+
+    ldr->cnts.num_links_seen += num_links;
+
+    _load_set_into_graph(bkey, kmer_flags, ldr, path, db_graph);
   }
+}
 
-  strbuf_dealloc(&kmerstr);
-  strbuf_dealloc(&juncs);
-  size_buf_dealloc(&counts);
+// Find the gzip blocks of a text file, skipping the header block
+// Returns offsets of blocks then the end of the file, or NULL if the file is
+// not entirely made of gzip blocks
+static uint64_t* _gpath_reader_gz_blocks(const uint8_t *data, size_t len,
+                                         size_t *nblocks_ptr)
+{
+  size_t offset, blklen, nblocks = 0, cap = 64;
+  uint64_t *offsets = ctx_malloc(cap * sizeof(uint64_t));
+
+  if((offset = gz_block_size(data, len)) == 0) { ctx_free(offsets); return NULL; }
+
+  while(offset < len) {
+    if((blklen = gz_block_size(data+offset, len-offset)) == 0) {
+      ctx_free(offsets);
+      return NULL;
+    }
+    if(nblocks+1 == cap) {
+      cap *= 2;
+      offsets = ctx_realloc(offsets, cap * sizeof(uint64_t));
+    }
+    offsets[nblocks++] = offset;
+    offset += blklen;
+  }
+
+  offsets[nblocks] = len;
+  *nblocks_ptr = nblocks;
+  return offsets;
+}
+
+typedef struct
+{
+  const GPathReader *file;
+  int kmer_flags;
+  const uint8_t *data; // memory mapped file
+  const uint64_t *offsets; // [nblocks+1] start of each block, then the end
+  size_t nblocks;
+  volatile size_t next_block;
+  bool threaded;
+  GPathLoadCounts cnts;
+  dBGraph *db_graph;
+} GPathLoading;
+
+// Threads take blocks in turn. Every kmer in a file is only in one block, so
+// no two threads load links for the same kmer at the same time.
+static void gpath_load_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  GPathLoading *load = (GPathLoading*)arg;
+  const GPathReader *file = load->file;
+  const char *path = file_filter_path(&file->fltr);
+  size_t i, start, end;
+
+  GPathLoader ldr;
+  _gpath_loader_alloc(&ldr, load->db_graph->num_of_cols, load->threaded);
 
-  load_check(total_kmers_exp == num_kmers_seen,
+  while((i = __sync_fetch_and_add(&load->next_block, 1)) < load->nblocks)
+  {
+    start = load->offsets[i];
+    end = load->offsets[i+1];
+
+    if(file->binary) {
+      CtpBinCursor cur = {.ptr = load->data + start, .end = load->data + end,
+                          .links_left = 0};
+      _gpath_reader_load_bin(file, &cur, load->kmer_flags, &ldr, load->db_graph);
+    } else {
+      gz_block_inflate(load->data + start, end - start, &ldr.txtbuf, path);
+      _gpath_reader_load_txt_block((char*)ldr.txtbuf.b, ldr.txtbuf.len,
+                                   file, load->kmer_flags, &ldr, load->db_graph);
+    }
+  }
+
+  __sync_fetch_and_add(&load->cnts.num_kmers_seen, ldr.cnts.num_kmers_seen);
+  __sync_fetch_and_add(&load->cnts.num_links_seen, ldr.cnts.num_links_seen);
+  __sync_fetch_and_add(&load->cnts.num_kmers_loaded, ldr.cnts.num_kmers_loaded);
+  __sync_fetch_and_add(&load->cnts.num_links_loaded, ldr.cnts.num_links_loaded);
+
+  _gpath_loader_dealloc(&ldr);
+}
+
+/**
+ * @param kmer_flags must be one of:
+ *   * GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
+ *   * GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
+ *   * GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
+ * @param nthreads number of threads to use for binary files and text files
+ *                 made of gzip blocks, other files are read with one thread
+ */
+void gpath_reader_load(GPathReader *file, int kmer_flags, size_t nthreads,
+                       dBGraph *db_graph)
+{
+  ctx_assert(nthreads > 0);
+  file_filter_status(&file->fltr);
+
+  const char *path = file_filter_path(&file->fltr);
+  size_t total_kmers_exp = gpath_reader_get_num_kmers(file);
+  size_t total_links_exp = gpath_reader_get_num_paths(file);
+
+  // Adding kmers from many threads needs bucket locks
+  if(kmer_flags == GPATH_ADD_MISSING_KMERS && db_graph->bktlocks == NULL)
+    nthreads = 1;
+
+  GPathLoading load = {.file = file, .kmer_flags = kmer_flags,
+                       .data = NULL, .offsets = NULL, .nblocks = 0,
+                       .next_block = 0, .db_graph = db_graph};
+
+  uint8_t *txtdata = NULL;
+  uint64_t *txtoffsets = NULL;
+  size_t txtlen = 0;
+
+  if(file->binary) {
+    load.data = file->mmap_data;
+    load.offsets = file->bin_index_offsets;
+    load.nblocks = file->bin_nblocks;
+  }
+  else if(strcmp(path, "-") != 0 &&
+          (txtdata = _gpath_reader_map_file(path, &txtlen)) != NULL &&
+          (txtoffsets = _gpath_reader_gz_blocks(txtdata, txtlen, &load.nblocks)) != NULL)
+  {
+    load.data = txtdata;
+    load.offsets = txtoffsets;
+  }
+
+  if(load.data != NULL)
+  {
+    nthreads = MAX2(1, MIN2(nthreads, load.nblocks));
+    load.threaded = (nthreads > 1);
+    status("[GPathReader] Loading %zu blocks with %zu threads",
+           load.nblocks, nthreads);
+    util_multi_thread(&load, nthreads, gpath_load_thread);
+  }
+  else
+  {
+    // Stream from stdin or a single gzip stream
+    GPathLoader ldr;
+    _gpath_loader_alloc(&ldr, db_graph->num_of_cols, false);
+    _gpath_reader_load_txt(file, kmer_flags, &ldr, db_graph);
+    load.cnts = ldr.cnts;
+    _gpath_loader_dealloc(&ldr);
+  }
+
+  if(txtdata != NULL && munmap(txtdata, txtlen) != 0)
+    warn("Cannot release memory map [%s]", strerror(errno));
+  ctx_free(txtoffsets);
+
+  load_check(total_kmers_exp == load.cnts.num_kmers_seen,
              "header number of kmers don't match seen (exp %zu vs %zu)",
-             total_kmers_exp, num_kmers_seen);
+             total_kmers_exp, load.cnts.num_kmers_seen);
 
-  load_check(total_links_exp == num_links_seen,
+  load_check(total_links_exp == load.cnts.num_links_seen,
              "header number of links don't match seen (exp %zu vs %zu)",
-             total_links_exp, num_links_seen);
+             total_links_exp, load.cnts.num_links_seen);
 
   // Print status update
   char nlinks_str[50], nkmers_str[50];
-  ulong_to_str(num_links_loaded, nlinks_str);
-  ulong_to_str(num_kmers_loaded, nkmers_str);
+  ulong_to_str(load.cnts.num_links_loaded, nlinks_str);
+  ulong_to_str(load.cnts.num_kmers_loaded, nkmers_str);
   status("Loaded %s paths from %s kmers", nlinks_str, nkmers_str);
-
-  gpath_subset_dealloc(&subset0);
-  gpath_subset_dealloc(&subset1);
-  gpath_set_dealloc(&gpset);
-  byte_buf_dealloc(&seqbuf);
 }
 
 void gpath_reader_load_sample_names(const GPathReader *file, dBGraph *db_graph)
@@ -6,9 +6,30 @@
 #include "cJSON/cJSON.h"
 
 #include "common_buffers.h"
+#include "binary_seq.h"
 
 #define CTP_FORMAT_VERSION 4
 
+// Binary link files, see gpath_save_bin()
+#define CTP_BIN_FORMAT_VERSION 5
+#define CTP_BIN_HDR_WORDS 8
+#define CTP_BIN_BLOCK_KMERS 4096
+
+extern const char ctp_bin_magic[8];
+
+// Bytes used by a link in a binary file:
+//   <uint16_t:num_juncs|orient<<15><uint8_t[ncols]:nseen><colset><seq>
+#define ctp_bin_link_mem(ncols,njuncs) \
+        (sizeof(uint16_t) + (ncols) + roundup_bits2bytes(ncols) + \
+         binary_seq_mem(njuncs))
+
+// Position in the records of a binary file
+typedef struct
+{
+  const uint8_t *ptr, *end; // next record, end of records
+  size_t links_left; // unread links of the current kmer
+} CtpBinCursor;
+
 typedef struct
 {
   StreamBuffer strmbuf;
@@ -27,6 +48,17 @@ typedef struct
   int version;
   size_t ncolours;
   cJSON **colours_json;
+
+  // Binary files are memory mapped rather than read through gz
+  bool binary;
+  uint8_t *mmap_data;
+  size_t mmap_len;
+  CtpBinCursor bin;
+  size_t bin_kmer_size, bin_ncols;
+  // Block index: first kmer and offset of every CTP_BIN_BLOCK_KMERS kmers
+  const BinaryKmer *bin_index_kmers; // [bin_nblocks]
+  const uint64_t *bin_index_offsets; // [bin_nblocks+1]
+  size_t bin_nblocks;
 } GPathReader;
 
 #define GPATH_ADD_MISSING_KMERS   0
@@ -62,6 +94,7 @@ bool gpath_reader_read_link(GPathReader *file,
 
 // Open file, exits on error
 // if successful creates a new GPathReader
+// Text and binary files are both accepted, binary files are memory mapped
 void gpath_reader_open(GPathReader *file, const char *path);
 
 // mode is "r", "r+" etc.
@@ -76,7 +109,11 @@ void gpath_reader_check(const GPathReader *file, size_t kmer_size, size_t ncols)
 //   GPATH_ADD_MISSING_KMERS - add kmers to the graph before loading path
 //   GPATH_DIE_MISSING_KMERS - die with error if cannot find kmer
 //   GPATH_SKIP_MISSING_KMERS - skip paths where kmer is not in graph
-void gpath_reader_load(GPathReader *file, int kmer_flags, dBGraph *db_graph);
+// Binary files and text files written as gzip blocks by gpath_save() are
+// loaded with `nthreads` threads. GPATH_ADD_MISSING_KMERS uses one thread
+// unless the graph has bucket locks (DBG_ALLOC_BKTLOCKS).
+void gpath_reader_load(GPathReader *file, int kmer_flags, size_t nthreads,
+                       dBGraph *db_graph);
 void gpath_reader_close(GPathReader *file);
 
 //
@@ -6,6 +6,7 @@
 #include "binary_seq.h"
 #include "util.h"
 #include "json_hdr.h"
+#include "gz_blocks.h"
 
 const char ctp_explanation_comment[] =
 "# This file was generated with McCortex\n"
@@ -110,13 +111,22 @@ cJSON* gpath_save_mkhdr(const char *path,
 }
 
 
-static inline void _gpath_save_flush(gzFile gzout, StrBuf *sbuf,
+// Compress buffered text into a gzip block then append it to the file.
+// Blocks are compressed in parallel and only writes are serialised.
+static inline void _gpath_save_flush(FILE *fout, const char *path,
+                                     StrBuf *sbuf, ByteBuffer *gzbuf,
                                      pthread_mutex_t *outlock)
 {
+  if(sbuf->end == 0) return;
+
+  byte_buf_reset(gzbuf);
+  gz_block_deflate(sbuf->b, sbuf->end, Z_DEFAULT_COMPRESSION, gzbuf);
+  strbuf_reset(sbuf);
+
   pthread_mutex_lock(outlock);
-  gzwrite(gzout, sbuf->b, sbuf->end);
+  if(fwrite(gzbuf->b, 1, gzbuf->len, fout) != gzbuf->len)
+    die("Cannot write to file: %s [%s]", path, strerror(errno));
   pthread_mutex_unlock(outlock);
-  strbuf_reset(sbuf);
 }
 
 /**
@@ -150,7 +160,7 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
   if(subset->list.len == 0) return;
 
   // Print "<kmer> <npaths>"
-  BinaryKmer bkmer = db_graph->ht.table[hkey];
+  BinaryKmer bkmer = hash_table_fetch(&db_graph->ht, hkey);
   char bkstr[MAX_KMER_SIZE+1];
   binary_kmer_to_str(bkmer, db_graph->kmer_size, bkstr);
 
@@ -187,7 +197,7 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
 
     strbuf_append_char(sbuf, ' ');
     strbuf_ensure_capacity(sbuf, sbuf->end + gpath->num_juncs + 2);
-    binary_seq_to_str(gpath->seq, gpath->num_juncs, sbuf->b+sbuf->end);
+    binary_seq_to_str(gpath_get_seq(gpath), gpath->num_juncs, sbuf->b+sbuf->end);
     sbuf->end += gpath->num_juncs;
 
     if(nbuf)
@@ -225,15 +235,18 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
 // @subset is a temp variable that is reused each time
 // @sbuf   is a temp variable that is reused each time
 static inline int _gpath_gzsave_node(hkey_t hkey,
-                                     StrBuf *sbuf, GPathSubset *subset,
+                                     StrBuf *sbuf, ByteBuffer *gzbuf,
+                                     GPathSubset *subset,
                                      dBNodeBuffer *nbuf, SizeBuffer *jposbuf,
-                                     gzFile gzout, pthread_mutex_t *outlock,
+                                     FILE *fout, const char *path,
+                                     pthread_mutex_t *outlock,
                                      const dBGraph *db_graph)
 {
   gpath_save_sbuf(hkey, sbuf, subset, nbuf, jposbuf, db_graph);
 
+  // Blocks always end at the end of a kmer's paths
   if(sbuf->end > DEFAULT_IO_BUFSIZE)
-    _gpath_save_flush(gzout, sbuf, outlock);
+    _gpath_save_flush(fout, path, sbuf, gzbuf, outlock);
 
   return 0; // => keep iterating
 }
@@ -242,7 +255,8 @@ typedef struct
 {
   size_t nthreads;
   bool save_seq; // write seq=... juncpos=...
-  gzFile gzout;
+  FILE *fout;
+  const char *path;
   pthread_mutex_t *outlock;
   dBGraph *db_graph;
 } GPathSaving;
@@ -254,10 +268,12 @@ static void gpath_save_thread(void *arg, size_t threadid)
 
   GPathSubset subset;
   StrBuf sbuf;
+  ByteBuffer gzbuf;
 
   gpath_subset_alloc(&subset);
   gpath_subset_init(&subset, &save->db_graph->gpstore.gpset);
   strbuf_alloc(&sbuf, 2 * DEFAULT_IO_BUFSIZE);
+  byte_buf_alloc(&gzbuf, DEFAULT_IO_BUFSIZE);
 
   dBNodeBuffer nbuf;
   SizeBuffer jposbuf;
@@ -266,28 +282,32 @@ static void gpath_save_thread(void *arg, size_t threadid)
 
   HASH_ITERATE_PART(&db_graph->ht, threadid, save->nthreads,
                     _gpath_gzsave_node,
-                    &sbuf, &subset,
+                    &sbuf, &gzbuf, &subset,
                     save->save_seq ? &nbuf : NULL, save->save_seq ? &jposbuf : NULL,
-                    save->gzout, save->outlock,
+                    save->fout, save->path, save->outlock,
                     db_graph);
 
-  _gpath_save_flush(save->gzout, &sbuf, save->outlock);
+  _gpath_save_flush(save->fout, save->path, &sbuf, &gzbuf, save->outlock);
 
   db_node_buf_dealloc(&nbuf);
   size_buf_dealloc(&jposbuf);
   gpath_subset_dealloc(&subset);
   strbuf_dealloc(&sbuf);
+  byte_buf_dealloc(&gzbuf);
 }
 
 /**
- * Save paths to a file.
- * @param gzout         gzFile to write to
+ * Save paths to a file. Output is gzipped, made of gzip blocks (see
+ * gz_blocks.h) that each thread compresses independently. The first block holds
+ * the header, every other block holds all the paths of a set of kmers, so
+ * gpath_reader_load() can decompress and parse blocks with many threads.
+ * @param fout          file to write to
  * @param path          path of output file
  * @param save_path_seq if true, save seq= and juncpos= for links, requires
  *                      exactly one colour in the graph
  * @param hdrs is array of JSON headers of input files
  */
-void gpath_save(gzFile gzout, const char *path,
+void gpath_save(FILE *fout, const char *path,
                 size_t nthreads, bool save_path_seq,
                 const char *cmdstr, cJSON *cmdhdr,
                 cJSON **hdrs, size_t nhdrs,
@@ -305,27 +325,216 @@ void gpath_save(gzFile gzout, const char *path,
   status("Saving %s paths to: %s", npaths_str, path);
   status("  using %zu threads", nthreads);
 
-  // Write header
+  // Write header and comments about the format in the first block
   cJSON *json = gpath_save_mkhdr(path, cmdstr, cmdhdr, hdrs, nhdrs,
                                  contig_hists, ncols, db_graph);
-  json_hdr_gzprint(json, gzout);
+  char *jstr = cJSON_Print(json);
   cJSON_Delete(json);
 
-  // Print comments about the format
-  gzputs(gzout, ctp_explanation_comment);
+  StrBuf sbuf;
+  ByteBuffer gzbuf;
+  strbuf_alloc(&sbuf, 4096);
+  byte_buf_alloc(&gzbuf, 4096);
+  strbuf_append_str(&sbuf, jstr);
+  strbuf_append_str(&sbuf, "\n\n");
+  strbuf_append_str(&sbuf, ctp_explanation_comment);
+  free(jstr);
 
   // Multithreaded
   pthread_mutex_t outlock;
   if(pthread_mutex_init(&outlock, NULL) != 0) die("Mutex init failed");
 
+  _gpath_save_flush(fout, path, &sbuf, &gzbuf, &outlock);
+  strbuf_dealloc(&sbuf);
+  byte_buf_dealloc(&gzbuf);
+
   GPathSaving save = {.nthreads = nthreads,
                       .save_seq = save_path_seq,
-                      .gzout = gzout,
+                      .fout = fout,
+                      .path = path,
                       .outlock = &outlock,
                       .db_graph = db_graph};
 
   // Iterate over kmers writing paths
   util_multi_thread(&save, nthreads, gpath_save_thread);
   pthread_mutex_destroy(&outlock);
+
+  if(fflush(fout) != 0) die("Cannot write to file: %s [%s]", path, strerror(errno));
+
+  status("[GPathSave] Graph paths saved to %s", path);
+}
+
+//
+// Binary format
+//
+
+typedef struct
+{
+  BinaryKmer bkey; // must be first, sorted with binary_kmers_qcmp()
+  hkey_t hkey;
+} GPathBinKmer;
+
+static inline int _gpath_bin_collect(hkey_t hkey, GPathBinKmer *kmers,
+                                     size_t *nkmers, const dBGraph *db_graph)
+{
+  if(gpath_store_fetch(&db_graph->gpstore, hkey) != NULL) {
+    kmers[*nkmers].bkey = hash_table_fetch(&db_graph->ht, hkey);
+    kmers[*nkmers].hkey = hkey;
+    (*nkmers)++;
+  }
+  return 0; // => keep iterating
+}
+
+static void _gpath_bin_fwrite(const void *ptr, size_t nbytes, size_t *offset,
+                              FILE *fh, const char *path)
+{
+  if(nbytes && fwrite(ptr, 1, nbytes, fh) != nbytes)
+    die("Cannot write to file: %s [%s]", path, strerror(errno));
+  *offset += nbytes;
+}
+
+static void _gpath_bin_pad(size_t *offset, FILE *fh, const char *path)
+{
+  const uint8_t zeros[sizeof(uint64_t)] = {0};
+  size_t rem = *offset % sizeof(uint64_t);
+  if(rem) _gpath_bin_fwrite(zeros, sizeof(uint64_t) - rem, offset, fh, path);
+}
+
+// Append a kmer and its paths to buf
+static void _gpath_bin_kmer(const GPathBinKmer *kmer, ByteBuffer *buf,
+                            GPathSubset *subset, const dBGraph *db_graph)
+{
+  const GPathSet *gpset = &db_graph->gpstore.gpset;
+  const size_t ncols = gpset->ncols, colset_bytes = roundup_bits2bytes(ncols);
+  GPath *first_gpath = gpath_store_fetch(&db_graph->gpstore, kmer->hkey);
+  const GPath *gpath;
+  uint32_t npaths;
+  uint16_t word;
+  uint8_t *ptr;
+  size_t i, nbytes;
+
+  // Sort paths so output is deterministic
+  gpath_subset_reset(subset);
+  gpath_subset_load_llist(subset, first_gpath);
+  gpath_subset_sort(subset);
+
+  nbytes = sizeof(BinaryKmer) + sizeof(uint32_t);
+  for(i = 0; i < subset->list.len; i++)
+    nbytes += ctp_bin_link_mem(ncols, subset->list.b[i]->num_juncs);
+
+  byte_buf_capacity(buf, nbytes);
+  ptr = buf->b;
+  npaths = subset->list.len;
+  memcpy(ptr, &kmer->bkey, sizeof(BinaryKmer));
+  memcpy(ptr + sizeof(BinaryKmer), &npaths, sizeof(uint32_t));
+  ptr += sizeof(BinaryKmer) + sizeof(uint32_t);
+
+  for(i = 0; i < subset->list.len; i++)
+  {
+    gpath = subset->list.b[i];
+    word = gpath->num_juncs | (uint16_t)(gpath->orient << 15);
+    memcpy(ptr, &word, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+    memcpy(ptr, gpath_set_get_nseen(gpset, gpath), ncols);
+    ptr += ncols;
+    // colset is directly before seq, as in a GPathSet
+    memcpy(ptr, gpath_get_colset(gpath, ncols),
+           colset_bytes + binary_seq_mem(gpath->num_juncs));
+    ptr += colset_bytes + binary_seq_mem(gpath->num_juncs);
+  }
+
+  buf->len = nbytes;
+}
+
+/**
+ * Save paths to a binary file. Kmers are sorted and there is an index of the
+ * first kmer of every CTP_BIN_BLOCK_KMERS kmers. Links are stored as they are
+ * in memory so files can be loaded without parsing. See gpath_reader.c for
+ * the file layout.
+ * @param fout must be a seekable file, not stdout, the header is written last
+ * @param path path of output file
+ */
+void gpath_save_bin(FILE *fout, const char *path,
+                    const char *cmdstr, cJSON *cmdhdr,
+                    cJSON **hdrs, size_t nhdrs,
+                    const ZeroSizeBuffer *contig_hists, size_t ncols,
+                    dBGraph *db_graph)
+{
+  ctx_assert(gpath_set_has_nseen(&db_graph->gpstore.gpset));
+  ctx_assert(ncols == db_graph->gpstore.gpset.ncols);
+
+  if(fout == stdout) die("Cannot write binary link file to STDOUT");
+
+  char npaths_str[50];
+  ulong_to_str(db_graph->gpstore.num_paths, npaths_str);
+  status("Saving %s paths to binary file: %s", npaths_str, path);
+
+  // Sort kmers with paths
+  size_t i, nkmers = 0, nblocks, offset = 0;
+  GPathBinKmer *kmers = ctx_calloc(db_graph->ht.num_kmers+1, sizeof(GPathBinKmer));
+  HASH_ITERATE(&db_graph->ht, _gpath_bin_collect, kmers, &nkmers, db_graph);
+  qsort(kmers, nkmers, sizeof(GPathBinKmer), binary_kmers_qcmp);
+
+  nblocks = (nkmers + CTP_BIN_BLOCK_KMERS - 1) / CTP_BIN_BLOCK_KMERS;
+  BinaryKmer *index_kmers = ctx_calloc(nblocks+1, sizeof(BinaryKmer));
+  uint64_t *index_offsets = ctx_calloc(nblocks+1, sizeof(uint64_t));
+
+  cJSON *json = gpath_save_mkhdr(path, cmdstr, cmdhdr, hdrs, nhdrs,
+                                 contig_hists, ncols, db_graph);
+  cJSON_ReplaceItemInObject(json, "format_version",
+                            cJSON_CreateNumber(CTP_BIN_FORMAT_VERSION));
+  char *jstr = cJSON_Print(json);
+  cJSON_Delete(json);
+
+  uint64_t hdr[CTP_BIN_HDR_WORDS];
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(&hdr[0], ctp_bin_magic, sizeof(uint64_t));
+  hdr[1] = CTP_BIN_FORMAT_VERSION;
+  hdr[2] = NUM_BKMER_WORDS;
+  hdr[3] = ncols;
+  hdr[4] = strlen(jstr);
+
+  _gpath_bin_fwrite(hdr, sizeof(hdr), &offset, fout, path);
+  _gpath_bin_fwrite(jstr, hdr[4], &offset, fout, path);
+  _gpath_bin_pad(&offset, fout, path);
+  hdr[5] = offset;
+  free(jstr);
+
+  ByteBuffer buf;
+  GPathSubset subset;
+  byte_buf_alloc(&buf, 4096);
+  gpath_subset_alloc(&subset);
+  gpath_subset_init(&subset, &db_graph->gpstore.gpset);
+
+  for(i = 0; i < nkmers; i++) {
+    if(i % CTP_BIN_BLOCK_KMERS == 0) {
+      index_kmers[i / CTP_BIN_BLOCK_KMERS] = kmers[i].bkey;
+      index_offsets[i / CTP_BIN_BLOCK_KMERS] = offset;
+    }
+    _gpath_bin_kmer(&kmers[i], &buf, &subset, db_graph);
+    _gpath_bin_fwrite(buf.b, buf.len, &offset, fout, path);
+  }
+
+  // Last offset is the end of the records, the index starts after padding
+  index_offsets[nblocks] = offset;
+  _gpath_bin_pad(&offset, fout, path);
+  hdr[6] = offset;
+  hdr[7] = nblocks;
+
+  _gpath_bin_fwrite(index_kmers, nblocks*sizeof(BinaryKmer), &offset, fout, path);
+  _gpath_bin_fwrite(index_offsets, (nblocks+1)*sizeof(uint64_t), &offset, fout, path);
+
+  // Write completed header
+  if(fseek(fout, 0, SEEK_SET) != 0)
+    die("Cannot seek in file: %s [%s]", path, strerror(errno));
+  _gpath_bin_fwrite(hdr, sizeof(hdr), &offset, fout, path);
+  if(fflush(fout) != 0) die("Cannot write to file: %s [%s]", path, strerror(errno));
+
+  byte_buf_dealloc(&buf);
+  gpath_subset_dealloc(&subset);
+  ctx_free(index_kmers);
+  ctx_free(index_offsets);
+  ctx_free(kmers);
+
   status("[GPathSave] Graph paths saved to %s", path);
 }
@@ -46,18 +46,31 @@ void gpath_save_sbuf(hkey_t hkey, StrBuf *sbuf, GPathSubset *subset,
                      const dBGraph *db_graph);
 
 /**
- * Save paths to a file.
+ * Save paths to a gzipped text file, compressing with `nthreads` threads.
+ * @param fout    file to write to, may be stdout
  * @param cmdstr  name of the command being run, to be used to add @cmdhdr
  * @param cmdhdr  JSON header to add under current command->@cmdstr
  *                If cmdstr and cmdhdr are both NULL they are ignored
  * @param hdrs    array of JSON headers of input files
  * @param nhdrs   number of elements in @hdrs
  */
-void gpath_save(gzFile gzout, const char *path,
+void gpath_save(FILE *fout, const char *path,
                 size_t nthreads, bool save_path_seq,
                 const char *cmdstr, cJSON *cmdhdr,
                 cJSON **hdrs, size_t nhdrs,
                 const ZeroSizeBuffer *contig_hists, size_t ncols,
                 dBGraph *db_graph);
 
+/**
+ * Save paths to a binary file, sorted by kmer with a block index.
+ * Binary files are read by gpath_reader_open() like text files.
+ * @param fout must be a seekable file, not stdout
+ * @param path path of output file
+ */
+void gpath_save_bin(FILE *fout, const char *path,
+                    const char *cmdstr, cJSON *cmdhdr,
+                    cJSON **hdrs, size_t nhdrs,
+                    const ZeroSizeBuffer *contig_hists, size_t ncols,
+                    dBGraph *db_graph);
+
 #endif /* GPATH_SAVE_H_ */
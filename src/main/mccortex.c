@@ -5,6 +5,8 @@
 #include "util.h"
 #include "file_util.h"
 #include "hash.h"
+#include "hash_table.h"
+#include "db_graph.h"
 
 // To add a new command to mccortex31 <cmd>:
 // 0. create a file src/commands/ctx_X.c
@@ -196,6 +198,9 @@ static const char options[] =
 "  -t, --threads <T>     Limit on proccessing threads [default: 2]\n"
 "  -o, --out <file>      Output file\n"
 "  -p, --paths <in.ctp>  Links file to load (can specify multiple times)\n"
+"  --hugepages           Use huge pages for the graph and hash table\n"
+"  --compact-hash        Store part of each kmer in the hash table (k <= 31)\n"
+"  --small-covgs         Store coverages in 8 bits, larger values kept aside\n"
 "\n";
 
 static int ctxcmd_cmp(const void *aa, const void *bb)
@@ -254,6 +259,27 @@ static const CtxCmd* ctx_get_command(const char* cmd)
   return NULL;
 }
 
+// Get the thread count passed to the command with -t,--threads, or
+// DEFAULT_NTHREADS if not given. Arguments are not removed.
+static size_t cmd_args_nthreads(int argc, char **argv)
+{
+  const char *val = NULL;
+  size_t nthreads = 0;
+  int i;
+
+  for(i = 2; i < argc && strcmp(argv[i],"--") != 0; i++) {
+    if(!strcmp(argv[i],"-t") || !strcmp(argv[i],"--threads"))
+      val = (i+1 < argc ? argv[++i] : NULL);
+    else if(!strncmp(argv[i],"--threads=",10)) val = argv[i]+10;
+    else if(!strncmp(argv[i],"-t",2)) val = argv[i]+2;
+  }
+
+  // Commands report invalid values
+  if(val == NULL || !parse_entire_size(val, &nthreads) || !nthreads)
+    return DEFAULT_NTHREADS;
+  return nthreads;
+}
+
 int main(int argc, char **argv)
 {
   time_t start, end;
@@ -273,19 +299,27 @@ int main(int argc, char **argv)
   // If no arguments after command, print help
   if(argc == 2) cmd_print_usage(NULL);
 
-  // Look for -q, --quiet argument, if given silence output
-  int argi = 1;
-  while(argi < argc && !(!strcmp(argv[argi],"-q") || !strcmp(argv[argi],"--quiet")))
-    argi++;
-
-  if(argi < argc) {
-    // Found -q, --quiet argument
-    ctx_msg_out = NULL;
+  // Look for -q, --quiet, --hugepages, --compact-hash and --small-covgs
+  // arguments, remove them if found
+  int argi = 1, argj;
+  while(argi < argc) {
+    if(!strcmp(argv[argi],"-q") || !strcmp(argv[argi],"--quiet"))
+      ctx_msg_out = NULL; // silence output
+    else if(!strcmp(argv[argi],"--hugepages"))
+      alloc_set_hugepages(true);
+    else if(!strcmp(argv[argi],"--compact-hash"))
+      hash_table_set_compact(true);
+    else if(!strcmp(argv[argi],"--small-covgs"))
+      db_graph_set_small_covgs(true);
+    else { argi++; continue; }
     // Remove argument
-    for(--argc; argi < argc; argi++)
-      argv[argi] = argv[argi+1];
+    for(--argc, argj = argi; argj < argc; argj++)
+      argv[argj] = argv[argj+1];
   }
 
+  // Large arrays are filled with as many threads as the command uses
+  alloc_set_nthreads(cmd_args_nthreads(argc, argv));
+
   // Print status header
   cmd_print_status_header();
 
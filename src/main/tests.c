@@ -18,16 +18,24 @@ int main(int argc, char **argv)
   // Binary Kmer tests should work for all values of MAXK
   test_bkmer_functions();
   test_hash_table();
+  test_graph_block();
+  test_kmer_mphf();
+  test_graph_mmap();
+  test_graph_load();
 
   #if MAX_KMER_SIZE == 31
     // not kmer dependent
     test_util();
     test_dna_functions();
     test_binary_seq_functions();
+    test_seq_inflate();
+    test_seq_reader();
 
     // only written in k=31
     test_db_node();
     test_build_graph();
+    test_build_graph_solid();
+    test_build_partitions();
     test_supernode();
     test_subgraph();
     test_cleaning();
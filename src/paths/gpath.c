@@ -7,7 +7,8 @@
 int gpath_cmp(const GPath *a, const GPath *b)
 {
   int ret = (int)a->orient - (int)b->orient;
-  return ret ? ret : binary_seqs_cmp(a->seq, a->num_juncs, b->seq, b->num_juncs);
+  return ret ? ret : binary_seqs_cmp(gpath_get_seq(a), a->num_juncs,
+                                   gpath_get_seq(b), b->num_juncs);
 }
 
 size_t gpath_colset_bits_set(const GPath *gpath, size_t ncols)
@@ -1,22 +1,75 @@
 #ifndef GPATH_H_
 #define GPATH_H_
 
-// 20 bytes per path
+// 12 bytes per path
 typedef struct GPathStruct GPath;
 
 #define GPATH_MAX_KMERS UINT32_MAX
 #define GPATH_MAX_JUNCS (UINT16_MAX>>1)
 #define GPATH_MAX_SEEN UINT8_MAX
 
-// 8+2+8=18bytes (could be 5+2+5 = 12)
+// 5+2+5 = 12 bytes
+// Paths are stored in a GPathSet (see gpath_set.h). Rather than pointers we
+// store the offset of the sequence in the set's sequence store and the index of
+// the next path in the set. Use the accessors below.
+// Do not use pointers to fields in this struct - they are not aligned
 struct GPathStruct
 {
-  uint8_t *seq;
+  uint64_t seq_offset:40;
   uint16_t num_juncs:15, orient:1;
-  GPath *next;
+  uint64_t next_idx:40; // GPATH_NULL_IDX if no next path
 } __attribute__((packed));
 
-#define gpath_get_colset(gp,ncols) ((gp)->seq - (((ncols)+7)/8))
+#define GPATH_NULL_IDX ((1UL<<40)-1)
+
+// Paths are stored in chunks of GPATH_CHUNK_PATHS, aligned to GPATH_CHUNK_ALIGN.
+// Sequences are stored in chunks of GPATH_SEQ_CHUNK_BYTES.
+#define GPATH_CHUNK_BITS 18
+#define GPATH_CHUNK_PATHS (1UL<<GPATH_CHUNK_BITS)
+#define GPATH_CHUNK_ALIGN (1UL<<22)
+#define GPATH_SEQ_CHUNK_BITS 22
+#define GPATH_SEQ_CHUNK_BYTES (1UL<<GPATH_SEQ_CHUNK_BITS)
+
+// Each chunk of paths starts with this header, which we can find by rounding
+// down the address of a path
+typedef struct
+{
+  GPath *const *entry_chunks; // first path in each chunk
+  uint8_t *const *seq_chunks;
+  uint64_t idx; // index of this chunk
+} GPathChunkHdr;
+
+#define gpath_chunk_hdr(gp) \
+  ((const GPathChunkHdr*)((uintptr_t)(gp) & ~(uintptr_t)(GPATH_CHUNK_ALIGN-1)))
+
+// Index of path in its GPathSet
+static inline uint64_t gpath_get_idx(const GPath *gp)
+{
+  const GPathChunkHdr *hdr = gpath_chunk_hdr(gp);
+  return (hdr->idx << GPATH_CHUNK_BITS) + (uint64_t)(gp - (const GPath*)(hdr+1));
+}
+
+static inline uint8_t* gpath_get_seq(const GPath *gp)
+{
+  uint64_t off = gp->seq_offset;
+  return gpath_chunk_hdr(gp)->seq_chunks[off >> GPATH_SEQ_CHUNK_BITS] +
+         (off & (GPATH_SEQ_CHUNK_BYTES-1));
+}
+
+// Returns NULL if last path in the list
+static inline GPath* gpath_get_next(const GPath *gp)
+{
+  uint64_t idx = gp->next_idx;
+  if(idx == GPATH_NULL_IDX) return NULL;
+  return gpath_chunk_hdr(gp)->entry_chunks[idx >> GPATH_CHUNK_BITS] +
+         (idx & (GPATH_CHUNK_PATHS-1));
+}
+
+// `next` must be in the same GPathSet, or NULL
+#define gpath_set_next(gp,next) \
+  ((gp)->next_idx = ((next) == NULL ? GPATH_NULL_IDX : gpath_get_idx(next)))
+
+#define gpath_get_colset(gp,ncols) (gpath_get_seq(gp) - (((ncols)+7)/8))
 #define gpath_has_colour(gp,ncols,col) bitset_get(gpath_get_colset(gp,ncols),col)
 #define gpath_set_colour(gp,ncols,col) bitset_set(gpath_get_colset(gp,ncols),col)
 #define gpath_wipe_colset(gp,ncols) memset(gpath_get_colset(gp,ncols), 0, ((ncols)+7)/8)
@@ -19,7 +19,7 @@ void gpath_follow_cache_update(GPathFollow *path, size_t pos)
     fetch_offset = path->first_cached/4;
     total_bytes = binary_seq_mem(path->len);
     fetch_bytes = MIN2(total_bytes-fetch_offset, sizeof(path->cache));
-    memcpy(path->cache, path->gpath->seq + fetch_offset, fetch_bytes);
+    memcpy(path->cache, path->seq + fetch_offset, fetch_bytes);
     memset(path->cache+fetch_bytes, 0, sizeof(path->cache)-fetch_bytes);
     // Need to zero rest of cache since it is used in hashing
     //  -> must be deterministic
@@ -42,7 +42,8 @@ Nucleotide gpath_follow_get_base(GPathFollow *path, size_t pos)
 GPathFollow gpath_follow_create(const GPath *gpath)
 {
   GPathFollow fpath = {.gpath = gpath,
-                        .pos = 0,
+                       .seq = gpath_get_seq(gpath),
+                       .pos = 0,
                        .len = gpath->num_juncs,
                        .age = 0};
 
@@ -22,6 +22,7 @@ age=2 and (b) has age=1.
 struct GPathFollowStruct
 {
   const GPath *gpath;
+  const uint8_t *seq; // gpath_get_seq(gpath)
   uint16_t pos, len;
   uint32_t age; // age is >= pos
   // A small buffer of upcoming 24 bases
@@ -34,7 +35,7 @@ typedef struct GPathFollowStruct GPathFollow;
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(gpath_follow_buf,GPathFollowBuffer,GPathFollow);
 
-#define gpath_follow_get_base(path,pos) (binary_seq_get((path)->gpath->seq,pos))
+#define gpath_follow_get_base(path,pos) (binary_seq_get((path)->seq,pos))
 // Nucleotide gpath_follow_get_base(GPathFollow *path, size_t pos);
 GPathFollow gpath_follow_create(const GPath *gpath);
 
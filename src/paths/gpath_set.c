@@ -6,14 +6,19 @@
 // This is relied on by GPathFollow
 #define SEQ_STORE_PADDING 16
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
+#define gpset_entry_chunk_mem() (GPSET_CHUNK_HDR + GPATH_CHUNK_PATHS*sizeof(GPath))
+
+// Chunk directories and one chunk of each kind
+#define gpset_min_mem() (2 * GPSET_MAX_CHUNKS * sizeof(void*) + \
+                         gpset_entry_chunk_mem() + GPATH_SEQ_CHUNK_BYTES)
+
+// If resize true, grow as needed
+// If resize false, die if more than `initpaths` paths or `initmem` bytes used
+// Memory is allocated in chunks as it is needed
 void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
                       size_t initpaths, size_t initmem,
                       bool resize, bool keep_path_counts)
 {
-  GPathSet tmp = {.ncols = ncols, .can_resize = resize};
-
   // 1:1 split between seq and paths (6 bytes each)
   size_t entry_size = 0, counts_size = 0;
 
@@ -29,33 +34,36 @@ void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
 
   size_t seq_mem = initmem - mem_used;
   size_t col_mem = initpaths * roundup_bits2bytes(ncols);
-  size_t seq_col_mem = col_mem + seq_mem;
-  size_t total_mem = initpaths * (sizeof(GPath)+counts_size) + seq_col_mem;
+  size_t seq_col_mem = initpaths * counts_size + col_mem + seq_mem;
+  size_t total_mem = initpaths * sizeof(GPath) + seq_col_mem;
   ctx_assert(total_mem <= initmem);
+  ctx_assert(gpset_entry_chunk_mem() <= GPATH_CHUNK_ALIGN);
 
   char npathstr[50], colmemstr[50], seqmemstr[50], totalmemstr[50];
   ulong_to_str(initpaths, npathstr);
   bytes_to_str(col_mem, 1, colmemstr);
   bytes_to_str(seq_mem, 1, seqmemstr);
   bytes_to_str(total_mem, 1, totalmemstr);
-  status("[GPathSet] Allocating for %s paths, %s colset, %s seq => %s total",
-         npathstr, colmemstr, seqmemstr, totalmemstr);
-
-  gpath_buf_alloc(&tmp.entries, initpaths);
-  byte_buf_alloc(&tmp.seqs, seq_col_mem + SEQ_STORE_PADDING);
-
-  if(keep_path_counts) {
-    // madcrowlib allocates with calloc, so these are all zero'd
-    byte_buf_alloc(&tmp.nseen_buf, initpaths * ncols);
-  } else {
-    memset(&tmp.nseen_buf, 0, sizeof(tmp.nseen_buf));
-  }
+  status("[GPathSet] Allocating for %s paths, %s colset, %s seq => %s total%s",
+         npathstr, colmemstr, seqmemstr, totalmemstr,
+         resize ? " (can grow)" : "");
+
+  GPathSet tmp = {.ncols = ncols,
+                  .has_nseen = keep_path_counts,
+                  .can_resize = resize,
+                  .max_paths = initpaths,
+                  .max_seq_bytes = seq_col_mem,
+                  .max_mem = 0,
+                  .entry_chunks = ctx_calloc(GPSET_MAX_CHUNKS, sizeof(GPath*)),
+                  .seq_chunks = ctx_calloc(GPSET_MAX_CHUNKS, sizeof(uint8_t*)),
+                  .num_paths = 0, .seq_bytes = 0,
+                  .num_entry_chunks = 0, .num_seq_chunks = 0};
 
   memcpy(gpset, &tmp, sizeof(GPathSet));
 }
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
+// If resize true, grow as needed
+// If resize false, die if more than `initmem` bytes used
 void gpath_set_alloc(GPathSet *gpset, size_t ncols, size_t initmem,
                      bool resize, bool keep_path_counts)
 {
@@ -71,149 +79,194 @@ void gpath_set_alloc(GPathSet *gpset, size_t ncols, size_t initmem,
 
 void gpath_set_dealloc(GPathSet *gpset)
 {
-  gpath_buf_dealloc(&gpset->entries);
-  byte_buf_dealloc(&gpset->seqs);
-  byte_buf_dealloc(&gpset->nseen_buf);
+  size_t i;
+  if(gpset->entry_chunks != NULL) {
+    for(i = 0; i < GPSET_MAX_CHUNKS; i++) {
+      if(gpset->entry_chunks[i] != NULL)
+        ctx_free((uint8_t*)gpset->entry_chunks[i] - GPSET_CHUNK_HDR);
+      ctx_free(gpset->seq_chunks[i]);
+    }
+  }
+  ctx_free(gpset->entry_chunks);
+  ctx_free(gpset->seq_chunks);
   memset(gpset, 0, sizeof(GPathSet));
 }
 
+// Chunks are kept for reuse
 void gpath_set_reset(GPathSet *gpset)
 {
-  gpath_buf_reset(&gpset->entries);
-  byte_buf_reset(&gpset->seqs);
-  byte_buf_reset(&gpset->nseen_buf);
+  gpset->num_paths = gpset->seq_bytes = 0;
 }
 
-void gpath_set_print_stats(const GPathSet *gpset)
+void gpath_set_limit_mem(GPathSet *gpset, size_t max_mem)
 {
-  char paths_str[50], paths_cap_str[50], seq_str[50], seq_cap_str[50];
-  ulong_to_str(gpset->entries.len, paths_str);
-  ulong_to_str(gpset->entries.size, paths_cap_str);
-  bytes_to_str(gpset->seqs.len, 1, seq_str);
-  bytes_to_str(gpset->seqs.size, 1, seq_cap_str);
-  status("[GPathSet] Paths: %s / %s [%.2f%%], seqs: %s / %s [%.2f%%] (%zu / %zu)",
-         paths_str, paths_cap_str,
-         (100.0 * gpset->entries.len) / gpset->entries.size,
-         seq_str, seq_cap_str,
-         (100.0 * gpset->seqs.len) / gpset->seqs.size,
-         gpset->seqs.len, gpset->seqs.size);
+  gpset->max_mem = MAX2(max_mem, gpset_min_mem());
 }
 
-uint8_t* gpath_set_get_nseen(const GPathSet *gpset, const GPath *gpath)
+size_t gpath_set_mem(const GPathSet *gpset)
 {
-  pkey_t pkey = gpset_get_pkey(gpset, gpath);
-  return gpath_set_has_nseen(gpset) ? &gpset->nseen_buf.b[pkey*gpset->ncols] : NULL;
+  return gpset->num_entry_chunks * gpset_entry_chunk_mem() +
+         gpset->num_seq_chunks * GPATH_SEQ_CHUNK_BYTES +
+         2 * GPSET_MAX_CHUNKS * sizeof(void*);
 }
 
-// Copy nseen counts to dst from src
-void gpath_set_nseen_sum_mt(const GPath *dst, GPathSet *dstset,
-                            const GPath *src, const GPathSet *srcset)
+void gpath_set_print_stats(const GPathSet *gpset)
 {
-  ctx_assert2(dstset->ncols == srcset->ncols, "ncols don't match");
+  char paths_str[50], seq_str[50], mem_str[50];
+  ulong_to_str(gpset->num_paths, paths_str);
+  bytes_to_str(gpset->seq_bytes, 1, seq_str);
+  bytes_to_str(gpath_set_mem(gpset), 1, mem_str);
+  status("[GPathSet] Paths: %s, seqs: %s; %zu path chunks, %zu seq chunks"
+         " => %s allocated",
+         paths_str, seq_str,
+         (size_t)gpset->num_entry_chunks, (size_t)gpset->num_seq_chunks,
+         mem_str);
+}
 
-  uint8_t *src_nseen = gpath_set_get_nseen(srcset, src);
-  uint8_t *dst_nseen = gpath_set_get_nseen(dstset, dst);
-  size_t i;
+static void _gpath_set_out_of_mem(const GPathSet *gpset)
+{
+  gpath_set_print_stats(gpset);
+  if(gpset->can_resize)
+    status("Limit: %zu bytes allocated", gpset->max_mem);
+  else
+    status("Limits: %zu paths, %zu bytes", gpset->max_paths, gpset->max_seq_bytes);
+  die("Out of memory for links, try increasing -m,--memory");
+}
 
-  if(src_nseen && dst_nseen) {
-    for(i = 0; i < dstset->ncols; i++)
-      safe_add_uint8_mt(&dst_nseen[i], src_nseen[i]);
+// Called by the thread that added a chunk. Thread safe.
+static void _gpath_set_check_mem(const GPathSet *gpset)
+{
+  if(gpset->max_mem && gpath_set_mem(gpset) > gpset->max_mem)
+    _gpath_set_out_of_mem(gpset);
+}
+
+// Allocate entry chunk `c` if no other thread has. Thread safe.
+static GPath* _gpath_set_entry_chunk(GPathSet *gpset, size_t c)
+{
+  GPath *volatile *ptr = &gpset->entry_chunks[c];
+  GPath *chunk = *ptr;
+  if(chunk != NULL) return chunk;
+
+  // Header lets us find a path's index, sequence and next path
+  uint8_t *mem = ctx_aligned_alloc(GPATH_CHUNK_ALIGN, gpset_entry_chunk_mem());
+  GPathChunkHdr hdr = {.entry_chunks = gpset->entry_chunks,
+                       .seq_chunks = gpset->seq_chunks,
+                       .idx = c};
+  memcpy(mem, &hdr, sizeof(hdr));
+  chunk = (GPath*)(mem + GPSET_CHUNK_HDR);
+
+  if(__sync_bool_compare_and_swap(ptr, NULL, chunk)) {
+    __sync_fetch_and_add(&gpset->num_entry_chunks, 1);
+    _gpath_set_check_mem(gpset);
+    return chunk;
   }
+
+  // Another thread got there first
+  ctx_free(mem);
+  return *ptr;
 }
 
-// Resize buffers if needed and update internal pointers
-void _check_resize(GPathSet *gpset, size_t req_num_bytes)
+// Allocate seq chunk `c` if no other thread has. Thread safe.
+static uint8_t* _gpath_set_seq_chunk(GPathSet *gpset, size_t c)
 {
-  const size_t ncols = gpset->ncols;
-  size_t i;
+  uint8_t *volatile *ptr = &gpset->seq_chunks[c];
+  uint8_t *chunk = *ptr;
+  if(chunk != NULL) return chunk;
 
-  GPath *old_entries = gpset->entries.b;
-  size_t old_num_entries = gpset->entries.size;
-  gpath_buf_capacity(&gpset->entries, gpset->entries.len+1);
-
-  if(old_entries != gpset->entries.b) {
-    // Correct all path pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].next != NULL) {
-        gpset->entries.b[i].next = gpset->entries.b +
-                                     (gpset->entries.b[i].next - old_entries);
-      }
-    }
+  chunk = ctx_malloc(GPATH_SEQ_CHUNK_BYTES);
+
+  if(__sync_bool_compare_and_swap(ptr, NULL, chunk)) {
+    __sync_fetch_and_add(&gpset->num_seq_chunks, 1);
+    _gpath_set_check_mem(gpset);
+    return chunk;
   }
 
-  if(old_num_entries != gpset->entries.size)
+  ctx_free(chunk);
+  return *ptr;
+}
+
+static GPath* _gpath_set_claim_entry(GPathSet *gpset)
+{
+  size_t idx = __sync_fetch_and_add(&gpset->num_paths, 1);
+  size_t c = idx >> GPATH_CHUNK_BITS;
+
+  if(!gpset->can_resize && idx >= gpset->max_paths) _gpath_set_out_of_mem(gpset);
+  if(c >= GPSET_MAX_CHUNKS) die("[GPathSet] Too many paths: %zu", idx);
+
+  return _gpath_set_entry_chunk(gpset, c) + (idx & (GPATH_CHUNK_PATHS-1));
+}
+
+// Claim `nbytes` followed by SEQ_STORE_PADDING bytes in the same chunk.
+// Padding may overlap the next path, it is only read.
+// Returns offset of the bytes, chunk is allocated if needed
+static size_t _gpath_set_claim_bytes(GPathSet *gpset, size_t nbytes)
+{
+  size_t start, offset, c;
+
+  if(nbytes + SEQ_STORE_PADDING > GPATH_SEQ_CHUNK_BYTES)
+    die("[GPathSet] Path too large: %zu bytes", nbytes);
+
+  while(1)
   {
-    if(gpath_set_has_nseen(gpset)) {
-      // Increase size of nseen buffer to match (zero'd by default)
-      byte_buf_capacity(&gpset->nseen_buf, gpset->entries.size * ncols);
+    start = __sync_fetch_and_add(&gpset->seq_bytes, nbytes);
+    offset = start & (GPATH_SEQ_CHUNK_BYTES-1);
+    c = start >> GPATH_SEQ_CHUNK_BITS;
+
+    if(!gpset->can_resize && start+nbytes > gpset->max_seq_bytes)
+      _gpath_set_out_of_mem(gpset);
+    if(c >= GPSET_MAX_CHUNKS) die("[GPathSet] Too much path data");
+
+    // Skip the end of a chunk if we don't fit
+    if(offset + nbytes + SEQ_STORE_PADDING <= GPATH_SEQ_CHUNK_BYTES) {
+      _gpath_set_seq_chunk(gpset, c);
+      return start;
     }
   }
+}
 
-  uint8_t *old_seq = gpset->seqs.b;
-  byte_buf_capacity(&gpset->seqs, gpset->seqs.len+req_num_bytes+SEQ_STORE_PADDING);
+// Copy nseen counts to dst from src
+void gpath_set_nseen_sum_mt(const GPath *dst, GPathSet *dstset,
+                            const GPath *src, const GPathSet *srcset)
+{
+  ctx_assert2(dstset->ncols == srcset->ncols, "ncols don't match");
 
-  if(gpset->seqs.b != old_seq) {
-    // Correct all seq pointers
-    for(i = 0; i < gpset->entries.len; i++) {
-      if(gpset->entries.b[i].seq != NULL) {
-        gpset->entries.b[i].seq = gpset->seqs.b +
-                                     (gpset->entries.b[i].seq - old_seq);
-      }
-    }
+  uint8_t *src_nseen = gpath_set_get_nseen(srcset, src);
+  uint8_t *dst_nseen = gpath_set_get_nseen(dstset, dst);
+  size_t i;
+
+  if(src_nseen && dst_nseen) {
+    for(i = 0; i < dstset->ncols; i++)
+      safe_add_uint8_mt(&dst_nseen[i], src_nseen[i]);
   }
 }
 
 // Always adds new path. If newpath could be a duplicate, use gpathhash
-// Threadsafe only if resize is false. GPath* not safe to edit until it returns
+// Threadsafe. GPath* not safe to edit until it returns
 // Copies newgpath.seq over and wipe new colset
 GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
 {
   ctx_assert(newgpath.seq != NULL);
 
-  pkey_t pkey;
   GPath *gpath;
-  uint8_t *data;
-  size_t colset_bytes = (gpset->ncols+7)/8;
+  uint8_t *colset, *seq;
+  size_t offset, colset_bytes = (gpset->ncols+7)/8;
+  size_t nseen_bytes = gpath_set_has_nseen(gpset) ? gpset->ncols : 0;
   size_t junc_bytes = binary_seq_mem(newgpath.num_juncs);
-  size_t nbytes = colset_bytes + junc_bytes;
+  size_t nbytes = nseen_bytes + colset_bytes + junc_bytes;
 
-  if(gpset->can_resize)
-  {
-    _check_resize(gpset, nbytes);
-    pkey = gpath_buf_add(&gpset->entries, (GPath){.seq = NULL, .num_juncs = 0});
-    gpath = &gpset->entries.b[pkey];
-    data = gpset->seqs.b + gpset->seqs.len;
-    gpset->seqs.len += nbytes;
-  }
-  else
-  {
-    gpath = gpset->entries.b + __sync_fetch_and_add((volatile size_t*)&gpset->entries.len, 1);
-    data = gpset->seqs.b + __sync_fetch_and_add((volatile size_t*)&gpset->seqs.len, nbytes);
-
-    if(gpath >= gpset->entries.b + gpset->entries.size ||
-       data+nbytes+SEQ_STORE_PADDING > gpset->seqs.b + gpset->seqs.size)
-    {
-      gpath_set_print_stats(gpset);
-      status("%zu >= %zu; %zu > %zu nbytes: %zu\n",
-             gpath - gpset->entries.b,
-             gpset->entries.size,
-             data+nbytes+SEQ_STORE_PADDING - gpset->seqs.b,
-             gpset->seqs.size,
-             nbytes);
-      die("Out of memory");
-    }
-
-    pkey = gpath - gpset->entries.b;
-  }
+  gpath = _gpath_set_claim_entry(gpset);
+  offset = _gpath_set_claim_bytes(gpset, nbytes) + nseen_bytes + colset_bytes;
 
-  uint8_t *colset = data;
-  gpath->seq = data + colset_bytes;
+  gpath->seq_offset = offset;
   gpath->num_juncs = newgpath.num_juncs;
   gpath->orient = newgpath.orient;
-  gpath->next = NULL;
+  gpath->next_idx = GPATH_NULL_IDX;
+
+  seq = gpath_get_seq(gpath);
+  colset = seq - colset_bytes;
 
   // copy seq and zero colset
-  memcpy(gpath->seq, newgpath.seq, junc_bytes);
+  memcpy(seq, newgpath.seq, junc_bytes);
 
   if(newgpath.colset)
     memcpy(colset, newgpath.colset, colset_bytes);
@@ -223,8 +276,6 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
   // link counts
   if(gpath_set_has_nseen(gpset))
   {
-    __sync_fetch_and_add((volatile size_t*)&gpset->nseen_buf.len, gpset->ncols);
-
     uint8_t *nseen = gpath_set_get_nseen(gpset, gpath);
     ctx_assert(nseen != NULL);
 
@@ -240,13 +291,15 @@ GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath)
 // Reset all counts to zero
 void gpath_set_zero_nseen(GPathSet *gpset)
 {
-  memset(gpset->nseen_buf.b, 0,
-         gpset->nseen_buf.len * sizeof(gpset->nseen_buf.b[0]));
+  size_t i;
+  if(!gpath_set_has_nseen(gpset)) return;
+  for(i = 0; i < gpset->num_paths; i++)
+    memset(gpath_set_get_nseen(gpset, gpath_set_fetch(gpset, i)), 0, gpset->ncols);
 }
 
 GPathNew gpath_set_get(const GPathSet *gpset, const GPath *gpath)
 {
-  GPathNew newgpath = {.seq = gpath->seq,
+  GPathNew newgpath = {.seq = gpath_get_seq(gpath),
                        .colset = gpath_get_colset(gpath, gpset->ncols),
                        .nseen = gpath_set_get_nseen(gpset, gpath),
                        .num_juncs = gpath->num_juncs,
@@ -5,9 +5,6 @@
 #include "common_buffers.h"
 #include "binary_seq.h"
 
-#include "madcrowlib/madcrow_buffer.h"
-madcrow_buffer(gpath_buf, GPathBuffer, GPath);
-
 typedef uint64_t pkey_t;
 
 // These passed around to be added
@@ -19,48 +16,95 @@ typedef struct
   Orientation orient;
 } GPathNew;
 
+//
+// Paths are stored in a segmented arena: fixed size chunks that are never moved
+// or freed until the set is, so GPath pointers stay valid as the set grows.
+// Threads claim entries and bytes with atomic counters, and whichever thread
+// first needs a new chunk allocates it and installs it with a compare-and-swap,
+// so adding is lock free whether or not the set can grow.
+//
+// Entry chunks hold GPATH_CHUNK_PATHS paths after a GPathChunkHdr (see gpath.h),
+// so the index, sequence and next path of a GPath can be found from its
+// address. Byte chunks hold the [nseen][colset][seq] of each path; a path never
+// spans two byte chunks.
+//
+
+#define GPSET_CHUNK_HDR sizeof(GPathChunkHdr)
+#define GPSET_MAX_CHUNKS (1UL<<16)
+
 typedef struct
 {
   const size_t ncols;
-  GPathBuffer entries;
-  ByteBuffer seqs; // colset+seq for each path
-  ByteBuffer nseen_buf; // counts for how many times we've seen path
-  bool can_resize;
+  const bool has_nseen; // store counts for how many times we've seen path
+  const bool can_resize; // if false die when limits are reached
+  const size_t max_paths, max_seq_bytes; // limits if !can_resize
+  size_t max_mem; // die if more memory is allocated, 0 if no limit
+  GPath **entry_chunks; // [GPSET_MAX_CHUNKS] first entry in each chunk
+  uint8_t **seq_chunks; // [GPSET_MAX_CHUNKS] nseen+colset+seq for each path
+  volatile size_t num_paths, seq_bytes; // entries and bytes claimed
+  volatile size_t num_entry_chunks, num_seq_chunks; // chunks allocated
 } GPathSet;
 
+#define gpath_set_num_paths(gpset) ((size_t)(gpset)->num_paths)
+
+// Get path from its index
+static inline GPath* gpath_set_fetch(const GPathSet *gpset, pkey_t pkey)
+{
+  return gpset->entry_chunks[pkey >> GPATH_CHUNK_BITS] +
+         (pkey & (GPATH_CHUNK_PATHS-1));
+}
 
+// Get index of a path from its address
 static inline pkey_t gpset_get_pkey(const GPathSet *gpset, const GPath *gpath)
 {
-  ctx_assert2(gpath >= gpset->entries.b &&
-              gpath <= gpset->entries.b+gpset->entries.len,
+  ctx_assert2(gpath_chunk_hdr(gpath)->entry_chunks == gpset->entry_chunks,
               "GPath is not in GPathSet");
-  return gpath - gpset->entries.b;
+  (void)gpset;
+  return gpath_get_idx(gpath);
 }
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
+// If resize true, grow as needed
+// If resize false, die if more than `initpaths` paths or `initmem` bytes used
+// Both are thread safe
 void gpath_set_alloc2(GPathSet *gpset, size_t ncols,
                       size_t initpaths, size_t initmem,
                       bool resize, bool keep_path_counts);
 
-// If resize true, cannot do multithreaded but can resize array
-// If resize false, die if out of mem, but can multithread
+// If resize true, grow as needed
+// If resize false, die if more than `initmem` bytes used
+// Both are thread safe
 void gpath_set_alloc(GPathSet *set, size_t ncols, size_t initmem,
                      bool resize, bool keep_path_counts);
 void gpath_set_dealloc(GPathSet *set);
+
+// Remove all paths, keeping memory allocated. Not thread safe.
 void gpath_set_reset(GPathSet *set);
 
+// Die if a set that can grow would allocate more than `max_mem` bytes.
+// At least one chunk of each kind is always allowed, so small limits are
+// raised to fit them. Not thread safe.
+void gpath_set_limit_mem(GPathSet *gpset, size_t max_mem);
+
 void gpath_set_print_stats(const GPathSet *gpset);
 
+// Bytes of memory allocated
+size_t gpath_set_mem(const GPathSet *gpset);
+
 // Always adds new path. If newpath could be a duplicate, use gpathhash
-// Threadsafe only if resize is false. GPath* not safe to edit until it returns
+// Threadsafe. GPath* not safe to edit until it returns
 // Copies newgpath.seq over and wipe new colset
 GPath* gpath_set_add_mt(GPathSet *gpset, GPathNew newgpath);
 
 // Returns true if we are storing number of sightings and kmer length
-#define gpath_set_has_nseen(gpset) ((gpset)->nseen_buf.b != NULL)
+#define gpath_set_has_nseen(gpset) ((gpset)->has_nseen)
 
-uint8_t* gpath_set_get_nseen(const GPathSet *gpset, const GPath *gpath);
+// nseen counts are stored directly before the colset
+static inline uint8_t* gpath_set_get_nseen(const GPathSet *gpset,
+                                           const GPath *gpath)
+{
+  return gpath_set_has_nseen(gpset) ? gpath_get_colset(gpath, gpset->ncols) -
+                                      gpset->ncols : NULL;
+}
 
 // Copy nseen counts to dst from src
 void gpath_set_nseen_sum_mt(const GPath *dst, GPathSet *dstset,
@@ -74,8 +118,9 @@ void gpath_set_zero_nseen(GPathSet *gpset);
 
 GPathNew gpath_set_get(const GPathSet *gpset, const GPath *gpath);
 
-#define gpaths_are_equal(a,b) \
-  ((a).orient == (b).orient && \
-   binary_seqs_cmp((a).seq, (a).num_juncs, (b).seq, (b).num_juncs) == 0)
+// Compare GPath* `gp` with GPathNew `b`
+#define gpath_equals_new(gp,b) \
+  ((gp)->orient == (b).orient && \
+   binary_seqs_cmp(gpath_get_seq(gp), (gp)->num_juncs, (b).seq, (b).num_juncs) == 0)
 
 #endif /* GPATH_SET_H_ */
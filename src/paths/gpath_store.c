@@ -2,6 +2,8 @@
 #include "gpath_store.h"
 #include "util.h"
 
+// Size of GPath when it held seq and next pointers
+#define GPATH_PTR_BYTES 18
 
 // If num_paths != 0, we ensure at least num_paths capacity
 // @split_linked_lists whether you intend to have traverse linked list and
@@ -18,12 +20,14 @@ void gpath_store_alloc(GPathStore *gpstore, size_t ncols, size_t graph_capacity,
 
   size_t gpset_mem = mem - store_mem;
 
-  // Don't allow resizing - this allows use to the thread safe
-  // and control memory usage (die when we fill up allowed memory)
+  // Set grows in chunks as paths are added, and dies if the chunks would use
+  // more than `mem`. Adding is thread safe whilst it grows.
   if(num_paths)
-    gpath_set_alloc2(&gpstore->gpset, ncols, num_paths, gpset_mem, false, count_nseen);
+    gpath_set_alloc2(&gpstore->gpset, ncols, num_paths, gpset_mem, true, count_nseen);
   else
-    gpath_set_alloc(&gpstore->gpset, ncols, gpset_mem, false, count_nseen);
+    gpath_set_alloc(&gpstore->gpset, ncols, gpset_mem, true, count_nseen);
+
+  gpath_set_limit_mem(&gpstore->gpset, gpset_mem);
 
   gpstore->graph_capacity = graph_capacity;
 
@@ -61,6 +65,16 @@ void gpath_store_print_stats(const GPathStore *gpstore)
   bytes_to_str(gpstore->path_bytes, 1, bytes_str);
   status("[GPathStore] kmers-with-paths: %s, num paths: %s, path-bytes: %s",
          kmers_str, paths_str, bytes_str);
+
+  // Memory per link, compared to the 8+2+8 byte GPath that stored pointers
+  size_t nlinks = gpath_set_num_paths(&gpstore->gpset);
+  if(nlinks > 0) {
+    double data_bytes = (double)gpstore->gpset.seq_bytes / nlinks;
+    status("[GPathStore] bytes per link: %.1f (%zu GPath + %.1f data); "
+           "was %.1f with pointers",
+           sizeof(GPath) + data_bytes, sizeof(GPath), data_bytes,
+           GPATH_PTR_BYTES + data_bytes);
+  }
 }
 
 void gpath_store_split_read_write(GPathStore *gpstore)
@@ -117,15 +131,17 @@ static void _gpstore_add_to_llist_mt(GPathStore *gpstore, hkey_t hkey, GPath *gp
 {
   // Add to linked list
   ctx_assert(sizeof(size_t) == sizeof(GPath*));
+  GPath *next;
   do {
-    gpath->next = *(GPath *volatile const*)&gpstore->paths_all[hkey];
+    next = *(GPath *volatile const*)&gpstore->paths_all[hkey];
+    gpath_set_next(gpath, next);
   }
   while(!__sync_bool_compare_and_swap((volatile size_t*)&gpstore->paths_all[hkey],
-                                      (size_t)gpath->next, (size_t)gpath));
+                                      (size_t)next, (size_t)gpath));
 
   // Update stats
   size_t nbytes = binary_seq_mem(gpath->num_juncs);
-  size_t new_kmer = (gpath->next == NULL ? 1 : 0);
+  size_t new_kmer = (next == NULL ? 1 : 0);
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_kmers_with_paths, new_kmer);
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->num_paths, 1);
   __sync_fetch_and_add((volatile uint64_t*)&gpstore->path_bytes, nbytes);
@@ -135,8 +151,8 @@ static void _gpstore_add_to_llist_mt(GPathStore *gpstore, hkey_t hkey, GPath *gp
 GPath* gpstore_find(const GPathStore *gpstore, hkey_t hkey, GPathNew find)
 {
   GPath *gpath = gpath_store_fetch(gpstore, hkey);
-  for(; gpath != NULL; gpath = gpath->next)
-    if(gpaths_are_equal(*gpath, find))
+  for(; gpath != NULL; gpath = gpath_get_next(gpath))
+    if(gpath_equals_new(gpath, find))
       return gpath;
   return NULL;
 }
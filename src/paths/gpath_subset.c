@@ -49,7 +49,7 @@ void gpath_subset_load_llist(GPathSubset *subset, GPath *first)
        gpath_set_get_nseen(subset->gpset, first)) {
       gpath_ptr_buf_add(&subset->list, first);
     }
-    first = first->next;
+    first = gpath_get_next(first);
   }
 }
 
@@ -58,9 +58,9 @@ void gpath_subset_load_llist(GPathSubset *subset, GPath *first)
 void gpath_subset_load_set(GPathSubset *subset)
 {
   GPathSet *gpset = subset->gpset;
-  size_t i;
-  for(i = 0; i < gpset->entries.len; i++)
-    gpath_ptr_buf_add(&subset->list, &gpset->entries.b[i]);
+  size_t i, n = gpath_set_num_paths(gpset);
+  for(i = 0; i < n; i++)
+    gpath_ptr_buf_add(&subset->list, gpath_set_fetch(gpset, i));
 }
 
 // Update the linked list of paths in set `subset->gpset`
@@ -70,8 +70,8 @@ void gpath_subset_update_linkedlist(GPathSubset *subset)
   if(subset->list.len == 0) return;
   size_t i;
   for(i = 0; i+1 < subset->list.len; i++)
-    subset->list.b[i]->next = subset->list.b[i+1];
-  subset->list.b[subset->list.len-1]->next = NULL;
+    gpath_set_next(subset->list.b[i], subset->list.b[i+1]);
+  gpath_set_next(subset->list.b[subset->list.len-1], NULL);
 }
 
 /**
@@ -129,8 +129,8 @@ void gpath_subset_rmsubstr(GPathSubset *subset)
           // or orientations don't match
           if(list[i]->num_juncs < list[j]->num_juncs ||
              list[i]->orient != list[j]->orient ||
-             binary_seqs_cmp(list[i]->seq, min_juncs,
-                             list[j]->seq, min_juncs) != 0)
+             binary_seqs_cmp(gpath_get_seq(list[i]), min_juncs,
+                             gpath_get_seq(list[j]), min_juncs) != 0)
           {
             break;
           }
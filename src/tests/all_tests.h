@@ -114,6 +114,10 @@ void test_db_node();
 
 // build_graph_tests.c
 void test_build_graph();
+void test_build_graph_solid();
+
+// build_partitions_tests.c
+void test_build_partitions();
 
 // supernode_tests.c
 void test_supernode();
@@ -151,4 +155,22 @@ void test_graph_crawler();
 // infer_edges_tests.c
 void test_infer_edges_tests();
 
+// graph_block_tests.c
+void test_graph_block();
+
+// kmer_mphf_tests.c
+void test_kmer_mphf();
+
+// graph_mmap_tests.c
+void test_graph_mmap();
+
+// graph_load_tests.c
+void test_graph_load();
+
+// seq_inflate_tests.c
+void test_seq_inflate();
+
+// seq_reader_tests.c
+void test_seq_reader();
+
 #endif  /* ALL_TESTS_H_ */
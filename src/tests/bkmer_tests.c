@@ -1,5 +1,6 @@
 #include "global.h"
 #include "all_tests.h"
+#include <ctype.h>
 #include "binary_kmer.h"
 
 void test_bkmer_str()
@@ -149,6 +150,40 @@ static void test_bkmer_first_last_nuc()
   }
 }
 
+static void test_bkmer_roll()
+{
+  test_status("Testing binary_kmer_roll_str()");
+
+  #define ROLL_SEQLEN (MAX_KMER_SIZE+200)
+  char seq[ROLL_SEQLEN+1];
+  BinaryKmer fw, rv, bkmer, bkmers[ROLL_SEQLEN], bkeys[ROLL_SEQLEN];
+  size_t k, i, n;
+
+  const char bases[] = "ACGTacgt";
+  for(i = 0; i < strlen(bases); i++)
+    TASSERT(dna_char_to_nuc_fast(bases[i]) == dna_char_to_nuc(bases[i]));
+
+  for(k = MIN_KMER_SIZE; k <= MAX_KMER_SIZE; k+=2)
+  {
+    dna_rand_str(seq, ROLL_SEQLEN);
+    for(i = 0; i < ROLL_SEQLEN; i += 3) seq[i] = tolower(seq[i]);
+    n = ROLL_SEQLEN + 1 - k;
+
+    fw = rv = zero_bkmer;
+    binary_kmer_roll_str(seq, k-1, k, &fw, &rv, NULL, NULL);
+    binary_kmer_roll_str(seq+k-1, n, k, &fw, &rv, bkmers, bkeys);
+
+    for(i = 0; i < n; i++) {
+      bkmer = binary_kmer_from_str(seq+i, k);
+      TASSERT(binary_kmers_are_equal(bkmers[i], bkmer));
+      TASSERT(binary_kmers_are_equal(bkeys[i], binary_kmer_get_key(bkmer, k)));
+      TASSERT(!binary_kmer_oversized(bkeys[i], k));
+    }
+
+    TASSERT(binary_kmers_are_equal(rv, binary_kmer_reverse_complement(fw, k)));
+  }
+}
+
 void test_bkmer_functions()
 {
   TASSERT(sizeof(BinaryKmer) == NUM_BKMER_WORDS * 8);
@@ -156,5 +191,6 @@ void test_bkmer_functions()
   test_bkmer_revcmp();
   test_bkmer_shifts();
   test_bkmer_first_last_nuc();
+  test_bkmer_roll();
   // TODO: equal, less than, cmp
 }
@@ -152,3 +152,65 @@ void test_build_graph()
 
   db_graph_dealloc(&graph);
 }
+
+static void _bloom_add_str(KmerBloom *kb, const char *str, size_t kmer_size)
+{
+  size_t i, len = strlen(str);
+  BinaryKmer bkmer;
+  for(i = 0; i + kmer_size <= len; i++) {
+    bkmer = binary_kmer_from_str(str+i, kmer_size);
+    kmer_bloom_add_mt(kb, binary_kmer_get_key(bkmer, kmer_size));
+  }
+}
+
+void test_build_graph_solid()
+{
+  test_status("Testing solid kmer filtering in build_graph.c");
+
+  dBGraph graph;
+  size_t kmer_size = 19, ncols = 1;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  KmerBloom kb;
+  kmer_bloom_alloc(&kb, 1<<16);
+
+  // First pass: seq0 seen twice, seq1 once
+  const char *seq0 = "CTACGATGTATGCTTAGCTGTTCCG";
+  const char *seq1 = "TAGAACGTTCCCTACACGTCCTATG";
+  _bloom_add_str(&kb, seq0, kmer_size);
+  _bloom_add_str(&kb, seq0, kmer_size);
+  _bloom_add_str(&kb, seq1, kmer_size);
+
+  BinaryKmer bkey = binary_kmer_from_str("CTACGATGTATGCTTAGCT", kmer_size);
+  bkey = binary_kmer_get_key(bkey, kmer_size);
+  TASSERT(kmer_bloom_count(&kb, bkey) == 2);
+  TASSERT(kmer_bloom_is_solid(&kb, bkey));
+
+  // Second pass: only load solid kmers
+  read_t r1;
+  seq_read_alloc(&r1);
+
+  SeqLoadingStats stats;
+  memset(&stats, 0, sizeof(stats));
+
+  SeqLoadingPrefs prefs = {.fq_cutoff = 0, .hp_cutoff = 0,
+                           .matedir = READPAIR_FF,
+                           .colour = 0, .remove_pcr_dups = false,
+                           .solid_kmers = &kb};
+
+  seq_read_set(&r1, seq0);
+  build_graph_from_reads_mt(&r1, NULL, 0, 0, &prefs, &stats, &graph);
+  seq_read_set(&r1, seq1);
+  build_graph_from_reads_mt(&r1, NULL, 0, 0, &prefs, &stats, &graph);
+
+  TASSERT(kmer_get_covg("CTACGATGTATGCTTAGCT", &graph) == 1);
+  TASSERT(db_graph_find_str(&graph, "TAGAACGTTCCCTACACGT").key == HASH_NOT_FOUND);
+  TASSERT2(graph.ht.num_kmers == strlen(seq0)+1-kmer_size,
+           "%zu", (size_t)graph.ht.num_kmers);
+
+  seq_read_dealloc(&r1);
+  kmer_bloom_dealloc(&kb);
+  db_graph_dealloc(&graph);
+}
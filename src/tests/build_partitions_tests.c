@@ -0,0 +1,164 @@
+#include "global.h"
+#include "all_tests.h"
+#include "build_partitions.h"
+#include "build_graph.h"
+#include "graph_file_reader.h"
+#include "db_node.h"
+
+#include <unistd.h> // close, unlink
+
+#define PART_NSEQS 40
+#define PART_SEQLEN 600
+#define PART_NCOLS 2
+
+// Random sequences that share segments, so that the graph branches. Every
+// fifth sequence has an N in it. Half of the sequences go in each file.
+static void write_part_seqs(char paths[PART_NCOLS][30])
+{
+  static char seqs[PART_NSEQS][PART_SEQLEN+1];
+  FILE *fhs[PART_NCOLS];
+  size_t i;
+
+  for(i = 0; i < PART_NCOLS; i++) {
+    fhs[i] = fopen(paths[i], "w");
+    TASSERT(fhs[i] != NULL);
+    if(fhs[i] == NULL) die("Cannot open: %s", paths[i]);
+  }
+
+  for(i = 0; i < PART_NSEQS; i++) {
+    rand_bases(seqs[i], PART_SEQLEN);
+    if(i > 0) memcpy(seqs[i]+100, seqs[i-1]+300, 200);
+    if(i % 5 == 0) seqs[i][250] = 'N';
+    seqs[i][PART_SEQLEN] = '\0';
+    fprintf(fhs[i % PART_NCOLS], ">seq%zu\n%s\n", i, seqs[i]);
+  }
+
+  for(i = 0; i < PART_NCOLS; i++) fclose(fhs[i]);
+}
+
+// One task per file, loading file i into colour i
+static void part_tasks_open(BuildGraphTask *tasks, char paths[PART_NCOLS][30])
+{
+  size_t i;
+  memset(tasks, 0, PART_NCOLS * sizeof(BuildGraphTask));
+  for(i = 0; i < PART_NCOLS; i++) {
+    asyncio_task_parse(&tasks[i].files, '1', paths[i], 0, NULL);
+    tasks[i].prefs = SEQ_LOADING_PREFS_INIT;
+    tasks[i].prefs.colour = i;
+  }
+}
+
+static void part_tasks_close(BuildGraphTask *tasks)
+{
+  size_t i;
+  for(i = 0; i < PART_NCOLS; i++) build_graph_task_destroy(&tasks[i]);
+}
+
+// Build with `nparts` partitions, compare every kmer with graph `ref`
+static void test_partitions_match(const dBGraph *ref, size_t nparts,
+                                  char seq_paths[PART_NCOLS][30],
+                                  const char *out_path)
+{
+  const size_t kmer_size = ref->kmer_size;
+  BuildGraphTask tasks[PART_NCOLS];
+  BuildPartitions bp;
+  dBGraph graph;
+  size_t p, nonempty = 0;
+
+  build_partitions_alloc(&bp, nparts, kmer_size, NULL);
+  part_tasks_open(tasks, seq_paths);
+  build_partitions_split(&bp, tasks, PART_NCOLS, 2);
+  part_tasks_close(tasks);
+
+  // Reads are cut into super-kmers in several partitions, so edges between
+  // partitions have to be restored when each partition is built
+  for(p = 0; p < nparts; p++) nonempty += (bp.num_kmers[p] > 0);
+  TASSERT(nparts == 1 || nonempty > 1);
+
+  db_graph_alloc(&graph, kmer_size, PART_NCOLS, PART_NCOLS, 1<<15,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  TASSERT(build_partitions_load(&bp, &graph, 2) == ref->ht.num_kmers);
+  TASSERT(build_partitions_save(&bp, out_path, &graph, PART_NCOLS) ==
+          ref->ht.num_kmers);
+
+  build_partitions_dealloc(&bp);
+  db_graph_dealloc(&graph);
+
+  // Saved graph is sorted and matches the one built in memory
+  GraphFileReader gfile;
+  memset(&gfile, 0, sizeof(gfile));
+  TASSERT(graph_file_open(&gfile, out_path) > 0);
+
+  BinaryKmer bkmer, prev = zero_bkmer;
+  Covg covgs[PART_NCOLS];
+  Edges edges[PART_NCOLS];
+  size_t col, nkmers = 0;
+  hkey_t hkey;
+
+  while(graph_file_read_reset(&gfile, &bkmer, covgs, edges)) {
+    TASSERT(nkmers == 0 || binary_kmer_less_than(prev, bkmer));
+    prev = bkmer;
+    nkmers++;
+
+    hkey = hash_table_find(&ref->ht, bkmer);
+    TASSERT(hkey != HASH_NOT_FOUND);
+    if(hkey == HASH_NOT_FOUND) continue;
+
+    for(col = 0; col < PART_NCOLS; col++) {
+      TASSERT(covgs[col] == db_node_get_covg(ref, hkey, col));
+      TASSERT(edges[col] == db_node_edges(ref, hkey, col));
+    }
+  }
+
+  TASSERT2(nkmers == ref->ht.num_kmers, "%zu vs %zu",
+           nkmers, (size_t)ref->ht.num_kmers);
+
+  graph_file_close(&gfile);
+}
+
+void test_build_partitions()
+{
+  test_status("Testing building a graph in partitions (build_partitions.h)...");
+
+  const size_t kmer_size = 19;
+  char seq_paths[PART_NCOLS][30], out_path[] = "/tmp/ctx_parts_XXXXXX";
+  size_t i;
+  int fd;
+
+  for(i = 0; i < PART_NCOLS; i++) {
+    strcpy(seq_paths[i], "/tmp/ctx_parts_XXXXXX");
+    fd = mkstemp(seq_paths[i]);
+    TASSERT(fd >= 0);
+    if(fd < 0) return;
+    close(fd);
+  }
+
+  fd = mkstemp(out_path);
+  TASSERT(fd >= 0);
+  if(fd < 0) return;
+  close(fd);
+
+  write_part_seqs(seq_paths);
+
+  // Build the same reads in memory
+  BuildGraphTask tasks[PART_NCOLS];
+  dBGraph ref;
+  db_graph_alloc(&ref, kmer_size, PART_NCOLS, PART_NCOLS, 1<<15,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_BKTLOCKS);
+
+  part_tasks_open(tasks, seq_paths);
+  build_graph(&ref, tasks, PART_NCOLS, 2);
+  part_tasks_close(tasks);
+
+  TASSERT(ref.ht.num_kmers > PART_NSEQS * 100);
+
+  test_partitions_match(&ref, 1, seq_paths, out_path);
+  test_partitions_match(&ref, 5, seq_paths, out_path);
+  test_partitions_match(&ref, 64, seq_paths, out_path);
+
+  db_graph_dealloc(&ref);
+
+  for(i = 0; i < PART_NCOLS; i++) unlink(seq_paths[i]);
+  unlink(out_path);
+}
@@ -0,0 +1,130 @@
+#include "global.h"
+#include "all_tests.h"
+#include "graph_block.h"
+
+#define NCOLS 3
+
+// Coverages and edges are a function of the kmer so we can check them after
+// the block has been sorted
+static void block_kmer_data(BinaryKmer bkmer, Covg *covgs, Edges *edges)
+{
+  uint64_t h = bkmer.b[NUM_BKMER_WORDS-1] * 0x9E3779B97F4A7C15UL;
+  covgs[0] = 1 + (h >> 60); // dense
+  covgs[1] = (h % 16 == 0) ? (Covg)(h >> 32) : 0; // sparse
+  covgs[2] = 7; // run-length
+  edges[0] = (Edges)(h >> 24);
+  edges[1] = covgs[1] ? 0x11 : 0;
+  edges[2] = 0;
+}
+
+static void test_block_round_trip(size_t nkmers, bool close_kmers)
+{
+  GraphBlock blk, blk2;
+  graph_block_alloc(&blk, NCOLS);
+  graph_block_alloc(&blk2, NCOLS);
+
+  BinaryKmer bkmers[nkmers], bkmer;
+  Covg covgs[NCOLS], covgs2[NCOLS];
+  Edges edges[NCOLS], edges2[NCOLS];
+  size_t i, w;
+
+  for(i = 0; i < nkmers; i++) {
+    for(w = 0; w < NUM_BKMER_WORDS; w++)
+      bkmers[i].b[w] = ((uint64_t)rand() << 40) ^ ((uint64_t)rand() << 20) ^ rand();
+    // Close kmers where the bottom word decreases, to test borrowing
+    if(close_kmers) {
+      if(i > 0) bkmers[i] = bkmers[0];
+      bkmers[i].b[0] = i;
+      bkmers[i].b[NUM_BKMER_WORDS-1] = UINT64_MAX - i*3;
+    }
+  }
+
+  // Kmers must be added in order
+  qsort(bkmers, nkmers, sizeof(BinaryKmer), binary_kmers_qcmp);
+
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(graph_block_in_order(&blk, bkmers[i]));
+    block_kmer_data(bkmers[i], covgs, edges);
+    graph_block_add(&blk, bkmers[i], covgs, edges);
+    TASSERT(!graph_block_in_order(&blk, bkmers[i]));
+  }
+
+  TASSERT(graph_block_full(&blk) == (nkmers == GRAPH_BLOCK_KMERS));
+
+  FILE *fh = tmpfile();
+  TASSERT(fh != NULL);
+  size_t nbytes = graph_block_write(&blk, fh);
+  TASSERT(blk.nkmers == 0);
+  TASSERT(nbytes > 2*sizeof(uint32_t));
+  TASSERT(nbytes <= 2*sizeof(uint32_t) + graph_block_max_bytes(nkmers, NCOLS));
+
+  uint32_t blkhdr[2];
+  rewind(fh);
+  TASSERT(fread(blkhdr, sizeof(uint32_t), 2, fh) == 2);
+  TASSERT(blkhdr[0] == nkmers);
+  TASSERT(blkhdr[1] + 2*sizeof(uint32_t) == nbytes);
+  TASSERT(fread(blk2.data, 1, blkhdr[1], fh) == blkhdr[1]);
+  fclose(fh);
+
+  // Truncated block is rejected
+  TASSERT(!graph_block_decode(&blk2, blkhdr[0], blkhdr[1]-1));
+  TASSERT(graph_block_decode(&blk2, blkhdr[0], blkhdr[1]));
+  TASSERT(blk2.nkmers == nkmers);
+
+  // Kmers come out in the same order
+  for(i = 0; graph_block_next(&blk2, &bkmer, covgs2, edges2); i++) {
+    TASSERT(i < nkmers && binary_kmers_are_equal(bkmer, bkmers[i]));
+    block_kmer_data(bkmer, covgs, edges);
+    TASSERT(memcmp(covgs, covgs2, sizeof(covgs)) == 0);
+    TASSERT(memcmp(edges, edges2, sizeof(edges)) == 0);
+  }
+  TASSERT(i == nkmers);
+
+  graph_block_dealloc(&blk);
+  graph_block_dealloc(&blk2);
+}
+
+static uint8_t* put_varint(uint8_t *ptr, uint64_t x)
+{
+  for(; x >= 0x80; x >>= 7) *ptr++ = (uint8_t)(x | 0x80);
+  *ptr++ = (uint8_t)x;
+  return ptr;
+}
+
+// Hand encoded block of two kmers: the first has top word `first`, the second
+// is `delta` more in the top word
+static bool decode_two_kmers(GraphBlock *blk, uint64_t first, uint64_t delta)
+{
+  uint8_t *ptr = blk->data;
+  size_t w, c;
+  for(w = 0; w < NUM_BKMER_WORDS; w++) ptr = put_varint(ptr, w ? 0 : first);
+  for(w = 0; w < NUM_BKMER_WORDS; w++) ptr = put_varint(ptr, w ? 0 : delta);
+  for(c = 0; c < 2*NCOLS; c++) {
+    *ptr++ = 0; // run-length encoded: two kmers with value 1 or 0
+    *ptr++ = 2;
+    *ptr++ = (c < NCOLS);
+  }
+  return graph_block_decode(blk, 2, ptr - blk->data);
+}
+
+static void test_block_unsorted()
+{
+  GraphBlock blk;
+  graph_block_alloc(&blk, NCOLS);
+  TASSERT(decode_two_kmers(&blk, 0, 1));
+  TASSERT(blk.nkmers == 2);
+  TASSERT(blk.bkmers[1].b[0] == 1);
+  TASSERT(!decode_two_kmers(&blk, 0, 0)); // duplicate kmer
+  TASSERT(!decode_two_kmers(&blk, 1, UINT64_MAX)); // second kmer is smaller
+  graph_block_dealloc(&blk);
+}
+
+void test_graph_block()
+{
+  test_status("Testing block compressed graph kmers (graph_block.h)...");
+  test_block_round_trip(1, false);
+  test_block_round_trip(100, false);
+  test_block_round_trip(100, true);
+  test_block_round_trip(GRAPH_BLOCK_KMERS, false);
+  test_block_unsorted();
+}
@@ -0,0 +1,172 @@
+#include "global.h"
+#include "all_tests.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "graph_writer.h"
+#include "graphs_load.h"
+
+#include <unistd.h> // close, unlink
+
+#define LOAD_NCOLS 3
+#define LOAD_NKMERS 20000
+
+// Random kmers with random coverage and edges. Every kmer is in colour 0,
+// about a third are missing from each of the other colours.
+static void load_random_graph(dBGraph *graph)
+{
+  size_t col;
+  bool found;
+  dBNode node;
+
+  while(graph->ht.num_kmers < LOAD_NKMERS) {
+    node = db_graph_find_or_add_node(graph,
+                                     binary_kmer_random(graph->kmer_size),
+                                     &found);
+    if(found) continue;
+    for(col = 0; col < LOAD_NCOLS; col++) {
+      if(col > 0 && rand() % 3 == 0) continue;
+      db_node_set_covg(graph, node.key, col, 1 + rand() % 1000);
+      db_node_edges(graph, node.key, col) = rand() & 0xff;
+      db_node_set_col(graph, node.key, col);
+    }
+  }
+}
+
+// Every kmer in `graph` must be in `exp` with the same coverage, edges and
+// colours
+static void load_check_kmer(hkey_t hkey, const dBGraph *graph,
+                            const dBGraph *exp)
+{
+  BinaryKmer bkmer = db_node_get_bkmer(graph, hkey);
+  hkey_t ekey = hash_table_find(&exp->ht, bkmer);
+  size_t col;
+
+  TASSERT(ekey != HASH_NOT_FOUND);
+  if(ekey == HASH_NOT_FOUND) return;
+
+  for(col = 0; col < LOAD_NCOLS; col++) {
+    TASSERT(db_node_get_covg(graph, hkey, col) ==
+            db_node_get_covg(exp, ekey, col));
+    TASSERT(db_node_get_edges(graph, hkey, col) ==
+            db_node_get_edges(exp, ekey, col));
+    TASSERT(db_node_has_col(graph, hkey, col) ==
+            db_node_has_col(exp, ekey, col));
+  }
+}
+
+// Loading `graph` twice into `exp` doubles coverage
+static void load_check_doubled(hkey_t hkey, const dBGraph *graph,
+                               const dBGraph *exp)
+{
+  BinaryKmer bkmer = db_node_get_bkmer(graph, hkey);
+  hkey_t ekey = hash_table_find(&exp->ht, bkmer);
+  size_t col;
+
+  TASSERT(ekey != HASH_NOT_FOUND);
+  if(ekey == HASH_NOT_FOUND) return;
+
+  for(col = 0; col < LOAD_NCOLS; col++) {
+    TASSERT(db_node_get_covg(exp, ekey, col) ==
+            2*db_node_get_covg(graph, hkey, col));
+    TASSERT(db_node_get_edges(exp, ekey, col) ==
+            db_node_get_edges(graph, hkey, col));
+    TASSERT(db_node_has_col(exp, ekey, col) ==
+            db_node_has_col(graph, hkey, col));
+  }
+}
+
+// Load `path` twice, so the second load finds every kmer
+static size_t load_twice(const char *path, dBGraph *graph, size_t nthreads)
+{
+  GraphFileReader gfile;
+  GraphLoadingPrefs prefs = graph_loading_prefs(graph);
+  size_t i, nloaded = 0;
+  prefs.nthreads = nthreads;
+
+  for(i = 0; i < 2; i++) {
+    memset(&gfile, 0, sizeof(gfile));
+    TASSERT(graph_file_open(&gfile, path) > 0);
+    nloaded += graph_load(&gfile, prefs, NULL);
+    graph_file_close(&gfile);
+  }
+
+  return nloaded;
+}
+
+static void load_alloc(dBGraph *graph, size_t kmer_size, size_t capacity,
+                       int extra_flags)
+{
+  db_graph_alloc(graph, kmer_size, LOAD_NCOLS, LOAD_NCOLS, capacity,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL |
+                 extra_flags);
+}
+
+// Load with `nthreads` threads, compare with loading on one thread (`exp`)
+static void load_compare(const char *path, const dBGraph *exp, size_t nthreads,
+                         size_t capacity, bool growable, bool bktlocks,
+                         bool lockfree)
+{
+  dBGraph graph;
+  uint64_t init_capacity;
+  bool prev_lockfree = hash_table_get_lockfree();
+  size_t nloaded;
+
+  load_alloc(&graph, exp->kmer_size, capacity, bktlocks ? DBG_ALLOC_BKTLOCKS : 0);
+  if(growable) db_graph_set_growable(&graph, nthreads, 0);
+  init_capacity = graph.ht.capacity;
+
+  hash_table_set_lockfree(lockfree);
+  nloaded = load_twice(path, &graph, nthreads);
+  hash_table_set_lockfree(prev_lockfree);
+
+  TASSERT(nloaded == 2*LOAD_NKMERS);
+  TASSERT(graph.ht.num_kmers == LOAD_NKMERS);
+  TASSERT(hash_table_count_kmers(&graph.ht) == LOAD_NKMERS);
+  TASSERT(!growable || graph.ht.capacity > init_capacity);
+
+  // Temporary bucket locks are freed
+  TASSERT((graph.bktlocks != NULL) == bktlocks);
+
+  HASH_ITERATE(&graph.ht, load_check_kmer, &graph, exp);
+
+  db_graph_dealloc(&graph);
+}
+
+void test_graph_load()
+{
+  test_status("Testing loading graph files with threads (graphs_load.h)...");
+
+  const size_t kmer_size = MAX_KMER_SIZE, small = 1024;
+  char path[] = "/tmp/ctx_load_XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  if(fd < 0) return;
+  close(fd);
+
+  dBGraph graph, exp;
+  load_alloc(&graph, kmer_size, LOAD_NKMERS*2, 0);
+  load_random_graph(&graph);
+  graph_writer_save_mkhdr(path, &graph, CTX_GRAPH_FILEFORMAT, NULL, 0,
+                          LOAD_NCOLS);
+
+  // Load on the calling thread
+  load_alloc(&exp, kmer_size, LOAD_NKMERS*2, 0);
+  TASSERT(load_twice(path, &exp, 1) == 2*LOAD_NKMERS);
+  TASSERT(exp.ht.num_kmers == LOAD_NKMERS);
+
+  HASH_ITERATE(&graph.ht, load_check_doubled, &graph, &exp);
+  db_graph_dealloc(&graph);
+
+  // Temporary bucket locks
+  load_compare(path, &exp, 4, LOAD_NKMERS*2, false, false, false);
+  // Graph grows, temporary bucket locks are remapped
+  load_compare(path, &exp, 4, small, true, false, false);
+  // Graph's own bucket locks
+  load_compare(path, &exp, 4, small, true, true, false);
+  // Lock-free, with and without bucket locks
+  load_compare(path, &exp, 4, small, true, false, true);
+  load_compare(path, &exp, 4, LOAD_NKMERS*2, false, true, true);
+
+  db_graph_dealloc(&exp);
+  unlink(path);
+}
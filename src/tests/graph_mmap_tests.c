@@ -0,0 +1,217 @@
+#include "global.h"
+#include "all_tests.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "graph_mmap.h"
+#include "graph_writer.h"
+#include "graphs_load.h"
+#include "file_util.h"
+
+#include <unistd.h> // close, unlink
+
+#define MMAP_NCOLS 3
+#define MMAP_NKMERS 5000
+#define MMAP_BLOCK_KMERS 100
+
+// Random kmers with random coverage and edges. Every kmer is in colour 0,
+// about a third are missing from each of the other colours.
+static void mmap_random_graph(dBGraph *graph)
+{
+  size_t col;
+  bool found;
+  dBNode node;
+
+  while(graph->ht.num_kmers < MMAP_NKMERS) {
+    node = db_graph_find_or_add_node(graph,
+                                     binary_kmer_random(graph->kmer_size),
+                                     &found);
+    if(found) continue;
+    for(col = 0; col < MMAP_NCOLS; col++) {
+      if(col > 0 && rand() % 3 == 0) continue;
+      db_node_set_covg(graph, node.key, col, 1 + rand() % 1000);
+      db_node_edges(graph, node.key, col) = rand() & 0xff;
+      db_node_set_col(graph, node.key, col);
+    }
+  }
+}
+
+static void mmap_get_bkmer(hkey_t hkey, const dBGraph *graph,
+                           BinaryKmer *bkmers, size_t *n)
+{
+  bkmers[(*n)++] = db_node_get_bkmer(graph, hkey);
+}
+
+// Save kmers in sorted order as `ctx sort` would, then index every
+// MMAP_BLOCK_KMERS kmers as `ctx index --block-kmers` would
+static void mmap_save_sorted(const dBGraph *graph, const char *path,
+                             const char *idx_path)
+{
+  const size_t ncols = graph->num_of_cols;
+  const size_t kmer_bytes = sizeof(BinaryKmer) + ncols*(sizeof(Covg)+sizeof(Edges));
+  BinaryKmer *bkmers = ctx_calloc(graph->ht.num_kmers+1, sizeof(BinaryKmer));
+  Covg covgs[MMAP_NCOLS];
+  Edges edges[MMAP_NCOLS];
+  char bkmerstr[MAX_KMER_SIZE+1];
+  size_t i, end, col, n = 0, hdr_size;
+  hkey_t hkey;
+
+  HASH_ITERATE(&graph->ht, mmap_get_bkmer, graph, bkmers, &n);
+  qsort(bkmers, n, sizeof(BinaryKmer), binary_kmers_qcmp);
+
+  GraphFileHeader hdr = {.version = CTX_GRAPH_FILEFORMAT,
+                         .kmer_size = (uint32_t)graph->kmer_size,
+                         .num_of_bitfields = NUM_BKMER_WORDS,
+                         .num_of_cols = (uint32_t)ncols,
+                         .capacity = 0,
+                         .ginfo = graph->ginfo};
+
+  FILE *fh = fopen(path, "w");
+  TASSERT(fh != NULL);
+  if(fh == NULL) die("Cannot open: %s", path);
+
+  hdr_size = graph_write_header(fh, &hdr);
+  for(i = 0; i < n; i++) {
+    hkey = hash_table_find(&graph->ht, bkmers[i]);
+    for(col = 0; col < ncols; col++) {
+      covgs[col] = db_node_get_covg(graph, hkey, col);
+      edges[col] = db_node_get_edges(graph, hkey, col);
+    }
+    graph_write_kmer(fh, NUM_BKMER_WORDS, ncols, bkmers[i], covgs, edges);
+  }
+  fclose(fh);
+
+  fh = fopen(idx_path, "w");
+  TASSERT(fh != NULL);
+  if(fh == NULL) die("Cannot open: %s", idx_path);
+
+  fputs("#block_start\tnext_block\tfirst_kmer\tkmer_idx\tnext_kmer_idx\n", fh);
+  for(i = 0; i < n; i = end) {
+    end = MIN2(i + MMAP_BLOCK_KMERS, n);
+    binary_kmer_to_str(bkmers[i], graph->kmer_size, bkmerstr);
+    fprintf(fh, "%zu\t%zu\t%s\t%zu\t%zu\n", hdr_size + i*kmer_bytes,
+            hdr_size + end*kmer_bytes, bkmerstr, i, end);
+  }
+  fclose(fh);
+
+  ctx_free(bkmers);
+}
+
+// Every kmer loaded into `graph` must be in the memory mapped graph `mgraph`
+static void mmap_check_kmer(hkey_t hkey, const dBGraph *graph,
+                            const dBGraph *mgraph)
+{
+  BinaryKmer bkmer = db_node_get_bkmer(graph, hkey);
+  dBNode node = db_graph_find(mgraph, bkmer);
+  size_t col;
+
+  TASSERT(node.key != HASH_NOT_FOUND);
+  if(node.key == HASH_NOT_FOUND) return;
+
+  TASSERT(binary_kmers_are_equal(db_node_get_bkmer(mgraph, node.key), bkmer));
+  TASSERT(db_node_get_edges_union(mgraph, node.key) ==
+          db_node_get_edges_union(graph, hkey));
+
+  for(col = 0; col < MMAP_NCOLS; col++) {
+    TASSERT(db_node_get_covg(mgraph, node.key, col) ==
+            db_node_get_covg(graph, hkey, col));
+    TASSERT(db_node_get_edges(mgraph, node.key, col) ==
+            db_node_get_edges(graph, hkey, col));
+    TASSERT(db_node_has_col(mgraph, node.key, col) ==
+            db_node_has_col(graph, hkey, col));
+  }
+}
+
+// Memory map `path`, compare with loading it with graph_load()
+static void mmap_compare_load(const char *path, bool with_mphf)
+{
+  GraphFileReader gfile;
+  dBGraph graph, mgraph;
+  BinaryKmer bkmer;
+  hkey_t hkey;
+  size_t i, nabsent = 0;
+
+  memset(&gfile, 0, sizeof(gfile));
+  TASSERT(graph_file_open(&gfile, path) > 0);
+
+  bool mapped = db_graph_mmap(&mgraph, &gfile);
+  TASSERT(mapped);
+  if(!mapped) { graph_file_close(&gfile); return; }
+  TASSERT((mgraph.gmap->mphf != NULL) == with_mphf);
+  TASSERT(mgraph.gmap->nblocks ==
+          (MMAP_NKMERS + MMAP_BLOCK_KMERS - 1) / MMAP_BLOCK_KMERS);
+
+  db_graph_alloc(&graph, mgraph.kmer_size, MMAP_NCOLS, MMAP_NCOLS,
+                 MMAP_NKMERS*2, DBG_ALLOC_EDGES | DBG_ALLOC_COVGS |
+                                DBG_ALLOC_NODE_IN_COL);
+
+  GraphLoadingPrefs prefs = graph_loading_prefs(&graph);
+  graph_load(&gfile, prefs, NULL);
+  graph_file_close(&gfile);
+
+  TASSERT(graph.ht.num_kmers == MMAP_NKMERS);
+  TASSERT(mgraph.ht.num_kmers == MMAP_NKMERS);
+
+  HASH_ITERATE(&graph.ht, mmap_check_kmer, &graph, &mgraph);
+
+  // hkeys of a memory mapped graph are kmer indices in the file
+  for(hkey = 0; hkey < mgraph.ht.num_kmers; hkey++) {
+    bkmer = db_node_get_bkmer(&mgraph, hkey);
+    TASSERT(hkey == 0 ||
+            binary_kmer_less_than(db_node_get_bkmer(&mgraph, hkey-1), bkmer));
+    TASSERT(db_graph_find(&mgraph, bkmer).key == hkey);
+  }
+
+  // Kmers not in the graph
+  for(i = 0; i < 1000; i++) {
+    bkmer = binary_kmer_random(graph.kmer_size);
+    if(db_graph_find(&graph, bkmer).key == HASH_NOT_FOUND) {
+      TASSERT(db_graph_find(&mgraph, bkmer).key == HASH_NOT_FOUND);
+      nabsent++;
+    }
+  }
+  TASSERT(nabsent > 0);
+
+  db_graph_dealloc(&graph);
+  db_graph_dealloc(&mgraph);
+}
+
+void test_graph_mmap()
+{
+  test_status("Testing memory mapped graph files (graph_mmap.h)...");
+
+  const size_t kmer_size = MAX_KMER_SIZE;
+  char path[] = "/tmp/ctx_mmap_XXXXXX";
+  char idx_path[sizeof(path)+10], mphf_path[sizeof(path)+10];
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  if(fd < 0) return;
+  close(fd);
+
+  sprintf(idx_path, "%s.idx", path);
+  sprintf(mphf_path, "%s.mphf", path);
+
+  dBGraph graph;
+  db_graph_alloc(&graph, kmer_size, MMAP_NCOLS, MMAP_NCOLS, MMAP_NKMERS*2,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS | DBG_ALLOC_NODE_IN_COL);
+
+  mmap_random_graph(&graph);
+  mmap_save_sorted(&graph, path, idx_path);
+  db_graph_dealloc(&graph);
+
+  // Binary search the index
+  mmap_compare_load(path, false);
+
+  // Minimal perfect hash saved by `ctx index --mphf`
+  GraphFileReader gfile;
+  memset(&gfile, 0, sizeof(gfile));
+  TASSERT(graph_file_open(&gfile, path) > 0);
+  futil_create_output(mphf_path);
+  graph_mmap_save_mphf(&gfile, mphf_path, 2);
+  graph_file_close(&gfile);
+
+  mmap_compare_load(path, true);
+
+  unlink(path);
+  unlink(idx_path);
+  unlink(mphf_path);
+}
@@ -3,12 +3,14 @@
 #include "hash_table.h"
 #include "binary_kmer.h"
 
+#include <time.h> // nanosleep
+
 #define NTESTS 1024
 
 static void xor_bkmers(hkey_t key, HashTable *ht, BinaryKmer *ptr, size_t *c)
 {
   size_t i;
-  BinaryKmer bkmer = ht->table[key];
+  BinaryKmer bkmer = hash_table_fetch(ht, key);
   for(i = 0; i < NUM_BKMER_WORDS; i++) ptr->b[i] ^= bkmer.b[i];
   (*c)++;
 }
@@ -94,15 +96,18 @@ void load_bset(void *arg, size_t threadid)
   }
 }
 
-static void test_hash_table_mt()
+static void test_hash_table_mt(bool lockfree)
 {
   // Generate 2000 random binary kmers
   // start 20 threads adding them to the hash table
   size_t i, kmer_size = MAX_KMER_SIZE;
   size_t nthreads = (rand() % 50)+1, nkmers = 1000000;
 
-  test_status("Testing hash table multithreading %zu threads, %zu kmers",
-              nthreads, nkmers);
+  test_status("Testing hash table multithreading %zu threads, %zu kmers%s",
+              nthreads, nkmers, lockfree ? " (lock-free)" : "");
+
+  bool prev_lockfree = hash_table_get_lockfree();
+  hash_table_set_lockfree(lockfree);
 
   BKmerTestSet bset;
   bset.n = nkmers;
@@ -122,14 +127,465 @@ static void test_hash_table_mt()
 
   TASSERT(bset.ht.num_kmers == nkmers);
 
+  // Threadsafe and single threaded finds should agree
+  for(i = 0; i < bset.n; i++) {
+    hkey_t hkey = hash_table_find_mt(&bset.ht, bset.bkmers[i], bset.bktlocks);
+    TASSERT(hkey != HASH_NOT_FOUND);
+    TASSERT(hkey == hash_table_find(&bset.ht, bset.bkmers[i]));
+  }
+
+  hash_table_set_lockfree(prev_lockfree);
+
   ctx_free(bset.bktlocks);
   ctx_free(bset.nadded);
   ctx_free(bset.bkmers);
   hash_table_dealloc(&bset.ht);
 }
 
+// Check SIMD bucket scans agree with the scalar scan
+static void test_hash_table_scan()
+{
+  test_status("Testing hash table bucket scan methods");
+
+  HashTable ht;
+  size_t i, nkmers = 4096, kmer_size = MAX_KMER_SIZE;
+  BinaryKmer *bkeys = ctx_calloc(nkmers, sizeof(BinaryKmer));
+  hkey_t *hkeys = ctx_calloc(nkmers, sizeof(hkey_t));
+  HashTableScan scan, best, orig = hash_table_get_scan();
+  bool found;
+
+  hash_table_alloc(&ht, nkmers*2);
+
+  for(i = 0; i < nkmers; i++) {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    hkeys[i] = hash_table_find_or_insert(&ht, bkeys[i], &found);
+  }
+
+  // Delete every third kmer to leave holes in buckets
+  for(i = 0; i < nkmers; i += 3) {
+    if(hkeys[i] != HASH_NOT_FOUND && hash_table_assigned(&ht, hkeys[i])) {
+      hash_table_delete(&ht, hkeys[i]);
+    }
+    hkeys[i] = HASH_NOT_FOUND;
+  }
+
+  best = hash_table_set_scan(HT_SCAN_AUTO);
+
+  for(scan = HT_SCAN_SCALAR; scan <= best; scan++) {
+    TASSERT(hash_table_set_scan(scan) == scan);
+    for(i = 0; i < nkmers; i++)
+      if(hkeys[i] != HASH_NOT_FOUND)
+        TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+  }
+
+  hash_table_set_scan(orig);
+  hash_table_dealloc(&ht);
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+}
+
+// Batch insert should give the same hkeys as finding kmers one at a time
+static void test_hash_table_batch()
+{
+  test_status("Testing hash table batch find or insert");
+
+  HashTable ht;
+  size_t i, nkmers = 1000, kmer_size = MAX_KMER_SIZE, nnovel = 0;
+  BinaryKmer *bkeys = ctx_calloc(nkmers, sizeof(BinaryKmer));
+  hkey_t *hkeys = ctx_calloc(nkmers, sizeof(hkey_t));
+  bool *found = ctx_calloc(nkmers, sizeof(bool));
+  uint8_t *bktlocks;
+
+  hash_table_alloc(&ht, nkmers*2);
+  bktlocks = ctx_calloc(roundup_bits2bytes(ht.num_of_buckets), 1);
+
+  // Every other kmer is a repeat of the one before
+  for(i = 0; i < nkmers; i++) {
+    if(i & 1) bkeys[i] = bkeys[i-1];
+    else bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+  }
+
+  hash_table_find_or_insert_batch_mt(&ht, bkeys, nkmers, hkeys, found, bktlocks);
+
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(hkeys[i] == hash_table_find(&ht, bkeys[i]));
+    nnovel += !found[i];
+    if(i & 1) TASSERT(found[i]);
+  }
+
+  TASSERT(nnovel == ht.num_kmers);
+
+  hash_table_dealloc(&ht);
+  ctx_free(bktlocks);
+  ctx_free(found);
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+}
+
+static void remap_hkey(hkey_t old, hkey_t hkey, void *arg)
+{
+  hkey_t *remap = (hkey_t*)arg;
+  remap[old] = hkey;
+}
+
+// Grow a table each time it fills up, hkeys should be remapped
+static void test_hash_table_grow()
+{
+  test_status("Testing hash table growing");
+
+  HashTable ht;
+  size_t i, j, nkmers = 20000, kmer_size = MAX_KMER_SIZE, ngrow = 0;
+  uint64_t init_capacity;
+  BinaryKmer *bkeys = ctx_calloc(nkmers, sizeof(BinaryKmer));
+  hkey_t *hkeys = ctx_calloc(nkmers, sizeof(hkey_t)), *remap;
+  bool found;
+
+  hash_table_alloc(&ht, 1024);
+  ht.growable = true;
+  init_capacity = ht.capacity;
+
+  for(i = 0; i < nkmers; i++)
+  {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+
+    while((hkeys[i] = hash_table_find_or_insert(&ht, bkeys[i], &found)) == HASH_NOT_FOUND)
+    {
+      remap = ctx_malloc(ht.capacity * sizeof(hkey_t));
+      hash_table_grow(&ht, 4, remap_hkey, remap);
+      for(j = 0; j < i; j++) hkeys[j] = remap[hkeys[j]];
+      ctx_free(remap);
+      ngrow++;
+    }
+  }
+
+  TASSERT(ngrow > 0);
+  TASSERT(ht.capacity == init_capacity << ngrow);
+  TASSERT(ht.num_kmers == nkmers);
+  TASSERT(hash_table_count_kmers(&ht) == nkmers);
+
+  for(i = 0; i < nkmers; i++)
+    TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+
+  hash_table_dealloc(&ht);
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+}
+
+// Fill a table with each hash, tables should keep the hash they were
+// allocated with
+static void test_hash_table_hashes()
+{
+  test_status("Testing hash table hash functions");
+
+  HashTable ht;
+  size_t i, h, nkmers = 3000, kmer_size = MAX_KMER_SIZE;
+  BinaryKmer *bkeys = ctx_calloc(nkmers, sizeof(BinaryKmer)), bkey;
+  hkey_t *hkeys = ctx_calloc(nkmers, sizeof(hkey_t));
+  HashTableHash orig = hash_table_get_hash(), hash;
+  bool found;
+
+  for(h = 0; h < HT_NUM_HASHES; h++)
+  {
+    TASSERT(hash_table_hash_parse(hash_table_hash_str(h), &hash) && hash == h);
+    hash_table_set_hash((HashTableHash)h);
+    hash_table_alloc(&ht, 4096);
+    hash_table_set_hash((HashTableHash)((h+1) % HT_NUM_HASHES));
+    TASSERT(ht.hash == h);
+
+    for(i = 0; i < nkmers; i++) {
+      bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+      hkeys[i] = hash_table_find_or_insert(&ht, bkeys[i], &found);
+      TASSERT(hkeys[i] != HASH_NOT_FOUND);
+    }
+
+    for(i = 0; i < nkmers; i++)
+      TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+
+    // Kmer of all A's was almost certainly not added
+    bkey = binary_kmer_get_key(zero_bkmer, kmer_size);
+    for(i = 0; i < nkmers && !binary_kmers_are_equal(bkeys[i], bkey); i++) {}
+    if(i == nkmers) TASSERT(hash_table_find(&ht, bkey) == HASH_NOT_FOUND);
+
+    hash_table_dealloc(&ht);
+  }
+
+  TASSERT(!hash_table_hash_parse("nohash", &hash));
+
+  hash_table_set_hash(orig);
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+}
+
+typedef struct {
+  HashTable ht;
+  uint8_t *bktlocks;
+  BinaryKmer *bkmers;
+  hkey_t *hkeys, *seen; // hkey from inserting, first hkey found by another thread
+  size_t n, nthreads, nwrong;
+} CompactFindSet;
+
+// Record the hkey found for kmer `i`, every find must give the same hkey
+static void compact_seen(CompactFindSet *cset, size_t i, hkey_t hkey)
+{
+  if(hkey == HASH_NOT_FOUND) return; // may not have been inserted yet
+  if(!__sync_bool_compare_and_swap(&cset->seen[i], HASH_NOT_FOUND, hkey) &&
+     cset->seen[i] != hkey) {
+    __sync_fetch_and_add(&cset->nwrong, 1);
+  }
+}
+
+// Insert every nthreads-th kmer, finding kmers other threads are inserting
+static void compact_insert_find(void *arg, size_t threadid)
+{
+  CompactFindSet *cset = (CompactFindSet*)arg;
+  size_t i, j;
+  bool found;
+  hkey_t hkey;
+
+  for(i = threadid; i < cset->n; i += cset->nthreads) {
+    cset->hkeys[i] = hash_table_find_or_insert_mt(&cset->ht, cset->bkmers[i],
+                                                  &found, cset->bktlocks);
+    for(j = i+1; j < MIN2(i+cset->nthreads, cset->n); j++) {
+      hkey = hash_table_find_mt(&cset->ht, cset->bkmers[j], cset->bktlocks);
+      compact_seen(cset, j, hkey);
+    }
+  }
+}
+
+// Compact entries spanning two words are written in two halves, threadsafe
+// finds must not match half written entries of other kmers
+static void test_hash_table_compact_mt(bool lockfree)
+{
+  size_t i, nkmers = 200000, kmer_size = MAX_KMER_SIZE;
+  bool prev_compact = hash_table_get_compact();
+  bool prev_lockfree = hash_table_get_lockfree();
+  CompactFindSet cset;
+
+  test_status("Testing compact hash table finds whilst inserting%s",
+              lockfree ? " (lock-free)" : "");
+
+  memset(&cset, 0, sizeof(cset));
+  cset.n = nkmers;
+  cset.nthreads = 8;
+
+  hash_table_set_compact(true);
+  hash_table_alloc(&cset.ht, nkmers*1.5);
+  hash_table_set_compact(prev_compact);
+  hash_table_set_lockfree(lockfree);
+  TASSERT(cset.ht.entries != NULL);
+
+  cset.bkmers = ctx_calloc(nkmers, sizeof(BinaryKmer));
+  cset.hkeys = ctx_calloc(nkmers, sizeof(hkey_t));
+  cset.seen = ctx_calloc(nkmers, sizeof(hkey_t));
+  cset.bktlocks = ctx_calloc(roundup_bits2bytes(cset.ht.num_of_buckets), 1);
+
+  for(i = 0; i < nkmers; i++) {
+    cset.bkmers[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    cset.seen[i] = HASH_NOT_FOUND;
+  }
+
+  util_multi_thread(&cset, cset.nthreads, compact_insert_find);
+
+  TASSERT2(cset.nwrong == 0, "%zu", cset.nwrong);
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(cset.hkeys[i] != HASH_NOT_FOUND);
+    TASSERT(cset.seen[i] == HASH_NOT_FOUND || cset.seen[i] == cset.hkeys[i]);
+    TASSERT(hash_table_find(&cset.ht, cset.bkmers[i]) == cset.hkeys[i]);
+  }
+
+  hash_table_set_lockfree(prev_lockfree);
+
+  ctx_free(cset.bktlocks);
+  ctx_free(cset.seen);
+  ctx_free(cset.hkeys);
+  ctx_free(cset.bkmers);
+  hash_table_dealloc(&cset.ht);
+}
+
+// Set compact entry `hkey` to `v` (not thread safe)
+static void compact_set_entry(HashTable *ht, hkey_t hkey, uint64_t v)
+{
+  uint64_t bit = hkey * ht->entry_bits, mask = bitmask64(ht->entry_bits);
+  uint64_t *w = ht->entries + (bit >> 6);
+  size_t s = bit & 63;
+  w[0] = (w[0] & ~(mask << s)) | (v << s);
+  if(s + ht->entry_bits > 64) w[1] = (w[1] & ~(mask >> (64 - s))) | (v >> (64 - s));
+}
+
+typedef struct {
+  HashTable *ht;
+  uint8_t *bktlocks;
+  hkey_t hkey; // entry being written
+  uint64_t entry;
+  uint_fast32_t bucket;
+  BinaryKmer find;
+  hkey_t found;
+} CompactTornEntry;
+
+// Thread 0 finishes writing an entry after a pause, thread 1 searches the
+// bucket whilst it is half written
+static void compact_torn_entry(void *arg, size_t threadid)
+{
+  CompactTornEntry *torn = (CompactTornEntry*)arg;
+  HashTable *ht = torn->ht;
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 50000000};
+
+  if(threadid == 0) {
+    nanosleep(&pause, NULL);
+    compact_set_entry(ht, torn->hkey, torn->entry);
+    ht->buckets[torn->bucket][HT_BITEMS]++;
+    ht->num_kmers++;
+    bitlock_release(torn->bktlocks, torn->bucket);
+  }
+  else {
+    torn->found = hash_table_find_mt(ht, torn->find, torn->bktlocks);
+  }
+}
+
+// An entry spanning two words is written in two halves. Pick kmers A and B in
+// the same bucket where A's low half is B's entry, write the low half of A
+// whilst holding the bucket lock, then find B.
+static void test_hash_table_compact_torn()
+{
+  size_t s = 0, nkmers = 1024;
+  bool prev_compact = hash_table_get_compact();
+  bool prev_lockfree = hash_table_get_lockfree();
+  uint64_t bit, entry_b = (1 << HT_CROUND_BITS) | 1; // remainder 1, round 0
+  BinaryKmer bkmer_a;
+  HashTable ht;
+  CompactTornEntry torn;
+  hkey_t hkey;
+
+  test_status("Testing compact hash table finds whilst an entry is half written");
+
+  hash_table_set_compact(true);
+  hash_table_alloc(&ht, nkmers);
+  hash_table_set_compact(prev_compact);
+  hash_table_set_lockfree(true);
+  TASSERT(ht.entries != NULL);
+
+  // An entry with at least 8 bits in its first word and the rest in the next
+  for(hkey = 0; hkey < ht.capacity; hkey++) {
+    bit = hkey * ht.entry_bits;
+    s = bit & 63;
+    if(s + ht.entry_bits > 64 && 64 - s >= 8) break;
+  }
+  TASSERT(hkey < ht.capacity);
+  if(hkey == ht.capacity) { hash_table_dealloc(&ht); return; }
+
+  memset(&torn, 0, sizeof(torn));
+  torn.ht = &ht;
+  torn.bktlocks = ctx_calloc(roundup_bits2bytes(ht.num_of_buckets), 1);
+  torn.hkey = hkey;
+  torn.entry = entry_b | (1UL << (64 - s));
+  torn.bucket = hkey / ht.bucket_size;
+
+  // Kmers stored by each entry
+  compact_set_entry(&ht, hkey, torn.entry);
+  bkmer_a = hash_table_fetch(&ht, hkey);
+  compact_set_entry(&ht, hkey, entry_b);
+  torn.find = hash_table_fetch(&ht, hkey);
+  compact_set_entry(&ht, hkey, 0);
+
+  // Start inserting A as ht_insert_in_bucket() does: raise the bucket size
+  // then write the entry, only the first word so far
+  bitlock_acquire(torn.bktlocks, torn.bucket);
+  ht.buckets[torn.bucket][HT_BSIZE] = hkey % ht.bucket_size + 1;
+  ht.entries[(hkey * ht.entry_bits) >> 6] |= torn.entry << s;
+
+  util_multi_thread(&torn, 2, compact_torn_entry);
+
+  TASSERT2(torn.found == HASH_NOT_FOUND, "%zu", (size_t)torn.found);
+  TASSERT(hash_table_find_mt(&ht, bkmer_a, torn.bktlocks) == hkey);
+  TASSERT(hash_table_find(&ht, torn.find) == HASH_NOT_FOUND);
+
+  hash_table_set_lockfree(prev_lockfree);
+  ctx_free(torn.bktlocks);
+  hash_table_dealloc(&ht);
+}
+
+// Compact tables store part of each kmer, check kmers are recovered after
+// inserting, deleting and growing
+static void test_hash_table_compact()
+{
+  if(!HT_COMPACT_SUPPORTED) return;
+
+  test_status("Testing compact hash tables");
+
+  HashTable ht;
+  size_t i, j, nkmers = 20000, kmer_size = MAX_KMER_SIZE, ngrow = 0, c = 0;
+  BinaryKmer *bkeys = ctx_calloc(nkmers, sizeof(BinaryKmer));
+  BinaryKmer bkxor = {.b = {0}}, bkresult = {.b = {0}};
+  hkey_t *hkeys = ctx_calloc(nkmers, sizeof(hkey_t)), *remap;
+  bool found, prev_compact = hash_table_get_compact();
+
+  hash_table_set_compact(true);
+  hash_table_alloc(&ht, 1024);
+  hash_table_set_compact(prev_compact);
+  TASSERT(ht.entries != NULL && ht.table == NULL);
+  ht.growable = true;
+
+  for(i = 0; i < nkmers; i++)
+  {
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+
+    while((hkeys[i] = hash_table_find_or_insert(&ht, bkeys[i], &found)) == HASH_NOT_FOUND)
+    {
+      remap = ctx_malloc(ht.capacity * sizeof(hkey_t));
+      hash_table_grow(&ht, 4, remap_hkey, remap);
+      for(j = 0; j < i; j++) hkeys[j] = remap[hkeys[j]];
+      ctx_free(remap);
+      ngrow++;
+    }
+
+    TASSERT(binary_kmers_are_equal(hash_table_fetch(&ht, hkeys[i]), bkeys[i]));
+  }
+
+  TASSERT(ngrow > 0);
+  TASSERT(ht.entries != NULL);
+  TASSERT(hash_table_count_kmers(&ht) == ht.num_kmers);
+
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+    TASSERT(binary_kmers_are_equal(hash_table_fetch(&ht, hkeys[i]), bkeys[i]));
+  }
+
+  // Delete every other kmer, the rest should still be found
+  for(i = 0; i < nkmers; i += 2) {
+    if(hash_table_assigned(&ht, hkeys[i])) hash_table_delete(&ht, hkeys[i]);
+    TASSERT(hash_table_find(&ht, bkeys[i]) == HASH_NOT_FOUND);
+  }
+  for(i = 1; i < nkmers; i += 2) {
+    TASSERT(hash_table_find(&ht, bkeys[i]) == hkeys[i]);
+    for(j = 0; j < NUM_BKMER_WORDS; j++) bkresult.b[j] ^= bkeys[i].b[j];
+  }
+
+  HASH_ITERATE(&ht, xor_bkmers, &ht, &bkxor, &c);
+  TASSERT(c == ht.num_kmers);
+  TASSERT(binary_kmers_are_equal(bkxor, bkresult));
+
+  hash_table_dealloc(&ht);
+  ctx_free(hkeys);
+  ctx_free(bkeys);
+
+  // Threads insert into neighbouring entries that share words
+  hash_table_set_compact(true);
+  test_hash_table_mt(false);
+  hash_table_set_compact(prev_compact);
+
+  test_hash_table_compact_mt(false);
+  test_hash_table_compact_mt(true);
+  test_hash_table_compact_torn();
+}
+
 void test_hash_table()
 {
   test_add_remove();
-  test_hash_table_mt();
+  test_hash_table_mt(false);
+  test_hash_table_mt(true);
+  test_hash_table_scan();
+  test_hash_table_batch();
+  test_hash_table_grow();
+  test_hash_table_hashes();
+  test_hash_table_compact();
 }
@@ -0,0 +1,90 @@
+#include "global.h"
+#include "all_tests.h"
+#include "kmer_mphf.h"
+
+#include <unistd.h> // unlink
+
+// Random unique kmer keys, returns number generated (<= n)
+static size_t mphf_random_keys(BinaryKmer *bkeys, size_t n, size_t kmer_size)
+{
+  size_t i, j;
+  for(i = 0; i < n; i++)
+    bkeys[i] = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+  qsort(bkeys, n, sizeof(BinaryKmer), binary_kmers_qcmp);
+  for(i = j = 0; i < n; i++)
+    if(j == 0 || !binary_kmers_are_equal(bkeys[i], bkeys[j-1]))
+      bkeys[j++] = bkeys[i];
+  return j;
+}
+
+// Every key should map to its own index and position
+static void mphf_check(const KmerMphf *mphf, const BinaryKmer *bkeys, size_t n)
+{
+  uint8_t *seen = ctx_calloc(n+1, 1);
+  size_t i, nseen = 0;
+  uint64_t idx;
+
+  TASSERT(mphf->num_of_kmers == n);
+
+  for(i = 0; i < n; i++) {
+    idx = kmer_mphf_index(mphf, bkeys[i]);
+    TASSERT(idx < n);
+    if(idx < n && !seen[idx]) { seen[idx] = 1; nseen++; }
+    TASSERT(kmer_mphf_find(mphf, bkeys[i]) == i);
+  }
+
+  TASSERT(nseen == n);
+  ctx_free(seen);
+}
+
+static void test_mphf_build(size_t n, size_t nthreads)
+{
+  size_t i, j, kmer_size = MAX_KMER_SIZE, nfound = 0, nabsent = 10000;
+  BinaryKmer *bkeys = ctx_calloc(n+1, sizeof(BinaryKmer)), bkey;
+  KmerMphf mphf, mphf2;
+
+  n = mphf_random_keys(bkeys, n, kmer_size);
+
+  // Shuffle so positions aren't in sorted order
+  for(i = n; i > 1; i--) { j = rand() % i; SWAP(bkeys[i-1], bkeys[j]); }
+
+  kmer_mphf_build(&mphf, bkeys, sizeof(BinaryKmer), n, nthreads);
+  mphf_check(&mphf, bkeys, n);
+
+  // Fingerprints should reject most kmers not in the set
+  for(i = 0; i < nabsent; i++) {
+    bkey = binary_kmer_get_key(binary_kmer_random(kmer_size), kmer_size);
+    nfound += (kmer_mphf_find(&mphf, bkey) != HASH_NOT_FOUND);
+  }
+  TASSERT2(nfound <= nabsent / 64, "%zu / %zu", nfound, nabsent);
+
+  // Save and memory map
+  char path[] = "/tmp/ctx_mphf_XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  if(fd >= 0) {
+    close(fd);
+    kmer_mphf_save(&mphf, path);
+    TASSERT(kmer_mphf_mmap(&mphf2, path));
+    if(mphf2.mmap_data != NULL) {
+      TASSERT(mphf2.num_of_levels == mphf.num_of_levels);
+      TASSERT(kmer_mphf_mem(&mphf2) == kmer_mphf_mem(&mphf));
+      mphf_check(&mphf2, bkeys, n);
+      kmer_mphf_dealloc(&mphf2);
+    }
+    unlink(path);
+  }
+
+  kmer_mphf_dealloc(&mphf);
+  ctx_free(bkeys);
+}
+
+void test_kmer_mphf()
+{
+  test_status("Testing minimal perfect hash of kmers (kmer_mphf.h)...");
+  test_mphf_build(0, 1);
+  test_mphf_build(1, 1);
+  test_mphf_build(100, 2);
+  test_mphf_build(100000, 1);
+  test_mphf_build(100000, 4);
+}
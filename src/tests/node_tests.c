@@ -87,8 +87,187 @@ static void test_left_shift()
   }
 }
 
+typedef struct {
+  dBGraph *graph;
+  const dBNode *nodes;
+  size_t n, nloops;
+} Covg8Adder;
+
+static void covg8_add_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  const Covg8Adder *adder = (const Covg8Adder*)arg;
+  size_t i, j;
+  for(i = 0; i < adder->nloops; i++) {
+    for(j = 0; j < adder->n; j++) {
+      db_node_increment_coverage_mt(adder->graph, adder->nodes[j].key, 0);
+      db_node_add_col_covg_mt(adder->graph, adder->nodes[j].key, 1, j);
+    }
+  }
+}
+
+static void test_covgs8()
+{
+  test_status("Testing 8 bit coverages with overflow table");
+
+  dBGraph graph;
+  size_t i, kmer_size = 11, ncols = 2, nkmers = 100, nthreads = 4, nloops = 100;
+  BinaryKmer bkmers[nkmers];
+  dBNode nodes[nkmers];
+  bool found;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COVGS8 | DBG_ALLOC_BKTLOCKS);
+  db_graph_set_growable(&graph, 2, 0);
+  TASSERT(graph.col_covgs == NULL && graph.col_covgs8 != NULL);
+
+  for(i = 0; i < nkmers; i++) {
+    bkmers[i] = binary_kmer_random(kmer_size);
+    nodes[i] = db_graph_find_or_add_node(&graph, bkmers[i], &found);
+  }
+
+  // Counters overflow part way through
+  Covg8Adder adder = {.graph = &graph, .nodes = nodes,
+                      .n = nkmers, .nloops = nloops};
+  util_multi_thread(&adder, nthreads, covg8_add_thread);
+
+  for(i = 0; i < nkmers; i++) {
+    TASSERT(db_node_get_covg(&graph, nodes[i].key, 0) == nthreads*nloops);
+    TASSERT(db_node_get_covg(&graph, nodes[i].key, 1) == nthreads*nloops*i);
+  }
+
+  // Set, add and zero
+  db_node_set_covg(&graph, nodes[0].key, 0, COVG_MAX-1);
+  db_node_add_col_covg(&graph, nodes[0].key, 0, 10);
+  TASSERT(db_node_get_covg(&graph, nodes[0].key, 0) == COVG_MAX);
+  db_node_set_covg(&graph, nodes[1].key, 0, 7);
+  TASSERT(db_node_get_covg(&graph, nodes[1].key, 0) == 7);
+  db_node_zero_covgs(&graph, nodes[2].key);
+  TASSERT(db_node_get_covg(&graph, nodes[2].key, 0) == 0);
+  TASSERT(db_node_get_covg(&graph, nodes[2].key, 1) == 0);
+
+  // Overflowed coverages move with their kmers
+  db_graph_grow(&graph);
+  TASSERT(graph.ht.capacity > 1024);
+  for(i = 0; i < nkmers; i++)
+    nodes[i] = db_graph_find(&graph, bkmers[i]);
+
+  TASSERT(db_node_get_covg(&graph, nodes[0].key, 0) == COVG_MAX);
+  TASSERT(db_node_get_covg(&graph, nodes[1].key, 0) == 7);
+  TASSERT(db_node_get_covg(&graph, nodes[2].key, 1) == 0);
+  for(i = 3; i < nkmers; i++) {
+    TASSERT(db_node_get_covg(&graph, nodes[i].key, 0) == nthreads*nloops);
+    TASSERT(db_node_get_covg(&graph, nodes[i].key, 1) == nthreads*nloops*i);
+  }
+
+  db_graph_dealloc(&graph);
+}
+
+typedef struct {
+  dBGraph *graph;
+  const dBNode *nodes;
+  size_t n, ncols;
+} ColSetAdder;
+
+// Node i is in colours that are multiples of (i%5)+1. Each node adds them in
+// a different order, so lists left behind are not shared between nodes.
+static void col_sets_add_thread(void *arg, size_t threadid)
+{
+  const ColSetAdder *adder = (const ColSetAdder*)arg;
+  size_t i, j, col;
+  for(j = threadid; j < adder->ncols; j += 4) {
+    for(i = 0; i < adder->n; i++) {
+      col = (j + i) % adder->ncols;
+      if(col % (i%5+1) == 0)
+        db_node_set_col_mt(adder->graph, adder->nodes[i].key, col);
+    }
+  }
+}
+
+static void col_sets_check(const dBGraph *graph, const dBNode *nodes,
+                           size_t n, size_t ncols, size_t wiped)
+{
+  size_t i, col;
+  for(i = 0; i < n; i++)
+    for(col = 0; col < ncols; col++)
+      TASSERT(db_node_has_col(graph, nodes[i].key, col) ==
+              (col != wiped && col % (i%5+1) == 0));
+}
+
+static void test_col_sets()
+{
+  test_status("Testing sparse colour sets");
+
+  dBGraph graph;
+  size_t i, kmer_size = 11, ncols = 1000, nkmers = 100;
+  BinaryKmer bkmers[nkmers];
+  dBNode nodes[nkmers];
+  bool found;
+
+  db_graph_alloc(&graph, kmer_size, ncols, 1, 1024,
+                 DBG_ALLOC_EDGES | DBG_ALLOC_COL_SETS | DBG_ALLOC_BKTLOCKS);
+  db_graph_set_growable(&graph, 2, 0);
+  TASSERT(db_graph_has_node_in_cols(&graph) && graph.node_in_cols == NULL);
+
+  for(i = 0; i < nkmers; i++) {
+    bkmers[i] = binary_kmer_random(kmer_size);
+    nodes[i] = db_graph_find_or_add_node(&graph, bkmers[i], &found);
+  }
+
+  // Edges are stored for each colour, and OR'd when colours are added again
+  BinaryKmer ebkmer = binary_kmer_random(kmer_size);
+  dBNode enode = db_graph_find_or_add_node(&graph, ebkmer, &found);
+  uint32_t ents[3] = {colset_entry(2, 0x1), colset_entry(7, 0x10),
+                      colset_entry(999, 0x3)};
+  colour_sets_add_mt(graph.col_sets, enode.key, ents, 3);
+  ents[0] = colset_entry(2, 0x4);
+  colour_sets_add_mt(graph.col_sets, enode.key, ents, 1);
+  colour_sets_add_col_mt(graph.col_sets, enode.key, 5);
+
+  ColSetAdder adder = {.graph = &graph, .nodes = nodes,
+                       .n = nkmers, .ncols = ncols};
+  util_multi_thread(&adder, 4, col_sets_add_thread);
+  col_sets_check(&graph, nodes, nkmers, ncols, SIZE_MAX);
+
+  // Lists left behind by adding one colour at a time are removed once the
+  // dictionary is close to its memory limit
+  size_t nchunks = graph.col_sets->num_chunks;
+  TASSERT2(nchunks > 1, "%zu", nchunks);
+  colour_sets_limit_mem(graph.col_sets, colour_sets_dict_mem(graph.col_sets)*2);
+  colour_sets_collect(graph.col_sets);
+  TASSERT2(graph.col_sets->num_chunks < nchunks, "%zu", nchunks);
+  // Five lists, the empty set and the list with edges
+  TASSERT2(colour_sets_num(graph.col_sets) == 7, "%zu",
+           colour_sets_num(graph.col_sets));
+  col_sets_check(&graph, nodes, nkmers, ncols, SIZE_MAX);
+
+  TASSERT(colour_sets_edges(graph.col_sets, enode.key, 2) == 0x5);
+  TASSERT(colour_sets_edges(graph.col_sets, enode.key, 7) == 0x10);
+  TASSERT(colour_sets_edges(graph.col_sets, enode.key, 999) == 0x3);
+  TASSERT(colour_sets_edges(graph.col_sets, enode.key, 5) == 0);
+  TASSERT(db_node_has_col(&graph, enode.key, 5));
+  TASSERT(!db_node_has_col(&graph, enode.key, 3));
+
+  // Nodes with the same colours share a set
+  TASSERT(graph.col_sets->ids[nodes[0].key] == graph.col_sets->ids[nodes[5].key]);
+  TASSERT(graph.col_sets->ids[nodes[0].key] != graph.col_sets->ids[nodes[1].key]);
+
+  // Colour sets move with their kmers
+  db_graph_grow(&graph);
+  for(i = 0; i < nkmers; i++)
+    nodes[i] = db_graph_find(&graph, bkmers[i]);
+  col_sets_check(&graph, nodes, nkmers, ncols, SIZE_MAX);
+
+  db_graph_wipe_colour(&graph, 60);
+  col_sets_check(&graph, nodes, nkmers, ncols, 60);
+
+  db_graph_dealloc(&graph);
+}
+
 void test_db_node()
 {
   test_db_graph_next_nodes();
   test_left_shift();
+  test_covgs8();
+  test_col_sets();
 }
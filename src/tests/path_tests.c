@@ -4,6 +4,10 @@
 #include "build_graph.h"
 #include "generate_paths.h"
 #include "gpath_checks.h"
+#include "gpath_reader.h"
+#include "gpath_save.h"
+
+#include <unistd.h> // unlink
 
 //       junctions:  >     >           <     <     <
 const char seq0[] = "CCTGGGTGCGAATGACACCAAATCGAATGAC"; // a->d
@@ -88,7 +92,7 @@ static void _check_node_paths(const char *kmer,
   #define MAX_SEQ 128
   char seq[MAX_SEQ];
 
-  for(; path != NULL; path = path->next)
+  for(; path != NULL; path = gpath_get_next(path))
   {
     if(path->orient == node.orient &&
        gpath_has_colour(path, gpstore->gpset.ncols, colour))
@@ -176,7 +180,223 @@ static void _test_add_paths()
   db_graph_dealloc(&graph);
 }
 
+// Add paths with random junctions to random kmers
+static void _add_random_paths(dBGraph *graph, size_t nkmers)
+{
+  size_t i, j, col, npaths, ncols = graph->num_of_cols;
+  uint8_t seq[16], nseen[ncols], colset[roundup_bits2bytes(ncols)];
+  hkey_t hkey;
+  bool found;
+
+  for(i = 0; i < nkmers; i++)
+  {
+    BinaryKmer bkey = binary_kmer_random(graph->kmer_size);
+    bkey = binary_kmer_get_key(bkey, graph->kmer_size);
+    hkey = hash_table_find_or_insert(&graph->ht, bkey, &found);
+    if(found) continue;
+
+    npaths = 1 + rand() % 3;
+    for(j = 0; j < npaths; j++) {
+      for(col = 0; col < sizeof(seq); col++) seq[col] = rand();
+      memset(colset, 0, sizeof(colset));
+      for(col = 0; col < ncols; col++) {
+        nseen[col] = col == 0 ? 1 + rand() % 10 : rand() % 3;
+        bitset_or(colset, col, nseen[col] > 0);
+      }
+      // Different lengths so no duplicates
+      GPathNew newgp = {.seq = seq, .colset = colset, .nseen = nseen,
+                        .num_juncs = 1 + 10*j + rand() % 10,
+                        .orient = rand() & 1};
+      gpath_store_add_mt(&graph->gpstore, hkey, newgp);
+    }
+  }
+}
+
+static void _check_paths_match(hkey_t hkey, const dBGraph *graph0,
+                               const dBGraph *graph1,
+                               StrBuf *sbuf0, StrBuf *sbuf1,
+                               GPathSubset *subset0, GPathSubset *subset1)
+{
+  BinaryKmer bkey = hash_table_fetch(&graph0->ht, hkey);
+  hkey_t hkey1 = hash_table_find(&graph1->ht, bkey);
+  TASSERT(hkey1 != HASH_NOT_FOUND);
+  if(hkey1 == HASH_NOT_FOUND) return;
+
+  strbuf_reset(sbuf0);
+  strbuf_reset(sbuf1);
+  gpath_save_sbuf(hkey,  sbuf0, subset0, NULL, NULL, graph0);
+  gpath_save_sbuf(hkey1, sbuf1, subset1, NULL, NULL, graph1);
+  TASSERT2(strcmp(sbuf0->b, sbuf1->b) == 0, "%s\nvs\n%s", sbuf0->b, sbuf1->b);
+}
+
+#define GROW_NTHREADS 4
+#define GROW_NPATHS 100000
+
+// Each thread adds paths labelled with its threadid and path index
+static void _gpath_set_grow_thread(void *arg, size_t threadid)
+{
+  GPathSet *gpset = (GPathSet*)arg;
+  uint8_t seq[64] = {0}, nseen[3], colset[1] = {5};
+  size_t i;
+
+  for(i = 0; i < GROW_NPATHS; i++) {
+    memcpy(seq, &i, sizeof(i));
+    nseen[0] = threadid; nseen[1] = i; nseen[2] = 1;
+    GPathNew newgp = {.seq = seq, .colset = colset, .nseen = nseen,
+                      .num_juncs = 32 + i % 200, .orient = i & 1};
+    gpath_set_add_mt(gpset, newgp);
+  }
+}
+
+// Add paths from several threads to a set that has to grow
+static void _test_gpath_set_grow()
+{
+  test_status("Testing GPathSet grows whilst adding with multiple threads");
+
+  GPathSet gpset;
+  size_t i, n, idx, nthreads = GROW_NTHREADS;
+  uint8_t *seen = ctx_calloc(nthreads * GROW_NPATHS, 1);
+  uint8_t *nseen, *colset;
+  GPath *gpath;
+
+  gpath_set_alloc(&gpset, 3, ONE_MEGABYTE, true, true);
+  util_multi_thread(&gpset, nthreads, _gpath_set_grow_thread);
+
+  n = gpath_set_num_paths(&gpset);
+  TASSERT2(n == nthreads * GROW_NPATHS, "%zu", n);
+  TASSERT(gpset.num_entry_chunks > 1 && gpset.num_seq_chunks > 1);
+
+  for(i = 0; i < n; i++) {
+    gpath = gpath_set_fetch(&gpset, i);
+    TASSERT(gpset_get_pkey(&gpset, gpath) == i);
+    nseen = gpath_set_get_nseen(&gpset, gpath);
+    colset = gpath_get_colset(gpath, gpset.ncols);
+    idx = 0;
+    memcpy(&idx, gpath_get_seq(gpath), sizeof(idx));
+    TASSERT(nseen[0] < nthreads && idx < GROW_NPATHS);
+    TASSERT(nseen[1] == (uint8_t)idx && nseen[2] == 1 && colset[0] == 5);
+    TASSERT(gpath->num_juncs == 32 + idx % 200 && gpath->orient == (idx & 1));
+    seen[nseen[0]*GROW_NPATHS + idx]++;
+  }
+
+  for(i = 0; i < nthreads * GROW_NPATHS && seen[i] == 1; i++) {}
+  TASSERT2(i == nthreads * GROW_NPATHS, "path %zu added %i times", i, seen[i]);
+
+  // Reset keeps chunks, which are then reused
+  size_t mem = gpath_set_mem(&gpset);
+  gpath_set_reset(&gpset);
+  _gpath_set_grow_thread(&gpset, 0);
+  TASSERT(gpath_set_num_paths(&gpset) == GROW_NPATHS);
+  TASSERT(gpath_set_mem(&gpset) == mem);
+
+  ctx_free(seen);
+  gpath_set_dealloc(&gpset);
+}
+
+// Save links then load them into a new graph with `nthreads` threads
+static void _test_save_load_links(bool binary, size_t nthreads)
+{
+  test_status("Testing saving and loading %s link files with %zu threads",
+              binary ? "binary" : "text", nthreads);
+
+  dBGraph graph0, graph1;
+  size_t i, kmer_size = MAX_KMER_SIZE, ncols = 3, nkmers = 10000;
+  dBGraph *graphs[2] = {&graph0, &graph1};
+
+  for(i = 0; i < 2; i++) {
+    db_graph_alloc(graphs[i], kmer_size, ncols, ncols, nkmers*2,
+                   DBG_ALLOC_BKTLOCKS);
+    gpath_store_alloc(&graphs[i]->gpstore, ncols, graphs[i]->ht.capacity,
+                      0, 8*ONE_MEGABYTE, true, false);
+  }
+
+  _add_random_paths(&graph0, nkmers);
+
+  char path[] = "/tmp/ctx_links_XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  if(fd < 0) return;
+  close(fd);
+
+  ZeroSizeBuffer *hists = ctx_calloc(ncols, sizeof(ZeroSizeBuffer));
+
+  FILE *fout = fopen(path, "w");
+  if(binary) gpath_save_bin(fout, path, NULL, NULL, NULL, 0, hists, ncols, &graph0);
+  else gpath_save(fout, path, 4, false, NULL, NULL, NULL, 0, hists, ncols, &graph0);
+  fclose(fout);
+  ctx_free(hists);
+
+  // Load into a new graph
+  GPathReader file;
+  memset(&file, 0, sizeof(file));
+  gpath_reader_open(&file, path);
+  TASSERT(file.binary == binary);
+  TASSERT(gpath_reader_get_num_kmers(&file) == graph0.gpstore.num_kmers_with_paths);
+  gpath_reader_load(&file, GPATH_ADD_MISSING_KMERS, nthreads, &graph1);
+  gpath_reader_close(&file);
+
+  TASSERT(graph1.gpstore.num_kmers_with_paths == graph0.gpstore.num_kmers_with_paths);
+  TASSERT(graph1.gpstore.num_paths == graph0.gpstore.num_paths);
+
+  StrBuf sbuf0, sbuf1;
+  GPathSubset subset0, subset1;
+  strbuf_alloc(&sbuf0, 1024);
+  strbuf_alloc(&sbuf1, 1024);
+  gpath_subset_alloc(&subset0);
+  gpath_subset_alloc(&subset1);
+  gpath_subset_init(&subset0, &graph0.gpstore.gpset);
+  gpath_subset_init(&subset1, &graph1.gpstore.gpset);
+
+  HASH_ITERATE(&graph0.ht, _check_paths_match, &graph0, &graph1,
+               &sbuf0, &sbuf1, &subset0, &subset1);
+
+  // Read links without loading, kmers in binary files should be sorted
+  StrBuf kmer, juncs;
+  SizeBuffer counts;
+  strbuf_alloc(&kmer, 64);
+  strbuf_alloc(&juncs, 64);
+  size_buf_alloc(&counts, 16);
+
+  size_t nkmers_read = 0, nlinks, nlinks_read = 0, njuncs;
+  bool fw, sorted = true;
+  BinaryKmer bkey, prev = zero_bkmer;
+
+  gpath_reader_open(&file, path);
+  while(gpath_reader_read_kmer(&file, &kmer, &nlinks)) {
+    bkey = binary_kmer_from_str(kmer.b, kmer_size);
+    sorted &= (nkmers_read == 0 || binary_kmers_cmp(prev, bkey) < 0);
+    prev = bkey;
+    nkmers_read++;
+    while(gpath_reader_read_link(&file, &fw, &njuncs, &counts, &juncs, NULL, NULL)) {
+      TASSERT(juncs.end == njuncs && counts.len == ncols && counts.b[0] > 0);
+      nlinks_read++;
+    }
+  }
+  gpath_reader_close(&file);
+
+  TASSERT(sorted || !binary);
+  TASSERT(nkmers_read == graph0.gpstore.num_kmers_with_paths);
+  TASSERT(nlinks_read == graph0.gpstore.num_paths);
+
+  strbuf_dealloc(&kmer);
+  strbuf_dealloc(&juncs);
+  size_buf_dealloc(&counts);
+  strbuf_dealloc(&sbuf0);
+  strbuf_dealloc(&sbuf1);
+  gpath_subset_dealloc(&subset0);
+  gpath_subset_dealloc(&subset1);
+  unlink(path);
+
+  db_graph_dealloc(&graph0);
+  db_graph_dealloc(&graph1);
+}
+
 void test_paths()
 {
   _test_add_paths();
+  _test_gpath_set_grow();
+  _test_save_load_links(true, 1);
+  _test_save_load_links(true, 3);
+  _test_save_load_links(false, 1);
+  _test_save_load_links(false, 3);
 }
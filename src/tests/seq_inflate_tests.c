@@ -0,0 +1,279 @@
+#include "global.h"
+#include "all_tests.h"
+#include "seq_inflate.h"
+#include "async_read_io.h"
+
+#include <unistd.h> // read, write, close, pipe
+#include <zlib.h>
+
+// Random FASTQ records, so that seq_file can guess the format
+static size_t rand_fastq(char *buf, size_t len)
+{
+  size_t i, n, end = 0, rlen = 100;
+  for(i = 0; end + 2*rlen + 32 < len; i++) {
+    end += sprintf(buf+end, "@read%zu\n", i);
+    rand_bases(buf+end, rlen);
+    end += rlen;
+    end += sprintf(buf+end, "\n+\n");
+    for(n = 0; n < rlen; n++) buf[end++] = '!' + rand() % 40;
+    buf[end++] = '\n';
+  }
+  return end;
+}
+
+static inline void put_le16(uint8_t *p, uint32_t x) { p[0] = x; p[1] = x >> 8; }
+static inline void put_le32(uint8_t *p, uint32_t x) {
+  p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+// Write BGZF blocks of at most `blocksize` input bytes, then an empty block
+static void write_bgzf(const char *path, const char *data, size_t len,
+                       size_t blocksize)
+{
+  const size_t hdrlen = 18;
+  uint8_t *out = ctx_malloc(hdrlen + compressBound(blocksize) + 8);
+  FILE *fh = fopen(path, "w");
+  size_t pos = 0, n, bsize;
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  TASSERT(fh != NULL);
+  if(fh == NULL) { ctx_free(out); return; }
+
+  while(1) {
+    n = MIN2(len - pos, blocksize);
+    TASSERT(deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK);
+    strm.next_in = (Bytef*)data+pos;
+    strm.avail_in = n;
+    strm.next_out = out+hdrlen;
+    strm.avail_out = compressBound(blocksize);
+    TASSERT(deflate(&strm, Z_FINISH) == Z_STREAM_END);
+    bsize = hdrlen + strm.total_out + 8;
+    deflateEnd(&strm);
+
+    memcpy(out, "\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+    put_le16(out+16, bsize-1);
+    put_le32(out+bsize-8, crc32(0, (const Bytef*)data+pos, n));
+    put_le32(out+bsize-4, n);
+    TASSERT(fwrite(out, 1, bsize, fh) == bsize);
+
+    if(n == 0) break;
+    pos += n;
+  }
+
+  fclose(fh);
+  ctx_free(out);
+}
+
+// Read everything from a file descriptor
+static size_t read_fd(int fd, char *buf, size_t len)
+{
+  ssize_t n;
+  size_t end = 0;
+  while(end < len && (n = read(fd, buf+end, len-end)) > 0) end += n;
+  return end;
+}
+
+// Decompress with zlib
+static size_t gzread_all(const char *path, char *buf, size_t len)
+{
+  gzFile gz = gzopen(path, "r");
+  int n;
+  size_t end = 0;
+  TASSERT(gz != NULL);
+  if(gz == NULL) return 0;
+  while(end < len && (n = gzread(gz, buf+end, MIN2(len-end, (size_t)INT_MAX))) > 0)
+    end += n;
+  gzclose(gz);
+  return end;
+}
+
+// Inflate `path` through a SeqInflate, compare with zlib and `exp`
+static void check_inflate(const char *path, size_t nthreads,
+                          const char *exp, size_t explen)
+{
+  char *out = ctx_malloc(explen+1), *zout = ctx_malloc(explen+1);
+  size_t outlen = 0, zlen = gzread_all(path, zout, explen+1);
+
+  seq_file_t *sf = seq_open(path);
+  TASSERT(sf != NULL);
+  if(sf == NULL) { ctx_free(out); ctx_free(zout); return; }
+
+  SeqInflate *inf = seq_inflate_open(sf, nthreads);
+  TASSERT(inf != NULL);
+  if(inf != NULL) {
+    int fd = seq_inflate_fd(inf);
+    outlen = read_fd(fd, out, explen+1);
+    close(fd);
+    seq_inflate_close(inf);
+  }
+  seq_close(sf);
+
+  TASSERT2(zlen == explen, "%zu vs %zu", zlen, explen);
+  TASSERT2(outlen == zlen, "%zu vs %zu", outlen, zlen);
+  TASSERT(memcmp(out, zout, MIN2(outlen, zlen)) == 0);
+  TASSERT(memcmp(out, exp, MIN2(outlen, explen)) == 0);
+
+  ctx_free(out);
+  ctx_free(zout);
+}
+
+// Input that is not a regular file has already been read by seq_file, so
+// must not be opened again
+static void check_pipe_not_inflated(const char *data, size_t len)
+{
+  int fds[2];
+  char fdpath[50];
+  TASSERT(pipe(fds) == 0);
+
+  // Pipe buffer holds a small gzip file without blocking
+  gzFile gz = gzdopen(dup(fds[1]), "w");
+  TASSERT(gz != NULL);
+  gzwrite(gz, data, MIN2(len, 4000));
+  gzclose(gz);
+  close(fds[1]);
+
+  sprintf(fdpath, "/dev/fd/%i", fds[0]);
+  seq_file_t *sf = seq_open(fdpath);
+  TASSERT(sf != NULL);
+  if(sf != NULL) {
+    TASSERT(seq_inflate_open(sf, 2) == NULL);
+    seq_close(sf);
+  }
+  close(fds[0]);
+}
+
+// Stop reading after `nbytes`, writer threads must not be left blocked or be
+// killed by SIGPIPE
+static void check_close_early(const char *path, size_t nthreads, size_t nbytes)
+{
+  char buf[1000];
+  seq_file_t *sf = seq_open(path);
+  TASSERT(sf != NULL);
+  if(sf == NULL) return;
+
+  SeqInflate *inf = seq_inflate_open(sf, nthreads);
+  TASSERT(inf != NULL);
+  if(inf != NULL) {
+    if(nbytes > 0) {
+      int fd = seq_inflate_fd(inf);
+      TASSERT(read_fd(fd, buf, MIN2(nbytes, sizeof(buf))) > 0);
+      close(fd);
+    }
+    seq_inflate_close(inf);
+  }
+  seq_close(sf);
+}
+
+// Number of bytes in the first `nreads` FASTQ records
+static size_t fastq_prefix(const char *data, size_t len, size_t nreads)
+{
+  size_t i, nlines = 0;
+  for(i = 0; i < len && nlines < 4*nreads; i++) nlines += (data[i] == '\n');
+  return i;
+}
+
+typedef struct {
+  size_t nreads, nmismatch;
+} InflatePairs;
+
+static void count_inflated_pairs(AsyncIOData *data, size_t threadid, void *arg)
+{
+  (void)threadid;
+  InflatePairs *cnt = (InflatePairs*)arg;
+  cnt->nreads++;
+  cnt->nmismatch += (strcmp(data->r1.name.b, data->r2.name.b) != 0 ||
+                     strcmp(data->r1.seq.b, data->r2.seq.b) != 0);
+}
+
+// Paired files with different numbers of reads stop at the end of the shorter
+// file, whilst the other is still being decompressed (as `-t 2`)
+static void check_uneven_pairs(const char *path1, const char *path2, size_t exp)
+{
+  char arg[PATH_MAX*2+2];
+  AsyncIOInput task;
+  InflatePairs cnts[2];
+  memset(cnts, 0, sizeof(cnts));
+
+  sprintf(arg, "%s:%s", path1, path2);
+  asyncio_task_parse(&task, '2', arg, 0, NULL);
+  asyncio_run_pool(&task, 1, count_inflated_pairs, cnts, 2, sizeof(InflatePairs));
+  asyncio_task_close(&task);
+
+  TASSERT2(cnts[0].nreads + cnts[1].nreads == exp, "%zu vs %zu",
+           cnts[0].nreads + cnts[1].nreads, exp);
+  TASSERT(cnts[0].nmismatch + cnts[1].nmismatch == 0);
+}
+
+static void write_gzip(const char *path, const char *data, size_t len)
+{
+  gzFile gz = gzopen(path, "w");
+  TASSERT(gz != NULL);
+  if(gz == NULL) return;
+  TASSERT(gzwrite(gz, data, len) == (int)len);
+  gzclose(gz);
+}
+
+// Both files are larger than the pipe buffer
+static void test_inflate_uneven_pairs(const char *data, size_t len)
+{
+  const size_t nshort = 1000;
+  size_t shortlen = fastq_prefix(data, len, nshort);
+  char path1[] = "/tmp/ctx_inflate_XXXXXX";
+  char path2[] = "/tmp/ctx_inflate_XXXXXX";
+  int fd1 = mkstemp(path1), fd2 = mkstemp(path2);
+  TASSERT(fd1 >= 0 && fd2 >= 0);
+  if(fd1 < 0 || fd2 < 0) return;
+  close(fd1);
+  close(fd2);
+
+  TASSERT(shortlen > 1<<16 && len - shortlen > 1<<16);
+
+  write_bgzf(path1, data, len, 20000);
+  write_bgzf(path2, data, shortlen, 20000);
+  check_uneven_pairs(path1, path2, nshort);
+  check_uneven_pairs(path2, path1, nshort);
+
+  write_gzip(path1, data, len);
+  write_gzip(path2, data, shortlen);
+  check_uneven_pairs(path1, path2, nshort);
+  check_uneven_pairs(path2, path1, nshort);
+
+  unlink(path1);
+  unlink(path2);
+}
+
+void test_seq_inflate()
+{
+  test_status("Testing decompressing input in threads (seq_inflate.h)...");
+
+  size_t len = 3*ONE_MEGABYTE, nthreads;
+  char *data = ctx_malloc(len);
+  len = rand_fastq(data, len);
+
+  char path[] = "/tmp/ctx_inflate_XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd >= 0);
+  if(fd < 0) { ctx_free(data); return; }
+  close(fd);
+
+  // BGZF with several batches of blocks
+  write_bgzf(path, data, len, 20000);
+  for(nthreads = 1; nthreads <= 4; nthreads++) {
+    check_inflate(path, nthreads, data, len);
+    check_close_early(path, nthreads, 0);
+    check_close_early(path, nthreads, 1000);
+  }
+
+  // Plain gzip
+  write_gzip(path, data, len);
+  check_inflate(path, 2, data, len);
+  check_close_early(path, 2, 0);
+  check_close_early(path, 2, 1000);
+
+  check_pipe_not_inflated(data, len);
+  test_inflate_uneven_pairs(data, len);
+
+  unlink(path);
+  ctx_free(data);
+}
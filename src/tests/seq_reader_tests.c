@@ -0,0 +1,216 @@
+#include "global.h"
+#include "all_tests.h"
+#include "seq_reader.h"
+#include "async_read_io.h"
+
+#include <unistd.h> // write, close, pipe
+
+typedef struct {
+  const char *name, *seq, *qual;
+} TestRead;
+
+// Parse `input` with seq_buf_next()/seq_buf_read(), compare with `exp`
+// `exp_end` is the value expected from seq_buf_next() after the last record
+static void check_buf_reads(const char *input, bool eof,
+                            const TestRead *exp, size_t nexp, int exp_end)
+{
+  size_t i, pos = 0, end = 0, len = strlen(input);
+  char *buf = ctx_malloc(len+1); // one byte spare to NUL terminate
+  memcpy(buf, input, len);
+  read_t r;
+  int s = 0;
+
+  for(i = 0; (s = seq_buf_next(buf, len, pos, eof, &end)) == 1; i++) {
+    TASSERT(pos < end && end <= len);
+    seq_buf_read(buf, pos, end, &r);
+    if(i < nexp) {
+      TASSERT2(strcmp(r.name.b, exp[i].name) == 0, "%s", r.name.b);
+      TASSERT2(strcmp(r.seq.b, exp[i].seq) == 0, "%s", r.seq.b);
+      TASSERT2(strcmp(r.qual.b, exp[i].qual) == 0, "%s", r.qual.b);
+      TASSERT(r.name.end == strlen(exp[i].name));
+      TASSERT(r.seq.end == strlen(exp[i].seq));
+      TASSERT(r.qual.end == strlen(exp[i].qual));
+    }
+    pos = end;
+  }
+
+  TASSERT2(i == nexp, "%zu vs %zu", i, nexp);
+  TASSERT2(s == exp_end, "%i vs %i", s, exp_end);
+
+  ctx_free(buf);
+}
+
+// Records must be found the same way when only part of the input has been
+// read: each prefix either holds complete records or asks for more input
+static void check_buf_prefixes(const char *input)
+{
+  size_t i, len = strlen(input), nrecs = 0, pos, end;
+  size_t *ends = ctx_calloc(len+1, sizeof(size_t));
+
+  for(pos = 0; seq_buf_next(input, len, pos, true, &end) == 1; pos = end)
+    ends[nrecs++] = end;
+
+  for(len = 0; input[len]; len++) {
+    for(pos = 0, i = 0; seq_buf_next(input, len, pos, false, &end) == 1; i++) {
+      TASSERT(i < nrecs && end == ends[i]);
+      if(i >= nrecs || end != ends[i]) break;
+      pos = end;
+    }
+  }
+
+  ctx_free(ends);
+}
+
+static void test_seq_buf_fasta()
+{
+  // Multi-line records, blank lines, empty sequence, no final newline
+  const char *fa = ">r1 desc\nACGT\nAAC\n\n>r2\nGG\n>r3\n>r4\nCA\nT";
+  TestRead fa_reads[] = {{"r1 desc", "ACGTAAC", ""}, {"r2", "GG", ""},
+                         {"r3", "", ""}, {"r4", "CAT", ""}};
+  check_buf_reads(fa, true, fa_reads, 4, 0);
+  check_buf_prefixes(fa);
+
+  // Without end of input, the last record may not be complete
+  check_buf_reads(fa, false, fa_reads, 3, 0);
+
+  // CRLF line endings
+  const char *fa_crlf = ">r1\r\nACGT\r\nAAC\r\n>r2\r\nGG\r\n";
+  TestRead fa_crlf_reads[] = {{"r1", "ACGTAAC", ""}, {"r2", "GG", ""}};
+  check_buf_reads(fa_crlf, true, fa_crlf_reads, 2, 0);
+}
+
+static void test_seq_buf_fastq()
+{
+  // Quality lines starting with '@' and '+', multi-line records
+  const char *fq = "@r1\nACGT\n+\n@@II\n"
+                   "@r2\nAC\n+r2\n+I\n"
+                   "@r3\nACG\nTT\n+\n@I\n+II\n"
+                   "\n@r4\n\n+\n\n";
+  TestRead fq_reads[] = {{"r1", "ACGT", "@@II"}, {"r2", "AC", "+I"},
+                         {"r3", "ACGTT", "@I+II"}, {"r4", "", ""}};
+  check_buf_reads(fq, true, fq_reads, 4, 0);
+  check_buf_prefixes(fq);
+
+  // CRLF line endings
+  const char *fq_crlf = "@r1\r\nACGT\r\n+\r\n@@II\r\n@r2\r\nAC\r\n+\r\n+I\r\n";
+  TestRead fq_crlf_reads[] = {{"r1", "ACGT", "@@II"}, {"r2", "AC", "+I"}};
+  check_buf_reads(fq_crlf, true, fq_crlf_reads, 2, 0);
+  check_buf_prefixes(fq_crlf);
+
+  // No final newline
+  const char *fq_nonl = "@r1\nACGT\n+\nIIII\n@r2\nAC\n+\nII";
+  TestRead fq_nonl_reads[] = {{"r1", "ACGT", "IIII"}, {"r2", "AC", "II"}};
+  check_buf_reads(fq_nonl, true, fq_nonl_reads, 2, 0);
+  check_buf_reads(fq_nonl, false, fq_nonl_reads, 1, 0);
+
+  // Truncated final record: short quality string is passed on (and warned
+  // about by seq_check_read()), a record without a '+' line is an error
+  const char *fq_shortq = "@r1\nACGT\n+\nIIII\n@r2\nACGT\n+\nII";
+  TestRead fq_shortq_reads[] = {{"r1", "ACGT", "IIII"}, {"r2", "ACGT", "II"}};
+  check_buf_reads(fq_shortq, true, fq_shortq_reads, 2, 0);
+
+  const char *fq_noqual = "@r1\nACGT\n+\nIIII\n@r2\nACGT\n+\n";
+  TestRead fq_noqual_reads[] = {{"r1", "ACGT", "IIII"}, {"r2", "ACGT", ""}};
+  check_buf_reads(fq_noqual, true, fq_noqual_reads, 2, 0);
+
+  const char *fq_noplus = "@r1\nACGT\n+\nIIII\n@r2\nACGT\n";
+  check_buf_reads(fq_noplus, true, fq_noqual_reads, 1, -1);
+  check_buf_reads(fq_noplus, false, fq_noqual_reads, 1, 0);
+
+  // Not FASTQ/FASTA
+  check_buf_reads("@r1\nACGT\n+\nIIII\nr2\nACGT\n", true,
+                  fq_noqual_reads, 1, -1);
+}
+
+//
+// Reading paired files through async_read_io
+//
+
+typedef struct {
+  size_t nreads, nmismatch;
+} ReadCount;
+
+static void count_pairs(AsyncIOData *data, size_t threadid, void *arg)
+{
+  (void)threadid;
+  ReadCount *cnt = (ReadCount*)arg;
+  cnt->nreads++;
+  cnt->nmismatch += (strcmp(data->r1.name.b, data->r2.name.b) != 0 ||
+                     strcmp(data->r1.seq.b, data->r2.seq.b) != 0);
+}
+
+static void write_file(const char *path, const char *str)
+{
+  FILE *fh = fopen(path, "w");
+  TASSERT(fh != NULL);
+  if(fh == NULL) return;
+  fputs(str, fh);
+  fclose(fh);
+}
+
+// Write `str` into a pipe, return path to read it from
+static void write_pipe(int fds[2], char *fdpath, const char *str)
+{
+  size_t len = strlen(str); // small enough to fit in pipe buffer
+  TASSERT(pipe(fds) == 0);
+  TASSERT(write(fds[1], str, len) == (ssize_t)len);
+  close(fds[1]);
+  sprintf(fdpath, "/dev/fd/%i", fds[0]);
+}
+
+static void check_pairs(const char *path1, const char *path2, size_t exp)
+{
+  char arg[PATH_MAX*2+2];
+  AsyncIOInput task;
+  ReadCount cnt = {0, 0};
+
+  sprintf(arg, "%s:%s", path1, path2);
+  asyncio_task_parse(&task, '2', arg, 0, NULL);
+  asyncio_run_pool(&task, 1, count_pairs, &cnt, 1, sizeof(ReadCount));
+  asyncio_task_close(&task);
+
+  TASSERT2(cnt.nreads == exp, "%zu vs %zu", cnt.nreads, exp);
+  TASSERT(cnt.nmismatch == 0);
+}
+
+static void test_seq_pairs()
+{
+  const char *fq3 = "@r1\nACGT\n+\nIIII\n@r2\nAC\n+\nII\n@r3\nA\n+\nI\n";
+  const char *fq2 = "@r1\nACGT\n+\nIIII\n@r2\nAC\n+\nII\n";
+  char path1[] = "/tmp/ctx_seq_reader_XXXXXX";
+  char path2[] = "/tmp/ctx_seq_reader_XXXXXX";
+  char fdpath[50];
+  int fd1 = mkstemp(path1), fd2 = mkstemp(path2), fds[2];
+  TASSERT(fd1 >= 0 && fd2 >= 0);
+  if(fd1 < 0 || fd2 < 0) return;
+  close(fd1);
+  close(fd2);
+
+  write_file(path1, fq3);
+  write_file(path2, fq2);
+
+  // Regular files are parsed in place, pairs stop when a file ends
+  check_pairs(path1, path1, 3);
+  check_pairs(path1, path2, 2);
+  check_pairs(path2, path1, 2);
+
+  // Pipes have been read from already, so must not be opened again by path
+  write_pipe(fds, fdpath, fq3);
+  check_pairs(path1, fdpath, 3);
+  close(fds[0]);
+
+  write_pipe(fds, fdpath, fq3);
+  check_pairs(fdpath, path2, 2);
+  close(fds[0]);
+
+  unlink(path1);
+  unlink(path2);
+}
+
+void test_seq_reader()
+{
+  test_status("Testing parsing FASTQ/FASTA in place (seq_reader.h)...");
+  test_seq_buf_fasta();
+  test_seq_buf_fastq();
+  test_seq_pairs();
+}
@@ -145,6 +145,40 @@ static void test_util_calc_N50()
   TASSERT(calc_N50(arr, 10, 55) == 8);
 }
 
+static void test_alloc_large()
+{
+  test_status("Testing ctx_large_alloc()");
+
+  const uint8_t fill[3] = {1,2,3};
+  size_t i, h, nel = 20*ONE_MEGABYTE; // enough to fill with several threads
+  bool hugepages = alloc_get_hugepages();
+  size_t nthreads = alloc_get_nthreads();
+  uint8_t *ptr;
+
+  for(h = 0; h < 2; h++)
+  {
+    alloc_set_hugepages(h);
+    alloc_set_nthreads(h ? 4 : 1);
+    ptr = ctx_large_alloc(nel, sizeof(fill), fill);
+    for(i = 0; i < nel*sizeof(fill) && ptr[i] == fill[i%3]; i++) {}
+    TASSERT(i == nel*sizeof(fill));
+
+    alloc_large_fill(ptr, nel, sizeof(fill), NULL);
+    for(i = 0; i < nel*sizeof(fill) && ptr[i] == 0; i++) {}
+    TASSERT(i == nel*sizeof(fill));
+    ctx_large_free(ptr);
+
+    ptr = ctx_large_alloc(100, 1, NULL);
+    for(i = 0; i < 100 && ptr[i] == 0; i++) {}
+    TASSERT(i == 100);
+    ctx_large_free(ptr);
+  }
+
+  ctx_large_free(NULL);
+  alloc_set_hugepages(hugepages);
+  alloc_set_nthreads(nthreads);
+}
+
 void test_util()
 {
   test_util_rev_nibble_lookup();
@@ -154,4 +188,5 @@ void test_util()
   test_util_calc_GCD();
   test_util_calc_N50();
   test_strnstr();
+  test_alloc_large();
 }
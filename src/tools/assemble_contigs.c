@@ -281,7 +281,7 @@ static int _assemble_from_paths(hkey_t hkey, Assembler *assem)
 
   gpath_set_reset(gpset);
 
-  for(; gpath != NULL; gpath = gpath->next)
+  for(; gpath != NULL; gpath = gpath_get_next(gpath))
   {
     pathid = gpset_get_pkey(&gpstore->gpset, gpath);
 
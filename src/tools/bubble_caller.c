@@ -500,7 +500,7 @@ void invoke_bubble_caller(size_t num_of_threads,
                           const dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols == 1);
-  ctx_assert(db_graph->node_in_cols != NULL);
+  ctx_assert(db_graph_has_node_in_cols(db_graph));
   size_t i;
 
   status("Calling bubbles with %zu threads, output: %s", num_of_threads, out_path);
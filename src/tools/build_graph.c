@@ -59,36 +59,51 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
     got_kmer2 = (start2 < r2->seq.end);
   }
 
-  bool found1 = false, found2 = false;
+  bool found1 = false, found2 = false, novel1 = false, novel2 = false;
+  size_t epoch;
 
-  // Look up first kmer
-  if(got_kmer1) {
-    bkmer1 = binary_kmer_from_str(r1->seq.b + start1, kmer_size);
-    node1 = db_graph_find_or_add_node_mt(db_graph, bkmer1, &found1);
-  }
+  if(got_kmer1) bkmer1 = binary_kmer_from_str(r1->seq.b + start1, kmer_size);
+  if(got_kmer2) bkmer2 = binary_kmer_from_str(r2->seq.b + start2, kmer_size);
+
+  // Look up first and second kmers, growing the graph if it is full
+  while(1)
+  {
+    epoch = db_graph_grow_enter(db_graph);
+
+    if(got_kmer1) {
+      node1 = db_graph_find_or_add_node_mt(db_graph, bkmer1, &found1);
+      novel1 |= (node1.key != HASH_NOT_FOUND && !found1);
+    }
+
+    if(got_kmer2) {
+      node2 = db_graph_find_or_add_node_mt(db_graph, bkmer2, &found2);
+      novel2 |= (node2.key != HASH_NOT_FOUND && !found2);
+    }
 
-  // Look up second kmer
-  if(got_kmer2) {
-    bkmer2 = binary_kmer_from_str(r2->seq.b + start2, kmer_size);
-    node2 = db_graph_find_or_add_node_mt(db_graph, bkmer2, &found2);
+    if((!got_kmer1 || node1.key != HASH_NOT_FOUND) &&
+       (!got_kmer2 || node2.key != HASH_NOT_FOUND)) break;
+
+    db_graph_grow_exit(db_graph, epoch);
+    db_graph_grow_mt(db_graph, epoch);
   }
 
-  size_t num_kmers_novel = !found1 + !found2;
+  size_t num_kmers_novel = novel1 + novel2;
   __sync_fetch_and_add((volatile size_t*)&stats->num_kmers_novel, num_kmers_novel);
 
   // Each read gives no kmer or a duplicate kmer
   // used find_or_insert so if we have a kmer we have a graph node
-  if((!got_kmer1 || db_node_has_read_start_mt(db_graph, node1)) &&
-     (!got_kmer2 || db_node_has_read_start_mt(db_graph, node2)))
-  {
-    return false;
-  }
+  bool is_novel = !((!got_kmer1 || db_node_has_read_start_mt(db_graph, node1)) &&
+                    (!got_kmer2 || db_node_has_read_start_mt(db_graph, node2)));
 
   // Read is novel
-  if(got_kmer1) (void)db_node_set_read_start_mt(db_graph, node1);
-  if(got_kmer2) (void)db_node_set_read_start_mt(db_graph, node2);
+  if(is_novel) {
+    if(got_kmer1) (void)db_node_set_read_start_mt(db_graph, node1);
+    if(got_kmer2) (void)db_node_set_read_start_mt(db_graph, node2);
+  }
+
+  db_graph_grow_exit(db_graph, epoch);
 
-  return true;
+  return is_novel;
 }
 
 
@@ -96,68 +111,152 @@ static bool seq_reads_are_novel(read_t *r1, read_t *r2,
 // Add to the de bruijn graph
 //
 
-static inline dBNode _find_or_insert(dBGraph *db_graph,
-                                     BinaryKmer bkmer, size_t colour,
-                                     bool must_exist_in_graph, bool *found)
+// Number of kmers from a contig looked up in the hash table at once
+#define BUILD_GRAPH_BATCH 64
+
+// Find or add the kmers in bkmers[0..n-1] (with keys bkeys[0..n-1]) that are
+// solid. Kmers that are not solid get node HASH_NOT_FOUND, and are counted in
+// *num_skipped. Returns number of bkmers resolved, see
+// db_graph_find_or_add_nodes_mt()
+static size_t find_or_add_solid_nodes_mt(dBGraph *db_graph,
+                                         const KmerBloom *solid_kmers,
+                                         const BinaryKmer *bkmers,
+                                         const BinaryKmer *bkeys, size_t n,
+                                         dBNode *nodes, bool *found,
+                                         size_t *num_skipped)
 {
-  dBNode node;
-  if(must_exist_in_graph)
-  {
-    // Doesn't have to be threadsafe find_mt, since we are not adding
-    node = db_graph_find_node(db_graph, bkmer);
-    *found = (node.key != HASH_NOT_FOUND);
-    if(*found) db_graph_update_node_mt(db_graph, node, colour);
+  BinaryKmer solid[BUILD_GRAPH_BATCH], solid_keys[BUILD_GRAPH_BATCH];
+  dBNode solid_nodes[BUILD_GRAPH_BATCH];
+  bool solid_found[BUILD_GRAPH_BATCH];
+  size_t idx[BUILD_GRAPH_BATCH], i, j, nsolid = 0, m;
+
+  for(i = 0; i < n; i++) {
+    if(kmer_bloom_is_solid(solid_kmers, bkeys[i])) {
+      solid[nsolid] = bkmers[i];
+      solid_keys[nsolid] = bkeys[i];
+      idx[nsolid++] = i;
+    }
+    nodes[i] = (dBNode)DB_NODE_INIT;
+    found[i] = false;
   }
-  else
-  {
-    node = db_graph_find_or_add_node_mt(db_graph, bkmer, found);
-    db_graph_update_node_mt(db_graph, node, colour);
+
+  m = db_graph_find_or_add_nodes_mt(db_graph, solid, solid_keys, nsolid,
+                                    solid_nodes, solid_found);
+
+  for(j = 0; j < m; j++) {
+    nodes[idx[j]] = solid_nodes[j];
+    found[idx[j]] = solid_found[j];
   }
-  return node;
+
+  // All resolved, or resolved up to the first solid kmer not added
+  n = (m < nsolid ? idx[m] : n);
+  *num_skipped += n - m;
+  return n;
 }
 
 // Threadsafe
 // Sequence must be entirely ACGT and len >= kmer_size
+// If solid_kmers is not NULL, only kmers it has seen KMER_BLOOM_SOLID times
+// are added, the number skipped is added to *num_skipped
 // Returns number of non-novel kmers seen
-size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
-                               const char *seq, size_t len,
-                               bool must_exist_in_graph)
+static size_t _build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
+                                       const char *seq, size_t len,
+                                       bool must_exist_in_graph,
+                                       const KmerBloom *solid_kmers,
+                                       size_t *num_skipped)
 {
   ctx_assert(len >= db_graph->kmer_size);
-  const size_t kmer_size = db_graph->kmer_size;
-  BinaryKmer bkmer;
-  Nucleotide nuc;
-  dBNode prev, curr;
-  size_t i, num_nonnovel_kmers = 0;
+  ctx_assert(!must_exist_in_graph || !solid_kmers);
+  const size_t kmer_size = db_graph->kmer_size, nkmers = len + 1 - kmer_size;
+  BinaryKmer fw = zero_bkmer, rv = zero_bkmer;
+  BinaryKmer bkmers[BUILD_GRAPH_BATCH], bkeys[BUILD_GRAPH_BATCH];
+  dBNode prev = DB_NODE_INIT, nodes[BUILD_GRAPH_BATCH];
+  bool found[BUILD_GRAPH_BATCH];
+  size_t i, j, n, m, num_nonnovel_kmers = 0;
   size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
-  bool found;
+  size_t epoch = db_graph_grow_enter(db_graph);
 
-  bkmer = binary_kmer_from_str(seq, kmer_size);
-  prev = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-  num_nonnovel_kmers += found;
+  binary_kmer_roll_str(seq, kmer_size-1, kmer_size, &fw, &rv, NULL, NULL);
 
-  for(i = kmer_size; i < len; i++, prev = curr)
+  // Look up kmers a batch at a time so hash table buckets can be prefetched,
+  // then add coverage and edges in order
+  for(i = 0; i < nkmers; i += n)
   {
-    nuc = dna_char_to_nuc(seq[i]);
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    curr = _find_or_insert(db_graph, bkmer, colour, must_exist_in_graph, &found);
-    if(prev.key != HASH_NOT_FOUND && curr.key != HASH_NOT_FOUND)
-      db_graph_add_edge_mt(db_graph, edge_col, prev, curr);
-    num_nonnovel_kmers += found;
+    n = MIN2(nkmers - i, BUILD_GRAPH_BATCH);
+    binary_kmer_roll_str(seq+i+kmer_size-1, n, kmer_size, &fw, &rv,
+                         bkmers, bkeys);
+
+    bool graph_full = false;
+
+    if(must_exist_in_graph) {
+      // Doesn't have to be threadsafe find_mt, since we are not adding
+      for(j = 0; j < n; j++) {
+        nodes[j] = db_graph_find_node(db_graph, bkmers[j]);
+        found[j] = (nodes[j].key != HASH_NOT_FOUND);
+      }
+    }
+    else {
+      if(solid_kmers != NULL) {
+        m = find_or_add_solid_nodes_mt(db_graph, solid_kmers, bkmers, bkeys, n,
+                                       nodes, found, num_skipped);
+      } else {
+        m = db_graph_find_or_add_nodes_mt(db_graph, bkmers, bkeys, n,
+                                          nodes, found);
+      }
+
+      if(m < n) {
+        // Growable graph is full: add the nodes we have, then continue from
+        // the first missing kmer once the graph has grown
+        graph_full = true;
+        n = m;
+        fw = rv = zero_bkmer;
+        binary_kmer_roll_str(seq+i+n, kmer_size-1, kmer_size, &fw, &rv,
+                             NULL, NULL);
+      }
+    }
+
+    for(j = 0; j < n; prev = nodes[j++]) {
+      if(nodes[j].key == HASH_NOT_FOUND) continue;
+      db_graph_update_node_mt(db_graph, nodes[j], colour);
+      if(prev.key != HASH_NOT_FOUND)
+        db_graph_add_edge_mt(db_graph, edge_col, prev, nodes[j]);
+      num_nonnovel_kmers += found[j];
+    }
+
+    if(graph_full) {
+      db_graph_grow_exit(db_graph, epoch);
+      db_graph_grow_mt(db_graph, epoch);
+      epoch = db_graph_grow_enter(db_graph);
+      // nodes have moved, look up the last kmer again
+      if(prev.key != HASH_NOT_FOUND) {
+        prev = db_graph_find_node(db_graph,
+                                  binary_kmer_from_str(seq+i+n-1, kmer_size));
+      }
+    }
   }
 
+  db_graph_grow_exit(db_graph, epoch);
+
   return num_nonnovel_kmers;
 }
 
+size_t build_graph_from_str_mt(dBGraph *db_graph, size_t colour,
+                               const char *seq, size_t len,
+                               bool must_exist_in_graph)
+{
+  return _build_graph_from_str_mt(db_graph, colour, seq, len,
+                                  must_exist_in_graph, NULL, NULL);
+}
+
 // Already found a start position
 // Stats must be private to this thread
 static void load_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
-                      bool must_exist_in_graph, Colour colour,
-                      SeqLoadingStats *stats, dBGraph *db_graph)
+                      bool must_exist_in_graph, const KmerBloom *solid_kmers,
+                      Colour colour, SeqLoadingStats *stats, dBGraph *db_graph)
 {
   const size_t kmer_size = db_graph->kmer_size;
   size_t contig_start, contig_end, contig_len;
-  size_t num_contigs = 0, search_start = 0, num_nonnovel_kmers;
+  size_t num_contigs = 0, search_start = 0, num_nonnovel_kmers, num_skipped;
 
   while((contig_start = seq_contig_start(r, search_start, kmer_size,
                                          qual_cutoff, hp_cutoff)) < r->seq.end)
@@ -166,11 +265,14 @@ static void load_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
                                 qual_cutoff, hp_cutoff, &search_start);
 
     contig_len = contig_end - contig_start;
-    num_nonnovel_kmers = build_graph_from_str_mt(db_graph, colour,
-                                                 r->seq.b+contig_start, contig_len,
-                                                 must_exist_in_graph);
-
-    size_t contig_kmers = contig_len + 1 - kmer_size;
+    num_skipped = 0;
+    num_nonnovel_kmers = _build_graph_from_str_mt(db_graph, colour,
+                                                  r->seq.b+contig_start, contig_len,
+                                                  must_exist_in_graph,
+                                                  solid_kmers, &num_skipped);
+
+    // Kmers that are not solid are not loaded
+    size_t contig_kmers = contig_len + 1 - kmer_size - num_skipped;
     size_t num_novel_kmers = contig_kmers - num_nonnovel_kmers;
 
     stats->total_bases_loaded += contig_len;
@@ -224,9 +326,9 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
   }
   else {
     load_read(r1, fq_cutoff1, prefs->hp_cutoff, prefs->must_exist_in_graph,
-              prefs->colour, stats, db_graph);
+              prefs->solid_kmers, prefs->colour, stats, db_graph);
     if(r2) load_read(r2, fq_cutoff2, prefs->hp_cutoff, prefs->must_exist_in_graph,
-                     prefs->colour, stats, db_graph);
+                     prefs->solid_kmers, prefs->colour, stats, db_graph);
   }
 }
 
@@ -300,6 +402,116 @@ void build_graph(dBGraph *db_graph, BuildGraphTask *files,
   db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, max_col+1);
 }
 
+//
+// Counting kmers before building (two pass build)
+//
+
+typedef struct {
+  KmerBloom *bloom;
+  size_t kmer_size;
+  uint64_t num_kmers, num_solid; // first and second sightings of kmers
+  size_t nreads;
+  volatile size_t *shared_nreads;
+} CountKmersThread;
+
+static void count_read_kmers(const read_t *r, uint8_t qual_cutoff,
+                             uint8_t hp_cutoff, CountKmersThread *wrkr)
+{
+  const size_t kmer_size = wrkr->kmer_size;
+  size_t i, j, n, contig_start, contig_end, search_start = 0;
+  BinaryKmer fw, rv, bkeys[BUILD_GRAPH_BATCH];
+  uint8_t count;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         qual_cutoff, hp_cutoff)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size,
+                                qual_cutoff, hp_cutoff, &search_start);
+
+    fw = rv = zero_bkmer;
+    binary_kmer_roll_str(r->seq.b + contig_start, kmer_size-1, kmer_size,
+                         &fw, &rv, NULL, NULL);
+
+    for(i = contig_start + kmer_size - 1; i < contig_end; i += n) {
+      n = MIN2(contig_end - i, BUILD_GRAPH_BATCH);
+      binary_kmer_roll_str(r->seq.b + i, n, kmer_size, &fw, &rv, NULL, bkeys);
+      for(j = 0; j < n; j++) {
+        count = kmer_bloom_add_mt(wrkr->bloom, bkeys[j]);
+        wrkr->num_kmers += (count == 0);
+        wrkr->num_solid += (count+1 == KMER_BLOOM_SOLID);
+      }
+    }
+  }
+}
+
+static void add_reads_to_bloom(AsyncIOData *data, size_t threadid, void *ptr)
+{
+  (void)threadid;
+  CountKmersThread *wrkr = (CountKmersThread*)ptr;
+  const BuildGraphTask *task = (BuildGraphTask*)data->ptr;
+  const SeqLoadingPrefs *prefs = &task->prefs;
+  read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
+
+  uint8_t fq_cutoff1 = prefs->fq_cutoff, fq_cutoff2 = prefs->fq_cutoff;
+
+  if(prefs->fq_cutoff) {
+    fq_cutoff1 += data->fq_offset1;
+    fq_cutoff2 += data->fq_offset2;
+  }
+
+  count_read_kmers(&data->r1, fq_cutoff1, prefs->hp_cutoff, wrkr);
+  if(r2) count_read_kmers(r2, fq_cutoff2, prefs->hp_cutoff, wrkr);
+
+  // Print progress
+  wrkr->nreads++;
+  if(wrkr->nreads >= BUILD_GRAPH_COUNTER_STEP) {
+    size_t n = __sync_fetch_and_add(wrkr->shared_nreads, wrkr->nreads);
+    ctx_update2("CountKmers", n, n+wrkr->nreads, CTX_UPDATE_REPORT_RATE);
+    wrkr->nreads = 0;
+  }
+}
+
+// First pass of a two pass build: count kmers in all reads.
+// One thread used per input file, nthreads used to add kmers to the filter.
+// Input files need to be reopened with asyncio_task_reopen() before loading.
+void build_graph_count_kmers(KmerBloom *bloom, size_t kmer_size,
+                             BuildGraphTask *files, size_t nfiles,
+                             size_t nthreads)
+{
+  AsyncIOInput *async_tasks = ctx_malloc(nfiles * sizeof(AsyncIOInput));
+  size_t i, f, total_nreads = 0;
+
+  for(f = 0; f < nfiles; f++) {
+    files[f].files.ptr = &files[f];
+    memcpy(&async_tasks[f], &files[f].files, sizeof(AsyncIOInput));
+  }
+
+  CountKmersThread *threads = ctx_calloc(nthreads, sizeof(CountKmersThread));
+
+  for(i = 0; i < nthreads; i++) {
+    threads[i].bloom = bloom;
+    threads[i].kmer_size = kmer_size;
+    threads[i].shared_nreads = &total_nreads;
+  }
+
+  asyncio_run_pool(async_tasks, nfiles, add_reads_to_bloom,
+                   threads, nthreads, sizeof(CountKmersThread));
+
+  for(i = 0; i < nthreads; i++) {
+    bloom->num_kmers += threads[i].num_kmers;
+    bloom->num_solid += threads[i].num_solid;
+  }
+
+  ctx_free(threads);
+  ctx_free(async_tasks);
+
+  char nkmers_str[50], nsolid_str[50];
+  ulong_to_str(bloom->num_kmers, nkmers_str);
+  ulong_to_str(bloom->num_solid, nsolid_str);
+  status("[bloom] Estimated %s distinct kmers, %s seen at least %i times",
+         nkmers_str, nsolid_str, KMER_BLOOM_SOLID);
+}
+
 // One thread used per input file, nthreads used to add reads to graph
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph,
@@ -11,6 +11,7 @@
 
 #include "cortex_types.h"
 #include "db_graph.h"
+#include "kmer_bloom.h"
 #include "seq_reader.h"
 #include "async_read_io.h"
 #include "seq_loading_stats.h"
@@ -21,6 +22,8 @@ typedef struct
   ReadMateDir matedir;
   Colour colour;
   bool remove_pcr_dups, must_exist_in_graph;
+  // If not NULL, only load kmers seen at least KMER_BLOOM_SOLID times
+  const KmerBloom *solid_kmers;
 } SeqLoadingPrefs;
 
 typedef struct
@@ -39,7 +42,9 @@ typedef struct
                                                  .hp_cutoff = 0, \
                                                  .matedir = READPAIR_FR, \
                                                  .colour = 0, \
-                                                 .remove_pcr_dups = false}
+                                                 .remove_pcr_dups = false, \
+                                                 .must_exist_in_graph = false, \
+                                                 .solid_kmers = NULL}
 
 #include "madcrowlib/madcrow_buffer.h"
 madcrow_buffer(build_graph_task_buf, BuildGraphTaskBuffer, BuildGraphTask);
@@ -65,6 +70,13 @@ void build_graph_from_reads_mt(read_t *r1, read_t *r2,
 void build_graph(dBGraph *db_graph, BuildGraphTask *files,
                  size_t num_files, size_t num_build_threads);
 
+// First pass of a two pass build: count kmers in all reads into `bloom`.
+// One thread used per input file, num_threads used to count kmers.
+// Input files must be reopened with asyncio_task_reopen() before building.
+void build_graph_count_kmers(KmerBloom *bloom, size_t kmer_size,
+                             BuildGraphTask *files, size_t num_files,
+                             size_t num_threads);
+
 // One thread used per input file, num_build_threads used to add reads to graph
 // Updates ginfo
 void build_graph_from_seq(dBGraph *db_graph, seq_file_t **files,
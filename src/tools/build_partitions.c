@@ -0,0 +1,515 @@
+#include "global.h"
+#include "build_partitions.h"
+#include "build_graph.h"
+#include "db_graph.h"
+#include "db_node.h"
+#include "graph_writer.h"
+#include "seq_reader.h"
+#include "util.h"
+#include "file_util.h"
+
+#include "sort_r/sort_r.h"
+
+// Update shared_nreads in steps of 100 to reduce thread interaction
+#define BUILD_PARTITIONS_COUNTER_STEP 100
+
+// Bytes buffered per partition per thread before writing / reading
+#define BUILD_PARTITIONS_BUFSIZE (1<<16)
+
+// Super-kmer records are text lines:
+//   <colour> <prev base><sequence><next base>\n
+// where prev/next base is '-' if the sequence could not be extended
+#define BUILD_PARTITIONS_NO_BASE '-'
+
+void build_partitions_alloc(BuildPartitions *bp, size_t num_parts,
+                            size_t kmer_size, const char *tmp_dir)
+{
+  ctx_assert(num_parts > 0 && num_parts <= BUILD_PARTITIONS_MAX);
+  size_t i;
+
+  FILE **tmp_files = futil_create_tmp_files(tmp_dir, num_parts*2);
+
+  BuildPartitions tmp = {.num_parts = num_parts,
+                         .kmer_size = kmer_size,
+                         .mmer_size = MIN2(kmer_size, BUILD_PARTITIONS_MMER),
+                         .seq_files = tmp_files,
+                         .kmer_files = tmp_files + num_parts,
+                         .locks = ctx_calloc(num_parts, sizeof(pthread_mutex_t)),
+                         .num_kmers = ctx_calloc(num_parts, sizeof(uint64_t))};
+
+  for(i = 0; i < num_parts; i++)
+    if(pthread_mutex_init(&tmp.locks[i], NULL) != 0) die("Mutex init failed");
+
+  memcpy(bp, &tmp, sizeof(tmp));
+
+  status("[partitions] Using %zu partitions in %s", num_parts,
+         tmp_dir ? tmp_dir : "/tmp");
+}
+
+void build_partitions_dealloc(BuildPartitions *bp)
+{
+  size_t i;
+  for(i = 0; i < bp->num_parts; i++) {
+    fclose(bp->seq_files[i]);
+    fclose(bp->kmer_files[i]);
+    pthread_mutex_destroy(&bp->locks[i]);
+  }
+  ctx_free(bp->seq_files); // also frees kmer_files
+  ctx_free(bp->locks);
+  ctx_free(bp->num_kmers);
+  memset(bp, 0, sizeof(*bp));
+}
+
+size_t build_partitions_max_kmers(const BuildPartitions *bp)
+{
+  size_t i; uint64_t max = 0;
+  for(i = 0; i < bp->num_parts; i++) max = MAX2(max, bp->num_kmers[i]);
+  return max;
+}
+
+//
+// Pass 1: split reads into super-kmers
+//
+
+typedef struct {
+  BuildPartitions *bp;
+  StrBuf *bufs; // [partitions]
+  uint64_t *num_kmers; // [partitions]
+  uint64_t *hashes; // minimizer hash of each mmer in the current contig
+  size_t hashes_cap;
+  SeqLoadingStats *stats; // [files]
+  size_t nreads;
+  volatile size_t *shared_nreads;
+} SplitThread;
+
+// Mix bits so that low complexity mmers (e.g. poly-A) are not favoured
+static inline uint64_t mmer_hash(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+static void flush_partition(SplitThread *wrkr, size_t part)
+{
+  BuildPartitions *bp = wrkr->bp;
+  StrBuf *buf = &wrkr->bufs[part];
+  if(buf->end == 0) return;
+  pthread_mutex_lock(&bp->locks[part]);
+  if(fwrite(buf->b, 1, buf->end, bp->seq_files[part]) != buf->end)
+    die("Cannot write to temporary file [%s]", strerror(errno));
+  pthread_mutex_unlock(&bp->locks[part]);
+  strbuf_reset(buf);
+}
+
+// Write kmers [start,end) of `seq` as a super-kmer
+static void write_super_kmer(SplitThread *wrkr, size_t part, Colour colour,
+                             const char *seq, size_t len,
+                             size_t start, size_t end)
+{
+  const size_t kmer_size = wrkr->bp->kmer_size;
+  StrBuf *buf = &wrkr->bufs[part];
+  char prev = start > 0 ? seq[start-1] : BUILD_PARTITIONS_NO_BASE;
+  char next = end+kmer_size-1 < len ? seq[end+kmer_size-1]
+                                    : BUILD_PARTITIONS_NO_BASE;
+
+  strbuf_sprintf(buf, "%zu %c", (size_t)colour, prev);
+  strbuf_append_strn(buf, seq+start, end-start+kmer_size-1);
+  strbuf_append_char(buf, next);
+  strbuf_append_char(buf, '\n');
+
+  wrkr->num_kmers[part] += end-start;
+  if(buf->end >= BUILD_PARTITIONS_BUFSIZE) flush_partition(wrkr, part);
+}
+
+// Sequence must be entirely ACGT and len >= kmer_size
+// The minimizer of a kmer is its mmer with the smallest hash. mmers are
+// canonical so a kmer and its reverse complement are in the same partition.
+static void split_contig(SplitThread *wrkr, Colour colour,
+                         const char *seq, size_t len)
+{
+  const BuildPartitions *bp = wrkr->bp;
+  const size_t kmer_size = bp->kmer_size, mmer_size = bp->mmer_size;
+  const size_t nkmers = len+1-kmer_size, nmmers = len+1-mmer_size;
+  const size_t win = kmer_size-mmer_size+1; // mmers per kmer
+  const uint64_t mask = (1UL << (2*mmer_size)) - 1;
+  const size_t shift = 2*(mmer_size-1);
+
+  size_t i, j, minpos = 0, part = 0, prev_part = 0, start = 0;
+  uint64_t fw = 0, rv = 0;
+  Nucleotide nuc;
+
+  if(wrkr->hashes_cap < nmmers) {
+    wrkr->hashes_cap = MAX2(nmmers, wrkr->hashes_cap*2);
+    wrkr->hashes = ctx_realloc(wrkr->hashes, wrkr->hashes_cap*sizeof(uint64_t));
+  }
+
+  uint64_t *hashes = wrkr->hashes;
+
+  for(i = 0; i < len; i++) {
+    nuc = dna_char_to_nuc(seq[i]);
+    fw = ((fw << 2) | nuc) & mask;
+    rv = (rv >> 2) | ((uint64_t)dna_nuc_complement(nuc) << shift);
+    if(i+1 >= mmer_size) hashes[i+1-mmer_size] = mmer_hash(MIN2(fw, rv));
+  }
+
+  // Sliding window minimum, break when the partition changes
+  for(i = 0; i < nkmers; i++) {
+    if(i == 0 || minpos < i) {
+      for(minpos = i, j = i+1; j < i+win; j++)
+        if(hashes[j] < hashes[minpos]) minpos = j;
+    }
+    else if(hashes[i+win-1] < hashes[minpos]) minpos = i+win-1;
+
+    part = hashes[minpos] % bp->num_parts;
+    if(i > 0 && part != prev_part) {
+      write_super_kmer(wrkr, prev_part, colour, seq, len, start, i);
+      start = i;
+    }
+    prev_part = part;
+  }
+
+  write_super_kmer(wrkr, part, colour, seq, len, start, nkmers);
+}
+
+static void split_read(const read_t *r, uint8_t qual_cutoff, uint8_t hp_cutoff,
+                       Colour colour, SeqLoadingStats *stats,
+                       SplitThread *wrkr)
+{
+  const size_t kmer_size = wrkr->bp->kmer_size;
+  size_t contig_start, contig_end, contig_len;
+  size_t num_contigs = 0, search_start = 0;
+
+  while((contig_start = seq_contig_start(r, search_start, kmer_size,
+                                         qual_cutoff, hp_cutoff)) < r->seq.end)
+  {
+    contig_end = seq_contig_end(r, contig_start, kmer_size,
+                                qual_cutoff, hp_cutoff, &search_start);
+
+    contig_len = contig_end - contig_start;
+    split_contig(wrkr, colour, r->seq.b+contig_start, contig_len);
+
+    stats->total_bases_loaded += contig_len;
+    stats->num_kmers_loaded += contig_len + 1 - kmer_size;
+    num_contigs++;
+  }
+
+  stats->contigs_parsed += num_contigs;
+  stats->num_good_reads += (num_contigs > 0);
+  stats->num_bad_reads += (num_contigs == 0);
+}
+
+static void split_reads(AsyncIOData *data, size_t threadid, void *ptr)
+{
+  (void)threadid;
+  SplitThread *wrkr = (SplitThread*)ptr;
+  const BuildGraphTask *task = (BuildGraphTask*)data->ptr;
+  const SeqLoadingPrefs *prefs = &task->prefs;
+  SeqLoadingStats *stats = &wrkr->stats[task->idx];
+  read_t *r2 = data->r2.name.end == 0 && data->r2.seq.end == 0 ? NULL : &data->r2;
+
+  uint8_t fq_cutoff1 = prefs->fq_cutoff, fq_cutoff2 = prefs->fq_cutoff;
+
+  if(prefs->fq_cutoff) {
+    fq_cutoff1 += data->fq_offset1;
+    fq_cutoff2 += data->fq_offset2;
+  }
+
+  stats->total_bases_read += data->r1.seq.end + (r2 ? r2->seq.end : 0);
+  if(r2) stats->num_pe_reads += 2;
+  else   stats->num_se_reads += 1;
+
+  split_read(&data->r1, fq_cutoff1, prefs->hp_cutoff, prefs->colour, stats, wrkr);
+  if(r2) split_read(r2, fq_cutoff2, prefs->hp_cutoff, prefs->colour, stats, wrkr);
+
+  // Print progress
+  wrkr->nreads++;
+  if(wrkr->nreads >= BUILD_PARTITIONS_COUNTER_STEP) {
+    size_t n = __sync_fetch_and_add(wrkr->shared_nreads, wrkr->nreads);
+    ctx_update2("SplitReads", n, n+wrkr->nreads, CTX_UPDATE_REPORT_RATE);
+    wrkr->nreads = 0;
+  }
+}
+
+void build_partitions_split(BuildPartitions *bp,
+                            BuildGraphTask *files, size_t nfiles,
+                            size_t nthreads)
+{
+  AsyncIOInput *async_tasks = ctx_malloc(nfiles * sizeof(AsyncIOInput));
+  size_t i, f, p, total_nreads = 0;
+
+  for(f = 0; f < nfiles; f++) {
+    files[f].idx = f;
+    files[f].files.ptr = &files[f];
+    memcpy(&async_tasks[f], &files[f].files, sizeof(AsyncIOInput));
+  }
+
+  SplitThread *threads = ctx_calloc(nthreads, sizeof(SplitThread));
+
+  for(i = 0; i < nthreads; i++) {
+    threads[i].bp = bp;
+    threads[i].bufs = ctx_calloc(bp->num_parts, sizeof(StrBuf));
+    threads[i].num_kmers = ctx_calloc(bp->num_parts, sizeof(uint64_t));
+    threads[i].stats = ctx_calloc(nfiles, sizeof(SeqLoadingStats));
+    threads[i].shared_nreads = &total_nreads;
+    for(p = 0; p < bp->num_parts; p++)
+      strbuf_alloc(&threads[i].bufs[p], 1024);
+  }
+
+  asyncio_run_pool(async_tasks, nfiles, split_reads,
+                   threads, nthreads, sizeof(SplitThread));
+
+  // Write remaining super-kmers, merge counts and stats
+  for(i = 0; i < nthreads; i++) {
+    for(p = 0; p < bp->num_parts; p++) {
+      flush_partition(&threads[i], p);
+      strbuf_dealloc(&threads[i].bufs[p]);
+      bp->num_kmers[p] += threads[i].num_kmers[p];
+    }
+    for(f = 0; f < nfiles; f++)
+      seq_loading_stats_merge(&files[f].stats, &threads[i].stats[f]);
+    ctx_free(threads[i].bufs);
+    ctx_free(threads[i].num_kmers);
+    ctx_free(threads[i].hashes);
+    ctx_free(threads[i].stats);
+  }
+
+  ctx_free(threads);
+  ctx_free(async_tasks);
+}
+
+//
+// Pass 2: build each partition
+//
+
+typedef struct {
+  dBGraph *db_graph;
+  FILE *fh;
+  pthread_mutex_t *lock;
+} PartitionLoader;
+
+// Load a single super-kmer record (without trailing newline)
+static void load_super_kmer(dBGraph *db_graph, const char *line, size_t len)
+{
+  const size_t kmer_size = db_graph->kmer_size;
+  char *end;
+  Colour colour = (Colour)strtoul(line, &end, 10);
+
+  const char *seq = end+2, *seq_end = line+len-1;
+  char prev = end[1], next = *seq_end;
+  size_t seq_len = seq_end - seq;
+  size_t edge_col = db_graph->num_edge_cols == 1 ? 0 : colour;
+  dBNode node;
+
+  if(*end != ' ' || seq_end < seq || seq_len < kmer_size ||
+     colour >= db_graph->num_of_cols)
+  {
+    die("Corrupt temporary partition file");
+  }
+
+  build_graph_from_str_mt(db_graph, colour, seq, seq_len, false);
+
+  // Add edges to kmers in other partitions
+  if(prev != BUILD_PARTITIONS_NO_BASE) {
+    node = db_graph_find_node_mt(db_graph, binary_kmer_from_str(seq, kmer_size));
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col,
+                            dna_nuc_complement(dna_char_to_nuc(prev)),
+                            !node.orient);
+  }
+  if(next != BUILD_PARTITIONS_NO_BASE) {
+    node = db_graph_find_node_mt(db_graph,
+                                 binary_kmer_from_str(seq_end-kmer_size,
+                                                      kmer_size));
+    db_node_set_col_edge_mt(db_graph, node.key, edge_col,
+                            dna_char_to_nuc(next), node.orient);
+  }
+}
+
+static void load_partition_thread(void *arg, size_t threadid)
+{
+  (void)threadid;
+  PartitionLoader *ldr = (PartitionLoader*)arg;
+  StrBuf buf;
+  char *line, *end;
+  bool done = false;
+
+  strbuf_alloc(&buf, BUILD_PARTITIONS_BUFSIZE + 1024);
+
+  while(!done)
+  {
+    // Read a block of lines
+    strbuf_reset(&buf);
+    pthread_mutex_lock(ldr->lock);
+    while(buf.end < BUILD_PARTITIONS_BUFSIZE && !done)
+      done = (strbuf_readline(&buf, ldr->fh) == 0);
+    pthread_mutex_unlock(ldr->lock);
+
+    for(line = buf.b; line < buf.b + buf.end; line = end+1) {
+      if((end = strchr(line, '\n')) == NULL)
+        die("Corrupt temporary partition file");
+      load_super_kmer(ldr->db_graph, line, end-line);
+    }
+  }
+
+  strbuf_dealloc(&buf);
+}
+
+static inline void _add_hkey(hkey_t hkey, hkey_t **ptr)
+{
+  *(*ptr)++ = hkey;
+}
+
+static inline int _hkey_bkmer_cmp(const void *aa, const void *bb, void *arg)
+{
+  const dBGraph *db_graph = (const dBGraph*)arg;
+  const hkey_t a = *(const hkey_t*)aa, b = *(const hkey_t*)bb;
+  return binary_kmers_cmp(db_node_get_bkmer(db_graph, a),
+                          db_node_get_bkmer(db_graph, b));
+}
+
+// Write kmers in the graph in sorted order
+static void write_sorted_partition(const dBGraph *db_graph, FILE *fh)
+{
+  const size_t nkmers = db_graph->ht.num_kmers;
+  hkey_t *hkeys = ctx_malloc(nkmers * sizeof(hkey_t)), *ptr = hkeys;
+  size_t i;
+
+  HASH_ITERATE(&db_graph->ht, _add_hkey, &ptr);
+  ctx_assert(ptr == hkeys + nkmers);
+
+  sort_r(hkeys, nkmers, sizeof(hkey_t), _hkey_bkmer_cmp, (void*)db_graph);
+
+  Covg covgs[db_graph->num_of_cols];
+
+  for(i = 0; i < nkmers; i++) {
+    db_node_get_covgs(db_graph, hkeys[i], 0, db_graph->num_of_cols, covgs);
+    graph_write_kmer(fh, NUM_BKMER_WORDS, db_graph->num_of_cols,
+                     db_node_get_bkmer(db_graph, hkeys[i]), covgs,
+                     &db_node_edges(db_graph, hkeys[i], 0));
+  }
+
+  ctx_free(hkeys);
+}
+
+// Wipe kmers, coverage and edges but keep ginfo
+static void partition_graph_reset(dBGraph *db_graph)
+{
+  size_t capacity = db_graph->ht.capacity;
+  hash_table_empty(&db_graph->ht);
+  memset(db_graph->col_edges, 0,
+         db_graph->num_edge_cols * sizeof(Edges) * capacity);
+  db_graph_zero_covgs(db_graph);
+}
+
+uint64_t build_partitions_load(BuildPartitions *bp, dBGraph *db_graph,
+                               size_t nthreads)
+{
+  ctx_assert(db_graph->col_edges != NULL);
+  ctx_assert(db_graph_covgs_alloced(db_graph));
+  ctx_assert(db_graph->num_edge_cols == db_graph->num_of_cols);
+  ctx_assert(db_graph->kmer_size == bp->kmer_size);
+
+  size_t p;
+  uint64_t total_kmers = 0;
+  char nkmers_str[50];
+
+  for(p = 0; p < bp->num_parts; p++)
+  {
+    partition_graph_reset(db_graph);
+
+    PartitionLoader ldr = {.db_graph = db_graph,
+                           .fh = bp->seq_files[p],
+                           .lock = &bp->locks[p]};
+
+    if(fseek(ldr.fh, 0L, SEEK_SET) != 0) die("fseek error");
+    util_multi_thread(&ldr, nthreads, load_partition_thread);
+    if(ferror(ldr.fh)) die("Cannot read temporary file [%s]", strerror(errno));
+
+    write_sorted_partition(db_graph, bp->kmer_files[p]);
+    if(fflush(bp->kmer_files[p]) != 0)
+      die("Cannot write to temporary file [%s]", strerror(errno));
+
+    total_kmers += db_graph->ht.num_kmers;
+    ulong_to_str(db_graph->ht.num_kmers, nkmers_str);
+    status("[partitions] Partition %zu/%zu: %s kmers", p+1, bp->num_parts,
+           nkmers_str);
+  }
+
+  return total_kmers;
+}
+
+//
+// Merge sorted partitions
+//
+
+static inline int _kmer_record_cmp(const char *a, const char *b)
+{
+  BinaryKmer b1, b2;
+  memcpy(b1.b, a, sizeof(BinaryKmer));
+  memcpy(b2.b, b, sizeof(BinaryKmer));
+  return binary_kmers_cmp(b1, b2);
+}
+
+uint64_t build_partitions_save(BuildPartitions *bp, const char *path,
+                               const dBGraph *db_graph, size_t num_of_cols)
+{
+  ctx_assert(num_of_cols == db_graph->num_of_cols);
+
+  GraphFileHeader header = {.version = CTX_GRAPH_FILEFORMAT,
+                            .kmer_size = (uint32_t)db_graph->kmer_size,
+                            .num_of_bitfields = NUM_BKMER_WORDS,
+                            .num_of_cols = (uint32_t)num_of_cols,
+                            .capacity = 0,
+                            .ginfo = db_graph->ginfo};
+
+  const size_t num_parts = bp->num_parts;
+  const size_t recsize = sizeof(BinaryKmer) + num_of_cols*(sizeof(Covg)+sizeof(Edges));
+  char *recs = ctx_malloc(num_parts * recsize);
+  bool *live = ctx_calloc(num_parts, sizeof(bool));
+  size_t p, best;
+  uint64_t num_kmers = 0;
+
+  for(p = 0; p < num_parts; p++) {
+    if(fseek(bp->kmer_files[p], 0L, SEEK_SET) != 0) die("fseek error");
+    live[p] = (fread(recs+p*recsize, recsize, 1, bp->kmer_files[p]) == 1);
+  }
+
+  status("[partitions] Merging %zu partitions into: %s", num_parts,
+         futil_outpath_str(path));
+
+  FILE *fout = futil_fopen(path, "w");
+  graph_write_header(fout, &header);
+
+  // Partitions are disjoint, take the smallest kmer each time
+  while(1)
+  {
+    for(best = SIZE_MAX, p = 0; p < num_parts; p++) {
+      if(live[p] && (best == SIZE_MAX ||
+                     _kmer_record_cmp(recs+p*recsize, recs+best*recsize) < 0))
+        best = p;
+    }
+
+    if(best == SIZE_MAX) break;
+
+    if(fwrite(recs+best*recsize, recsize, 1, fout) != 1)
+      die("Cannot write to file: %s [%s]", path, strerror(errno));
+
+    num_kmers++;
+    live[best] = (fread(recs+best*recsize, recsize, 1, bp->kmer_files[best]) == 1);
+  }
+
+  for(p = 0; p < num_parts; p++)
+    if(ferror(bp->kmer_files[p]))
+      die("Cannot read temporary file [%s]", strerror(errno));
+
+  fclose(fout);
+  ctx_free(recs);
+  ctx_free(live);
+
+  graph_writer_print_status(num_kmers, num_of_cols, path, CTX_GRAPH_FILEFORMAT);
+
+  return num_kmers;
+}
@@ -0,0 +1,54 @@
+#ifndef BUILD_PARTITIONS_H_
+#define BUILD_PARTITIONS_H_
+
+//
+// Out-of-core graph building
+// Reads are cut into super-kmers (runs of consecutive kmers that share a
+// minimizer) and written to one of `num_parts` temporary files, chosen by
+// minimizer. Partitions are then built one at a time in the same dBGraph,
+// sorted and written to temporary files, which are merged into a single sorted
+// graph file. Peak memory is that of the largest partition.
+//
+
+#include <pthread.h>
+
+#include "db_graph.h"
+#include "build_graph.h"
+
+#define BUILD_PARTITIONS_MAX 256
+#define BUILD_PARTITIONS_MMER 11 // minimizer length
+
+typedef struct
+{
+  size_t num_parts, kmer_size, mmer_size;
+  FILE **seq_files, **kmer_files; // super-kmers and sorted kmers per partition
+  pthread_mutex_t *locks; // one per partition
+  uint64_t *num_kmers; // kmers (including duplicates) in each partition
+} BuildPartitions;
+
+// Temporary files are created in `tmp_dir` and removed when closed
+void build_partitions_alloc(BuildPartitions *bp, size_t num_parts,
+                            size_t kmer_size, const char *tmp_dir);
+void build_partitions_dealloc(BuildPartitions *bp);
+
+// Pass 1: split reads into partitions. Stats are written to each task.
+// One thread used per input file, num_threads used to split reads.
+void build_partitions_split(BuildPartitions *bp,
+                            BuildGraphTask *files, size_t num_files,
+                            size_t num_threads);
+
+// Upper bound on the number of kmers in any one partition
+size_t build_partitions_max_kmers(const BuildPartitions *bp);
+
+// Pass 2: build each partition in turn in `db_graph`, which is wiped before
+// each partition (ginfo is kept). Writes sorted kmers to temporary files.
+// Returns total number of kmers
+uint64_t build_partitions_load(BuildPartitions *bp, dBGraph *db_graph,
+                               size_t num_threads);
+
+// Merge sorted partitions into a graph file, using ginfo from db_graph.
+// Returns number of kmers written
+uint64_t build_partitions_save(BuildPartitions *bp, const char *path,
+                               const dBGraph *db_graph, size_t num_of_cols);
+
+#endif /* BUILD_PARTITIONS_H_ */
@@ -267,7 +267,7 @@ static inline void fetch_coverages(dBNodeBuffer nbuf, CovgBuffer *cbuf,
   covg_buf_capacity(cbuf, nbuf.len);
   cbuf->len = nbuf.len;
   for(i = 0; i < nbuf.len; i++)
-    cbuf->b[i] = db_graph->col_covgs[nbuf.b[i].key];
+    cbuf->b[i] = db_node_get_covg(db_graph, nbuf.b[i].key, 0);
 }
 
 static inline bool nodes_are_tip(dBNodeBuffer nbuf, const dBGraph *db_graph)
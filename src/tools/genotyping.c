@@ -186,7 +186,7 @@ size_t genotyping_get_kmers(Genotyper *typer,
 
   StrBuf *seq = &typer->seq;
   khash_t(BkToBits) *h = typer->h;
-  BinaryKmer bkmer, bkey;
+  BinaryKmer fw, rv, bkey;
   int hret;
   khiter_t kiter;
 
@@ -227,13 +227,13 @@ size_t genotyping_get_kmers(Genotyper *typer,
                                cstart, kmer_size, 0, 0, &cnext);
 
         // Get kmers
-        bkmer = binary_kmer_from_str(seq->b+cstart, kmer_size);
-        bkmer = binary_kmer_right_shift_one_base(bkmer);
+        fw = rv = zero_bkmer;
+        binary_kmer_roll_str(seq->b+cstart, kmer_size-1, kmer_size,
+                             &fw, &rv, NULL, NULL);
 
         for(i = cstart+kmer_size-1; i < cend; i++) {
-          bkmer = binary_kmer_left_shift_add(bkmer, kmer_size,
-                                             dna_char_to_nuc(seq->b[i]));
-          bkey = binary_kmer_get_key(bkmer, kmer_size);
+          binary_kmer_roll(&fw, &rv, kmer_size, dna_char_to_nuc(seq->b[i]));
+          bkey = binary_kmer_roll_key(fw, rv);
           kiter = kh_put(BkToBits, h, bkey, &hret);
           if(hret < 0) die("khash table failed: out of memory?");
           if(hret > 0) kh_value(h, kiter) = 0; // initialise if not in table
@@ -10,9 +10,9 @@ static inline void _add_edge_to_colours(hkey_t next_hkey,
 {
   size_t col, ncols = db_graph->num_of_cols;
 
-  if(db_graph->col_covgs != NULL) {
+  if(db_graph_covgs_alloced(db_graph)) {
     for(col = 0; col < ncols; col++) {
-      if(covgs[col] > 0 && db_node_covg(db_graph, next_hkey, col)) {
+      if(covgs[col] > 0 && db_node_get_covg(db_graph, next_hkey, col)) {
         edges[col] |= new_edge;
       }
     }
@@ -139,9 +139,11 @@ static inline int infer_edges_node(hkey_t hkey,
   size_t col;
 
   // Create coverages that are zero or one depending on if node has colour
-  if(db_graph->col_covgs == NULL) {
+  if(!db_graph_covgs_alloced(db_graph)) {
     for(col = 0; col < db_graph->num_of_cols; col++)
       tmp_covgs[col] = db_node_has_col(db_graph, hkey, col);
+  } else if(db_graph->col_covgs8 != NULL) {
+    db_node_get_covgs(db_graph, hkey, 0, db_graph->num_of_cols, tmp_covgs);
   } else {
     tmp_covgs = &db_node_covg(db_graph, hkey, 0);
   }
@@ -176,7 +178,7 @@ static void infer_edges_worker(void *arg, size_t threadid)
 
 size_t infer_edges(size_t nthreads, bool add_all_edges, const dBGraph *db_graph)
 {
-  ctx_assert(db_graph->node_in_cols != NULL || db_graph->col_covgs != NULL);
+  ctx_assert(db_graph_has_node_in_cols(db_graph) || db_graph_covgs_alloced(db_graph));
   ctx_assert(db_graph->col_edges != NULL);
 
   status("[inferedges] Processing stream");